@@ -12,7 +12,9 @@
 #cmakedefine PROJECT_NAME "${PROJECT_NAME}"
 #cmakedefine HAS_GET_TIME
 #cmakedefine HAS_PUT_TIME
+#cmakedefine HAS_SIGNALFD
 #cmakedefine DEBUG_SQL_QUERIES
+#cmakedefine PROFILE_ALLOCATIONS
 
 #if defined(USE_DATABASE) && defined(BOTAN_FOUND)
 # define WITH_SASL
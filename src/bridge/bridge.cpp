@@ -5,10 +5,16 @@
 #include <utils/empty_if_fixed_server.hpp>
 #include <utils/encoding.hpp>
 #include <utils/tolower.hpp>
+#include <utils/metrics.hpp>
+#include <utils/tracing.hpp>
+#include <utils/allocations.hpp>
 #include <utils/uuid.hpp>
+#include <utils/serializer.hpp>
 #include <logger/logger.hpp>
 #include <utils/revstr.hpp>
 #include <utils/split.hpp>
+#include <utils/time.hpp>
+#include <cstring>
 #include <xmpp/jid.hpp>
 #include <database/database.hpp>
 #include "result_set_management.hpp"
@@ -18,6 +24,9 @@ using namespace std::string_literals;
 
 static const char* action_prefix = "\01ACTION ";
 
+static metrics::Gauge& live_bridges = metrics::Registry::instance().gauge(
+    "biboumi_bridges", "Bridges, one for each XMPP user with at least one IrcClient");
+
 
 static std::string in_encoding_for(const Bridge& bridge, const Iid& iid)
 {
@@ -36,12 +45,18 @@ Bridge::Bridge(std::string user_jid, BiboumiComponent& xmpp, std::shared_ptr<Pol
   xmpp(xmpp),
   poller(poller)
 {
+  live_bridges.inc();
 #ifdef USE_DATABASE
   const auto options = Database::get_global_options(this->user_jid);
   this->set_record_history(options.col<Database::RecordHistory>());
 #endif
 }
 
+Bridge::~Bridge()
+{
+  live_bridges.dec();
+}
+
 /**
  * Return the role and affiliation, corresponding to the given irc mode
  */
@@ -71,29 +86,152 @@ void Bridge::shutdown(const std::string& exit_message)
 void Bridge::remove_resource(const std::string& resource,
                              const std::string& part_message)
 {
-  const auto resources_in_chan_copy = this->resources_in_chan;
-  for (const auto& chan_pair: resources_in_chan_copy)
-  {
-    const ChannelKey& channel_key = chan_pair.first;
-    const std::set<Resource>& resources = chan_pair.second;
-    if (resources.count(resource))
-      this->leave_irc_channel({std::get<0>(channel_key), std::get<1>(channel_key), {}},
-                              part_message, resource);
-  }
+  std::vector<ChannelKey> channels;
+  for (const auto& server_pair: this->resources_in_chan)
+    for (const auto& chan_pair: server_pair.second)
+      if (chan_pair.second.count(resource))
+        channels.emplace_back(chan_pair.first, server_pair.first);
+  // Leave them in a predictable order
+  std::sort(channels.begin(), channels.end());
+  for (const auto& channel_key: channels)
+    this->leave_irc_channel({std::get<0>(channel_key), std::get<1>(channel_key), {}},
+                            part_message, resource);
 }
 
 void Bridge::clean()
 {
-  auto it = this->irc_clients.begin();
-  while (it != this->irc_clients.end())
+  std::vector<std::string> hostnames;
+  std::swap(hostnames, this->clients_to_clean);
+  for (const auto& hostname: hostnames)
   {
+    auto it = this->irc_clients.find(hostname);
+    if (it == this->irc_clients.end())
+      continue;
     IrcClient* client = it->second.get();
     if (!client->is_connected() && !client->is_connecting() &&
         !client->get_resolver().is_resolving())
-      it = this->irc_clients.erase(it);
+      this->irc_clients.erase(it);
+  }
+}
+
+void Bridge::mark_for_cleanup(const std::string& hostname)
+{
+  this->clients_to_clean.push_back(hostname);
+  this->xmpp.mark_for_cleanup(this->get_bare_jid());
+}
+
+static std::size_t resource_set_size(const ResourceSet& resources)
+{
+  std::size_t res = sizeof(resources) + resources.size() * sizeof(std::string);
+  for (const auto& resource: resources)
+    res += memory_usage::heap(resource);
+  return res;
+}
+
+MemoryUsage Bridge::get_memory_usage() const
+{
+  MemoryUsage usage;
+  usage.irc_clients += sizeof(*this);
+  for (const auto& pair: this->irc_clients)
+    {
+      usage.irc_clients += memory_usage::node_overhead + sizeof(pair) + memory_usage::heap(pair.first);
+      pair.second->add_memory_usage(usage);
+    }
+  for (const auto& pair: this->resources_in_server)
+    usage.irc_clients += memory_usage::node_overhead + memory_usage::heap(pair.first) + resource_set_size(pair.second);
+  for (const auto& server: this->resources_in_chan)
+    for (const auto& pair: server.second)
+      usage.channels += memory_usage::node_overhead + memory_usage::heap(pair.first) + resource_set_size(pair.second);
+  for (const auto& pair: this->channel_list_cache)
+    {
+      const ChannelList& list = pair.second;
+      usage.channel_list_cache += memory_usage::node_overhead + sizeof(pair) + memory_usage::heap(pair.first) +
+          list.channels.capacity() * sizeof(ListElement);
+      for (const ListElement& element: list.channels)
+        usage.channel_list_cache += memory_usage::heap(element.channel) + memory_usage::heap(element.nb_users) +
+            memory_usage::heap(element.topic);
+    }
+  usage.waiting_callbacks += this->waiting_irc.capacity() * sizeof(irc_responder_callback_t);
+  return usage;
+}
+
+void Bridge::shed_cached_data()
+{
+  // An incomplete list is still being received, and the callbacks waiting
+  // for it would recreate it empty
+  for (auto it = this->channel_list_cache.begin(); it != this->channel_list_cache.end();)
+    if (it->second.complete)
+      it = this->channel_list_cache.erase(it);
     else
       ++it;
-  }
+  this->waiting_irc.shrink_to_fit();
+  for (const auto& pair: this->irc_clients)
+    pair.second->shed_cached_data();
+}
+
+void Bridge::save_state(Serializer& out, std::vector<socket_t>& sockets) const
+{
+  std::vector<const IrcClient*> clients;
+  for (const auto& pair: this->irc_clients)
+    if (pair.second->can_be_handed_over())
+      clients.push_back(pair.second.get());
+  out.put(clients.size());
+  for (const IrcClient* irc: clients)
+    {
+      const auto& hostname = irc->get_hostname();
+      out.put(hostname);
+      out.put(sockets.size());
+      sockets.push_back(irc->get_socket());
+      const auto& resources = this->get_resources_in_server(hostname);
+      out.put(resources.size());
+      for (const auto& resource: resources)
+        out.put(resource);
+      const auto it = this->resources_in_chan.find(hostname);
+      out.put(it == this->resources_in_chan.end() ? 0 : it->second.size());
+      if (it != this->resources_in_chan.end())
+        for (const auto& chan_pair: it->second)
+          {
+            out.put(chan_pair.first);
+            out.put(chan_pair.second.size());
+            for (const auto& resource: chan_pair.second)
+              out.put(resource);
+          }
+      irc->save_state(out);
+    }
+}
+
+void Bridge::restore_state(Deserializer& in, const std::vector<socket_t>& sockets)
+{
+  for (auto i = in.get_int(); i > 0; i--)
+    {
+      const auto hostname = in.get_string();
+      const auto index = in.get_int();
+      if (index >= sockets.size())
+        throw std::runtime_error("Invalid socket index in the state");
+      for (auto j = in.get_int(); j > 0; j--)
+        this->resources_in_server[hostname].insert(in.get_string());
+      for (auto j = in.get_int(); j > 0; j--)
+        {
+          const auto channel = in.get_string();
+          for (auto k = in.get_int(); k > 0; k--)
+            this->resources_in_chan[hostname][channel].insert(in.get_string());
+        }
+      IrcClient* irc = this->make_irc_client(hostname, {});
+      irc->restore_state(in, sockets[static_cast<std::size_t>(index)]);
+    }
+}
+
+void Bridge::quit_not_handed_over(const std::string& message)
+{
+  for (const auto& pair: this->irc_clients)
+    {
+      IrcClient* irc = pair.second.get();
+      if (irc->can_be_handed_over() || !irc->is_connected())
+        continue;
+      irc->send_quit_command(message);
+      irc->on_error(IrcMessage("ERROR", {message}));
+      irc->on_send();
+    }
 }
 
 const std::string& Bridge::get_jid() const
@@ -128,7 +266,7 @@ IrcClient* Bridge::make_irc_client(const std::string& hostname, const std::strin
       auto username = nickname;
       auto realname = nickname;
       Jid jid(this->user_jid);
-      if (Config::get("realname_from_jid", "false") == "true")
+      if (Config::snapshot().realname_from_jid)
         {
           username = jid.local;
           realname = this->get_bare_jid();
@@ -138,7 +276,11 @@ IrcClient* Bridge::make_irc_client(const std::string& hostname, const std::strin
                                                             nickname, username,
                                                             realname, jid.domain,
                                                             *this));
+      // If nothing makes it connect, it must be removed
+      this->mark_for_cleanup(hostname);
       std::unique_ptr<IrcClient>& irc = this->irc_clients.at(hostname);
+      if (this->xmpp.is_above_high_watermark())
+        irc->pause_receiving();
       return irc.get();
     }
 }
@@ -181,9 +323,7 @@ bool Bridge::join_irc_channel(const Iid& iid, std::string nickname,
   IrcClient* irc = this->make_irc_client(hostname, nickname);
   irc->history_limit = history_limit;
   this->add_resource_to_server(hostname, resource);
-  auto res_in_chan = this->is_resource_in_chan(ChannelKey{iid.get_local(), hostname}, resource);
-  if (!res_in_chan)
-    this->add_resource_to_chan(ChannelKey{iid.get_local(), hostname}, resource);
+  this->add_resource_to_chan(iid.get_local(), hostname, resource);
   if (!irc->is_channel_joined(iid.get_local()))
     {
       irc->send_join_command(iid.get_local(), password);
@@ -197,9 +337,10 @@ bool Bridge::join_irc_channel(const Iid& iid, std::string nickname,
 
 void Bridge::send_channel_message(const Iid& iid, const std::string& body, std::string id, std::vector<XmlNode> nodes_to_reflect)
 {
+  ALLOCATIONS_SCOPE(bridge, "Bridge::send_channel_message");
   if (iid.get_server().empty())
     {
-      for (const auto& resource: this->resources_in_chan[iid.to_tuple()])
+      for (const auto& resource: this->get_resources_in_chan(iid.get_local(), iid.get_server()))
         this->xmpp.send_stanza_error("message", this->user_jid + "/" + resource, std::to_string(iid), "",
                                      "cancel", "remote-server-not-found",
                                      std::to_string(iid) + " is not a valid channel name. "
@@ -239,7 +380,7 @@ void Bridge::send_channel_message(const Iid& iid, const std::string& body, std::
         if ((line.size() > strlen("\01ACTION\01")) &&
             (line.substr(0, 7) == "\01ACTION") && line[line.size() - 1] == '\01')
           line = "/me " + line.substr(8, line.size() - 9);
-        for (const auto& resource: this->resources_in_chan[iid.to_tuple()])
+        for (const auto& resource: this->get_resources_in_chan(iid.get_local(), iid.get_server()))
           {
             auto stanza = this->xmpp.make_muc_message(std::to_string(iid), irc->get_own_nick(), this->make_xmpp_body(line),
                                                        this->user_jid + "/"
@@ -420,13 +561,12 @@ void Bridge::send_raw_message(const std::string& hostname, const std::string& bo
 void Bridge::leave_irc_channel(Iid&& iid, const std::string& status_message, const std::string& resource)
 {
   IrcClient* irc = this->get_irc_client(iid.get_server());
-  const auto key = iid.to_tuple();
-  if (!this->is_resource_in_chan(key, resource))
+  if (!this->is_resource_in_chan(iid.get_local(), iid.get_server(), resource))
     return ;
 
   IrcChannel* channel = irc->get_channel(iid.get_local());
 
-  const auto resources = this->number_of_resources_in_chan(key);
+  const auto resources = this->number_of_resources_in_chan(iid.get_local(), iid.get_server());
   if (resources == 1)
     {
       // Do not send a PART message if we actually are not in that channel
@@ -452,7 +592,7 @@ void Bridge::leave_irc_channel(Iid&& iid, const std::string& status_message, con
           this->send_muc_leave(iid, *channel->get_self(), "", true, true, resource, irc);
         }
       if (persistent)
-        this->remove_resource_from_chan(key, resource);
+        this->remove_resource_from_chan(iid.get_local(), iid.get_server(), resource);
     }
   else
     {
@@ -460,7 +600,7 @@ void Bridge::leave_irc_channel(Iid&& iid, const std::string& status_message, con
         this->send_muc_leave(iid, *channel->get_self(),
                              "Biboumi note: " + std::to_string(resources - 1) + " resources are still in this channel.",
                              true, true, resource, irc);
-      this->remove_resource_from_chan(key, resource);
+      this->remove_resource_from_chan(iid.get_local(), iid.get_server(), resource);
     }
   if (this->number_of_channels_the_resource_is_in(iid.get_server(), resource) == 0)
     this->remove_resource_from_server(iid.get_server(), resource);
@@ -469,7 +609,7 @@ void Bridge::leave_irc_channel(Iid&& iid, const std::string& status_message, con
 void Bridge::send_irc_nick_change(const Iid& iid, const std::string& new_nick, const std::string& requesting_resource)
 {
   // We don’t change the nick if the presence was sent to a channel the resource is not in.
-  auto res_in_chan = this->is_resource_in_chan(ChannelKey{iid.get_local(), iid.get_server()}, requesting_resource);
+  auto res_in_chan = this->is_resource_in_chan(iid.get_local(), iid.get_server(), requesting_resource);
   if (!res_in_chan)
     return;
   IrcClient* irc = this->get_irc_client(iid.get_server());
@@ -747,7 +887,7 @@ void Bridge::send_irc_participant_ping_request(const Iid& iid, const std::string
   Jid from(to_jid);
   IrcClient* irc = this->get_irc_client(iid.get_server());
   IrcChannel* chan = irc->get_channel(iid.get_local());
-  if (!chan->joined || !this->is_resource_in_chan(iid.to_tuple(), from.resource))
+  if (!chan->joined || !this->is_resource_in_chan(iid.get_local(), iid.get_server(), from.resource))
     {
       this->xmpp.send_stanza_error("iq", to_jid, from_jid, iq_id, "cancel", "not-acceptable",
                                     "", true);
@@ -845,8 +985,11 @@ void Bridge::send_irc_version_request(const std::string& irc_hostname, const std
   this->add_waiting_irc(std::move(cb));
 }
 
-void Bridge::send_message(const Iid& iid, const std::string& nick, const std::string& body, const bool muc, const bool log)
+void Bridge::send_message(const Iid& iid, const std::string& nick, const std::string& body, const bool muc, const bool log,
+                          const std::chrono::system_clock::time_point date)
 {
+  ALLOCATIONS_SCOPE(bridge, "Bridge::send_message");
+  tracing::mark(tracing::Stage::bridged);
   const auto encoding = in_encoding_for(*this, iid);
   std::string uuid{};
   if (muc)
@@ -854,12 +997,14 @@ void Bridge::send_message(const Iid& iid, const std::string& nick, const std::st
 #ifdef USE_DATABASE
       const auto xmpp_body = this->make_xmpp_body(body, encoding);
       if (log && this->record_history)
-        uuid = Database::store_muc_message(this->get_bare_jid(), iid.get_local(), iid.get_server(), std::chrono::system_clock::now(),
+        uuid = Database::store_muc_message(this->get_bare_jid(), iid.get_local(), iid.get_server(), date,
                                            std::get<0>(xmpp_body), nick);
+      tracing::mark(tracing::Stage::archived);
 #else
       (void)log;
+      (void)date;
 #endif
-      for (const auto& resource: this->resources_in_chan[iid.to_tuple()])
+      for (const auto& resource: this->get_resources_in_chan(iid.get_local(), iid.get_server()))
         {
           auto stanza = this->xmpp.make_muc_message(std::to_string(iid), nick, this->make_xmpp_body(body, encoding),
                                                      this->user_jid + "/"
@@ -898,15 +1043,15 @@ void Bridge::send_muc_leave(const Iid& iid, const IrcUser& user,
                               this->user_jid + "/" + resource, self, user_requested, affiliation, role);
   else
     {
-      for (const auto &res: this->resources_in_chan[iid.to_tuple()])
+      for (const auto &res: this->get_resources_in_chan(iid.get_local(), iid.get_server()))
         this->xmpp.send_muc_leave(std::to_string(iid), user.nick, this->make_xmpp_body(message),
                                   this->user_jid + "/" + res, self, user_requested, affiliation, role);
       if (self)
         {
           // Copy the resources currently in that channel
-          const auto resources_in_chan = this->resources_in_chan[iid.to_tuple()];
+          const auto resources_in_chan = this->get_resources_in_chan(iid.get_local(), iid.get_server());
 
-          this->remove_all_resources_from_chan(iid.to_tuple());
+          this->remove_all_resources_from_chan(iid.get_local(), iid.get_server());
 
           // Now, for each resource that was in that channel, remove it from the server if it’s
           // not in any other channel
@@ -930,7 +1075,7 @@ void Bridge::send_nick_change(Iid&& iid,
   std::string role;
   std::tie(role, affiliation) = get_role_affiliation_from_irc_mode(user_mode);
 
-  for (const auto& resource: this->resources_in_chan[iid.to_tuple()])
+  for (const auto& resource: this->get_resources_in_chan(iid.get_local(), iid.get_server()))
     this->xmpp.send_nick_change(std::to_string(iid),
                                 old_nick, new_nick, affiliation, role, this->user_jid + "/" + resource, self);
 }
@@ -949,9 +1094,9 @@ void Bridge::send_xmpp_message(const std::string& from, const std::string& autho
     body = msg;
 
   const auto encoding = in_encoding_for(*this, {from, this});
-  for (const auto& resource: this->resources_in_server[from])
+  for (const auto& resource: this->get_resources_in_server(from))
     {
-      if (Config::get("fixed_irc_server", "").empty())
+      if (Config::snapshot().fixed_irc_server.empty())
         this->xmpp.send_message(from, this->make_xmpp_body(body, encoding), this->user_jid + "/" + resource, "chat", false, true);
       else
         this->xmpp.send_message("", this->make_xmpp_body(body, encoding), this->user_jid + "/" + resource, "chat", false, true);
@@ -961,7 +1106,7 @@ void Bridge::send_xmpp_message(const std::string& from, const std::string& autho
 void Bridge::send_user_join(const std::string& hostname, const std::string& chan_name,
                             const IrcUser* user, const char user_mode, const bool self)
 {
-  const auto resources = this->resources_in_chan[ChannelKey{chan_name, hostname}];
+  const auto& resources = this->get_resources_in_chan(chan_name, hostname);
   if (self && resources.empty())
     { // This was a forced join: no client ever asked to join this room,
       // but the server tells us we are in that room anyway.  XMPP can’t
@@ -980,6 +1125,7 @@ void Bridge::send_user_join(const std::string& hostname, const std::string& chan
                        const IrcUser* user, const char user_mode,
                        const bool self, const std::string& resource)
 {
+  ALLOCATIONS_SCOPE(bridge, "Bridge::send_user_join");
   std::string affiliation;
   std::string role;
   std::tie(role, affiliation) = get_role_affiliation_from_irc_mode(user_mode);
@@ -1004,7 +1150,7 @@ void Bridge::send_user_join(const std::string& hostname, const std::string& chan
 void Bridge::send_topic(const std::string& hostname, const std::string& chan_name, const std::string& topic,
                         const std::string& who)
 {
-  for (const auto& resource: this->resources_in_chan[ChannelKey{chan_name, hostname}])
+  for (const auto& resource: this->get_resources_in_chan(chan_name, hostname))
     {
       this->send_topic(hostname, chan_name, topic, who, resource);
     }
@@ -1024,7 +1170,7 @@ void Bridge::send_topic(const std::string& hostname, const std::string& chan_nam
 
 void Bridge::send_room_history(const std::string& hostname, const std::string& chan_name, const HistoryLimit& history_limit)
 {
-  for (const auto& resource: this->resources_in_chan[ChannelKey{chan_name, hostname}])
+  for (const auto& resource: this->get_resources_in_chan(chan_name, hostname))
     this->send_room_history(hostname, chan_name, resource, history_limit);
 }
 
@@ -1037,7 +1183,7 @@ void Bridge::send_room_history(const std::string& hostname, std::string chan_nam
     limit = 20;
   if (history_limit.stanzas >= 0 && history_limit.stanzas < limit)
     limit = history_limit.stanzas;
-  const auto result = Database::get_muc_logs(this->user_jid, chan_name, hostname, static_cast<std::size_t>(limit), history_limit.since, {}, Id::unset_value, Database::Paging::last);
+  const auto result = Database::get_muc_logs(this->user_jid, chan_name, hostname, static_cast<std::size_t>(limit), history_limit.since, {}, nullptr, Database::Paging::last);
   const auto& lines = std::get<1>(result);
   chan_name.append(utils::empty_if_fixed_server("%" + hostname));
   for (const auto& line: lines)
@@ -1054,6 +1200,90 @@ void Bridge::send_room_history(const std::string& hostname, std::string chan_nam
 #endif
 }
 
+std::time_t Bridge::get_last_archived_date(const std::string& hostname, const std::string& chan_name)
+{
+#ifdef USE_DATABASE
+  if (!this->record_history)
+    return -1;
+  // The latest date, whatever the order in which the lines were archived
+  const auto result = Database::get_muc_logs(this->get_bare_jid(), chan_name, hostname, 1, {}, {}, nullptr, Database::Paging::last);
+  const auto& lines = std::get<1>(result);
+  if (lines.empty())
+    return -1;
+  return static_cast<std::time_t>(lines.back().col<Database::Date>());
+#else
+  (void)hostname;
+  (void)chan_name;
+  return -1;
+#endif
+}
+
+void Bridge::archive_missed_messages(const Iid& iid, const std::time_t since, const std::vector<HistoryMessage>& messages)
+{
+#ifdef USE_DATABASE
+  ALLOCATIONS_SCOPE(bridge, "Bridge::archive_missed_messages");
+  if (!this->record_history || since == -1 || messages.empty())
+    return;
+  const auto encoding = in_encoding_for(*this, iid);
+  std::vector<HistoryMessage> received;
+  received.reserve(messages.size());
+  std::time_t newest = since;
+  for (const auto& message: messages)
+    {
+      received.emplace_back(std::get<0>(message), std::get<1>(message),
+                            std::get<0>(this->make_xmpp_body(std::get<2>(message), encoding)));
+      newest = std::max(newest, std::get<0>(message));
+    }
+  // The messages received live since the request was sent, and the ones
+  // of the anchor’s second archived before it, may be returned again.
+  // Each of them can only be in the archive once
+  const auto lines = std::get<1>(Database::get_muc_logs(this->get_bare_jid(), iid.get_local(), iid.get_server(),
+                                                        messages.size() + 1000,
+                                                        utils::to_string(since), utils::to_string(newest)));
+  std::vector<HistoryMessage> archived;
+  archived.reserve(lines.size());
+  for (const auto& line: lines)
+    archived.emplace_back(static_cast<std::time_t>(line.col<Database::Date>()), line.col<Database::Nick>(),
+                          line.col<Database::Body>());
+  const auto missed = Bridge::filter_missed_messages(since, received, std::move(archived));
+  if (missed.empty())
+    return;
+  std::vector<std::tuple<Database::time_point, std::string, std::string>> to_store;
+  to_store.reserve(missed.size());
+  for (const auto& message: missed)
+    to_store.emplace_back(std::chrono::system_clock::from_time_t(std::get<0>(message)), std::get<2>(message),
+                          std::get<1>(message));
+  log_debug("Archiving ", to_store.size(), " missed messages from ", iid.get_local(), " on ", iid.get_server());
+  Database::store_muc_messages(this->get_bare_jid(), iid.get_local(), iid.get_server(), to_store);
+  for (const auto& resource: this->get_resources_in_chan(iid.get_local(), iid.get_server()))
+    for (const auto& message: missed)
+      this->xmpp.send_history_message(std::to_string(iid), std::get<1>(message), std::get<2>(message),
+                                      this->user_jid + "/" + resource, std::get<0>(message));
+#else
+  (void)iid;
+  (void)since;
+  (void)messages;
+#endif
+}
+
+std::vector<Bridge::HistoryMessage> Bridge::filter_missed_messages(const std::time_t since, const std::vector<HistoryMessage>& messages,
+                                                                   std::vector<HistoryMessage> archived)
+{
+  std::sort(archived.begin(), archived.end());
+  std::vector<HistoryMessage> res;
+  for (const auto& message: messages)
+    {
+      if (std::get<0>(message) < since)
+        continue;
+      const auto it = std::lower_bound(archived.begin(), archived.end(), message);
+      if (it != archived.end() && *it == message)
+        archived.erase(it);
+      else
+        res.push_back(message);
+    }
+  return res;
+}
+
 std::string Bridge::get_own_nick(const Iid& iid)
 {
   IrcClient* irc = this->find_irc_client(iid.get_server());
@@ -1070,13 +1300,13 @@ size_t Bridge::active_clients() const
 void Bridge::kick_muc_user(Iid&& iid, const std::string& target, const std::string& reason, const std::string& author,
                            const bool self)
 {
-  for (const auto& resource: this->resources_in_chan[iid.to_tuple()])
+  for (const auto& resource: this->get_resources_in_chan(iid.get_local(), iid.get_server()))
       this->xmpp.kick_user(std::to_string(iid), target, reason, author, this->user_jid + "/" + resource, self);
 }
 
 void Bridge::send_nickname_conflict_error(const Iid& iid, const std::string& nickname)
 {
-    for (const auto& resource: this->resources_in_chan[iid.to_tuple()])
+    for (const auto& resource: this->get_resources_in_chan(iid.get_local(), iid.get_server()))
         this->xmpp.send_presence_error(std::to_string(iid), nickname, this->user_jid + "/" + resource,
                                        "cancel", "conflict", "409", "");
 }
@@ -1087,14 +1317,14 @@ void Bridge::send_affiliation_role_change(const Iid& iid, const std::string& tar
   std::string affiliation;
 
   std::tie(role, affiliation) = get_role_affiliation_from_irc_mode(mode);
-  for (const auto& resource: this->resources_in_chan[iid.to_tuple()])
+  for (const auto& resource: this->get_resources_in_chan(iid.get_local(), iid.get_server()))
     this->xmpp.send_affiliation_role_change(std::to_string(iid), target, affiliation, role,
                                             this->user_jid + "/" + resource);
 }
 
 void Bridge::send_iq_version_request(const std::string& nick, const std::string& hostname)
 {
-  const auto resources = this->resources_in_server[hostname];
+  const auto& resources = this->get_resources_in_server(hostname);
   if (resources.begin() != resources.end())
     this->xmpp.send_iq_version_request(utils::tolower(nick) + utils::empty_if_fixed_server("%" + hostname),
                                        this->user_jid + "/" + *resources.begin());
@@ -1106,8 +1336,8 @@ void Bridge::send_xmpp_ping_request(const std::string& nick, const std::string&
   // Use revstr because the forwarded ping to target XMPP user must not be
   // the same as the request iq, but we also need to get it back easily
   // (revstr again)
-  // Forward to the first resource (arbitrary, based on the “order” of the std::set) only
-  const auto resources = this->resources_in_server[hostname];
+  // Forward to the first resource (arbitrary, based on the “order” of the ResourceSet) only
+  const auto& resources = this->get_resources_in_server(hostname);
   if (resources.begin() != resources.end())
     this->xmpp.send_ping_request(utils::tolower(nick) + utils::empty_if_fixed_server("%" + hostname),
                                  this->user_jid + "/" + *resources.begin(), utils::revstr(id));
@@ -1115,7 +1345,7 @@ void Bridge::send_xmpp_ping_request(const std::string& nick, const std::string&
 
 void Bridge::send_xmpp_invitation(const Iid& iid, const std::string& author)
 {
-  for (const auto& resource: this->resources_in_server[iid.get_server()])
+  for (const auto& resource: this->get_resources_in_server(iid.get_server()))
     this->xmpp.send_invitation(std::to_string(iid), this->user_jid + "/" + resource, author);
 }
 
@@ -1164,47 +1394,66 @@ std::set<char> Bridge::get_chantypes(const std::string& hostname) const
   return irc->get_chantypes();
 }
 
-void Bridge::add_resource_to_chan(const Bridge::ChannelKey& channel, const std::string& resource)
+const ResourceSet& Bridge::get_resources_in_chan(const Bridge::ChannelName& channel, const Bridge::IrcHostname& irc_hostname) const
 {
-  auto it = this->resources_in_chan.find(channel);
-  if (it == this->resources_in_chan.end())
-    this->resources_in_chan[channel] = {resource};
-  else
-    it->second.insert(resource);
+  static const ResourceSet empty{};
+  const auto server_it = this->resources_in_chan.find(irc_hostname);
+  if (server_it == this->resources_in_chan.end())
+    return empty;
+  const auto it = server_it->second.find(channel);
+  if (it == server_it->second.end())
+    return empty;
+  return it->second;
+}
+
+const ResourceSet& Bridge::get_resources_in_server(const Bridge::IrcHostname& irc_hostname) const
+{
+  static const ResourceSet empty{};
+  const auto it = this->resources_in_server.find(irc_hostname);
+  if (it == this->resources_in_server.end())
+    return empty;
+  return it->second;
 }
 
-void Bridge::remove_resource_from_chan(const Bridge::ChannelKey& channel, const std::string& resource)
+void Bridge::add_resource_to_chan(const Bridge::ChannelName& channel, const Bridge::IrcHostname& irc_hostname, const std::string& resource)
 {
-  auto it = this->resources_in_chan.find(channel);
-  if (it != this->resources_in_chan.end())
+  this->resources_in_chan[irc_hostname][channel].insert(resource);
+}
+
+void Bridge::remove_resource_from_chan(const Bridge::ChannelName& channel, const Bridge::IrcHostname& irc_hostname, const std::string& resource)
+{
+  auto server_it = this->resources_in_chan.find(irc_hostname);
+  if (server_it == this->resources_in_chan.end())
+    return;
+  auto it = server_it->second.find(channel);
+  if (it != server_it->second.end())
     {
       it->second.erase(resource);
       if (it->second.empty())
-        this->resources_in_chan.erase(it);
+        server_it->second.erase(it);
     }
+  if (server_it->second.empty())
+    this->resources_in_chan.erase(server_it);
 }
 
-bool Bridge::is_resource_in_chan(const Bridge::ChannelKey& channel, const std::string& resource) const
+bool Bridge::is_resource_in_chan(const Bridge::ChannelName& channel, const Bridge::IrcHostname& irc_hostname, const std::string& resource) const
 {
-  auto it = this->resources_in_chan.find(channel);
-  if (it != this->resources_in_chan.end())
-    if (it->second.count(resource) == 1)
-      return true;
-  return false;
+  return this->get_resources_in_chan(channel, irc_hostname).count(resource) == 1;
 }
 
-void Bridge::remove_all_resources_from_chan(const Bridge::ChannelKey& channel)
+void Bridge::remove_all_resources_from_chan(const Bridge::ChannelName& channel, const Bridge::IrcHostname& irc_hostname)
 {
-  this->resources_in_chan.erase(channel);
+  auto server_it = this->resources_in_chan.find(irc_hostname);
+  if (server_it == this->resources_in_chan.end())
+    return;
+  server_it->second.erase(channel);
+  if (server_it->second.empty())
+    this->resources_in_chan.erase(server_it);
 }
 
 void Bridge::add_resource_to_server(const Bridge::IrcHostname& irc_hostname, const std::string& resource)
 {
-  auto it = this->resources_in_server.find(irc_hostname);
-  if (it == this->resources_in_server.end())
-    this->resources_in_server[irc_hostname] = {resource};
-  else
-    it->second.insert(resource);
+  this->resources_in_server[irc_hostname].insert(resource);
 }
 
 void Bridge::remove_resource_from_server(const Bridge::IrcHostname& irc_hostname, const std::string& resource)
@@ -1218,20 +1467,20 @@ void Bridge::remove_resource_from_server(const Bridge::IrcHostname& irc_hostname
     }
 }
 
-std::size_t Bridge::number_of_resources_in_chan(const Bridge::ChannelKey& channel) const
+std::size_t Bridge::number_of_resources_in_chan(const Bridge::ChannelName& channel, const Bridge::IrcHostname& irc_hostname) const
 {
-  auto it = this->resources_in_chan.find(channel);
-  if (it == this->resources_in_chan.end())
-    return 0;
-  return it->second.size();
+  return this->get_resources_in_chan(channel, irc_hostname).size();
 }
 
 std::size_t Bridge::number_of_channels_the_resource_is_in(const std::string& irc_hostname, const std::string& resource) const
 {
   std::size_t res = 0;
-  for (auto pair: this->resources_in_chan)
+  const auto server_it = this->resources_in_chan.find(irc_hostname);
+  if (server_it == this->resources_in_chan.end())
+    return 0;
+  for (const auto& pair: server_it->second)
     {
-      if (std::get<1>(pair.first) == irc_hostname && pair.second.count(resource) != 0)
+      if (pair.second.count(resource) != 0)
         res++;
     }
 
@@ -1247,7 +1496,7 @@ void Bridge::generate_channel_join_for_resource(const Iid& iid, const std::strin
   // Send the occupant list
   for (const auto& user: channel->get_users())
     {
-      if (user->nick != self->nick)
+      if (user->nick != self->nick && user->announced)
         {
           this->send_user_join(iid.get_server(), iid.get_encoded_local(),
                                user.get(), user->get_most_significant_mode(irc->get_sorted_user_modes()),
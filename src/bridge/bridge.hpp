@@ -3,10 +3,12 @@
 #include <bridge/result_set_management.hpp>
 #include <bridge/list_element.hpp>
 #include <bridge/history_limit.hpp>
+#include <bridge/resource_set.hpp>
 
 #include <irc/irc_message.hpp>
 #include <irc/irc_client.hpp>
 #include <bridge/colors.hpp>
+#include <utils/memory_usage.hpp>
 #include <irc/irc_user.hpp>
 #include <irc/iid.hpp>
 
@@ -15,11 +17,17 @@
 #include <exception>
 #include <string>
 #include <memory>
+#include <vector>
+#include <tuple>
+#include <chrono>
+#include <ctime>
 
 #include <biboumi.h>
 
 class BiboumiComponent;
 class Poller;
+class Serializer;
+class Deserializer;
 struct ResultSetInfo;
 
 /**
@@ -40,7 +48,7 @@ class Bridge
 {
 public:
   explicit Bridge(std::string  user_jid, BiboumiComponent& xmpp, std::shared_ptr<Poller>& poller);
-  ~Bridge() = default;
+  ~Bridge();
 
   Bridge(const Bridge&) = delete;
   Bridge(Bridge&& other) = delete;
@@ -55,9 +63,42 @@ public:
    */
   void remove_resource(const std::string& resource, const std::string& part_message);
   /**
-   * Remove all inactive IrcClients
+   * Remove the inactive IrcClients among the ones marked with
+   * mark_for_cleanup()
    */
   void clean();
+  /**
+   * Remember that the IrcClient for this hostname may be inactive, and
+   * needs to be checked by the next clean(). Also marks this bridge
+   * itself, in the BiboumiComponent.
+   */
+  void mark_for_cleanup(const std::string& hostname);
+  /**
+   * The approximate memory used by this bridge and its IrcClients.
+   */
+  MemoryUsage get_memory_usage() const;
+  /**
+   * Free what can be fetched again from the IRC servers: the complete
+   * channel lists and the MOTDs.  Used when the memory usage is above the
+   * soft limit chosen by the administrator.
+   */
+  void shed_cached_data();
+  /**
+   * Write the state of the IrcClients that can be given to a new biboumi
+   * process (see IrcClient::can_be_handed_over()), with the resources in
+   * their servers and channels, and add their sockets to the list.
+   */
+  void save_state(Serializer& out, std::vector<socket_t>& sockets) const;
+  /**
+   * Recreate the IrcClients written by save_state(), each one continuing
+   * its connection on its socket from the given list.
+   */
+  void restore_state(Deserializer& in, const std::vector<socket_t>& sockets);
+  /**
+   * QUIT the IRC servers whose connection could not be given to the new
+   * process, and tell the user.
+   */
+  void quit_not_handed_over(const std::string& message);
   /**
    * Return the jid of the XMPP user using this bridge
    */
@@ -162,9 +203,40 @@ public:
   void send_room_history(const std::string& hostname, const std::string& chan_name, const HistoryLimit& history_limit);
   void send_room_history(const std::string& hostname, std::string chan_name, const std::string& resource, const HistoryLimit& history_limit);
   /**
-   * Send a message from a MUC participant or a direct message
+   * The date (in seconds since the epoch) of the last message archived in
+   * the channel, or -1 if there is none, or if the history is not
+   * recorded.
+   */
+  std::time_t get_last_archived_date(const std::string& hostname, const std::string& chan_name);
+  /**
+   * A message of the channel history: its date, the nick of its author and
+   * its body.
+   */
+  using HistoryMessage = std::tuple<std::time_t, std::string, std::string>;
+  /**
+   * Archive the messages that were sent in the channel while we were not
+   * in it, returned by a CHATHISTORY request whose anchor was the given
+   * date, and send them to the user as history.  The ones that were
+   * already archived are skipped.
+   */
+  void archive_missed_messages(const Iid& iid, const std::time_t since, const std::vector<HistoryMessage>& messages);
+  /**
+   * Among the messages returned by a CHATHISTORY request whose anchor was
+   * the given date, return the ones that must be archived: the ones sent
+   * from that date on, and not in the given list of messages already
+   * archived since then.  The archived dates have no fraction of seconds,
+   * so a message is already archived if one with the same date, nick and
+   * body is, each archived one matching only one received message.
+   */
+  static std::vector<HistoryMessage> filter_missed_messages(const std::time_t since, const std::vector<HistoryMessage>& messages,
+                                                            std::vector<HistoryMessage> archived);
+  /**
+   * Send a message from a MUC participant or a direct message.  The date
+   * is the one archived with it: when the message was sent, according to
+   * the IRC server if it tells us.
    */
-  void send_message(const Iid& iid, const std::string& nick, const std::string& body, const bool muc, const bool log=true);
+  void send_message(const Iid& iid, const std::string& nick, const std::string& body, const bool muc, const bool log=true,
+                    const std::chrono::system_clock::time_point date=std::chrono::system_clock::now());
   /**
    * Send a presence of type error, from a room.
    */
@@ -261,6 +333,11 @@ private:
    * The pointer is shared by the bridge and the poller.
    */
   std::unordered_map<std::string, std::unique_ptr<IrcClient>> irc_clients;
+  /**
+   * The hostnames of the IrcClients that were created or closed since the
+   * last clean().
+   */
+  std::vector<std::string> clients_to_clean;
   /**
    * To communicate back with the XMPP component
    */
@@ -285,19 +362,29 @@ private:
   using IrcHostname = std::string;
   using ChannelKey = std::tuple<ChannelName, IrcHostname>;
 public:
-  std::map<ChannelKey, std::set<Resource>> resources_in_chan;
-  std::map<IrcHostname, std::set<Resource>> resources_in_server;
+  /**
+   * Indexed by server first, then by channel name, so that finding the
+   * resources of a channel never needs to build a composite key.
+   */
+  std::unordered_map<IrcHostname, std::unordered_map<ChannelName, ResourceSet>> resources_in_chan;
+  std::unordered_map<IrcHostname, ResourceSet> resources_in_server;
+  /**
+   * Return the resources in that channel or on that server (an empty set
+   * if there is none).
+   */
+  const ResourceSet& get_resources_in_chan(const ChannelName& channel, const IrcHostname& irc_hostname) const;
+  const ResourceSet& get_resources_in_server(const IrcHostname& irc_hostname) const;
 private:
   /**
    * Manage which resource is in which channel
    */
-  void add_resource_to_chan(const ChannelKey& channel, const std::string& resource);
-  void remove_resource_from_chan(const ChannelKey& channel, const std::string& resource);
+  void add_resource_to_chan(const ChannelName& channel, const IrcHostname& irc_hostname, const std::string& resource);
+  void remove_resource_from_chan(const ChannelName& channel, const IrcHostname& irc_hostname, const std::string& resource);
 public:
-  bool is_resource_in_chan(const ChannelKey& channel, const std::string& resource) const;
+  bool is_resource_in_chan(const ChannelName& channel, const IrcHostname& irc_hostname, const std::string& resource) const;
 private:
-  void remove_all_resources_from_chan(const ChannelKey& channel);
-  std::size_t number_of_resources_in_chan(const ChannelKey& channel) const;
+  void remove_all_resources_from_chan(const ChannelName& channel, const IrcHostname& irc_hostname);
+  std::size_t number_of_resources_in_chan(const ChannelName& channel, const IrcHostname& irc_hostname) const;
 
   void add_resource_to_server(const IrcHostname& irc_hostname, const std::string& resource);
   void remove_resource_from_server(const IrcHostname& irc_hostname, const std::string& resource);
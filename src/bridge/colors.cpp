@@ -1,5 +1,6 @@
 #include <bridge/colors.hpp>
 #include <xmpp/xmpp_stanza.hpp>
+#include <utils/encoding.hpp>
 
 #include <algorithm>
 #include <iostream>
@@ -40,6 +41,83 @@ struct styles_t
   int bg;
 };
 
+namespace
+{
+  /**
+   * Appends the XML-escaped text to the serialized XHTML-IM body, skipping
+   * the characters that are not allowed in XML, like sanitize() does.
+   */
+  void append_text(std::string& xhtml, const std::string& s,
+                   const std::string::size_type begin, const std::string::size_type end,
+                   const bool valid_utf8)
+  {
+    if (!valid_utf8)
+      {
+        xhtml += sanitize(s.substr(begin, end - begin));
+        return;
+      }
+    const auto* str = reinterpret_cast<const unsigned char*>(s.data()) + begin;
+    const auto* str_end = reinterpret_cast<const unsigned char*>(s.data()) + end;
+    while (str < str_end)
+      {
+        const auto size = utils::get_next_codepoint_size(*str);
+        if (utils::is_valid_xml_codepoint(str, size))
+          {
+            switch (*str)
+              {
+              case '&':
+                xhtml += "&amp;";
+                break;
+              case '<':
+                xhtml += "&lt;";
+                break;
+              case '>':
+                xhtml += "&gt;";
+                break;
+              case '\"':
+                xhtml += "&quot;";
+                break;
+              case '\'':
+                xhtml += "&apos;";
+                break;
+              default:
+                xhtml.append(reinterpret_cast<const char*>(str), size);
+                break;
+              }
+          }
+        str += size;
+      }
+  }
+
+  /**
+   * The state of the span element being written.
+   */
+  enum class SpanState
+  {
+    None,                       // no span is open
+    Empty,                      // "<span style='…'" has been written
+    Content,                    // "<span style='…'>" and some content
+  };
+
+  void write_span_content(std::string& xhtml, SpanState& span)
+  {
+    if (span == SpanState::Empty)
+      {
+        xhtml += '>';
+        span = SpanState::Content;
+      }
+  }
+
+  void close_span(std::string& xhtml, SpanState& span)
+  {
+    if (span == SpanState::Empty)
+      xhtml += "/>";
+    else if (span == SpanState::Content)
+      xhtml += "</span>";
+    span = SpanState::None;
+  }
+}
+
 /** We keep the currently-applied CSS styles in a structure. Each time a tag
  * is found, update this style list, then close the current span XML element
  * (if it is open), then reopen it with all the new styles in it.  This is
@@ -48,6 +126,9 @@ struct styles_t
  * and reapply them for each tag, instead of trying to keep a consistent
  * hierarchy of span, strong, em etc tags.  The generated XML is one-level
  * deep only.
+ *
+ * The XHTML-IM content is directly written as serialized XML, in the same
+ * pass as the cleaned body, instead of building a tree of XmlNode.
 */
 Xmpp::body irc_format_to_xhtmlim(const std::string& s)
 {
@@ -55,33 +136,34 @@ Xmpp::body irc_format_to_xhtmlim(const std::string& s)
     // there is no special formatting at all
     return std::make_tuple(s, nullptr);
 
+  const bool valid_utf8 = utils::is_valid_utf8(s.data());
+
   std::string cleaned;
+  cleaned.reserve(s.size());
+  std::string xhtml;
+  xhtml.reserve(s.size() * 2);
 
   styles_t styles = {false, false, false, -1, -1};
-
-  std::unique_ptr<XmlNode> result = std::make_unique<XmlNode>("body");
-  (*result)["xmlns"] = XHTML_NS;
-
-  std::unique_ptr<XmlNode> current_node_up;
-  XmlNode* current_node = result.get();
+  SpanState span = SpanState::None;
 
   std::string::size_type pos_start = 0;
   std::string::size_type pos_end;
 
   while ((pos_end = s.find_first_of(irc_format_char, pos_start)) != std::string::npos)
     {
-      const std::string txt = s.substr(pos_start, pos_end-pos_start);
-      cleaned += txt;
-      if (current_node->has_children())
-        current_node->get_last_child()->add_to_tail(txt);
-      else
-        current_node->add_to_inner(txt);
+      if (pos_end != pos_start)
+        {
+          cleaned.append(s, pos_start, pos_end - pos_start);
+          write_span_content(xhtml, span);
+          append_text(xhtml, s, pos_start, pos_end, valid_utf8);
+        }
 
       if (s[pos_end] == IRC_FORMAT_BOLD_CHAR)
         styles.strong = !styles.strong;
       else if (s[pos_end] == IRC_FORMAT_NEWLINE_CHAR)
         {
-          current_node->add_child(std::make_unique<XmlNode>("br"));
+          write_span_content(xhtml, span);
+          xhtml += "<br/>";
           cleaned += '\n';
         }
       else if (s[pos_end] == IRC_FORMAT_UNDERLINE_CHAR)
@@ -124,30 +206,32 @@ Xmpp::body irc_format_to_xhtmlim(const std::string& s)
         }
 
       // close opened span, if any
-      if (current_node != result.get())
-        {
-          result->add_child(std::move(current_node_up));
-          current_node = result.get();
-        }
-      // Take all currently-applied style and create a new span with it
-      std::string styles_str;
-      if (styles.strong)
-        styles_str += "font-weight:bold;";
-      if (styles.underline)
-        styles_str += "text-decoration:underline;";
-      if (styles.italic)
-        styles_str += "font-style:italic;";
-      if (styles.fg != -1)
-        styles_str += "color:"s +
-          irc_colors_to_css[styles.fg % IRC_NUM_COLORS] + ";";
-      if (styles.bg != -1)
-        styles_str += "background-color:"s +
-          irc_colors_to_css[styles.bg % IRC_NUM_COLORS] + ";";
-      if (!styles_str.empty())
+      close_span(xhtml, span);
+      // Take all currently-applied style and open a new span with it
+      if (styles.strong || styles.underline || styles.italic ||
+          styles.fg != -1 || styles.bg != -1)
         {
-          current_node_up = std::make_unique<XmlNode>("span");
-          current_node = current_node_up.get();
-          (*current_node)["style"] = styles_str;
+          xhtml += "<span style='";
+          if (styles.strong)
+            xhtml += "font-weight:bold;";
+          if (styles.underline)
+            xhtml += "text-decoration:underline;";
+          if (styles.italic)
+            xhtml += "font-style:italic;";
+          if (styles.fg != -1)
+            {
+              xhtml += "color:";
+              xhtml += irc_colors_to_css[styles.fg % IRC_NUM_COLORS];
+              xhtml += ';';
+            }
+          if (styles.bg != -1)
+            {
+              xhtml += "background-color:";
+              xhtml += irc_colors_to_css[styles.bg % IRC_NUM_COLORS];
+              xhtml += ';';
+            }
+          xhtml += '\'';
+          span = SpanState::Empty;
         }
 
       pos_start = pos_end + 1;
@@ -155,16 +239,18 @@ Xmpp::body irc_format_to_xhtmlim(const std::string& s)
 
   // If some text remains, without any format char, just append that text at
   // the end of the current node
-  const std::string txt = s.substr(pos_start, pos_end-pos_start);
-  cleaned += txt;
-  if (current_node->has_children())
-    current_node->get_last_child()->add_to_tail(txt);
-  else
-    current_node->add_to_inner(txt);
-
-  if (current_node != result.get())
-    result->add_child(std::move(current_node_up));
-
-  Xmpp::body body_res = std::make_tuple(cleaned, std::move(result));
-  return body_res;
+  if (pos_start < s.size())
+    {
+      cleaned.append(s, pos_start, std::string::npos);
+      write_span_content(xhtml, span);
+      append_text(xhtml, s, pos_start, s.size(), valid_utf8);
+    }
+  close_span(xhtml, span);
+
+  auto result = std::make_unique<XmlNode>("body");
+  (*result)["xmlns"] = XHTML_NS;
+  if (!xhtml.empty())
+    result->set_inner_xml(std::move(xhtml));
+
+  return std::make_tuple(std::move(cleaned), std::move(result));
 }
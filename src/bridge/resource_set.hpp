@@ -0,0 +1,57 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+/**
+ * The XMPP resources of one user that are in a given channel, or on a
+ * given IRC server.
+ *
+ * A user rarely has more than a few resources, so they are kept sorted
+ * in a vector instead of a std::set: lookups and iterations then stay in
+ * one contiguous allocation, and the iteration order is the same.
+ */
+class ResourceSet
+{
+public:
+  using const_iterator = std::vector<std::string>::const_iterator;
+
+  /**
+   * Returns false if the resource was already in the set.
+   */
+  bool insert(const std::string& resource)
+  {
+    const auto it = std::lower_bound(this->resources.begin(), this->resources.end(), resource);
+    if (it != this->resources.end() && *it == resource)
+      return false;
+    this->resources.insert(it, resource);
+    return true;
+  }
+  /**
+   * Returns the number of removed resources (0 or 1), like std::set::erase.
+   */
+  std::size_t erase(const std::string& resource)
+  {
+    const auto it = std::lower_bound(this->resources.begin(), this->resources.end(), resource);
+    if (it == this->resources.end() || *it != resource)
+      return 0;
+    this->resources.erase(it);
+    return 1;
+  }
+  std::size_t count(const std::string& resource) const
+  {
+    return std::binary_search(this->resources.begin(), this->resources.end(), resource) ? 1 : 0;
+  }
+  std::size_t size() const
+  { return this->resources.size(); }
+  bool empty() const
+  { return this->resources.empty(); }
+  const_iterator begin() const
+  { return this->resources.begin(); }
+  const_iterator end() const
+  { return this->resources.end(); }
+
+private:
+  std::vector<std::string> resources;
+};
@@ -15,6 +15,7 @@ extern char** environ;
 std::string Config::filename{};
 std::map<std::string, std::string> Config::values{};
 std::vector<t_config_changed_callback> Config::callbacks{};
+std::unique_ptr<const ConfigSnapshot> Config::current_snapshot = std::make_unique<const ConfigSnapshot>();
 
 std::string Config::get(const std::string& option, const std::string& def)
 {
@@ -54,6 +55,7 @@ bool Config::is_in_list(const std::string& option, const std::string& value)
 void Config::set(const std::string& option, const std::string& value, bool save)
 {
   Config::values[option] = value;
+  Config::update_snapshot();
   if (save)
     {
       Config::save_to_file();
@@ -69,6 +71,7 @@ void Config::connect(const t_config_changed_callback& callback)
 void Config::clear()
 {
   Config::values.clear();
+  Config::update_snapshot();
 }
 
 /**
@@ -81,6 +84,25 @@ void Config::trigger_configuration_change()
       (*it)();
 }
 
+void Config::update_snapshot()
+{
+  auto snapshot = std::make_unique<ConfigSnapshot>();
+  snapshot->fixed_irc_server = Config::get("fixed_irc_server", "");
+  snapshot->realname_customization = Config::get("realname_customization", "true") == "true";
+  snapshot->realname_from_jid = Config::get("realname_from_jid", "false") == "true";
+  snapshot->trace_sampling = Config::get_int("trace_sampling", 0);
+  snapshot->trace_slow_threshold = std::chrono::milliseconds(Config::get_int("trace_slow_threshold", 500));
+  snapshot->loop_slow_threshold = std::chrono::milliseconds(Config::get_int("loop_slow_threshold", 100));
+  // Given in KiB
+  const auto high_watermark = Config::get_int("output_high_watermark", 16384);
+  const auto low_watermark = Config::get_int("output_low_watermark", 4096);
+  snapshot->output_high_watermark = static_cast<std::size_t>(std::max(high_watermark, 0)) * 1024;
+  snapshot->output_low_watermark = std::min(static_cast<std::size_t>(std::max(low_watermark, 0)) * 1024,
+                                            snapshot->output_high_watermark / 2);
+  snapshot->lazy_presence_threshold = static_cast<std::size_t>(std::max(Config::get_int("lazy_presence_threshold", 0), 0));
+  Config::current_snapshot = std::move(snapshot);
+}
+
 bool Config::read_conf(const std::string& name)
 {
   if (!name.empty())
@@ -130,6 +152,7 @@ bool Config::read_conf(const std::string& name)
       parse_line(*env_line, true);
       env_line++;
     }
+  Config::update_snapshot();
   return true;
 }
 
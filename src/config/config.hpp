@@ -17,6 +17,7 @@
 
 #include <functional>
 #include <fstream>
+#include <chrono>
 #include <memory>
 #include <vector>
 #include <string>
@@ -24,6 +25,31 @@
 
 typedef std::function<void()> t_config_changed_callback;
 
+/**
+ * The options used on hot paths (for each stanza or IRC message), parsed
+ * once each time the configuration changes instead of being looked up by
+ * name every time.
+ */
+struct ConfigSnapshot
+{
+  std::string fixed_irc_server{};
+  bool realname_customization{true};
+  bool realname_from_jid{false};
+  int trace_sampling{0};
+  std::chrono::milliseconds trace_slow_threshold{0};
+  std::chrono::milliseconds loop_slow_threshold{0};
+  /**
+   * In bytes, 0 disables the backpressure.
+   */
+  std::size_t output_high_watermark{0};
+  std::size_t output_low_watermark{0};
+  /**
+   * The number of occupants from which the channels use lazy presences, 0
+   * to never use them.
+   */
+  std::size_t lazy_presence_threshold{0};
+};
+
 class Config
 {
 public:
@@ -70,6 +96,13 @@ public:
    * Read the configuration file at the given path.
    */
   static bool read_conf(const std::string& name="");
+  /**
+   * Returns the current values of the options in ConfigSnapshot. The
+   * reference must not be kept across a configuration change (set(),
+   * clear() or read_conf()): a new snapshot then replaces this one.
+   */
+  static const ConfigSnapshot& snapshot()
+  { return *Config::current_snapshot; }
   /**
    * Get the filename
    */
@@ -90,9 +123,15 @@ private:
    * This is used to notify any class that a configuration change occured.
    */
   static void trigger_configuration_change();
+  /**
+   * Parse the values into a new ConfigSnapshot, and replace the current one
+   * with it.
+   */
+  static void update_snapshot();
 
   static std::map<std::string, std::string> values;
   static std::vector<t_config_changed_callback> callbacks;
+  static std::unique_ptr<const ConfigSnapshot> current_snapshot;
 
 };
 
@@ -7,6 +7,7 @@
 #include <utils/get_first_non_empty.hpp>
 #include <utils/time.hpp>
 #include <utils/uuid.hpp>
+#include <utils/allocations.hpp>
 
 #include <config/config.hpp>
 #include <database/sqlite3_engine.hpp>
@@ -169,6 +170,7 @@ std::string Database::store_muc_message(const std::string& owner, const std::str
                                         const std::string& server_name, Database::time_point date,
                                         const std::string& body, const std::string& nick)
 {
+  ALLOCATIONS_SCOPE(database, "Database::store_muc_message");
   auto line = Database::muc_log_lines.row();
 
   auto uuid = Database::gen_uuid();
@@ -186,9 +188,19 @@ std::string Database::store_muc_message(const std::string& owner, const std::str
   return uuid;
 }
 
+void Database::store_muc_messages(const std::string& owner, const std::string& chan_name, const std::string& server_name,
+                                  const std::vector<std::tuple<time_point, std::string, std::string>>& lines)
+{
+  ALLOCATIONS_SCOPE(database, "Database::store_muc_messages");
+  Transaction transaction;
+  for (const auto& line: lines)
+    Database::store_muc_message(owner, chan_name, server_name, std::get<0>(line), std::get<1>(line), std::get<2>(line));
+}
+
 std::tuple<bool, std::vector<Database::MucLogLine>> Database::get_muc_logs(const std::string& owner, const std::string& chan_name, const std::string& server,
-                                                   std::size_t limit, const std::string& start, const std::string& end, const Id::real_type reference_record_id, Database::Paging paging)
+                                                   std::size_t limit, const std::string& start, const std::string& end, const MucLogLine* reference_record, Database::Paging paging)
 {
+  ALLOCATIONS_SCOPE(database, "Database::get_muc_logs");
   auto request = select(Database::muc_log_lines);
   request.where() << Database::Owner{} << "=" << owner << \
           " and " << Database::IrcChanName{} << "=" << chan_name << \
@@ -206,20 +218,21 @@ std::tuple<bool, std::vector<Database::MucLogLine>> Database::get_muc_logs(const
       if (end_time != -1)
         request << " and " << Database::Date{} << "<=" << end_time;
     }
-  if (reference_record_id != Id::unset_value)
+  // The lines are sorted by date: the missed messages of a channel can be
+  // archived after the ones received since.  The lines of the same second
+  // are kept in the order in which they were archived
+  if (reference_record)
     {
-      request << " and " << Id{};
-      if (paging == Database::Paging::first)
-        request << ">";
-      else
-        request << "<";
-      request << reference_record_id;
+      const auto comparison = paging == Database::Paging::first ? ">" : "<";
+      request << " and (" << Database::Date{} << comparison << reference_record->col<Database::Date>() <<
+                 " or (" << Database::Date{} << "=" << reference_record->col<Database::Date>() <<
+                 " and " << Id{} << comparison << reference_record->col<Id>() << "))";
     }
 
   if (paging == Database::Paging::first)
-    request.order_by() << Id{} << " ASC ";
+    request.order_by() << Database::Date{} << " ASC, " << Id{} << " ASC ";
   else
-    request.order_by() << Id{} << " DESC ";
+    request.order_by() << Database::Date{} << " DESC, " << Id{} << " DESC ";
 
   // Just a simple trick: to know whether we got the totality of the
   // possible results matching this query (except for the limit), we just
@@ -133,12 +133,13 @@ class Database
   static void set_after_connection_commands(const IrcServerOptions& server_options, AfterConnectionCommands& commands);
 
   /**
-   * Get all the lines between (optional) start and end dates, with a (optional) limit.
-   * If after_id is set, only the records after it will be returned.
+   * Get all the lines between (optional) start and end dates, with a (optional) limit,
+   * sorted by date.  If reference_record is set, only the records after it (or before
+   * it, with Paging::last) will be returned.
    */
   static std::tuple<bool, std::vector<MucLogLine>> get_muc_logs(const std::string& owner, const std::string& chan_name, const std::string& server,
                                               std::size_t limit, const std::string& start="", const std::string& end="",
-                                              const Id::real_type reference_record_id=Id::unset_value, Paging=Paging::first);
+                                              const MucLogLine* reference_record=nullptr, Paging=Paging::first);
 
   /**
    * Get just one single record matching the given uuid, between (optional) end and start.
@@ -147,6 +148,12 @@ class Database
   static MucLogLine get_muc_log(const std::string& owner, const std::string& chan_name, const std::string& server, const std::string& uuid, const std::string& start="", const std::string& end="");
   static std::string store_muc_message(const std::string& owner, const std::string& chan_name, const std::string& server_name,
                                        time_point date, const std::string& body, const std::string& nick);
+  /**
+   * Store all the given lines (tuples with their date, body and nick) in a
+   * single transaction.
+   */
+  static void store_muc_messages(const std::string& owner, const std::string& chan_name, const std::string& server_name,
+                                 const std::vector<std::tuple<time_point, std::string, std::string>>& lines);
 
   static void add_roster_item(const std::string& local, const std::string& remote);
   static bool has_roster_item(const std::string& local, const std::string& remote);
@@ -23,9 +23,7 @@ public:
     auto statement = db.prepare(this->body);
     if (!statement)
       return;
-#ifdef DEBUG_SQL_QUERIES
     const auto timer = this->log_and_time();
-#endif
     statement->bind(std::move(this->params));
     if (statement->step() != StepResult::Done)
       log_error("Failed to execute DELETE command");
@@ -68,8 +68,8 @@ std::tuple<bool, std::string> PostgresqlEngine::raw_exec(const std::string& quer
 {
 #ifdef DEBUG_SQL_QUERIES
   log_debug("SQL QUERY: ", query);
-  const auto timer = make_sql_timer();
 #endif
+  const auto timer = make_sql_timer();
   PGresult* res = PQexec(this->conn, query.data());
   auto sg = utils::make_scope_guard([res](){
       PQclear(res);
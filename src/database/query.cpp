@@ -1,6 +1,14 @@
 #include <database/query.hpp>
 #include <database/column.hpp>
 
+metrics::Histogram& query_duration_histogram()
+{
+  static auto& histogram = metrics::Registry::instance().histogram(
+      "biboumi_database_query_duration_seconds", "Duration of the database queries",
+      {0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5});
+  return histogram;
+}
+
 void actual_bind(Statement& statement, const std::string& value, int index)
 {
   statement.bind_text(index, value);
@@ -21,19 +21,30 @@ void actual_bind(Statement& statement, const T& value, int index)
   statement.bind_int64(index, static_cast<std::int64_t>(value));
 }
 
-#ifdef DEBUG_SQL_QUERIES
 #include <utils/scopetimer.hpp>
+#include <utils/metrics.hpp>
+
+/**
+ * The durations of all the executed queries.
+ */
+metrics::Histogram& query_duration_histogram();
 
+/**
+ * Time a query, until the returned value is destroyed.  The duration is
+ * exported, and logged if DEBUG_SQL_QUERIES is set.
+ */
 inline auto make_sql_timer()
 {
   return make_scope_timer([](const std::chrono::steady_clock::duration& elapsed)
                           {
+                            query_duration_histogram().observe(elapsed);
+#ifdef DEBUG_SQL_QUERIES
                             const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(elapsed);
                             const auto rest = elapsed - seconds;
                             log_debug("Query executed in ", seconds.count(), ".", rest.count(), "s.");
+#endif
                           });
 }
-#endif
 
 struct Query
 {
@@ -45,17 +56,17 @@ struct Query
         body(std::move(str))
     {}
 
-#ifdef DEBUG_SQL_QUERIES
     auto log_and_time()
     {
+#ifdef DEBUG_SQL_QUERIES
        std::ostringstream os;
        os << this->body << "; ";
        for (const auto& param: this->params)
          os << "'" << param << "' ";
        log_debug("SQL QUERY: ", os.str());
+#endif
        return make_sql_timer();
     }
-#endif
 };
 
 template <typename ColumnType>
@@ -112,9 +112,7 @@ struct SelectQuery: public Query
     {
       std::vector<Row<T...>> rows;
 
-#ifdef DEBUG_SQL_QUERIES
       const auto timer = this->log_and_time();
-#endif
 
       auto statement = db.prepare(this->body);
       if (!statement)
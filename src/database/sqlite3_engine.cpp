@@ -60,8 +60,8 @@ std::tuple<bool, std::string> Sqlite3Engine::raw_exec(const std::string& query)
 {
 #ifdef DEBUG_SQL_QUERIES
   log_debug("SQL QUERY: ", query);
-  const auto timer = make_sql_timer();
 #endif
+  const auto timer = make_sql_timer();
 
   char* error;
   const auto result = sqlite3_exec(db, query.data(), nullptr, nullptr, &error);
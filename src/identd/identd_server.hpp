@@ -26,8 +26,15 @@ class IdentdServer: public TcpSocketServer<IdentdSocket>
     ::close(this->socket);
     this->sockets.clear();
   }
+  void mark_for_cleanup()
+  {
+    this->needs_cleaning = true;
+  }
   void clean()
   {
+    if (!this->needs_cleaning)
+      return;
+    this->needs_cleaning = false;
     this->sockets.erase(std::remove_if(this->sockets.begin(), this->sockets.end(),
                                        [](const std::unique_ptr<IdentdSocket>& socket)
                                        {
@@ -37,4 +44,8 @@ class IdentdServer: public TcpSocketServer<IdentdSocket>
   }
  private:
   const BiboumiComponent& biboumi_component;
+  /**
+   * Whether at least one socket has been closed since the last clean()
+   */
+  bool needs_cleaning{false};
 };
@@ -4,7 +4,8 @@
 #include <sstream>
 #include <iomanip>
 
-#include <utils/sha1.hpp>
+#include <network/tcp_client_socket_handler.hpp>
+#include <network/resolver.hpp>
 
 #include <logger/logger.hpp>
 
@@ -13,6 +14,12 @@ IdentdSocket::IdentdSocket(std::shared_ptr<Poller>& poller, const socket_t socke
   server(dynamic_cast<IdentdServer&>(server))
 {
   this->socket = socket;
+  // The server asking us is the one at the other end of the connection
+  // that it asks about
+  struct sockaddr_storage peer{};
+  socklen_t peer_size = sizeof(peer);
+  if (::getpeername(this->socket, reinterpret_cast<struct sockaddr*>(&peer), &peer_size) != -1)
+    this->remote_address = addr_to_string(reinterpret_cast<const struct sockaddr*>(&peer));
 }
 
 void IdentdSocket::parse_in_buffer(const std::size_t)
@@ -31,35 +38,26 @@ void IdentdSocket::parse_in_buffer(const std::size_t)
       line >> local_port >> sep >> remote_port;
       if (line.fail()) // Data did not match the expected format, ignore the line entirely
         continue;
-      const auto& xmpp = this->server.get_biboumi_component();
-      auto response = this->generate_answer(xmpp, local_port, remote_port);
+      auto response = this->generate_answer(local_port, remote_port);
 
       this->send_data(std::move(response));
     }
 }
 
-static std::string hash_jid(const std::string& jid)
+void IdentdSocket::close()
 {
-  return sha1(jid);
+  TCPSocketHandler::close();
+  this->server.mark_for_cleanup();
 }
 
-std::string IdentdSocket::generate_answer(const BiboumiComponent& biboumi, uint16_t local, uint16_t remote)
+std::string IdentdSocket::generate_answer(uint16_t local, uint16_t remote)
 {
-  for (const Bridge* bridge: biboumi.get_bridges())
-    {
-      for (const auto& pair: bridge->get_irc_clients())
-        {
-          if (pair.second->match_port_pair(local, remote))
-            {
-              std::ostringstream os;
-              os << local << " , " << remote << " : USERID : OTHER : " << hash_jid(bridge->get_bare_jid()) << "\r\n";
-              log_debug("Identd, sending: ", os.str());
-              return os.str();
-            }
-        }
-    }
+  const auto client = TCPClientSocketHandler::find_by_port_pair(local, remote, this->remote_address);
   std::ostringstream os;
-  os << local << " , " << remote << " ERROR : NO-USER" << "\r\n";
+  if (client && !client->get_ident().empty())
+    os << local << " , " << remote << " : USERID : OTHER : " << client->get_ident() << "\r\n";
+  else
+    os << local << " , " << remote << " ERROR : NO-USER" << "\r\n";
   log_debug("Identd, sending: ", os.str());
   return os.str();
 }
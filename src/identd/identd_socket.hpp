@@ -18,9 +18,13 @@ class IdentdSocket: public TCPSocketHandler
  public:
   IdentdSocket(std::shared_ptr<Poller>& poller, const socket_t socket, TcpSocketServer<IdentdSocket>& server);
   ~IdentdSocket() = default;
-  std::string generate_answer(const BiboumiComponent& biboumi, uint16_t local, uint16_t remote);
+  std::string generate_answer(uint16_t local, uint16_t remote);
 
   void parse_in_buffer(const std::size_t size) override final;
+  /**
+   * Also tell our server that it has something to clean.
+   */
+  void close() override final;
 
   bool is_connected() const override final
   {
@@ -33,4 +37,9 @@ class IdentdSocket: public TCPSocketHandler
 
  private:
   IdentdServer& server;
+  /**
+   * The address of the server that sends the requests, only the
+   * connections to it are identified.
+   */
+  std::string remote_address;
 };
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <irc/irc_message.hpp>
+
+#include <vector>
+#include <string>
+
+/**
+ * A group of messages that the server sends between a “BATCH +reference”
+ * and a “BATCH -reference” (https://ircv3.net/specs/extensions/batch).
+ */
+struct Batch
+{
+  std::string type;
+  std::vector<std::string> parameters;
+  /**
+   * The messages of the batch, all handled once it ends.  A nested batch
+   * that ended is represented, at its place, by its “BATCH -reference”
+   * message.
+   */
+  std::vector<IrcMessage> messages;
+  /**
+   * The reference of the batch that this one is nested in, empty if it is
+   * not.  A nested batch is handled when the outermost one ends, not
+   * before.
+   */
+  std::string parent;
+  /**
+   * Whether the server ended this batch, when it waits for its parent.
+   */
+  bool ended{false};
+};
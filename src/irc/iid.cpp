@@ -36,7 +36,7 @@ Iid::Iid(const std::string& iid, const Bridge *bridge)
 void Iid::set_type(const std::set<char>& chantypes)
 {
   if (this->local.empty() && (
-      !Config::get("fixed_irc_server", "").empty() || this->server.empty()))
+      !Config::snapshot().fixed_irc_server.empty() || this->server.empty()))
     this->type = Iid::Type::None;
   if (this->local.empty())
     return;
@@ -48,7 +48,7 @@ void Iid::set_type(const std::set<char>& chantypes)
 
 void Iid::init(const std::string& iid)
 {
-  const std::string fixed_irc_server = Config::get("fixed_irc_server", "");
+  const std::string& fixed_irc_server = Config::snapshot().fixed_irc_server;
 
   if (fixed_irc_server.empty())
   {
@@ -104,7 +104,7 @@ const std::string& Iid::get_server() const
 namespace std {
   const std::string to_string(const Iid& iid)
   {
-    if (Config::get("fixed_irc_server", "").empty())
+    if (Config::snapshot().fixed_irc_server.empty())
     {
       if (iid.type == Iid::Type::Server)
         return iid.get_server();
@@ -1,6 +1,23 @@
 #include <irc/irc_channel.hpp>
+#include <utils/metrics.hpp>
 #include <algorithm>
 
+static metrics::Gauge& live_channels = metrics::Registry::instance().gauge(
+    "biboumi_irc_channels", "IRC channels joined, or being joined, by all the IrcClients");
+static metrics::Gauge& live_users = metrics::Registry::instance().gauge(
+    "biboumi_irc_channel_users", "Occupants of all the IRC channels, as seen by each IrcClient");
+
+IrcChannel::IrcChannel()
+{
+  live_channels.inc();
+}
+
+IrcChannel::~IrcChannel()
+{
+  live_channels.dec();
+  live_users.dec(static_cast<std::int64_t>(this->users.size()));
+}
+
 void IrcChannel::set_self(IrcUser* user)
 {
   this->self = user;
@@ -13,7 +30,9 @@ IrcUser* IrcChannel::add_user(const std::string& name,
   auto old_user = this->find_user(new_user->nick);
   if (old_user)
     return old_user;
+  new_user->announced = !this->lazy_presences;
   this->users.emplace_back(std::move(new_user));
+  live_users.inc();
   return this->users.back().get();
 }
 
@@ -47,6 +66,7 @@ std::unique_ptr<IrcUser> IrcChannel::remove_user(const IrcUser* user)
     {
       result = std::move(*it);
       this->users.erase(it);
+      live_users.dec();
       if (is_self)
         {
           this->self = nullptr;
@@ -14,7 +14,8 @@
 class IrcChannel
 {
 public:
-  IrcChannel() = default;
+  IrcChannel();
+  ~IrcChannel();
 
   IrcChannel(const IrcChannel&) = delete;
   IrcChannel(IrcChannel&&) = delete;
@@ -25,6 +26,11 @@ public:
   // Set to true if we sent a PART but didn’t yet receive the PART ack from
   // the server
   bool parting{false};
+  /**
+   * Set once joined if the channel has too many occupants (see the
+   * lazy_presence_threshold option): new occupants are not announced.
+   */
+  bool lazy_presences{false};
   std::string topic{};
   std::string topic_author{};
   void set_self(IrcUser* user);
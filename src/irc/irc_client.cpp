@@ -6,18 +6,27 @@
 #include <bridge/bridge.hpp>
 #include <irc/irc_user.hpp>
 #include <utils/base64.hpp>
+#include <utils/sha1.hpp>
 
 #include <logger/logger.hpp>
 #include <config/config.hpp>
 #include <utils/tolower.hpp>
+#include <utils/metrics.hpp>
+#include <utils/tracing.hpp>
+#include <utils/capture.hpp>
+#include <utils/allocations.hpp>
 #include <utils/split.hpp>
 #include <utils/string.hpp>
+#include <utils/serializer.hpp>
+#include <utils/time.hpp>
 
 #include <sstream>
 #include <iostream>
 #include <stdexcept>
 #include <algorithm>
 #include <cstring>
+#include <cstdlib>
+#include <ctime>
 
 #include <chrono>
 #include <string>
@@ -33,6 +42,16 @@ using namespace std::chrono_literals;
  */
 using IrcCallback = void (IrcClient::*)(const IrcMessage&);
 
+static metrics::Traffic irc_traffic("biboumi_irc", "the IRC servers");
+static metrics::Counter& received_lines = metrics::Registry::instance().counter(
+    "biboumi_irc_received_lines_total", "IRC messages received from the IRC servers");
+static metrics::Counter& sent_lines = metrics::Registry::instance().counter(
+    "biboumi_irc_sent_lines_total", "IRC messages sent to the IRC servers");
+static metrics::Gauge& throttled_messages = metrics::Registry::instance().gauge(
+    "biboumi_irc_throttled_messages", "IRC messages waiting for a token of their IrcClient’s TokensBucket");
+static metrics::Gauge& live_irc_clients = metrics::Registry::instance().gauge(
+    "biboumi_irc_clients", "IrcClients, connected or not");
+
 static const std::unordered_map<std::string,
                                 std::pair<IrcCallback, std::pair<std::size_t, std::size_t>>> irc_callbacks = {
   {"NOTICE", {&IrcClient::on_notice, {2, 0}}},
@@ -83,6 +102,7 @@ static const std::unordered_map<std::string,
   {"KICK", {&IrcClient::on_kick, {3, 0}}},
   {"INVITE", {&IrcClient::on_invite, {2, 0}}},
   {"CAP", {&IrcClient::on_cap, {3, 0}}},
+  {"BATCH", {&IrcClient::on_batch, {1, 0}}},
 #ifdef WITH_SASL
   {"AUTHENTICATE", {&IrcClient::on_authenticate, {1, 0}}},
   {"900", {&IrcClient::on_sasl_login, {3, 0}}},
@@ -161,9 +181,15 @@ IrcClient::IrcClient(std::shared_ptr<Poller>& poller, std::string hostname,
       return true;
     this->actual_send(std::move(this->message_queue.front()));
     this->message_queue.pop_front();
+    throttled_messages.dec();
     return false;
   }, "TokensBucket" + this->hostname + this->bridge.get_jid())
 {
+  this->traffic = &irc_traffic;
+  this->capture_stream = capture::Writer::instance().open_stream({capture::StreamKind::irc, this->bridge.get_jid(), this->hostname});
+  live_irc_clients.inc();
+  // Computed once, instead of on each identd query
+  this->ident = sha1(this->bridge.get_bare_jid());
 #ifdef USE_DATABASE
   auto options = Database::get_irc_server_options(this->bridge.get_bare_jid(),
                                                   this->get_hostname());
@@ -187,10 +213,13 @@ IrcClient::IrcClient(std::shared_ptr<Poller>& poller, std::string hostname,
 
 IrcClient::~IrcClient()
 {
+  live_irc_clients.dec();
+  throttled_messages.dec(static_cast<std::int64_t>(this->message_queue.size()));
   // This event may or may not exist (if we never got connected, it
   // doesn't), but it's ok
   TimedEventsManager::instance().cancel("PING" + this->hostname + this->bridge.get_jid());
   TimedEventsManager::instance().cancel("TokensBucket" + this->hostname + this->bridge.get_jid());
+  TimedEventsManager::instance().cancel("Netsplit" + this->hostname + this->bridge.get_jid());
 }
 
 void IrcClient::start()
@@ -215,7 +244,7 @@ void IrcClient::start()
 # ifdef BOTAN_FOUND
   this->credential_manager.set_trusted_fingerprint(options.col<Database::TrustedFingerprint>());
 # endif
-  if (Config::get("fixed_irc_server", "").empty() &&
+  if (Config::snapshot().fixed_irc_server.empty() &&
       !options.col<Database::Address>().empty())
     address = options.col<Database::Address>();
 #endif
@@ -288,6 +317,15 @@ void IrcClient::on_connected()
   this->send_gateway_message("Connected to IRC server"s + (this->use_tls ? " (encrypted)": "") + ".");
 
   this->capabilities["multi-prefix"] = {[]{}, []{}};
+  this->capabilities["batch"] = {[]{}, []{}};
+  this->capabilities["server-time"] = {[]{}, []{}};
+  this->capabilities["draft/chathistory"] = {[this]{ this->chathistory_supported = true; }, []{}};
+  this->offered_capabilities.clear();
+  this->chathistory_supported = false;
+  this->chathistory_limit = 0;
+  this->batches.clear();
+  this->split_users.clear();
+  this->chathistory_anchors.clear();
 
 #ifdef USE_DATABASE
   auto options = Database::get_irc_server_options(this->bridge.get_bare_jid(),
@@ -306,26 +344,26 @@ void IrcClient::on_connected()
       this->capabilities["sasl"] = {
           [this]
           {
-            this->send_message({"AUTHENTICATE", {"PLAIN"}});
+            this->send_message({"AUTHENTICATE", {"PLAIN"}}, {}, false);
             log_warning("negotiating SASL now...");
           },
-          []
+          [this]
           {
             log_warning("SASL not supported by the server, disconnecting.");
+            this->on_sasl_failure(IrcMessage("904", {this->current_nick, "SASL not supported by the server"}));
           }
       };
       this->sasl_state = SaslState::needed;
     }
 #endif
 
-  {
-    for (const auto &pair : this->capabilities)
-      this->send_message({ "CAP", {"REQ", pair.first}});
-  }
-
-  this->send_nick_command(this->current_nick);
+  // The whole registration is written at once, without waiting for the
+  // tokens bucket: the server holds it until we send CAP END, after
+  // requesting the capabilities it lists that we want
+  this->send_message({"CAP", {"LS", "302"}}, {}, false);
+  this->send_message(IrcMessage("NICK", {this->current_nick}), {}, false);
 #ifdef USE_DATABASE
-  if (Config::get("realname_customization", "true") == "true")
+  if (Config::snapshot().realname_customization)
     {
       if (!options.col<Database::Username>().empty())
         this->username = options.col<Database::Username>();
@@ -351,6 +389,11 @@ void IrcClient::on_connection_close(const std::string& error_msg)
   this->bridge.on_irc_client_disconnected(this->get_hostname());
 }
 
+void IrcClient::on_closed()
+{
+  this->bridge.mark_for_cleanup(this->get_hostname());
+}
+
 IrcChannel* IrcClient::get_channel(const std::string& n)
 {
   const std::string name = utils::tolower(n);
@@ -388,8 +431,14 @@ std::string IrcClient::get_own_nick() const
   return this->current_nick;
 }
 
+std::string IrcClient::describe() const
+{
+  return this->bridge.get_jid() + " on IRC server " + this->hostname;
+}
+
 void IrcClient::parse_in_buffer(const size_t)
 {
+  ALLOCATIONS_SCOPE(irc, "IrcClient::parse_in_buffer");
   while (true)
     {
       auto pos = this->in_buf.find("\r\n");
@@ -397,42 +446,54 @@ void IrcClient::parse_in_buffer(const size_t)
         break ;
       IrcMessage message(this->in_buf.substr(0, pos));
       this->consume_in_buffer(pos + 2);
-      log_debug("IRC RECEIVING: (", this->get_hostname(), ") ", message);
-
-      // Call the standard callback (if any), associated with the command
-      // name that we just received.
-      auto it = irc_callbacks.find(message.command);
-      if (it != irc_callbacks.end())
+      received_lines.inc();
+      if (tracing::sample(this->last_received, this))
         {
-          const auto& limits = it->second.second;
-          // Check that the Message is well formed before actually calling
-          // the callback.
-          const auto args_size = message.arguments.size();
-          const auto min = limits.first;
-          const auto max = limits.second;
-          if (args_size < min ||
-              (max > 0 && args_size > max))
-            log_warning("Invalid number of arguments for IRC command “", message.command,
-                        "”: ", args_size);
-          else
-            {
-              const auto& cb = it->second.first;
-              try {
-                (this->*(cb))(message);
-              } catch (const std::exception& e) {
-                log_error("Unhandled exception: ", e.what());
-              }
-            }
+          tracing::current->description = message.command + " from " + this->hostname + " to " + this->bridge.get_jid();
+          tracing::mark(tracing::Stage::parsed);
         }
+      log_debug("IRC RECEIVING: (", this->get_hostname(), ") ", message);
+      if (!this->add_to_batch(message))
+        this->handle_message(message);
+      tracing::end();
+    }
+}
+
+void IrcClient::handle_message(const IrcMessage& message)
+{
+  // Call the standard callback (if any), associated with the command
+  // name that we just received.
+  auto it = irc_callbacks.find(message.command);
+  if (it != irc_callbacks.end())
+    {
+      const auto& limits = it->second.second;
+      // Check that the Message is well formed before actually calling
+      // the callback.
+      const auto args_size = message.arguments.size();
+      const auto min = limits.first;
+      const auto max = limits.second;
+      if (args_size < min ||
+          (max > 0 && args_size > max))
+        log_warning("Invalid number of arguments for IRC command “", message.command,
+                    "”: ", args_size);
       else
         {
-          log_info("No handler for command ", message.command,
-                   ", forwarding the arguments to the user");
-          this->on_unknown_message(message);
+          const auto& cb = it->second.first;
+          try {
+            (this->*(cb))(message);
+          } catch (const std::exception& e) {
+            log_error("Unhandled exception: ", e.what());
+          }
         }
-      // Try to find a waiting_iq, which response will be triggered by this IrcMessage
-      this->bridge.trigger_on_irc_message(this->hostname, message);
     }
+  else
+    {
+      log_info("No handler for command ", message.command,
+               ", forwarding the arguments to the user");
+      this->on_unknown_message(message);
+    }
+  // Try to find a waiting_iq, which response will be triggered by this IrcMessage
+  this->bridge.trigger_on_irc_message(this->hostname, message);
 }
 
 void IrcClient::actual_send(std::pair<IrcMessage, MessageCallback>&& message_pair)
@@ -455,6 +516,7 @@ void IrcClient::actual_send(std::pair<IrcMessage, MessageCallback>&& message_pai
         res += " " + arg;
       }
     res += "\r\n";
+    sent_lines.inc();
     this->send_data(std::move(res));
 
     if (callback)
@@ -463,22 +525,27 @@ void IrcClient::actual_send(std::pair<IrcMessage, MessageCallback>&& message_pai
 
 void IrcClient::send_message(IrcMessage message, MessageCallback callback, bool throttle)
 {
+  ALLOCATIONS_SCOPE(irc, "IrcClient::send_message");
   auto message_pair = std::make_pair(std::move(message), std::move(callback));
-  if (this->tokens_bucket.use_token() || !throttle)
+  if (!throttle || this->tokens_bucket.use_token())
     this->actual_send(std::move(message_pair));
   else
-    message_queue.push_back(std::move(message_pair));
+    {
+      message_queue.push_back(std::move(message_pair));
+      throttled_messages.inc();
+    }
 }
 
 void IrcClient::send_raw(const std::string& txt)
 {
   log_debug("IRC SENDING (raw): (", this->get_hostname(), ") ", txt);
+  sent_lines.inc();
   this->send_data(txt + "\r\n");
 }
 
 void IrcClient::send_user_command(const std::string& username, const std::string& realname)
 {
-  this->send_message(IrcMessage("USER", {username, this->user_hostname, "ignored", realname}));
+  this->send_message(IrcMessage("USER", {username, this->user_hostname, "ignored", realname}), {}, false);
 }
 
 void IrcClient::send_nick_command(const std::string& nick)
@@ -488,12 +555,12 @@ void IrcClient::send_nick_command(const std::string& nick)
 
 void IrcClient::send_pass_command(const std::string& password)
 {
-  this->send_message(IrcMessage("PASS", {password}));
+  this->send_message(IrcMessage("PASS", {password}), {}, false);
 }
 
 void IrcClient::send_webirc_command(const std::string& password, const std::string& user_ip)
 {
-  this->send_message(IrcMessage("WEBIRC", {password, "biboumi", this->user_hostname, user_ip}));
+  this->send_message(IrcMessage("WEBIRC", {password, "biboumi", this->user_hostname, user_ip}), {}, false);
 }
 
 void IrcClient::send_kick_command(const std::string& chan_name, const std::string& target, const std::string& reason)
@@ -659,6 +726,7 @@ void IrcClient::on_notice(const IrcMessage& message)
       // to indicate that it is a notice, and make it a MUC message coming
       // from the MUC JID
       IrcMessage modified_message(std::move(from), "PRIVMSG", {to, "\u000303[notice]\u0003 " + body});
+      modified_message.tags = message.tags;
       this->on_channel_message(modified_message);
     }
 }
@@ -698,6 +766,8 @@ void IrcClient::on_isupport_message(const IrcMessage& message)
         while (i < token.size())
           this->chantypes.insert(token[i++]);
       }
+    else if (token.substr(0, 12) == "CHATHISTORY=")
+      this->chathistory_limit = static_cast<std::size_t>(std::atoi(token.c_str() + 12));
   }
 }
 
@@ -714,12 +784,23 @@ void IrcClient::set_and_forward_user_list(const IrcMessage& message)
 {
   const std::string chan_name = utils::tolower(message.arguments[2]);
   IrcChannel* channel = this->get_channel(chan_name);
+  std::vector<std::string> nicks = utils::split(message.arguments[3], ' ');
   if (channel->joined)
     {
+      // A NAMES sent by the user.  The occupants we did not know about are
+      // added (and announced, unless the channel uses lazy presences)
       this->forward_server_message(message);
+      for (const std::string& nick: nicks)
+        {
+          IrcUser tmp_user{nick, this->prefix_to_mode};
+          if (channel->find_user(tmp_user.nick))
+            continue;
+          const IrcUser* user = channel->add_user(nick, this->prefix_to_mode);
+          if (user->announced)
+            this->bridge.send_user_join(this->hostname, chan_name, user, user->get_most_significant_mode(this->sorted_user_modes), false);
+        }
       return;
     }
-  std::vector<std::string> nicks = utils::split(message.arguments[3], ' ');
   for (const std::string& nick: nicks)
     {
       // Just create this dummy user to parse and get its modes
@@ -730,11 +811,8 @@ void IrcClient::set_and_forward_user_list(const IrcMessage& message)
           // We now know our own modes, that’s all.
           channel->get_self()->modes = tmp_user.modes;
         }
-      else
-        { // Otherwise this is a new user
-          const IrcUser *user = channel->add_user(nick, this->prefix_to_mode);
-          this->bridge.send_user_join(this->hostname, chan_name, user, user->get_most_significant_mode(this->sorted_user_modes), false);
-        }
+      else // Otherwise this is a new user, announced once the list is complete
+        channel->add_user(nick, this->prefix_to_mode);
     }
 }
 
@@ -744,13 +822,34 @@ void IrcClient::on_channel_join(const IrcMessage& message)
   IrcChannel* channel;
   channel = this->get_channel(chan_name);
   const std::string nick = message.prefix;
+  // A user that we kept after a netsplit is back, without a netjoin batch
+  auto split_user = this->split_users.find(IrcUser(nick).nick);
+  if (split_user != this->split_users.end())
+    split_user->second.second.erase(chan_name);
   IrcUser* user = channel->add_user(nick, this->prefix_to_mode);
   if (channel->joined == false)
     channel->set_self(user);
-  else
+  else if (user->announced)
     this->bridge.send_user_join(this->hostname, chan_name, user, user->get_most_significant_mode(this->sorted_user_modes), false);
 }
 
+/**
+ * When the message was sent, according to its server-time tag, or now if
+ * it has none.
+ */
+static std::chrono::system_clock::time_point get_date(const IrcMessage& message)
+{
+  const auto now = std::chrono::system_clock::now();
+  const auto time = message.tags.find("time");
+  if (time == message.tags.end())
+    return now;
+  const auto date = utils::parse_datetime(time->second);
+  if (date == -1)
+    return now;
+  // A server clock ahead of ours must not date the messages in the future
+  return std::min(now, std::chrono::system_clock::from_time_t(date));
+}
+
 void IrcClient::on_channel_message(const IrcMessage& message)
 {
   const IrcUser user(message.prefix);
@@ -767,12 +866,15 @@ void IrcClient::on_channel_message(const IrcMessage& message)
       muc = false;
     }
   else
-    iid.type = Iid::Type::Channel;
+    {
+      iid.type = Iid::Type::Channel;
+      this->announce_speakers(iid.get_local(), nick, body);
+    }
   if (!body.empty() && body[0] == '\01')
     {
       if (body.substr(1, 6) == "ACTION")
         this->bridge.send_message(iid, nick,
-                  "/me" + body.substr(7, body.size() - 8), muc);
+                  "/me" + body.substr(7, body.size() - 8), muc, true, get_date(message));
       else if (body.substr(1, 8) == "VERSION\01")
         this->bridge.send_iq_version_request(nick, this->hostname);
       else if (body.substr(1, 5) == "PING ")
@@ -780,7 +882,27 @@ void IrcClient::on_channel_message(const IrcMessage& message)
                                              body.substr(6, body.size() - 7));
     }
   else
-    this->bridge.send_message(iid, nick, body, muc);
+    this->bridge.send_message(iid, nick, body, muc, true, get_date(message));
+}
+
+void IrcClient::announce_speakers(const std::string& chan_name, const std::string& nick, const std::string& body)
+{
+  IrcChannel* channel = this->get_channel(chan_name);
+  if (!channel->lazy_presences)
+    return;
+  std::vector<IrcUser*> users{channel->find_user(nick)};
+  // Looking for every occupant in the whole body would be too costly in
+  // such a channel, only the usual “nick: ” or “nick, ” prefix is used
+  const auto end = body.find_first_of(":, ");
+  if (end != std::string::npos && end > 0 && body[end] != ' ')
+    users.push_back(channel->find_user(body.substr(0, end)));
+  for (IrcUser* user: users)
+    if (user && !user->announced)
+      {
+        user->announced = true;
+        this->bridge.send_user_join(this->hostname, chan_name, user,
+                                    user->get_most_significant_mode(this->sorted_user_modes), false);
+      }
 }
 
 void IrcClient::on_rpl_liststart(const IrcMessage&)
@@ -865,10 +987,26 @@ void IrcClient::on_channel_completely_joined(const IrcMessage& message)
       return;
     }
   channel->joined = true;
+  // The occupants are announced before our own presence, unless there are
+  // too many of them
+  const auto threshold = Config::snapshot().lazy_presence_threshold;
+  channel->lazy_presences = threshold > 0 && channel->get_users().size() >= threshold;
+  for (const auto& user: channel->get_users())
+    {
+      if (user.get() == channel->get_self())
+        continue;
+      // Also reset for the occupants added while a previous join of this
+      // channel was lazy
+      user->announced = !channel->lazy_presences;
+      if (user->announced)
+        this->bridge.send_user_join(this->hostname, chan_name, user.get(),
+                                    user->get_most_significant_mode(this->sorted_user_modes), false);
+    }
   this->bridge.send_user_join(this->hostname, chan_name, channel->get_self(),
                               channel->get_self()->get_most_significant_mode(this->sorted_user_modes), true);
   this->bridge.send_room_history(this->hostname, chan_name, this->history_limit);
   this->bridge.send_topic(this->hostname, chan_name, channel->topic, channel->topic_author);
+  this->request_missed_history(chan_name);
 }
 
 void IrcClient::on_banlist(const IrcMessage& message)
@@ -976,6 +1114,16 @@ void IrcClient::on_welcome_message(const IrcMessage& message)
 {
   this->current_nick = message.arguments[0];
   this->welcomed = true;
+  // A server that does not support CAP registers us without answering
+  // our CAP LS
+  if (!this->capabilities.empty())
+    {
+      auto capabilities = std::move(this->capabilities);
+      this->capabilities.clear();
+      for (auto& pair: capabilities)
+        pair.second.on_nack();
+      this->bridge.on_irc_client_connected(this->get_hostname());
+    }
 #ifdef USE_DATABASE
   auto options = Database::get_irc_server_options(this->bridge.get_bare_jid(),
                                                   this->get_hostname());
@@ -1055,7 +1203,8 @@ void IrcClient::on_part(const IrcMessage& message)
       iid.set_local(chan_name);
       iid.set_server(this->hostname);
       iid.type = Iid::Type::Channel;
-      this->bridge.send_muc_leave(iid, *user_ptr, txt, self, true, {}, this);
+      if (self || user_ptr->announced)
+        this->bridge.send_muc_leave(iid, *user_ptr, txt, self, true, {}, this);
     }
 }
 
@@ -1097,7 +1246,8 @@ void IrcClient::on_quit(const IrcMessage& message)
       iid.set_local(chan_name);
       iid.set_server(this->hostname);
       iid.type = Iid::Type::Channel;
-      this->bridge.send_muc_leave(iid, *user, txt, self, false, {}, this);
+      if (self || user->announced)
+        this->bridge.send_muc_leave(iid, *user, txt, self, false, {}, this);
       channel->remove_user(user);
     }
 }
@@ -1119,7 +1269,8 @@ void IrcClient::on_nick(const IrcMessage& message)
         Iid iid(chan_name, this->hostname, Iid::Type::Channel);
         const bool self = channel->get_self()->nick == old_nick;
         const char user_mode = user->get_most_significant_mode(this->sorted_user_modes);
-        this->bridge.send_nick_change(std::move(iid), old_nick, new_nick, user_mode, self);
+        if (self || user->announced)
+          this->bridge.send_nick_change(std::move(iid), old_nick, new_nick, user_mode, self);
         user->nick = new_nick;
         if (self)
           {
@@ -1157,7 +1308,8 @@ void IrcClient::on_kick(const IrcMessage& message)
   iid.set_local(chan_name);
   iid.set_server(this->hostname);
   iid.type = Iid::Type::Channel;
-  this->bridge.kick_muc_user(std::move(iid), target_nick, reason, author.nick, self);
+  if (self || target->announced)
+    this->bridge.kick_muc_user(std::move(iid), target_nick, reason, author.nick, self);
   channel->remove_user(target);
 }
 
@@ -1280,6 +1432,8 @@ void IrcClient::on_channel_mode(const IrcMessage& message)
     }
   for (const IrcUser* u: modified_users)
     {
+      if (!u->announced)
+        continue;
       char most_significant_mode = u->get_most_significant_mode(this->sorted_user_modes);
       this->bridge.send_affiliation_role_change(iid, u->nick, most_significant_mode);
     }
@@ -1317,6 +1471,256 @@ size_t IrcClient::number_of_joined_channels() const
   return this->channels.size();
 }
 
+void IrcClient::add_memory_usage(MemoryUsage& usage) const
+{
+  usage.irc_clients += sizeof(*this) + memory_usage::heap(this->motd);
+  for (const auto& pair: this->channels)
+    {
+      const IrcChannel& channel = *pair.second;
+      usage.channels += memory_usage::node_overhead + sizeof(pair) + memory_usage::heap(pair.first) +
+          sizeof(channel) + memory_usage::heap(channel.topic) + memory_usage::heap(channel.topic_author);
+      const auto& users = channel.get_users();
+      usage.occupants += users.capacity() * sizeof(users[0]);
+      for (const auto& user: users)
+        usage.occupants += sizeof(*user) + memory_usage::heap(user->nick) + memory_usage::heap(user->host) +
+            user->modes.size() * memory_usage::node_overhead;
+    }
+  for (const auto& pair: this->message_queue)
+    {
+      const IrcMessage& message = pair.first;
+      usage.message_queue += sizeof(pair) + memory_usage::heap(message.prefix) + memory_usage::heap(message.command) +
+          message.arguments.capacity() * sizeof(std::string);
+      for (const auto& argument: message.arguments)
+        usage.message_queue += memory_usage::heap(argument);
+    }
+  usage.buffers += this->get_buffers_size();
+}
+
+void IrcClient::shed_cached_data()
+{
+  this->motd.clear();
+  this->motd.shrink_to_fit();
+  this->shrink_buffers();
+}
+
+bool IrcClient::can_be_handed_over() const
+{
+  return this->is_connected() && this->welcomed && !this->is_using_tls();
+}
+
+static void put_message(Serializer& out, const IrcMessage& message)
+{
+  out.put(message.tags.size());
+  for (const auto& tag: message.tags)
+    {
+      out.put(tag.first);
+      out.put(tag.second);
+    }
+  out.put(message.prefix);
+  out.put(message.command);
+  out.put(message.arguments.size());
+  for (const auto& argument: message.arguments)
+    out.put(argument);
+}
+
+static IrcMessage get_message(Deserializer& in)
+{
+  std::map<std::string, std::string> tags;
+  for (auto i = in.get_int(); i > 0; i--)
+    {
+      auto key = in.get_string();
+      tags[std::move(key)] = in.get_string();
+    }
+  auto prefix = in.get_string();
+  auto command = in.get_string();
+  std::vector<std::string> arguments;
+  for (auto i = in.get_int(); i > 0; i--)
+    arguments.push_back(in.get_string());
+  IrcMessage message(std::move(prefix), std::move(command), std::move(arguments));
+  message.tags = std::move(tags);
+  return message;
+}
+
+void IrcClient::save_state(Serializer& out) const
+{
+  out.put(this->get_port());
+  out.put(this->current_nick);
+  out.put(this->username);
+  out.put(this->realname);
+  out.put(this->own_host);
+  out.put(this->chanmodes.size());
+  for (const auto& modes: this->chanmodes)
+    out.put(modes);
+  out.put(std::string(this->chantypes.begin(), this->chantypes.end()));
+  out.put(this->prefix_to_mode.size());
+  for (const auto& pair: this->prefix_to_mode)
+    out.put(std::string{pair.first, pair.second});
+  out.put(std::string(this->sorted_user_modes.begin(), this->sorted_user_modes.end()));
+  out.put(this->nicks_to_treat_as_private.size());
+  for (const auto& nick: this->nicks_to_treat_as_private)
+    out.put(nick);
+  out.put(this->channels_to_join.size());
+  for (const auto& tuple: this->channels_to_join)
+    {
+      out.put(std::get<0>(tuple));
+      out.put(std::get<1>(tuple));
+    }
+  out.put(this->channels.size());
+  for (const auto& pair: this->channels)
+    {
+      const IrcChannel& channel = *pair.second;
+      out.put(pair.first);
+      out.put(static_cast<std::uint64_t>(channel.joined));
+      out.put(static_cast<std::uint64_t>(channel.parting));
+      out.put(static_cast<std::uint64_t>(channel.lazy_presences));
+      out.put(channel.topic);
+      out.put(channel.topic_author);
+      out.put(channel.get_self() ? channel.get_self()->nick : std::string{});
+      out.put(channel.get_users().size());
+      for (const auto& user: channel.get_users())
+        {
+          out.put(user->nick);
+          out.put(user->host);
+          out.put(std::string(user->modes.begin(), user->modes.end()));
+          out.put(static_cast<std::uint64_t>(user->announced));
+        }
+    }
+  // The capabilities themselves only matter during the registration
+  out.put(static_cast<std::uint64_t>(this->chathistory_supported));
+  out.put(this->chathistory_limit);
+  out.put(this->chathistory_anchors.size());
+  for (const auto& pair: this->chathistory_anchors)
+    {
+      out.put(pair.first);
+      out.put(static_cast<std::uint64_t>(pair.second));
+    }
+  out.put(this->batches.size());
+  for (const auto& pair: this->batches)
+    {
+      const Batch& batch = pair.second;
+      out.put(pair.first);
+      out.put(batch.type);
+      out.put(batch.parameters.size());
+      for (const auto& parameter: batch.parameters)
+        out.put(parameter);
+      out.put(batch.messages.size());
+      for (const auto& message: batch.messages)
+        put_message(out, message);
+      out.put(batch.parent);
+      out.put(static_cast<std::uint64_t>(batch.ended));
+    }
+  out.put(this->split_users.size());
+  for (const auto& pair: this->split_users)
+    {
+      out.put(pair.first);
+      out.put(pair.second.first);
+      out.put(pair.second.second.size());
+      for (const auto& chan_name: pair.second.second)
+        out.put(chan_name);
+    }
+  // Their callbacks are lost, the responses will just be ignored
+  out.put(this->message_queue.size());
+  for (const auto& pair: this->message_queue)
+    put_message(out, pair.first);
+  out.put(this->in_buf);
+  out.put(this->get_pending_data());
+}
+
+void IrcClient::restore_state(Deserializer& in, const socket_t socket)
+{
+  const auto port = in.get_string();
+  this->current_nick = in.get_string();
+  this->username = in.get_string();
+  this->realname = in.get_string();
+  this->own_host = in.get_string();
+  this->chanmodes.clear();
+  for (auto i = in.get_int(); i > 0; i--)
+    this->chanmodes.push_back(in.get_string());
+  const auto chantypes = in.get_string();
+  this->chantypes = {chantypes.begin(), chantypes.end()};
+  for (auto i = in.get_int(); i > 0; i--)
+    {
+      const auto pair = in.get_string();
+      if (pair.size() == 2)
+        this->prefix_to_mode[pair[0]] = pair[1];
+    }
+  const auto sorted_user_modes = in.get_string();
+  this->sorted_user_modes = {sorted_user_modes.begin(), sorted_user_modes.end()};
+  for (auto i = in.get_int(); i > 0; i--)
+    this->nicks_to_treat_as_private.insert(in.get_string());
+  for (auto i = in.get_int(); i > 0; i--)
+    {
+      auto chan = in.get_string();
+      auto key = in.get_string();
+      this->channels_to_join.emplace_back(std::move(chan), std::move(key));
+    }
+  for (auto i = in.get_int(); i > 0; i--)
+    {
+      IrcChannel* channel = this->get_channel(in.get_string());
+      channel->joined = in.get_int() != 0;
+      channel->parting = in.get_int() != 0;
+      channel->lazy_presences = in.get_int() != 0;
+      channel->topic = in.get_string();
+      channel->topic_author = in.get_string();
+      const auto self = in.get_string();
+      for (auto j = in.get_int(); j > 0; j--)
+        {
+          const auto nick = in.get_string();
+          const auto host = in.get_string();
+          const auto modes = in.get_string();
+          IrcUser* user = channel->add_user(host.empty() ? nick : nick + "!" + host, {});
+          user->modes = {modes.begin(), modes.end()};
+          user->announced = in.get_int() != 0;
+        }
+      if (!self.empty())
+        channel->set_self(channel->find_user(self));
+    }
+  this->chathistory_supported = in.get_int() != 0;
+  this->chathistory_limit = static_cast<std::size_t>(in.get_int());
+  for (auto i = in.get_int(); i > 0; i--)
+    {
+      auto chan_name = in.get_string();
+      this->chathistory_anchors[std::move(chan_name)] = static_cast<std::time_t>(in.get_int());
+    }
+  for (auto i = in.get_int(); i > 0; i--)
+    {
+      Batch& batch = this->batches[in.get_string()];
+      batch.type = in.get_string();
+      for (auto j = in.get_int(); j > 0; j--)
+        batch.parameters.push_back(in.get_string());
+      for (auto j = in.get_int(); j > 0; j--)
+        batch.messages.push_back(get_message(in));
+      batch.parent = in.get_string();
+      batch.ended = in.get_int() != 0;
+    }
+  for (auto i = in.get_int(); i > 0; i--)
+    {
+      auto& split_user = this->split_users[in.get_string()];
+      split_user.first = in.get_string();
+      for (auto j = in.get_int(); j > 0; j--)
+        split_user.second.insert(in.get_string());
+    }
+  std::vector<IrcMessage> queue;
+  for (auto i = in.get_int(); i > 0; i--)
+    queue.push_back(get_message(in));
+  this->in_buf = in.get_string();
+  auto pending_data = in.get_string();
+
+  this->welcomed = true;
+  this->resume_connected_socket(socket, this->hostname, port);
+  this->send_data(std::move(pending_data));
+  for (auto& message: queue)
+    this->send_message(std::move(message));
+  TimedEventsManager::instance().add_event(TimedEvent(240s, std::bind(&IrcClient::send_ping_command, this),
+                                                      "PING" + this->hostname + this->bridge.get_jid()));
+  // The split users get the whole delay again to come back
+  if (!this->split_users.empty())
+    TimedEventsManager::instance().add_event(TimedEvent(60s, std::bind(&IrcClient::end_netsplit, this),
+                                                        "Netsplit" + this->hostname + this->bridge.get_jid()));
+  log_info("Resumed the connection to ", this->hostname, " as ", this->current_nick, ", with ",
+           this->channels.size(), " channels");
+}
+
 #ifdef BOTAN_FOUND
 bool IrcClient::abort_on_invalid_cert() const
 {
@@ -1340,7 +1744,21 @@ long int IrcClient::get_throttle_limit() const
 void IrcClient::on_cap(const IrcMessage &message)
 {
   const auto& sub_command = message.arguments[1];
-  const auto& caps = utils::split(message.arguments[2], ' ', false);
+  const auto& caps = utils::split(message.arguments.back(), ' ', false);
+  if (sub_command == "LS")
+    {
+      // Their values (“sasl=PLAIN,EXTERNAL”) are not used
+      for (const auto& cap: caps)
+        this->offered_capabilities.insert(cap.substr(0, cap.find('=')));
+      // A long list is split on several messages, all but the last one
+      // with a “*” before the list
+      if (message.arguments.size() < 4 || message.arguments[2] != "*")
+        this->request_capabilities();
+      return;
+    }
+  // The NEW and DEL notifications of CAP LS 302 are ignored
+  if (sub_command != "ACK" && sub_command != "NACK")
+    return;
   for (const auto& cap: caps)
     {
       auto it = this->capabilities.find(cap);
@@ -1374,7 +1792,7 @@ void IrcClient::on_authenticate(const IrcMessage &)
   const auto& nick = !options.col<Database::Nick>().empty() ? options.col<Database::Nick>() : this->get_own_nick();
   const auto auth_string = '\0' + nick + '\0' + options.col<Database::SaslPassword>();
   const auto base64_auth_string = base64::encode(auth_string);
-  this->send_message({"AUTHENTICATE", {base64_auth_string}});
+  this->send_message({"AUTHENTICATE", {base64_auth_string}}, {}, false);
 }
 
 void IrcClient::on_sasl_success(const IrcMessage &)
@@ -1409,6 +1827,255 @@ void IrcClient::on_sasl_login(const IrcMessage &message)
 }
 #endif
 
+constexpr std::size_t IrcClient::max_open_batches;
+
+void IrcClient::on_batch(const IrcMessage& message)
+{
+  const auto& reference = message.arguments[0];
+  if (reference.size() < 2)
+    return;
+  if (reference[0] == '+' && message.arguments.size() >= 2)
+    {
+      if (this->batches.size() >= IrcClient::max_open_batches &&
+          this->batches.find(reference.substr(1)) == this->batches.end())
+        {
+          log_warning(this->hostname, ": too many open batches, the messages of ", reference.substr(1),
+                      " are handled right away");
+          return;
+        }
+      Batch& batch = this->batches[reference.substr(1)];
+      batch.type = message.arguments[1];
+      batch.parameters.assign(message.arguments.begin() + 2, message.arguments.end());
+      const auto tag = message.tags.find("batch");
+      if (tag != message.tags.end() && tag->second != reference.substr(1) &&
+          this->batches.find(tag->second) != this->batches.end())
+        batch.parent = tag->second;
+    }
+  else if (reference[0] == '-')
+    {
+      auto it = this->batches.find(reference.substr(1));
+      if (it == this->batches.end())
+        return;
+      auto parent = this->batches.find(it->second.parent);
+      if (parent != this->batches.end())
+        {
+          // Handled with its parent, at the place of its end
+          it->second.ended = true;
+          parent->second.messages.emplace_back("BATCH", std::vector<std::string>{reference});
+        }
+      else
+        this->handle_batch(it->first);
+    }
+}
+
+void IrcClient::handle_batch(const std::string& reference)
+{
+  auto it = this->batches.find(reference);
+  if (it == this->batches.end())
+    return;
+  const Batch batch = std::move(it->second);
+  this->batches.erase(it);
+  if (batch.type == "chathistory")
+    this->on_chathistory_batch(batch);
+  else if (batch.type == "netsplit")
+    this->on_netsplit_batch(batch);
+  else if (batch.type == "netjoin")
+    this->on_netjoin_batch(batch);
+  else
+    {
+#ifdef USE_DATABASE
+      // Whatever they archive is written at once
+      Transaction transaction;
+#endif
+      // The end of a nested batch handles it, its parent being gone
+      for (const auto& batched_message: batch.messages)
+        this->handle_message(batched_message);
+    }
+  // The nested batches that the handler of this type ignored
+  for (const auto& batched_message: batch.messages)
+    if (batched_message.command == "BATCH" && !batched_message.arguments.empty() &&
+        batched_message.arguments[0].size() > 1 && batched_message.arguments[0][0] == '-')
+      this->handle_batch(batched_message.arguments[0].substr(1));
+}
+
+bool IrcClient::add_to_batch(IrcMessage& message)
+{
+  // Nested batches are started right away, their messages are kept in
+  // the innermost one, and it is kept in its parent
+  if (message.command == "BATCH")
+    return false;
+  const auto tag = message.tags.find("batch");
+  if (tag == message.tags.end())
+    return false;
+  auto it = this->batches.find(tag->second);
+  if (it == this->batches.end())
+    return false;
+  it->second.messages.push_back(std::move(message));
+  return true;
+}
+
+void IrcClient::on_netsplit_batch(const Batch& batch)
+{
+  for (const auto& message: batch.messages)
+    {
+      if (message.command != "QUIT")
+        {
+          this->handle_message(message);
+          continue;
+        }
+      const IrcUser user(message.prefix);
+      auto& split_user = this->split_users[user.nick];
+      split_user.first = message.arguments.empty() ? "" : message.arguments[0];
+      for (const auto& pair: this->channels)
+        {
+          const IrcUser* channel_user = pair.second->find_user(user.nick);
+          if (channel_user && channel_user != pair.second->get_self())
+            split_user.second.insert(pair.first);
+        }
+    }
+  // Restarted by each netsplit, it removes the users that did not come back
+  // in the meantime
+  const auto event_name = "Netsplit" + this->hostname + this->bridge.get_jid();
+  TimedEventsManager::instance().cancel(event_name);
+  TimedEventsManager::instance().add_event(TimedEvent(60s, std::bind(&IrcClient::end_netsplit, this), event_name));
+}
+
+void IrcClient::on_netjoin_batch(const Batch& batch)
+{
+  for (const auto& message: batch.messages)
+    {
+      if (message.command == "JOIN" && !message.arguments.empty())
+        {
+          const IrcUser user(message.prefix);
+          auto it = this->split_users.find(user.nick);
+          if (it != this->split_users.end() && it->second.second.erase(utils::tolower(message.arguments[0])) != 0)
+            {
+              if (it->second.second.empty())
+                this->split_users.erase(it);
+              continue;
+            }
+        }
+      this->handle_message(message);
+    }
+}
+
+void IrcClient::end_netsplit()
+{
+  const auto split_users = std::move(this->split_users);
+  this->split_users.clear();
+  for (const auto& split_user: split_users)
+    for (const auto& chan_name: split_user.second.second)
+      {
+        auto it = this->channels.find(chan_name);
+        if (it == this->channels.end())
+          continue;
+        IrcChannel* channel = it->second.get();
+        const IrcUser* user = channel->find_user(split_user.first);
+        if (!user)
+          continue;
+        Iid iid(chan_name, this->hostname, Iid::Type::Channel);
+        if (user->announced)
+          this->bridge.send_muc_leave(iid, *user, split_user.second.first, false, false, {}, this);
+        channel->remove_user(user);
+      }
+}
+
+void IrcClient::request_missed_history(const std::string& chan_name)
+{
+  if (!this->chathistory_supported)
+    return;
+  const auto last_date = this->bridge.get_last_archived_date(this->hostname, chan_name);
+  if (last_date == -1)
+    return;
+  this->send_chathistory_request(chan_name, last_date);
+}
+
+std::size_t IrcClient::get_chathistory_limit() const
+{
+  return this->chathistory_limit ? this->chathistory_limit : 100;
+}
+
+void IrcClient::send_chathistory_request(const std::string& chan_name, const std::time_t since)
+{
+  // The messages received live before the batch will be archived too, it
+  // must be compared with this anchor, not the date of the last archived
+  // message at that time
+  this->chathistory_anchors[utils::tolower(chan_name)] = since;
+  // The archive has no fraction of seconds, so we ask for everything after
+  // the beginning of that second, the duplicates are skipped when archiving
+  const auto stamp = utils::to_string(since);
+  this->send_message(IrcMessage("CHATHISTORY", {"AFTER", chan_name,
+                                                "timestamp=" + stamp.substr(0, stamp.size() - 1) + ".000Z",
+                                                std::to_string(this->get_chathistory_limit())}));
+}
+
+void IrcClient::on_chathistory_batch(const Batch& batch)
+{
+  if (batch.parameters.empty())
+    return;
+  const auto chan_name = utils::tolower(batch.parameters[0]);
+  // Only the answers to our own requests are archived
+  const auto anchor = this->chathistory_anchors.find(chan_name);
+  if (anchor == this->chathistory_anchors.end())
+    return;
+  const auto since = anchor->second;
+  this->chathistory_anchors.erase(anchor);
+  Iid iid(chan_name + "%" + this->hostname, this->chantypes);
+  std::vector<Bridge::HistoryMessage> messages;
+  std::time_t newest = since;
+  for (const auto& message: batch.messages)
+    {
+      if ((message.command != "PRIVMSG" && message.command != "NOTICE") || message.arguments.size() < 2)
+        continue;
+      const auto time = message.tags.find("time");
+      const auto date = time == message.tags.end() ? -1 : utils::parse_datetime(time->second);
+      if (date == -1)
+        continue;
+      newest = std::max(newest, date);
+      const IrcUser user(message.prefix);
+      const auto& body = message.arguments[1];
+      // Transformed like the messages received live, in on_channel_message
+      // and on_notice
+      if (message.command == "NOTICE")
+        messages.emplace_back(date, user.nick, "\u000303[notice]\u0003 " + body);
+      else if (body.substr(0, 7) == "\01ACTION")
+        messages.emplace_back(date, user.nick, "/me" + body.substr(7, body.size() - 8));
+      else if (body.empty() || body[0] != '\01')
+        messages.emplace_back(date, user.nick, body);
+    }
+  this->bridge.archive_missed_messages(iid, since, messages);
+  // A full batch may not contain the whole gap: ask for the rest, unless
+  // the batch did not move forward (it would return the same messages)
+  if (batch.messages.size() >= this->get_chathistory_limit() && newest > since)
+    this->send_chathistory_request(batch.parameters[0], newest);
+}
+
+void IrcClient::request_capabilities()
+{
+  std::string requested;
+  for (auto it = this->capabilities.begin(); it != this->capabilities.end();)
+    {
+      if (this->offered_capabilities.count(it->first) != 0)
+        {
+          if (!requested.empty())
+            requested += ' ';
+          requested += it->first;
+          ++it;
+        }
+      else
+        {
+          auto capability = std::move(it->second);
+          it = this->capabilities.erase(it);
+          capability.on_nack();
+        }
+    }
+  this->offered_capabilities.clear();
+  if (requested.empty())
+    this->cap_end();
+  else
+    this->send_message({"CAP", {"REQ", requested}}, {}, false);
+}
+
 void IrcClient::cap_end()
 {
 #ifdef WITH_SASL
@@ -1416,6 +2083,6 @@ void IrcClient::cap_end()
   if (this->sasl_state == SaslState::needed)
     return;
 #endif
-  this->send_message({"CAP", {"END"}});
+  this->send_message({"CAP", {"END"}}, {}, false);
   this->bridge.on_irc_client_connected(this->get_hostname());
 }
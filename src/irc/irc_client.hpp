@@ -3,6 +3,7 @@
 #include <irc/irc_message.hpp>
 #include <irc/irc_channel.hpp>
 #include <irc/capability.hpp>
+#include <irc/batch.hpp>
 
 #include "biboumi.h"
 
@@ -18,6 +19,7 @@
 
 #include <unordered_map>
 #include <utility>
+#include <ctime>
 #include <memory>
 #include <vector>
 #include <string>
@@ -26,12 +28,15 @@
 #include <map>
 #include <set>
 #include <utils/tokens_bucket.hpp>
+#include <utils/memory_usage.hpp>
 
 class IrcClient;
 
 using MessageCallback = std::function<void(const IrcClient*, const IrcMessage&)>;
 
 class Bridge;
+class Serializer;
+class Deserializer;
 
 /**
  * Represent one IRC client, i.e. an endpoint connected to a single IRC
@@ -67,6 +72,14 @@ public:
    * Close the connection, remove us from the poller
    */
   void on_connection_close(const std::string& error_msg) override final;
+  /**
+   * Tell our bridge that we may need to be removed
+   */
+  void on_closed() override final;
+  /**
+   * The JID of our user and the IRC server
+   */
+  std::string describe() const override final;
   /**
    * Parse the data we have received so far and try to get one or more
    * complete messages from it.
@@ -242,8 +255,66 @@ public:
    *  NACK, or something else
    */
   void on_cap(const IrcMessage& message);
+  /**
+   * The server starts (“+reference type params…”) or ends (“-reference”) a
+   * batch of messages.
+   */
+  void on_batch(const IrcMessage& message);
 private:
+  /**
+   * Once the server listed all its capabilities, request the ones we
+   * want, all in one CAP REQ, and give up on the others.
+   */
+  void request_capabilities();
   void cap_end();
+  /**
+   * If the message is part of a batch that is handled as a whole, keep it
+   * into that batch and return true.  Otherwise it must be handled now.
+   */
+  bool add_to_batch(IrcMessage& message);
+  /**
+   * Remove that batch, and handle its messages and the ones of the batches
+   * nested in it.
+   */
+  void handle_batch(const std::string& reference);
+  /**
+   * Ask the server for the messages of the channel that were sent after
+   * the last one that we archived, if it supports draft/chathistory.
+   */
+  void request_missed_history(const std::string& chan_name);
+  /**
+   * Ask for the messages of the channel sent since that date, and remember
+   * it to filter the answer.
+   */
+  void send_chathistory_request(const std::string& chan_name, const std::time_t since);
+  /**
+   * The number of messages asked in each CHATHISTORY request.
+   */
+  std::size_t get_chathistory_limit() const;
+  /**
+   * Archive the messages of a chathistory batch.
+   */
+  void on_chathistory_batch(const Batch& batch);
+  /**
+   * The users who quit because of a netsplit are kept in their channels
+   * for a while: if a netjoin brings them back, the XMPP user sees neither
+   * their departure nor their return.
+   */
+  void on_netsplit_batch(const Batch& batch);
+  void on_netjoin_batch(const Batch& batch);
+  /**
+   * In a channel with lazy presences, announce the author of a message,
+   * and the occupant it is addressed to, if they were not yet.
+   */
+  void announce_speakers(const std::string& chan_name, const std::string& nick, const std::string& body);
+  /**
+   * Remove the users that did not come back after the netsplit.
+   */
+  void end_netsplit();
+  /**
+   * Handle a complete message, received alone or as part of a batch.
+   */
+  void handle_message(const IrcMessage& message);
 public:
 #ifdef WITH_SASL
   void on_authenticate(const IrcMessage& message);
@@ -311,6 +382,33 @@ public:
    * Return the number of joined channels
    */
   size_t number_of_joined_channels() const;
+  /**
+   * Add the approximate memory used by this client, its channels with
+   * their occupants, its message queue and its buffers.
+   */
+  void add_memory_usage(MemoryUsage& usage) const;
+  /**
+   * Forget the MOTD, which is only sent once after the connection, and
+   * give back the unused capacity of the buffers.
+   */
+  void shed_cached_data();
+  /**
+   * Whether this connection can be given to a new biboumi process, on an
+   * upgrade: it must be registered, and not use TLS (its session can not
+   * be transferred).
+   */
+  bool can_be_handed_over() const;
+  /**
+   * Write everything needed to continue this connection in another
+   * process: our nick, the joined channels and their occupants, the
+   * messages waiting to be sent, etc.  The socket is given separately.
+   */
+  void save_state(Serializer& out) const;
+  /**
+   * Read what save_state() wrote, and continue the connection on the
+   * given socket, without registering again.
+   */
+  void restore_state(Deserializer& in, const socket_t socket);
 
   const std::string& get_hostname() const { return this->hostname; }
   std::string get_nick() const { return this->current_nick; }
@@ -387,6 +485,37 @@ private:
   SaslState sasl_state{SaslState::unneeded};
 #endif
   std::map<std::string, Capability> capabilities;
+  /**
+   * The capabilities listed by the server so far, in its CAP LS response.
+   */
+  std::set<std::string> offered_capabilities;
+  /**
+   * Whether the server accepted our draft/chathistory capability request,
+   * and the maximum number of messages that it returns for each CHATHISTORY
+   * command (from its CHATHISTORY ISUPPORT token, 0 if it does not say).
+   */
+  bool chathistory_supported{false};
+  std::size_t chathistory_limit{0};
+  /**
+   * For each channel (lowercase) whose CHATHISTORY batch we are waiting
+   * for, the date we asked the messages after.
+   */
+  std::map<std::string, std::time_t> chathistory_anchors;
+  /**
+   * The batches that were started and not yet ended, indexed by their
+   * reference tag.
+   */
+  std::map<std::string, Batch> batches;
+  /**
+   * No more batches are kept open at the same time: the messages of the
+   * other ones are handled as if they were not part of a batch.
+   */
+  static constexpr std::size_t max_open_batches = 32;
+  /**
+   * The users who quit in a netsplit, and did not come back yet: for each
+   * nick, the reason of their QUIT and the channels where they are kept.
+   */
+  std::map<std::string, std::pair<std::string, std::set<std::string>>> split_users;
   /**
    * See http://www.irc.org/tech_docs/draft-brocklesby-irc-isupport-03.txt section 3.3
    * We store the possible chanmodes in this object.
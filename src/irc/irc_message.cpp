@@ -1,8 +1,62 @@
 #include <irc/irc_message.hpp>
 #include <iostream>
 
+/**
+ * See https://ircv3.net/specs/extensions/message-tags#escaping-values
+ */
+static std::string unescape_tag_value(const std::string& value)
+{
+  std::string res;
+  res.reserve(value.size());
+  for (std::size_t i = 0; i < value.size(); i++)
+    {
+      if (value[i] != '\\')
+        res += value[i];
+      else if (++i < value.size())
+        {
+          switch (value[i])
+            {
+            case ':':
+              res += ';';
+              break;
+            case 's':
+              res += ' ';
+              break;
+            case 'r':
+              res += '\r';
+              break;
+            case 'n':
+              res += '\n';
+              break;
+            default:
+              res += value[i];
+            }
+        }
+    }
+  return res;
+}
+
 IrcMessage::IrcMessage(std::stringstream ss)
 {
+  if (ss.peek() == '@')
+    {
+      ss.ignore();
+      std::string tags;
+      ss >> tags >> std::ws;
+      std::size_t start = 0;
+      while (start < tags.size())
+        {
+          auto end = tags.find(';', start);
+          if (end == std::string::npos)
+            end = tags.size();
+          const auto equal = tags.find('=', start);
+          if (equal < end)
+            this->tags[tags.substr(start, equal - start)] = unescape_tag_value(tags.substr(equal + 1, end - equal - 1));
+          else if (end > start)
+            this->tags[tags.substr(start, end - start)];
+          start = end + 1;
+        }
+    }
   if (ss.peek() == ':')
     {
       ss.ignore();
@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <string>
+#include <map>
 #include <ostream>
 #include <sstream>
 
@@ -20,6 +21,11 @@ public:
   IrcMessage& operator=(const IrcMessage&) = delete;
   IrcMessage& operator=(IrcMessage&&) = default;
 
+  /**
+   * The IRCv3 message tags (“@time=…;batch=…”), with their values
+   * unescaped.  A tag without a value is associated with an empty string.
+   */
+  std::map<std::string, std::string> tags;
   std::string prefix;
   std::string command;
   std::vector<std::string> arguments;
@@ -28,6 +28,12 @@ public:
   std::string nick;
   std::string host;
   std::set<char> modes;
+  /**
+   * Whether the XMPP user received a presence for this occupant.  In the
+   * channels with lazy presences, it is only sent once the occupant speaks
+   * or is addressed.
+   */
+  bool announced{true};
 };
 
 
@@ -1,27 +1,40 @@
 #include <xmpp/biboumi_component.hpp>
 #include <utils/timed_events.hpp>
 #include <network/poller.hpp>
+#include <network/signal_handler.hpp>
+#include <network/upgrade.hpp>
 #include <config/config.hpp>
 #include <logger/logger.hpp>
 #include <utils/xdg.hpp>
 #include <utils/reload.hpp>
+#include <utils/capture.hpp>
+#include <utils/allocations.hpp>
+#include <utils/serializer.hpp>
 
 #ifdef UDNS_FOUND
 # include <network/dns_handler.hpp>
+#else
+# include <network/getaddrinfo_pool.hpp>
 #endif
 
-#include <atomic>
+#include <algorithm>
 #include <csignal>
+#include <cstdlib>
+#include <vector>
 
 #include <identd/identd_server.hpp>
+#include <metrics/metrics_server.hpp>
+#include <metrics/statsd_client.hpp>
 
-// A flag set by the SIGINT signal handler.
-static std::atomic<bool> stop(false);
-// Flag set by the SIGUSR1/2 signal handler.
-static std::atomic<bool> reload(false);
+// The signals used to exit the process cleanly (SIGINT, SIGTERM), to
+// upgrade it (SIGQUIT), or to reload the config (the others)
+static const std::vector<int> managed_signals{SIGINT, SIGTERM, SIGQUIT, SIGUSR1, SIGUSR2, SIGHUP};
 // A flag indicating that we are wanting to exit the process. i.e: if this
 // flag is set and all connections are closed, we can exit properly.
 static bool exiting = false;
+// Set once a new process took our IRC connections: we exit right away,
+// without closing them
+static bool upgraded = false;
 
 /**
  * Provide an helpful message to help the user write a minimal working
@@ -42,103 +55,171 @@ int display_help()
   return 0;
 }
 
-static void sigint_handler(int sig, siginfo_t*, void*)
-{
-  // In 2 seconds, repeat the same signal, to force the exit
-  TimedEventsManager::instance().add_event(TimedEvent(std::chrono::steady_clock::now() + 2s,
-                                    [sig]() { raise(sig); }));
-  stop.store(true);
-}
-
-static void sigusr_handler(int, siginfo_t*, void*)
+/**
+ * Start a new biboumi process, and give it our IRC connections (see
+ * src/network/upgrade.hpp).  If that fails, we just continue.
+ */
+static void upgrade_process(BiboumiComponent& xmpp_component)
 {
-  reload.store(true);
+  if (exiting || upgraded)
+    return;
+  const auto binary = upgrade::get_binary();
+  if (binary.empty())
+    {
+      log_error("Can not upgrade: the upgrade_binary option is not set");
+      return;
+    }
+  log_info("Upgrading to ", binary, "...");
+  Serializer state;
+  std::vector<socket_t> sockets;
+  xmpp_component.save_state(state, sockets);
+  pid_t pid;
+  try
+    {
+      pid = upgrade::hand_over(binary, Config::get_filename(), state.data(), sockets);
+    }
+  catch (const std::runtime_error& e)
+    {
+      log_error("Upgrade failed, continuing: ", e.what());
+      return;
+    }
+  log_info("The new process (", pid, ") took ", sockets.size(), " IRC connections, exiting");
+#ifdef SYSTEMD_FOUND
+  sd_notifyf(0, "MAINPID=%d", static_cast<int>(pid));
+#endif
+  xmpp_component.quit_not_handed_over();
+  if (xmpp_component.is_document_open())
+    xmpp_component.close_document();
+  if (xmpp_component.is_connected())
+    xmpp_component.on_send();
+  upgraded = true;
 }
 
-static void setup_signals()
+/**
+ * In the process started by upgrade_process(): take the state and the IRC
+ * connections of the previous process, before connecting to the XMPP
+ * server.
+ */
+static bool resume_previous_process(const int fd, BiboumiComponent& xmpp_component)
 {
-  // Block the signals we want to manage. They will be unblocked only during
-  // the epoll_pwait or ppoll calls. This avoids some race conditions,
-  // explained in man 2 pselect on linux
-  sigset_t mask{};
-  sigemptyset(&mask);
-  sigaddset(&mask, SIGINT);
-  sigaddset(&mask, SIGTERM);
-  sigaddset(&mask, SIGUSR1);
-  sigaddset(&mask, SIGUSR2);
-  sigaddset(&mask, SIGHUP);
-  sigprocmask(SIG_BLOCK, &mask, nullptr);
-
-  // Install the signals used to exit the process cleanly, or reload the
-  // config
-  struct sigaction on_sigint;
-  on_sigint.sa_sigaction = &sigint_handler;
-  // All signals must be blocked while a signal handler is running
-  sigfillset(&on_sigint.sa_mask);
-  // we want to catch that signal only once.
-  // Sending SIGINT again will "force" an exit
-  on_sigint.sa_flags = 0 & SA_RESETHAND;
-  sigaction(SIGINT, &on_sigint, nullptr);
-  sigaction(SIGTERM, &on_sigint, nullptr);
-
-  // Install a signal to reload the config on SIGUSR1/2
-  struct sigaction on_sigusr;
-  on_sigusr.sa_sigaction = &sigusr_handler;
-  sigfillset(&on_sigusr.sa_mask);
-  on_sigusr.sa_flags = 0;
-  sigaction(SIGUSR1, &on_sigusr, nullptr);
-  sigaction(SIGUSR2, &on_sigusr, nullptr);
-  sigaction(SIGHUP, &on_sigusr, nullptr);
+  std::string state;
+  std::vector<socket_t> sockets;
+  try
+    {
+      upgrade::receive(fd, state, sockets);
+      Deserializer in(state);
+      xmpp_component.restore_state(in, sockets);
+    }
+  catch (const std::exception& e)
+    {
+      log_error("Failed to resume the state of the previous process: ", e.what());
+      return false;
+    }
+  log_info("Resumed ", sockets.size(), " IRC connections, waiting for the previous process to exit");
+  upgrade::acknowledge(fd);
+  // The previous process was authenticated: if the XMPP server is not
+  // reachable yet, we keep retrying instead of dropping the users
+  xmpp_component.ever_auth = true;
+  return true;
 }
 
-static int main_loop(std::string hostname, std::string password)
+static int main_loop(std::string hostname, std::string password, const int upgrade_fd)
 {
   auto p = std::make_shared<Poller>();
 
+  // Before creating the component, to capture its stream from the start
+  if (!Config::get("capture_file", "").empty())
+    capture::Writer::instance().start(Config::get("capture_file", ""));
+
 #ifdef UDNS_FOUND
   DNSHandler dns_handler(p);
+#else
+  GetaddrinfoPool getaddrinfo_pool(p, static_cast<std::size_t>(std::max(Config::get_int("resolver_threads", 4), 1)));
 #endif
 
   auto xmpp_component =
     std::make_shared<BiboumiComponent>(p, hostname, password);
+  if (upgrade_fd != -1 && !resume_previous_process(upgrade_fd, *xmpp_component))
+    return 1;
   xmpp_component->start();
 
   std::unique_ptr<IdentdServer> identd;
   if (Config::get_int("identd_port", 113) != 0)
     identd = std::make_unique<IdentdServer>(*xmpp_component, p, static_cast<uint16_t>(Config::get_int("identd_port", 113)));
 
+  std::unique_ptr<MetricsServer> metrics_server;
+  if (Config::get_int("metrics_port", 0) != 0)
+    metrics_server = std::make_unique<MetricsServer>(p, static_cast<uint16_t>(Config::get_int("metrics_port", 0)),
+                                                     Config::get("metrics_address", "127.0.0.1"));
+  std::unique_ptr<StatsdClient> statsd;
+  if (!Config::get("statsd_host", "").empty())
+    statsd = std::make_unique<StatsdClient>(Config::get("statsd_host", ""), Config::get("statsd_port", "8125"),
+                                            std::chrono::seconds(std::max(Config::get_int("statsd_interval", 10), 1)));
+
+  // The signals are received while the poller is dispatching events, so
+  // the actual work is posted, to be done once all of them are handled
+  SignalHandler signal_handler(p, managed_signals, [&](const int sig)
+  {
+    if (sig == SIGQUIT)
+      {
+        p->post([&]()
+                {
+                  log_info("Signal received, upgrading...");
+                  upgrade_process(*xmpp_component);
+                });
+        return;
+      }
+    if (sig != SIGINT && sig != SIGTERM)
+      {
+        p->post([]()
+                {
+                  log_info("Signal received, reloading the config...");
+                  ::reload_process();
+                });
+        return;
+      }
+    p->post([&]()
+            {
+              if (exiting)
+                return;
+              log_info("Signal received, exiting...");
+#ifdef SYSTEMD_FOUND
+              sd_notify(0, "STOPPING=1");
+#endif
+              exiting = true;
+              xmpp_component->shutdown();
+#ifdef UDNS_FOUND
+              dns_handler.destroy();
+#else
+              getaddrinfo_pool.destroy();
+#endif
+              if (identd)
+                identd->shutdown();
+              if (metrics_server)
+                metrics_server->shutdown();
+              statsd.reset();
+              // Cancel the timer for a potential reconnection
+              TimedEventsManager::instance().cancel("XMPP reconnection");
+              // Sending the same signal again forces the exit
+              signal_handler.destroy();
+            });
+  });
+
   auto timeout = TimedEventsManager::instance().get_timeout();
   while (p->poll(timeout) != -1)
   {
+    if (upgrade::take_request())
+      upgrade_process(*xmpp_component);
+    if (upgraded)
+      break;
     TimedEventsManager::instance().execute_expired_events();
-    // Check for empty irc_clients (not connected, or with no joined
-    // channel) and remove them
+    // Remove the irc_clients (not connected, or with no joined channel)
+    // and bridges that were marked as potentially inactive
     xmpp_component->clean();
     if (identd)
       identd->clean();
-    if (stop)
-    {
-      log_info("Signal received, exiting...");
-#ifdef SYSTEMD_FOUND
-      sd_notify(0, "STOPPING=1");
-#endif
-      exiting = true;
-      stop.store(false);
-      xmpp_component->shutdown();
-#ifdef UDNS_FOUND
-      dns_handler.destroy();
-#endif
-      if (identd)
-        identd->shutdown();
-      // Cancel the timer for a potential reconnection
-      TimedEventsManager::instance().cancel("XMPP reconnection");
-    }
-    if (reload)
-    {
-      log_info("Signal received, reloading the config...");
-      ::reload_process();
-      reload.store(false);
-    }
+    if (metrics_server)
+      metrics_server->clean();
     // Reconnect to the XMPP server if this was not intended.  This may have
     // happened because we sent something invalid to it and it decided to
     // close the connection.  This is a bug that should be fixed, but we
@@ -170,9 +251,15 @@ static int main_loop(std::string hostname, std::string password)
         {
 #ifdef UDNS_FOUND
           dns_handler.destroy();
+#else
+          getaddrinfo_pool.destroy();
 #endif
           if (identd)
             identd->shutdown();
+          if (metrics_server)
+            metrics_server->shutdown();
+          statsd.reset();
+          signal_handler.destroy();
         }
     }
     // If the only existing connection is the one to the XMPP component:
@@ -186,6 +273,12 @@ static int main_loop(std::string hostname, std::string password)
     else
       timeout = TimedEventsManager::instance().get_timeout();
   }
+  capture::Writer::instance().stop();
+#ifdef PROFILE_ALLOCATIONS
+  log_info(allocations::report());
+#endif
+  if (upgraded)
+    return 0;
   if (!xmpp_component->ever_auth)
     return 1; // To signal that the process did not properly start
   log_info("All connections cleanly closed, have a nice day.");
@@ -196,6 +289,7 @@ int main(int ac, char** av)
 {
   std::string conf_filename{};
   bool test_conf = false;
+  int upgrade_fd = -1;
   if (ac > 1)
     {
       for (int i = 1; i < ac; i++)
@@ -205,6 +299,8 @@ int main(int ac, char** av)
             return display_help();
           else if ((arg == "-t") || (arg == "--test-config"))
             test_conf = true;
+          else if (arg == "--upgrade-from" && i + 1 < ac)
+            upgrade_fd = std::atoi(av[++i]);
           else if (i + 1 == ac)
             conf_filename = arg;
           else
@@ -247,7 +343,10 @@ int main(int ac, char** av)
     }
 #endif
 
-  setup_signals();
+  // Before starting any thread, so that none of them can receive these
+  // signals instead of the SignalHandler
+  SignalHandler::block(managed_signals);
 
-  return main_loop(std::move(hostname), std::move(password));
+  upgrade::remember_own_binary();
+  return main_loop(std::move(hostname), std::move(password), upgrade_fd);
 }
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <network/tcp_server_socket.hpp>
+#include <metrics/metrics_socket.hpp>
+#include <algorithm>
+#include <unistd.h>
+
+/**
+ * A minimal HTTP server, answering the requests of Prometheus (or of
+ * anything else) with the current value of all the metrics.
+ */
+class MetricsServer: public TcpSocketServer<MetricsSocket>
+{
+ public:
+  MetricsServer(std::shared_ptr<Poller>& poller, const uint16_t port, const std::string& address):
+      TcpSocketServer<MetricsSocket>(poller, port, address)
+  {}
+
+  void shutdown()
+  {
+    if (this->poller->is_managing_socket(this->socket))
+      this->poller->remove_socket_handler(this->socket);
+    ::close(this->socket);
+    this->sockets.clear();
+  }
+  void mark_for_cleanup()
+  {
+    this->needs_cleaning = true;
+  }
+  void clean()
+  {
+    if (!this->needs_cleaning)
+      return;
+    this->needs_cleaning = false;
+    this->sockets.erase(std::remove_if(this->sockets.begin(), this->sockets.end(),
+                                       [](const std::unique_ptr<MetricsSocket>& socket)
+                                       {
+                                         return socket->get_socket() == -1;
+                                       }),
+                        this->sockets.end());
+  }
+ private:
+  /**
+   * Whether at least one socket has been closed since the last clean()
+   */
+  bool needs_cleaning{false};
+};
@@ -0,0 +1,88 @@
+#include <metrics/metrics_socket.hpp>
+#include <metrics/metrics_server.hpp>
+#include <utils/metrics.hpp>
+#include <utils/split.hpp>
+
+#include <logger/logger.hpp>
+
+#include <sstream>
+
+/**
+ * No valid request can be bigger than this.
+ */
+static constexpr std::size_t max_request_size = 8192;
+
+static std::string make_response(const std::string& status, const std::string& content_type, const std::string& body)
+{
+  return "HTTP/1.1 " + status + "\r\n"
+         "Content-Type: " + content_type + "\r\n"
+         "Content-Length: " + std::to_string(body.size()) + "\r\n"
+         "\r\n" + body;
+}
+
+MetricsSocket::MetricsSocket(std::shared_ptr<Poller>& poller, const socket_t socket, TcpSocketServer<MetricsSocket>& server):
+  TCPSocketHandler(poller),
+  server(dynamic_cast<MetricsServer&>(server))
+{
+  this->socket = socket;
+}
+
+void MetricsSocket::parse_in_buffer(const std::size_t)
+{
+  while (!this->ignore_input)
+    {
+      const auto end = this->in_buf.find("\r\n\r\n");
+      if (end == std::string::npos)
+        {
+          if (this->in_buf.size() > max_request_size)
+            {
+              log_warning("Metrics: request too big, ignoring it");
+              this->send_data(make_response("431 Request Header Fields Too Large", "text/plain", ""));
+              this->ignore_input = true;
+            }
+          break;
+        }
+      const auto request_line = this->in_buf.substr(0, this->in_buf.find("\r\n"));
+      this->consume_in_buffer(end + 4);
+      this->send_data(this->handle_request(request_line));
+    }
+  if (this->ignore_input)
+    this->in_buf.clear();
+}
+
+void MetricsSocket::close()
+{
+  TCPSocketHandler::close();
+  this->server.mark_for_cleanup();
+}
+
+void MetricsSocket::on_all_sent()
+{
+  if (this->ignore_input)
+    this->close();
+}
+
+std::string MetricsSocket::handle_request(const std::string& request_line)
+{
+  const auto words = utils::split(request_line, ' ', false);
+  if (words.size() != 3)
+    {
+      this->ignore_input = true;
+      return make_response("400 Bad Request", "text/plain", "");
+    }
+  const auto& method = words[0];
+  // Ignore the query string, if any
+  const auto path = words[1].substr(0, words[1].find('?'));
+  log_debug("Metrics: ", method, " ", path);
+  if (method != "GET")
+    {
+      // There may be a body, that we do not want to parse
+      this->ignore_input = true;
+      return make_response("405 Method Not Allowed", "text/plain", "");
+    }
+  if (path != "/metrics")
+    return make_response("404 Not Found", "text/plain", "Not found, try /metrics\n");
+  std::ostringstream body;
+  metrics::Registry::instance().write_prometheus(body);
+  return make_response("200 OK", "text/plain; version=0.0.4; charset=utf-8", body.str());
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <network/tcp_socket_handler.hpp>
+
+#include <string>
+
+class MetricsServer;
+template <typename T>
+class TcpSocketServer;
+
+/**
+ * One HTTP connection to the MetricsServer. Only GET requests, without
+ * body, are supported. The connection is kept open for the next requests,
+ * until the client closes it, or until we answered a request that we do
+ * not understand.
+ */
+class MetricsSocket: public TCPSocketHandler
+{
+ public:
+  MetricsSocket(std::shared_ptr<Poller>& poller, const socket_t socket, TcpSocketServer<MetricsSocket>& server);
+  ~MetricsSocket() = default;
+
+  void parse_in_buffer(const std::size_t size) override final;
+  /**
+   * Also tell our server that it has something to clean.
+   */
+  void close() override final;
+  /**
+   * Close the connection once the answer to a request that we do not
+   * understand has been sent.
+   */
+  void on_all_sent() override final;
+
+  bool is_connected() const override final
+  {
+    return true;
+  }
+  bool is_connecting() const override final
+  {
+    return false;
+  }
+
+ private:
+  /**
+   * Returns the whole response to the given request line, like
+   * "GET /metrics HTTP/1.1".
+   */
+  std::string handle_request(const std::string& request_line);
+
+  MetricsServer& server;
+  /**
+   * Set after a request that we do not understand: we can not know where
+   * the next one starts, so everything else is ignored, and the connection
+   * is closed after our answer.
+   */
+  bool ignore_input{false};
+};
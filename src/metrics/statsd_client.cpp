@@ -0,0 +1,144 @@
+#include <metrics/statsd_client.hpp>
+#include <utils/timed_events.hpp>
+#include <utils/scopeguard.hpp>
+#include <utils/metrics.hpp>
+
+#include <logger/logger.hpp>
+
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <unistd.h>
+
+/**
+ * Small enough to never be fragmented, on any usual network.
+ */
+static constexpr std::size_t max_datagram_size = 1432;
+
+static const std::string push_event_name{"statsd push"};
+
+/**
+ * The name of the metric, followed by the value of each label. The
+ * characters that have a meaning for statsd are replaced.
+ */
+static std::string make_name(const metrics::Metric& metric)
+{
+  std::string name = metric.name;
+  for (const auto& label: metric.labels)
+    name += "." + label.second;
+  for (auto& c: name)
+    if (c == ':' || c == '|' || c == '@' || c == ' ' || c == '\n')
+      c = '_';
+  return name;
+}
+
+static std::string format_value(const double value)
+{
+  std::ostringstream os;
+  os.precision(9);
+  os << value;
+  return os.str();
+}
+
+StatsdClient::StatsdClient(const std::string& host, const std::string& port, const std::chrono::seconds interval)
+{
+  struct addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  struct addrinfo* addr_res = nullptr;
+  const int res = ::getaddrinfo(host.data(), port.data(), &hints, &addr_res);
+  if (res != 0)
+    {
+      log_error("Failed to resolve the statsd host ", host, ": ", ::gai_strerror(res));
+      return;
+    }
+  auto sg = utils::make_scope_guard([addr_res]() { ::freeaddrinfo(addr_res); });
+
+  for (auto* rp = addr_res; rp; rp = rp->ai_next)
+    {
+      const int fd = ::socket(rp->ai_family, rp->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, rp->ai_protocol);
+      if (fd == -1)
+        continue;
+      // Connecting an UDP socket only sets the default destination
+      if (::connect(fd, rp->ai_addr, rp->ai_addrlen) == 0)
+        {
+          this->socket = fd;
+          break;
+        }
+      ::close(fd);
+    }
+  if (this->socket == -1)
+    {
+      log_error("Failed to create a socket to the statsd host ", host, ": ", std::strerror(errno));
+      return;
+    }
+  log_info("Pushing the metrics to statsd on ", host, ":", port, " every ", interval.count(), "s");
+  TimedEventsManager::instance().add_event(TimedEvent(std::chrono::milliseconds(interval),
+                                                      [this]() { this->push(); }, push_event_name));
+}
+
+StatsdClient::~StatsdClient()
+{
+  TimedEventsManager::instance().cancel(push_event_name);
+  if (this->socket != -1)
+    ::close(this->socket);
+}
+
+std::vector<std::string> StatsdClient::make_lines()
+{
+  std::vector<std::string> lines;
+  std::size_t index = 0;
+  // Returns the increase since the last call, for the same index
+  auto increase = [this, &index](const double value)
+  {
+    if (this->previous_values.size() <= index)
+      this->previous_values.resize(index + 1, 0);
+    const auto res = value - this->previous_values[index];
+    this->previous_values[index++] = value;
+    return res;
+  };
+  for (const auto& metric: metrics::Registry::instance().get_metrics())
+    {
+      const auto name = make_name(metric);
+      if (metric.type == metrics::Type::counter)
+        lines.push_back(name + ":" + format_value(increase(metric.get_value())) + "|c");
+      else if (metric.type == metrics::Type::gauge)
+        lines.push_back(name + ":" + format_value(metric.get_value()) + "|g");
+      else
+        {
+          lines.push_back(name + ".count:" + format_value(increase(metric.get_value())) + "|c");
+          lines.push_back(name + ".sum:" + format_value(increase(metric.histogram->get_sum())) + "|c");
+        }
+    }
+  return lines;
+}
+
+void StatsdClient::push()
+{
+  if (this->socket == -1)
+    return;
+  std::string datagram;
+  for (const auto& line: this->make_lines())
+    {
+      if (!datagram.empty() && datagram.size() + 1 + line.size() > max_datagram_size)
+        {
+          this->send(datagram);
+          datagram.clear();
+        }
+      if (!datagram.empty())
+        datagram += '\n';
+      datagram += line;
+    }
+  if (!datagram.empty())
+    this->send(datagram);
+}
+
+void StatsdClient::send(const std::string& datagram)
+{
+  if (::send(this->socket, datagram.data(), datagram.size(), MSG_DONTWAIT | MSG_NOSIGNAL) == -1)
+    log_debug("Failed to send the metrics to statsd: ", std::strerror(errno));
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Periodically push all the metrics to a statsd server, over UDP.
+ *
+ * Counters are sent as the increase since the previous push, gauges as
+ * their current value, and histograms as the increase of their count and
+ * sum.  The labels are appended to the name, separated by dots, for
+ * example biboumi_xmpp_sent_stanzas_total.message.  Nothing is retried:
+ * a datagram that can not be sent is lost.
+ */
+class StatsdClient
+{
+public:
+  /**
+   * The host is resolved only once, here.
+   */
+  StatsdClient(const std::string& host, const std::string& port, const std::chrono::seconds interval);
+  ~StatsdClient();
+  StatsdClient(const StatsdClient&) = delete;
+  StatsdClient(StatsdClient&&) = delete;
+  StatsdClient& operator=(const StatsdClient&) = delete;
+  StatsdClient& operator=(StatsdClient&&) = delete;
+
+  /**
+   * Send the current values. Called by a repeating TimedEvent.
+   */
+  void push();
+  /**
+   * Returns the lines to send, and remember the values sent, to compute
+   * the next increases.
+   */
+  std::vector<std::string> make_lines();
+
+private:
+  void send(const std::string& datagram);
+
+  int socket{-1};
+  /**
+   * The values sent by the previous push, by index in the registry. The
+   * histograms use two of them (count and sum), the other metrics one.
+   */
+  std::vector<double> previous_values;
+};
@@ -0,0 +1,61 @@
+#include <network/connection_attempt.hpp>
+#include <network/poller.hpp>
+
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+
+ConnectionAttempt::ConnectionAttempt(std::shared_ptr<Poller>& poller, const socket_t socket,
+                                     const struct addrinfo* rp, CallbackType callback):
+  SocketHandler(poller, socket),
+  callback(std::move(callback))
+{
+  memcpy(&this->addrinfo, rp, sizeof(struct addrinfo));
+  memcpy(&this->ai_addr, rp->ai_addr, rp->ai_addrlen);
+  this->addrinfo.ai_addr = reinterpret_cast<struct sockaddr*>(&this->ai_addr);
+  this->addrinfo.ai_canonname = nullptr;
+  this->addrinfo.ai_next = nullptr;
+
+  this->poller->add_socket_handler(this);
+  this->poller->watch_send_events(this);
+}
+
+ConnectionAttempt::~ConnectionAttempt()
+{
+  this->abort();
+}
+
+void ConnectionAttempt::connect()
+{
+  // Aborted by the attempt that won the race, while the event for our
+  // socket was already in the poller’s current list
+  if (this->socket == -1)
+    return;
+  int error = 0;
+  socklen_t len = sizeof(error);
+  if (::getsockopt(this->socket, SOL_SOCKET, SO_ERROR, &error, &len) == -1)
+    error = errno;
+  // The callback may release or abort us: nothing must be done after it
+  this->callback(*this, error);
+}
+
+bool ConnectionAttempt::is_connected() const
+{
+  return false;
+}
+
+socket_t ConnectionAttempt::release()
+{
+  const auto socket = this->socket;
+  if (this->socket != -1 && this->poller->is_managing_socket(this->socket))
+    this->poller->remove_socket_handler(this->socket);
+  this->socket = -1;
+  return socket;
+}
+
+void ConnectionAttempt::abort()
+{
+  const auto socket = this->release();
+  if (socket != -1)
+    ::close(socket);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <network/socket_handler.hpp>
+
+#include <functional>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+
+/**
+ * One non-blocking connect() in progress, to one of the addresses of a
+ * remote host. TCPClientSocketHandler races a few of these against each
+ * other (see RFC 8305, Happy Eyeballs) and keeps the socket of the first
+ * one that succeeds.
+ */
+class ConnectionAttempt: public SocketHandler
+{
+public:
+  /**
+   * Called when the connection succeeded (with an error of 0) or failed
+   * (with the errno value describing the failure).
+   */
+  using CallbackType = std::function<void(ConnectionAttempt&, const int)>;
+
+  /**
+   * The socket must be a non-blocking socket on which connect() returned
+   * EINPROGRESS. We watch it until it becomes writable.
+   */
+  explicit ConnectionAttempt(std::shared_ptr<Poller>& poller, const socket_t socket,
+                             const struct addrinfo* rp, CallbackType callback);
+  ~ConnectionAttempt();
+  ConnectionAttempt(const ConnectionAttempt&) = delete;
+  ConnectionAttempt(ConnectionAttempt&&) = delete;
+  ConnectionAttempt& operator=(const ConnectionAttempt&) = delete;
+  ConnectionAttempt& operator=(ConnectionAttempt&&) = delete;
+
+  /**
+   * Called by the poller when the socket becomes writable, which means the
+   * connection either succeeded or failed.
+   */
+  void connect() override final;
+  /**
+   * Always false: once connected, the socket is given to someone else.
+   */
+  bool is_connected() const override final;
+
+  const struct addrinfo& get_addrinfo() const
+  { return this->addrinfo; }
+  /**
+   * Stop watching the socket, and return it without closing it.
+   */
+  socket_t release();
+  /**
+   * Stop watching the socket, and close it.
+   */
+  void abort();
+
+private:
+  /**
+   * A copy of the addrinfo we are connecting to, with its sockaddr.
+   */
+  struct addrinfo addrinfo{};
+  struct sockaddr_in6 ai_addr{};
+
+  CallbackType callback;
+};
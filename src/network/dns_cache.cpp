@@ -0,0 +1,343 @@
+#include <network/dns_cache.hpp>
+#include <utils/timed_events.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include <sys/stat.h>
+
+#include <sys/socket.h>
+
+#ifdef UDNS_FOUND
+# include <network/dns_handler.hpp>
+# include <arpa/inet.h>
+# include <netinet/in.h>
+# include <cstdlib>
+# include <map>
+# include <udns.h>
+#endif
+
+HostsFile::HostsFile(std::string filename):
+  filename(std::move(filename))
+{
+}
+
+const std::vector<std::string>& HostsFile::find(const std::string& hostname)
+{
+  static const std::vector<std::string> not_found{};
+
+  this->reload_if_changed();
+  const auto it = this->hosts.find(hostname);
+  if (it == this->hosts.end())
+    return not_found;
+  return it->second;
+}
+
+void HostsFile::reload_if_changed()
+{
+  if (this->filename.empty())
+    return;
+
+  struct stat st{};
+  if (::stat(this->filename.data(), &st) == -1)
+    {
+      this->hosts.clear();
+      this->mtime = -1;
+      return;
+    }
+  if (st.st_mtime == this->mtime && st.st_size == this->size && st.st_ino == this->inode)
+    return;
+
+  this->mtime = st.st_mtime;
+  this->size = st.st_size;
+  this->inode = st.st_ino;
+  std::ifstream is(this->filename);
+  this->load(is);
+}
+
+void HostsFile::load(std::istream& is)
+{
+  this->hosts.clear();
+
+  std::string line;
+  while (std::getline(is, line))
+    {
+      if (line.empty())
+        continue;
+
+      std::string ip;
+      std::istringstream line_stream(line);
+      line_stream >> ip;
+      if (ip.empty() || ip[0] == '#')
+        continue;
+
+      std::string host;
+      while (line_stream >> host && !host.empty() && host[0] != '#')
+        {
+          auto& addresses = this->hosts[host];
+          if (std::find(addresses.begin(), addresses.end(), ip) == addresses.end())
+            addresses.push_back(ip);
+        }
+    }
+}
+
+constexpr std::chrono::seconds DNSCache::negative_ttl;
+constexpr std::chrono::seconds DNSCache::purge_interval;
+
+DNSCache::DNSCache(QueryFunction query, std::string hosts_filename):
+  query(std::move(query)),
+  hosts(std::move(hosts_filename))
+{
+}
+
+void DNSCache::resolve(const std::string& hostname, const void* owner, Callback callback)
+{
+  const auto& etc_hosts = this->hosts.find(hostname);
+  if (!etc_hosts.empty())
+    {
+      callback(etc_hosts, {});
+      return;
+    }
+
+  const auto now = std::chrono::steady_clock::now();
+  if (!this->notifying && now >= this->next_purge)
+    {
+      this->purge_expired(now);
+      this->next_purge = now + DNSCache::purge_interval;
+    }
+
+  auto it = this->entries.find(hostname);
+  if (it == this->entries.end())
+    it = this->entries.emplace(hostname, Entry{}).first;
+  auto& entry = it->second;
+  if (entry.is_resolving())
+    {
+      entry.waiters.emplace_back(owner, std::move(callback));
+      return;
+    }
+  if (entry.expiration > now)
+    {
+      callback(entry.addresses, entry.error_msg);
+      return;
+    }
+  entry.waiters.emplace_back(owner, std::move(callback));
+
+  entry.addresses.clear();
+  entry.addresses4.clear();
+  entry.error_msg.clear();
+  entry.ttl = std::chrono::seconds::max();
+  entry.resolving4 = true;
+  entry.resolving6 = true;
+  // Not the hostname given by the caller: the QueryFunction may keep a
+  // reference to it until the answer comes
+  this->query(it->first);
+}
+
+void DNSCache::cancel(const std::string& hostname, const void* owner)
+{
+  auto it = this->entries.find(hostname);
+  if (it == this->entries.end())
+    return;
+  auto& waiters = it->second.waiters;
+  waiters.erase(std::remove_if(waiters.begin(), waiters.end(),
+                               [owner](const auto& waiter) { return waiter.first == owner; }),
+                waiters.end());
+}
+
+void DNSCache::on_query_result(const std::string& hostname, const int family, std::vector<std::string> addresses,
+                               const std::chrono::seconds ttl, const std::string& error_msg)
+{
+  auto it = this->entries.find(hostname);
+  if (it == this->entries.end())
+    return;
+  auto& entry = it->second;
+  const bool found = !addresses.empty();
+
+  if (family == AF_INET)
+    {
+      entry.resolving4 = false;
+      entry.addresses4 = std::move(addresses);
+      if (found)
+        entry.ttl = std::min(entry.ttl, ttl);
+    }
+  else
+    {
+      entry.resolving6 = false;
+      entry.addresses.insert(entry.addresses.end(), addresses.begin(), addresses.end());
+      if (found)
+        entry.ttl = std::min(entry.ttl, ttl);
+    }
+  if (!found && !error_msg.empty())
+    entry.error_msg = error_msg;
+
+  if (entry.is_resolving())
+    return;
+
+  entry.addresses.insert(entry.addresses.end(), entry.addresses4.begin(), entry.addresses4.end());
+  entry.addresses4.clear();
+  if (entry.addresses.empty())
+    entry.expiration = std::chrono::steady_clock::now() + DNSCache::negative_ttl;
+  else
+    entry.expiration = std::chrono::steady_clock::now() + entry.ttl;
+  this->notify_waiters(entry);
+}
+
+void DNSCache::notify_waiters(Entry& entry)
+{
+  // The entry must not be purged by a resolve() done from a callback
+  const bool was_notifying = this->notifying;
+  this->notifying = true;
+  // A callback may cancel (or add) other waiters, so we never iterate
+  // over the vector directly
+  while (!entry.waiters.empty())
+    {
+      auto callback = std::move(entry.waiters.back().second);
+      entry.waiters.pop_back();
+      callback(entry.addresses, entry.error_msg);
+    }
+  this->notifying = was_notifying;
+}
+
+void DNSCache::purge_expired(const std::chrono::steady_clock::time_point now)
+{
+  for (auto it = this->entries.begin(); it != this->entries.end();)
+    {
+      if (!it->second.is_resolving() && it->second.expiration <= now)
+        it = this->entries.erase(it);
+      else
+        ++it;
+    }
+}
+
+void DNSCache::clear()
+{
+  this->entries.clear();
+}
+
+std::size_t DNSCache::size() const
+{
+  return this->entries.size();
+}
+
+bool DNSCache::is_resolving(const std::string& hostname) const
+{
+  const auto it = this->entries.find(hostname);
+  return it != this->entries.end() && it->second.is_resolving();
+}
+
+#ifdef UDNS_FOUND
+
+static std::map<int, std::string> dns_error_messages {
+    {DNS_E_TEMPFAIL, "Timeout while contacting DNS servers"},
+    {DNS_E_PROTOCOL, "Misformatted DNS reply"},
+    {DNS_E_NXDOMAIN, "Domain name not found"},
+    {DNS_E_NODATA, "Domain name not found"},
+    {DNS_E_NOMEM, "Out of memory"},
+    {DNS_E_BADQUERY, "Misformatted domain name"}
+};
+
+static std::string get_dns_error_message()
+{
+  const auto error = dns_error_messages.find(dns_status(nullptr));
+  if (error != end(dns_error_messages))
+    return error->second;
+  return {};
+}
+
+static void start_dns_timer()
+{
+  const auto timeout = dns_timeouts(nullptr, -1, 0);
+  if (timeout < 0)
+    return;
+  TimedEventsManager::instance().cancel("DNS");
+  TimedEvent event(std::chrono::steady_clock::now() + std::chrono::seconds(timeout), start_dns_timer, "DNS");
+  TimedEventsManager::instance().add_event(std::move(event));
+}
+
+static void after_dns_result()
+{
+  if (dns_active(nullptr) == 0)
+    DNSHandler::unwatch();
+}
+
+static void hostname4_resolved(dns_ctx*, dns_rr_a4* result, void* data)
+{
+  // The key of the entry in the cache, which stays in the map until both
+  // of its queries complete
+  const auto& hostname = *static_cast<const std::string*>(data);
+  std::vector<std::string> addresses;
+  std::string error_msg;
+  std::chrono::seconds ttl{0};
+  if (dns_status(nullptr) >= 0 && result)
+    {
+      char buf[INET6_ADDRSTRLEN];
+      for (auto i = 0; i < result->dnsa4_nrr; ++i)
+        {
+          inet_ntop(AF_INET, &result->dnsa4_addr[i], buf, sizeof(buf));
+          addresses.emplace_back(buf);
+        }
+      ttl = std::chrono::seconds(result->dnsa4_ttl);
+    }
+  else
+    error_msg = get_dns_error_message();
+  std::free(result);
+  after_dns_result();
+  DNSCache::instance().on_query_result(hostname, AF_INET, std::move(addresses), ttl, error_msg);
+}
+
+static void hostname6_resolved(dns_ctx*, dns_rr_a6* result, void* data)
+{
+  const auto& hostname = *static_cast<const std::string*>(data);
+  std::vector<std::string> addresses;
+  std::string error_msg;
+  std::chrono::seconds ttl{0};
+  if (dns_status(nullptr) >= 0 && result)
+    {
+      char buf[INET6_ADDRSTRLEN];
+      for (auto i = 0; i < result->dnsa6_nrr; ++i)
+        {
+          inet_ntop(AF_INET6, &result->dnsa6_addr[i], buf, sizeof(buf));
+          addresses.emplace_back(buf);
+        }
+      ttl = std::chrono::seconds(result->dnsa6_ttl);
+    }
+  else
+    error_msg = get_dns_error_message();
+  std::free(result);
+  after_dns_result();
+  DNSCache::instance().on_query_result(hostname, AF_INET6, std::move(addresses), ttl, error_msg);
+}
+
+/**
+ * Send the A and AAAA queries with udns. The data given to the callbacks
+ * is the key of the cache entry, whose address is stable.
+ */
+static void udns_query(const std::string& hostname)
+{
+  auto data = const_cast<std::string*>(&hostname);
+  DNSHandler::watch();
+  const bool submitted4 = dns_submit_a4(nullptr, hostname.data(), 0, hostname4_resolved, data) != nullptr;
+  const std::string error4 = submitted4 ? std::string{} : get_dns_error_message();
+  const bool submitted6 = dns_submit_a6(nullptr, hostname.data(), 0, hostname6_resolved, data) != nullptr;
+  const std::string error6 = submitted6 ? std::string{} : get_dns_error_message();
+
+  if (submitted4 || submitted6)
+    start_dns_timer();
+  else
+    after_dns_result();
+  // This may complete the entry and notify its waiters, so it must be
+  // done once everything else is
+  if (!submitted4)
+    DNSCache::instance().on_query_result(hostname, AF_INET, {}, std::chrono::seconds{0}, error4);
+  if (!submitted6)
+    DNSCache::instance().on_query_result(hostname, AF_INET6, {}, std::chrono::seconds{0}, error6);
+}
+
+DNSCache& DNSCache::instance()
+{
+  static DNSCache inst(udns_query);
+  return inst;
+}
+
+#endif /* UDNS_FOUND */
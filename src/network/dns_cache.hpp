@@ -0,0 +1,177 @@
+#pragma once
+
+#include "biboumi.h"
+
+#include <chrono>
+#include <functional>
+#include <istream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/types.h>
+
+/**
+ * The content of a hosts file (/etc/hosts by default), parsed once and
+ * read again only when the file is modified.
+ */
+class HostsFile
+{
+public:
+  /**
+   * If the filename is empty, nothing is ever read from the disk, and
+   * the content can only be provided with load().
+   */
+  explicit HostsFile(std::string filename="/etc/hosts");
+  ~HostsFile() = default;
+  HostsFile(const HostsFile&) = delete;
+  HostsFile(HostsFile&&) = delete;
+  HostsFile& operator=(const HostsFile&) = delete;
+  HostsFile& operator=(HostsFile&&) = delete;
+
+  /**
+   * Return the list of IP addresses associated with the given hostname
+   * (empty if it is not found). The file is parsed again first, if it
+   * changed since the previous call.
+   */
+  const std::vector<std::string>& find(const std::string& hostname);
+  /**
+   * Replace the known entries with the ones read from the stream.
+   */
+  void load(std::istream& is);
+
+private:
+  void reload_if_changed();
+
+  const std::string filename;
+  /**
+   * The identity of the file we parsed, to know when it needs to be read
+   * again.
+   */
+  time_t mtime{-1};
+  off_t size{-1};
+  ino_t inode{0};
+
+  std::unordered_map<std::string, std::vector<std::string>> hosts;
+};
+
+/**
+ * A cache of hostname resolutions, shared by all the Resolvers when
+ * biboumi is built with udns.
+ *
+ * Positive answers are kept for the duration of their smallest TTL, and
+ * failures for negative_ttl. When a hostname is requested while a query
+ * for it is already in flight, the callback is just added to the list of
+ * the ones waiting for that query’s result. Expired entries are removed
+ * from time to time, when a new hostname is resolved.
+ *
+ * The queries themselves are sent by the QueryFunction given to the
+ * constructor, which must then call on_query_result() once for AF_INET
+ * and once for AF_INET6 (possibly before returning).  The hostname it
+ * receives is the key of the cache entry, valid until both are done.
+ */
+class DNSCache
+{
+public:
+  using QueryFunction = std::function<void(const std::string& hostname)>;
+  /**
+   * Called with the addresses found for the hostname (IPv6 first, as
+   * recommended by RFC 8305), or the error message if there is none.
+   */
+  using Callback = std::function<void(const std::vector<std::string>& addresses, const std::string& error_msg)>;
+
+  DNSCache(QueryFunction query, std::string hosts_filename="/etc/hosts");
+  ~DNSCache() = default;
+  DNSCache(const DNSCache&) = delete;
+  DNSCache(DNSCache&&) = delete;
+  DNSCache& operator=(const DNSCache&) = delete;
+  DNSCache& operator=(DNSCache&&) = delete;
+
+#ifdef UDNS_FOUND
+  /**
+   * The instance used by all the Resolvers, sending its queries with udns.
+   */
+  static DNSCache& instance();
+#endif
+
+  static constexpr std::chrono::seconds negative_ttl{30};
+  /**
+   * The minimum delay between two passes over all the entries, looking
+   * for the expired ones.
+   */
+  static constexpr std::chrono::seconds purge_interval{60};
+
+  /**
+   * Look for the given hostname in the hosts file, then in the cache, and
+   * finally start a query if needed. Once the result is known (possibly
+   * immediately, before this function returns), the callback is called.
+   * The owner is only used to cancel it.
+   */
+  void resolve(const std::string& hostname, const void* owner, Callback callback);
+  /**
+   * Make sure the callback given by this owner will not be called, for
+   * example because it is being destroyed.
+   */
+  void cancel(const std::string& hostname, const void* owner);
+  /**
+   * Called by the QueryFunction with the result of the query for one
+   * address family. An empty list of addresses means that the query
+   * failed, with the given error message.
+   */
+  void on_query_result(const std::string& hostname, const int family, std::vector<std::string> addresses,
+                       const std::chrono::seconds ttl, const std::string& error_msg);
+  /**
+   * Remove all the entries that expired before the given time, unless a
+   * query is still in flight for them.
+   */
+  void purge_expired(const std::chrono::steady_clock::time_point now);
+  /**
+   * Forget everything. Must only be called when no query is in flight
+   * anymore.
+   */
+  void clear();
+  /**
+   * Returns the number of hostnames in the cache (expired or not).
+   */
+  std::size_t size() const;
+  /**
+   * Returns whether a query is in flight for the given hostname.
+   */
+  bool is_resolving(const std::string& hostname) const;
+
+private:
+  struct Entry
+  {
+    std::vector<std::string> addresses{};
+    /**
+     * The IPv4 results, appended to the addresses once both queries are
+     * done, so that IPv6 comes first whatever the order of the answers.
+     */
+    std::vector<std::string> addresses4{};
+    std::string error_msg{};
+    std::chrono::steady_clock::time_point expiration{};
+    /**
+     * The smallest TTL among the received records.
+     */
+    std::chrono::seconds ttl{std::chrono::seconds::max()};
+    bool resolving4{false};
+    bool resolving6{false};
+    std::vector<std::pair<const void*, Callback>> waiters{};
+
+    bool is_resolving() const
+    { return this->resolving4 || this->resolving6; }
+  };
+
+  void notify_waiters(Entry& entry);
+
+  const QueryFunction query;
+  HostsFile hosts;
+  /**
+   * Entries are never removed from this map while a query is in flight,
+   * because the QueryFunction may keep a reference to their key until
+   * the query completes.
+   */
+  std::unordered_map<std::string, Entry> entries;
+  std::chrono::steady_clock::time_point next_purge{};
+  bool notifying{false};
+};
@@ -3,6 +3,7 @@
 
 #include <network/dns_socket_handler.hpp>
 #include <network/dns_handler.hpp>
+#include <network/dns_cache.hpp>
 #include <network/poller.hpp>
 
 #include <utils/timed_events.hpp>
@@ -32,6 +33,7 @@ void DNSHandler::destroy()
 {
   DNSHandler::socket_handler.reset(nullptr);
   dns_close(nullptr);
+  DNSCache::instance().clear();
 }
 
 void DNSHandler::watch()
@@ -0,0 +1,133 @@
+#include <biboumi.h>
+#ifndef UDNS_FOUND
+
+#include <network/getaddrinfo_pool.hpp>
+#include <network/poller.hpp>
+
+GetaddrinfoPool* GetaddrinfoPool::instance = nullptr;
+
+GetaddrinfoPool::GetaddrinfoPool(std::shared_ptr<Poller>& poller, const std::size_t nb_threads):
+  poller(poller),
+  self(std::make_shared<GetaddrinfoPool*>(this)),
+  stopping(false),
+  next_id(0)
+{
+  for (std::size_t i = 0; i < nb_threads; ++i)
+    this->threads.emplace_back(&GetaddrinfoPool::work, this);
+  GetaddrinfoPool::instance = this;
+}
+
+GetaddrinfoPool::~GetaddrinfoPool()
+{
+  this->destroy();
+}
+
+GetaddrinfoPool* GetaddrinfoPool::get()
+{
+  return GetaddrinfoPool::instance;
+}
+
+void GetaddrinfoPool::destroy()
+{
+  if (GetaddrinfoPool::instance == this)
+    GetaddrinfoPool::instance = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->stopping = true;
+    this->requests.clear();
+  }
+  this->condition.notify_all();
+  for (auto& thread: this->threads)
+    thread.join();
+  this->threads.clear();
+  this->results.clear();
+  this->callbacks.clear();
+}
+
+std::uint64_t GetaddrinfoPool::submit(const std::string& hostname, const std::string& port,
+                                      CallbackType callback)
+{
+  const auto id = this->next_id++;
+  this->callbacks.emplace(id, std::move(callback));
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->requests.push_back({id, hostname, port});
+  }
+  this->condition.notify_one();
+  return id;
+}
+
+void GetaddrinfoPool::cancel(const std::uint64_t id)
+{
+  this->callbacks.erase(id);
+}
+
+void GetaddrinfoPool::on_results()
+{
+  std::vector<Result> finished;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    std::swap(finished, this->results);
+  }
+  for (auto& result: finished)
+    {
+      auto it = this->callbacks.find(result.id);
+      if (it == this->callbacks.end())
+        continue;
+      // The callback may submit or cancel other requests
+      auto callback = std::move(it->second);
+      this->callbacks.erase(it);
+      callback(result.res, std::move(result.addr));
+    }
+}
+
+void GetaddrinfoPool::work()
+{
+  while (true)
+    {
+      Request request;
+      {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->condition.wait(lock, [this]() { return this->stopping || !this->requests.empty(); });
+        if (this->stopping)
+          return;
+        request = std::move(this->requests.front());
+        this->requests.pop_front();
+      }
+
+      struct addrinfo hints{};
+      hints.ai_flags = 0;
+      hints.ai_family = AF_UNSPEC;
+      hints.ai_socktype = SOCK_STREAM;
+      hints.ai_protocol = 0;
+
+      struct addrinfo* addr_res = nullptr;
+      const int res = ::getaddrinfo(request.hostname.data(), request.port.data(),
+                                    &hints, &addr_res);
+      bool first_result;
+      {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (this->stopping)
+          {
+            if (addr_res)
+              ::freeaddrinfo(addr_res);
+            return;
+          }
+        first_result = this->results.empty();
+        this->results.push_back({request.id, res, ResultType{res == 0 ? addr_res : nullptr}});
+      }
+      // Only one task is needed to handle all the results pushed before it
+      // runs
+      if (first_result)
+        {
+          std::weak_ptr<GetaddrinfoPool*> weak_self = this->self;
+          this->poller->post([weak_self]()
+                             {
+                               if (auto self = weak_self.lock())
+                                 (*self)->on_results();
+                             });
+        }
+    }
+}
+
+#endif /* UDNS_FOUND */
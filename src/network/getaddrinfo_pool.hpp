@@ -0,0 +1,124 @@
+#pragma once
+
+#include <biboumi.h>
+#ifndef UDNS_FOUND
+
+#include <network/resolver.hpp>
+
+#include <condition_variable>
+#include <unordered_map>
+#include <functional>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <mutex>
+
+/**
+ * When biboumi is built without udns, getaddrinfo() is the only way to
+ * resolve a hostname, and it blocks for the whole duration of the DNS
+ * resolution. This pool runs these calls in a few threads instead, and
+ * gives the results back to the poller thread with Poller::post().
+ *
+ * Only one instance is supposed to exist, created in main_loop(). If
+ * there is none (for example in the tests), Resolver calls getaddrinfo()
+ * directly.
+ */
+class Poller;
+
+class GetaddrinfoPool
+{
+public:
+  using ResultType = std::unique_ptr<struct addrinfo, AddrinfoDeleter>;
+  /**
+   * Called on the poller thread, with the return value of getaddrinfo()
+   * and the list it returned (nullptr on error).
+   */
+  using CallbackType = std::function<void(int, ResultType)>;
+
+  explicit GetaddrinfoPool(std::shared_ptr<Poller>& poller, const std::size_t nb_threads);
+  ~GetaddrinfoPool();
+  GetaddrinfoPool(const GetaddrinfoPool&) = delete;
+  GetaddrinfoPool(GetaddrinfoPool&&) = delete;
+  GetaddrinfoPool& operator=(const GetaddrinfoPool&) = delete;
+  GetaddrinfoPool& operator=(GetaddrinfoPool&&) = delete;
+
+  /**
+   * Stop all the threads (waiting for the running getaddrinfo() calls to
+   * return), and drop all pending requests.
+   */
+  void destroy();
+
+  /**
+   * Returns the running pool, or nullptr if there is none.
+   */
+  static GetaddrinfoPool* get();
+
+  /**
+   * Queue a getaddrinfo() call for the given hostname and port. Returns an
+   * identifier that can be used to cancel it.
+   */
+  std::uint64_t submit(const std::string& hostname, const std::string& port,
+                       CallbackType callback);
+  /**
+   * Make sure the callback of the given request is never called. The
+   * getaddrinfo() call itself may still run, its result is then dropped.
+   */
+  void cancel(const std::uint64_t id);
+
+private:
+  struct Request
+  {
+    std::uint64_t id;
+    std::string hostname;
+    std::string port;
+  };
+  struct Result
+  {
+    std::uint64_t id;
+    int res;
+    ResultType addr;
+  };
+
+  /**
+   * The function executed by each thread: pop requests, resolve them and
+   * push the results, until we are stopped.
+   */
+  void work();
+  /**
+   * Posted to the poller by the threads: call the callbacks of all the
+   * finished requests.
+   */
+  void on_results();
+
+  static GetaddrinfoPool* instance;
+
+  std::shared_ptr<Poller> poller;
+  /**
+   * Kept by the tasks posted to the poller, which may be executed after
+   * our destruction and must then do nothing.
+   */
+  std::shared_ptr<GetaddrinfoPool*> self;
+
+  std::vector<std::thread> threads;
+
+  /**
+   * Protects everything that is accessed by the threads: requests,
+   * results and stopping.
+   */
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::deque<Request> requests;
+  std::vector<Result> results;
+  bool stopping;
+
+  /**
+   * Only accessed from the poller thread.
+   */
+  std::unordered_map<std::uint64_t, CallbackType> callbacks;
+  std::uint64_t next_id;
+};
+
+#endif /* UDNS_FOUND */
@@ -1,21 +1,32 @@
 #include <network/poller.hpp>
 #include <logger/logger.hpp>
 #include <utils/timed_events.hpp>
+#include <utils/loop_monitor.hpp>
 
 #include <cassert>
 #include <cerrno>
 #include <stdio.h>
-#include <signal.h>
 #include <unistd.h>
+#include <sys/eventfd.h>
 
 #include <cstring>
+#include <cstdint>
 #include <iostream>
+#include <limits>
 #include <stdexcept>
 
 Poller::Poller()
 {
+  this->wakeup_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (this->wakeup_fd == -1)
+    {
+      log_error("eventfd failed: ", strerror(errno));
+      throw std::runtime_error("Could not create the poller eventfd");
+    }
 #if POLLER == POLL
-  this->nfds = 0;
+  this->fds[0].fd = this->wakeup_fd;
+  this->fds[0].events = POLLIN;
+  this->nfds = 1;
 #elif POLLER == EPOLL
   this->epfd = ::epoll_create1(0);
   if (this->epfd == -1)
@@ -23,6 +34,13 @@ Poller::Poller()
       log_error("epoll failed: ", strerror(errno));
       throw std::runtime_error("Could not create epoll instance");
     }
+  // A null pointer is how we recognize the wakeup fd in poll()
+  struct epoll_event event = {EPOLLIN, {nullptr}};
+  if (::epoll_ctl(this->epfd, EPOLL_CTL_ADD, this->wakeup_fd, &event) == -1)
+    {
+      log_error("epoll_ctl failed: ", strerror(errno));
+      throw std::runtime_error("Could not add the eventfd to epoll");
+    }
 #endif
 }
 
@@ -32,6 +50,7 @@ Poller::~Poller()
   if (this->epfd > 0)
     ::close(this->epfd);
 #endif
+  ::close(this->wakeup_fd);
 }
 
 void Poller::add_socket_handler(SocketHandler* socket_handler)
@@ -66,6 +85,8 @@ void Poller::remove_socket_handler(const socket_t socket)
   if (it == this->socket_handlers.end())
     throw std::runtime_error("Trying to remove a SocketHandler that is not managed");
   this->socket_handlers.erase(it);
+  this->sending_sockets.erase(socket);
+  this->paused_sockets.erase(socket);
 
 #if POLLER == POLL
   for (size_t i = 0; i < this->nfds; i++)
@@ -94,42 +115,46 @@ void Poller::remove_socket_handler(const socket_t socket)
 
 void Poller::watch_send_events(SocketHandler* socket_handler)
 {
-#if POLLER == POLL
-  for (size_t i = 0; i < this->nfds; ++i)
-    {
-      if (this->fds[i].fd == socket_handler->get_socket())
-        {
-          this->fds[i].events = POLLIN|POLLOUT;
-          return;
-        }
-    }
-  throw std::runtime_error("Cannot watch a non-registered socket for send events");
-#elif POLLER == EPOLL
-  struct epoll_event event = {EPOLLIN|EPOLLOUT, {socket_handler}};
-  const int res = ::epoll_ctl(this->epfd, EPOLL_CTL_MOD, socket_handler->get_socket(), &event);
-  if (res == -1)
-    {
-      log_error("epoll_ctl failed: ", strerror(errno));
-      throw std::runtime_error("Could not modify socket flags in epoll");
-    }
-#endif
+  this->sending_sockets.insert(socket_handler->get_socket());
+  this->update_events(socket_handler);
 }
 
 void Poller::stop_watching_send_events(SocketHandler* socket_handler)
 {
+  this->sending_sockets.erase(socket_handler->get_socket());
+  this->update_events(socket_handler);
+}
+
+void Poller::pause_receive_events(SocketHandler* socket_handler)
+{
+  this->paused_sockets.insert(socket_handler->get_socket());
+  this->update_events(socket_handler);
+}
+
+void Poller::resume_receive_events(SocketHandler* socket_handler)
+{
+  this->paused_sockets.erase(socket_handler->get_socket());
+  this->update_events(socket_handler);
+}
+
+void Poller::update_events(SocketHandler* socket_handler)
+{
+  const auto socket = socket_handler->get_socket();
+  const bool send = this->sending_sockets.count(socket) != 0;
+  const bool receive = this->paused_sockets.count(socket) == 0;
 #if POLLER == POLL
-  for (size_t i = 0; i <= this->nfds; ++i)
+  for (size_t i = 0; i < this->nfds; ++i)
     {
-      if (this->fds[i].fd == socket_handler->get_socket())
+      if (this->fds[i].fd == socket)
         {
-          this->fds[i].events = POLLIN;
+          this->fds[i].events = static_cast<short>((receive ? POLLIN : 0) | (send ? POLLOUT : 0));
           return;
         }
     }
-  throw std::runtime_error("Cannot watch a non-registered socket for send events");
+  throw std::runtime_error("Cannot watch the events of a non-registered socket");
 #elif POLLER == EPOLL
-  struct epoll_event event = {EPOLLIN, {socket_handler}};
-  const int res = ::epoll_ctl(this->epfd, EPOLL_CTL_MOD, socket_handler->get_socket(), &event);
+  struct epoll_event event = {(receive ? EPOLLIN : 0u) | (send ? EPOLLOUT : 0u), {socket_handler}};
+  const int res = ::epoll_ctl(this->epfd, EPOLL_CTL_MOD, socket, &event);
   if (res == -1)
     {
       log_error("epoll_ctl failed: ", strerror(errno));
@@ -138,6 +163,23 @@ void Poller::stop_watching_send_events(SocketHandler* socket_handler)
 #endif
 }
 
+/**
+ * Call the callback of the socket handler matching the event, and measure
+ * how long it takes.
+ */
+static void dispatch(const LoopMonitor::Kind kind, SocketHandler* socket_handler)
+{
+  LoopMonitor::instance().run(kind, [kind, socket_handler]()
+  {
+    if (kind == LoopMonitor::Kind::recv)
+      socket_handler->on_recv();
+    else if (kind == LoopMonitor::Kind::send)
+      socket_handler->on_send();
+    else
+      socket_handler->connect();
+  }, [socket_handler]() { return socket_handler->describe(); });
+}
+
 int Poller::poll(const std::chrono::milliseconds& timeout)
 {
   if (this->socket_handlers.empty() && timeout == utils::no_timeout)
@@ -156,15 +198,16 @@ int Poller::poll(const std::chrono::milliseconds& timeout)
   else
     timeout_tsp = nullptr;
 
-  // Unblock all signals, only during the ppoll call
-  sigset_t empty_signal_set;
-  sigemptyset(&empty_signal_set);
-  int nb_events = ::ppoll(this->fds, this->nfds, timeout_tsp,
-                          &empty_signal_set);
+  // The signal mask is left untouched: signals are received through a
+  // SignalHandler, like any other event
+  int nb_events = ::ppoll(this->fds, this->nfds, timeout_tsp, nullptr);
   if (nb_events < 0)
     {
       if (errno == EINTR)
-        return true;
+        {
+          this->run_posted_tasks();
+          return true;
+        }
       log_error("poll failed: ", strerror(errno));
       throw std::runtime_error("Poll failed");
     }
@@ -173,60 +216,116 @@ int Poller::poll(const std::chrono::milliseconds& timeout)
   assert(static_cast<unsigned int>(nb_events) <= this->nfds);
   for (size_t i = 0; i < this->nfds && nb_events != 0; ++i)
     {
-      auto socket_handler = this->socket_handlers.at(this->fds[i].fd);
       if (this->fds[i].revents == 0)
         continue;
-      else if (this->fds[i].revents & POLLIN && socket_handler->is_connected())
+      if (this->fds[i].fd == this->wakeup_fd)
+        {
+          // The tasks are executed below, for now we just stop being woken up
+          std::uint64_t value;
+          if (::read(this->wakeup_fd, &value, sizeof(value)) == -1 && errno != EAGAIN)
+            log_error("Failed to read the poller eventfd: ", strerror(errno));
+          nb_events--;
+          continue;
+        }
+      auto socket_handler = this->socket_handlers.at(this->fds[i].fd);
+      if (this->fds[i].revents & POLLIN && socket_handler->is_connected())
         {
-          socket_handler->on_recv();
+          dispatch(LoopMonitor::Kind::recv, socket_handler);
           nb_events--;
         }
       else if (this->fds[i].revents & POLLOUT && socket_handler->is_connected())
         {
-            socket_handler->on_send();
+            dispatch(LoopMonitor::Kind::send, socket_handler);
             nb_events--;
         }
+      else if (this->fds[i].revents & (POLLHUP|POLLERR) && socket_handler->is_connected())
+        { // The receive events are paused, but we need to see the error
+          dispatch(LoopMonitor::Kind::recv, socket_handler);
+          nb_events--;
+        }
       else if (this->fds[i].revents & POLLOUT ||
                this->fds[i].revents & POLLIN)
         {
-          socket_handler->connect();
+          dispatch(LoopMonitor::Kind::connect, socket_handler);
           nb_events--;
         }
     }
+  this->run_posted_tasks();
   return 1;
 #elif POLLER == EPOLL
   static const size_t max_events = 12;
   struct epoll_event revents[max_events];
-  // Unblock all signals, only during the epoll_pwait call
-  sigset_t empty_signal_set{};
-  sigemptyset(&empty_signal_set);
 
   int real_timeout = std::numeric_limits<int>::max();
   if (timeout.count() < real_timeout) // Just avoid any potential int overflow
     real_timeout = static_cast<int>(timeout.count());
-  const int nb_events = ::epoll_pwait(this->epfd, revents, max_events, real_timeout,
-                                      &empty_signal_set);
+  // The signal mask is left untouched: signals are received through a
+  // SignalHandler, like any other event
+  const int nb_events = ::epoll_wait(this->epfd, revents, max_events, real_timeout);
   if (nb_events == -1)
     {
       if (errno == EINTR)
-        return 0;
+        {
+          this->run_posted_tasks();
+          return 0;
+        }
       log_error("epoll wait: ", strerror(errno));
       throw std::runtime_error("Epoll_wait failed");
     }
   for (int i = 0; i < nb_events; ++i)
     {
       auto socket_handler = static_cast<SocketHandler*>(revents[i].data.ptr);
-      if (revents[i].events & EPOLLIN && socket_handler->is_connected())
-        socket_handler->on_recv();
+      if (!socket_handler)
+        {
+          // The tasks are executed below, for now we just stop being woken up
+          std::uint64_t value;
+          if (::read(this->wakeup_fd, &value, sizeof(value)) == -1 && errno != EAGAIN)
+            log_error("Failed to read the poller eventfd: ", strerror(errno));
+        }
+      else if (revents[i].events & EPOLLIN && socket_handler->is_connected())
+        dispatch(LoopMonitor::Kind::recv, socket_handler);
       else if (revents[i].events & EPOLLOUT && socket_handler->is_connected())
-        socket_handler->on_send();
+        dispatch(LoopMonitor::Kind::send, socket_handler);
       else if (revents[i].events & EPOLLOUT)
-        socket_handler->connect();
+        dispatch(LoopMonitor::Kind::connect, socket_handler);
+      else if (revents[i].events & (EPOLLHUP|EPOLLERR) && socket_handler->is_connected())
+        // The receive events are paused, but we need to see the error
+        dispatch(LoopMonitor::Kind::recv, socket_handler);
     }
+  this->run_posted_tasks();
   return nb_events;
 #endif
 }
 
+void Poller::post(std::function<void()> task)
+{
+  {
+    std::lock_guard<std::mutex> lock(this->tasks_mutex);
+    this->tasks.push_back(std::move(task));
+  }
+  // This can only fail if the counter overflows, and we reset it each time
+  // we are woken up.  The logger is not thread-safe anyway.
+  const std::uint64_t one = 1;
+  const auto written = ::write(this->wakeup_fd, &one, sizeof(one));
+  static_cast<void>(written);
+}
+
+void Poller::run_posted_tasks()
+{
+  std::vector<std::function<void()>> tasks;
+  {
+    std::lock_guard<std::mutex> lock(this->tasks_mutex);
+    if (this->tasks.empty())
+      return;
+    std::swap(tasks, this->tasks);
+  }
+  // Tasks posted by these ones will be executed by the next call to poll(),
+  // which will not wait because the eventfd has been written again
+  for (auto& task: tasks)
+    LoopMonitor::instance().run(LoopMonitor::Kind::posted_task, task,
+                                []() { return std::string("a task posted to the poller"); });
+}
+
 size_t Poller::size() const
 {
   return this->socket_handlers.size();
@@ -4,8 +4,12 @@
 #include <network/socket_handler.hpp>
 
 #include <unordered_map>
+#include <unordered_set>
+#include <functional>
 #include <memory>
 #include <chrono>
+#include <vector>
+#include <mutex>
 
 #define POLL 1
 #define EPOLL 2
@@ -61,6 +65,14 @@ public:
    * this SocketHandler.
    */
   void stop_watching_send_events(SocketHandler* socket_handler);
+  /**
+   * Stop watching the receive events of this SocketHandler, until
+   * resume_receive_events() is called: the received data stays in the
+   * kernel buffers and, once they are full, the remote end has to wait.
+   * A hang up or an error is still reported as a receive event.
+   */
+  void pause_receive_events(SocketHandler* socket_handler);
+  void resume_receive_events(SocketHandler* socket_handler);
   /**
    * Wait for all watched events, and call the SocketHandlers' callbacks
    * when one is ready.  Returns if nothing happened before the provided
@@ -78,14 +90,49 @@ public:
    * Whether the given socket is managed by the poller
    */
    bool is_managing_socket(const socket_t socket) const;
+  /**
+   * Queue a function to be called by the thread running poll(), at the
+   * end of its current (or next) call, once all the events have been
+   * handled.  This is the only method that can be called from any thread:
+   * it wakes the poller up if it is waiting.
+   */
+  void post(std::function<void()> task);
 
 private:
+  /**
+   * Watch the events of the socket according to sending_sockets and
+   * paused_sockets.
+   */
+  void update_events(SocketHandler* socket_handler);
+  /**
+   * Read the wakeup eventfd, and execute all the posted tasks.
+   */
+  void run_posted_tasks();
   /**
    * A "list" of all the SocketHandlers that we manage, indexed by socket,
    * because that's what is returned by select/poll/etc when an event
    * occures.
    */
   std::unordered_map<socket_t, SocketHandler*> socket_handlers;
+  /**
+   * The sockets watched for send events, and the ones whose receive
+   * events are not watched.
+   */
+  std::unordered_set<socket_t> sending_sockets;
+  std::unordered_set<socket_t> paused_sockets;
+
+  /**
+   * An eventfd written by post(), to interrupt the wait. It is watched
+   * like the sockets, but is not associated with any SocketHandler and is
+   * not counted by size().
+   */
+  int wakeup_fd;
+  /**
+   * The tasks given to post() and not yet executed, protected by
+   * tasks_mutex because they can come from other threads.
+   */
+  std::mutex tasks_mutex;
+  std::vector<std::function<void()>> tasks;
 
 #if POLLER == POLL
   struct pollfd fds[MAX_POLL_FD_NUMBER];
@@ -1,56 +1,80 @@
-#include <network/dns_handler.hpp>
-#include <utils/timed_events.hpp>
 #include <network/resolver.hpp>
+#ifndef UDNS_FOUND
+# include <network/getaddrinfo_pool.hpp>
+#endif
+#include <algorithm>
 #include <cstring>
 #include <arpa/inet.h>
 #include <netinet/in.h>
-#ifdef UDNS_FOUND
-# include <udns.h>
-#endif
-
-#include <fstream>
-#include <cstdlib>
-#include <sstream>
-#include <chrono>
-#include <map>
-
-using namespace std::string_literals;
-
-#ifdef UDNS_FOUND
-static std::map<int, std::string> dns_error_messages {
-    {DNS_E_TEMPFAIL, "Timeout while contacting DNS servers"},
-    {DNS_E_PROTOCOL, "Misformatted DNS reply"},
-    {DNS_E_NXDOMAIN, "Domain name not found"},
-    {DNS_E_NODATA, "Domain name not found"},
-    {DNS_E_NOMEM, "Out of memory"},
-    {DNS_E_BADQUERY, "Misformatted domain name"}
-};
-#endif
 
 Resolver::Resolver():
-#ifdef UDNS_FOUND
-  resolved4(false),
-  resolved6(false),
   resolving(false),
+  hostname{},
   port{},
+#ifndef UDNS_FOUND
+  request_id(0),
 #endif
   resolved(false),
   error_msg{}
 {
 }
 
+Resolver::~Resolver()
+{
+  this->clear();
+}
+
 void Resolver::resolve(const std::string& hostname, const std::string& port,
                        SuccessCallbackType success_cb, ErrorCallbackType error_cb)
 {
   this->error_cb = std::move(error_cb);
   this->success_cb = std::move(success_cb);
-#ifdef UDNS_FOUND
+  this->cancel();
+  this->hostname = hostname;
   this->port = port;
-#endif
 
   this->start_resolving(hostname, port);
 }
 
+void Resolver::clear()
+{
+  this->cancel();
+  this->resolving = false;
+  this->hostname.clear();
+  this->port.clear();
+  this->resolved = false;
+  this->addr.reset();
+  this->error_msg.clear();
+}
+
+void Resolver::cancel()
+{
+  if (!this->resolving)
+    return;
+#ifdef UDNS_FOUND
+  DNSCache::instance().cancel(this->hostname, this);
+#else
+  if (auto pool = GetaddrinfoPool::get())
+    pool->cancel(this->request_id);
+#endif
+}
+
+void Resolver::on_resolved()
+{
+  this->resolved = true;
+  this->resolving = false;
+  if (!this->addr)
+    {
+      if (this->error_cb)
+        this->error_cb(this->error_msg.data());
+    }
+  else
+    {
+      if (this->success_cb)
+        this->success_cb(this->addr.get());
+    }
+}
+
 int Resolver::call_getaddrinfo(const char *name, const char* port, int flags)
 {
   struct addrinfo hints{};
@@ -84,8 +108,6 @@ void Resolver::start_resolving(const std::string& hostname, const std::string& p
 {
   this->resolving = true;
   this->resolved = false;
-  this->resolved4 = false;
-  this->resolved6 = false;
 
   this->error_msg.clear();
   this->addr.reset(nullptr);
@@ -98,177 +120,61 @@ void Resolver::start_resolving(const std::string& hostname, const std::string& p
       return;
     }
 
-  // Then we look into /etc/hosts to translate the given hostname
-  const auto hosts = this->look_in_etc_hosts(hostname);
-  if (!hosts.empty())
-    {
-      for (const auto &host: hosts)
-        this->call_getaddrinfo(host.data(), port.data(), AI_NUMERICHOST);
-      this->on_resolved();
-      return;
-    }
-
-  // And finally, we try a DNS resolution
-  auto hostname6_resolved = [](dns_ctx*, dns_rr_a6* result, void* data)
-  {
-    auto resolver = static_cast<Resolver*>(data);
-    resolver->on_hostname6_resolved(result);
-    resolver->after_resolved();
-    std::free(result);
-  };
-
-  auto hostname4_resolved = [](dns_ctx*, dns_rr_a4* result, void* data)
-  {
-    auto resolver = static_cast<Resolver*>(data);
-    resolver->on_hostname4_resolved(result);
-    resolver->after_resolved();
-    std::free(result);
-  };
-
-  DNSHandler::watch();
-  auto res = dns_submit_a4(nullptr, hostname.data(), 0, hostname4_resolved, this);
-  if (!res)
-    this->on_hostname4_resolved(nullptr);
-  res = dns_submit_a6(nullptr, hostname.data(), 0, hostname6_resolved, this);
-  if (!res)
-    this->on_hostname6_resolved(nullptr);
-
-  this->start_timer();
-}
-
-void Resolver::start_timer()
-{
-  const auto timeout = dns_timeouts(nullptr, -1, 0);
-  if (timeout < 0)
-    return;
-  TimedEvent event(std::chrono::steady_clock::now() + std::chrono::seconds(timeout), [this]() { this->start_timer(); }, "DNS");
-  TimedEventsManager::instance().add_event(std::move(event));
-}
-
-std::vector<std::string> Resolver::look_in_etc_hosts(const std::string &hostname)
-{
-  std::ifstream hosts("/etc/hosts");
-  std::string line;
-
-  std::vector<std::string> results;
-  while (std::getline(hosts, line))
-    {
-      if (line.empty())
-        continue;
-
-      std::string ip;
-      std::istringstream line_stream(line);
-      line_stream >> ip;
-      if (ip.empty() || ip[0] == '#')
-        continue;
-
-      std::string host;
-      while (line_stream >> host && !host.empty() && host[0] != '#')
-        {
-          if (hostname == host)
-            {
-              results.push_back(ip);
-              break;
-            }
-        }
-    }
-  return results;
-}
-
-void Resolver::on_hostname4_resolved(dns_rr_a4 *result)
-{
-  this->resolved4 = true;
-
-  const auto status = dns_status(nullptr);
-
-  if (status >= 0 && result)
-    {
-      char buf[INET6_ADDRSTRLEN];
-
-      for (auto i = 0; i < result->dnsa4_nrr; ++i)
-        {
-          inet_ntop(AF_INET, &result->dnsa4_addr[i], buf, sizeof(buf));
-          this->call_getaddrinfo(buf, this->port.data(), AI_NUMERICHOST);
-        }
-    }
-  else
-    {
-      const auto error = dns_error_messages.find(status);
-      if (error != end(dns_error_messages))
-        this->error_msg = error->second;
-    }
-}
-
-void Resolver::on_hostname6_resolved(dns_rr_a6 *result)
-{
-  this->resolved6 = true;
-
-  const auto status = dns_status(nullptr);
-
-  if (status >= 0 && result)
-    {
-      char buf[INET6_ADDRSTRLEN];
-      for (auto i = 0; i < result->dnsa6_nrr; ++i)
-        {
-          inet_ntop(AF_INET6, &result->dnsa6_addr[i], buf, sizeof(buf));
-          this->call_getaddrinfo(buf, this->port.data(), AI_NUMERICHOST);
-        }
-    }
-  else
-    {
-      const auto error = dns_error_messages.find(status);
-      if (error != end(dns_error_messages))
-        this->error_msg = error->second;
-    }
+  // Then we look into /etc/hosts, our cache, and finally do a DNS
+  // resolution if needed. on_cache_result() is called with the result,
+  // maybe even before this call returns.
+  DNSCache::instance().resolve(hostname, this,
+                               [this](const std::vector<std::string>& addresses, const std::string& error_msg)
+                               {
+                                 this->on_cache_result(addresses, error_msg);
+                               });
 }
 
-void Resolver::after_resolved()
+void Resolver::on_cache_result(const std::vector<std::string>& addresses, const std::string& error_msg)
 {
-  if (dns_active(nullptr) == 0)
-    DNSHandler::unwatch();
-
-  if (this->resolved6 && this->resolved4)
-    this->on_resolved();
-}
-
-void Resolver::on_resolved()
-{
-  this->resolved = true;
-  this->resolving = false;
+  for (const auto& address: addresses)
+    this->call_getaddrinfo(address.data(), this->port.data(), AI_NUMERICHOST);
   if (!this->addr)
-    {
-      if (this->error_cb)
-        this->error_cb(this->error_msg.data());
-    }
-  else
-    {
-      if (this->success_cb)
-        this->success_cb(this->addr.get());
-    }
+    this->error_msg = error_msg;
+  this->on_resolved();
 }
 
 #else  // ifdef UDNS_FOUND
 
 void Resolver::start_resolving(const std::string& hostname, const std::string& port)
 {
+  this->resolving = true;
+  this->resolved = false;
+
+  this->error_msg.clear();
   // If the resolution fails, the addr will be unset
   this->addr.reset(nullptr);
 
-  const auto res = this->call_getaddrinfo(hostname.data(), port.data(), 0);
-
-  this->resolved = true;
-
-  if (res != 0)
+  // We first try to use it as an IP address directly, this never blocks
+  if (this->call_getaddrinfo(hostname.data(), port.data(), AI_NUMERICHOST) == 0)
     {
-      this->error_msg = gai_strerror(res);
-      if (this->error_cb)
-        this->error_cb(this->error_msg.data());
+      this->on_resolved();
+      return;
     }
-  else
+
+  auto pool = GetaddrinfoPool::get();
+  if (!pool)
     {
-      if (this->success_cb)
-        this->success_cb(this->addr.get());
+      const auto res = this->call_getaddrinfo(hostname.data(), port.data(), 0);
+      if (res != 0)
+        this->error_msg = gai_strerror(res);
+      this->on_resolved();
+      return;
     }
+
+  this->request_id = pool->submit(hostname, port,
+                                  [this](int res, GetaddrinfoPool::ResultType addr)
+                                  {
+                                    if (res != 0)
+                                      this->error_msg = gai_strerror(res);
+                                    this->addr = std::move(addr);
+                                    this->on_resolved();
+                                  });
 }
 #endif  // ifdef UDNS_FOUND
 
@@ -285,3 +191,42 @@ std::string addr_to_string(const struct addrinfo* rp)
                        buf, sizeof(buf));
   return {};
 }
+
+std::string addr_to_string(const struct sockaddr* addr)
+{
+  char buf[INET6_ADDRSTRLEN];
+  if (addr->sa_family == AF_INET)
+    return ::inet_ntop(AF_INET, &reinterpret_cast<const sockaddr_in*>(addr)->sin_addr, buf, sizeof(buf));
+  else if (addr->sa_family == AF_INET6)
+    {
+      const auto& addr6 = reinterpret_cast<const sockaddr_in6*>(addr)->sin6_addr;
+      if (IN6_IS_ADDR_V4MAPPED(&addr6))
+        return ::inet_ntop(AF_INET, &addr6.s6_addr[12], buf, sizeof(buf));
+      return ::inet_ntop(AF_INET6, &addr6, buf, sizeof(buf));
+    }
+  return {};
+}
+
+std::vector<const struct addrinfo*> interleave_address_families(const struct addrinfo* list)
+{
+  std::vector<const struct addrinfo*> preferred;
+  std::vector<const struct addrinfo*> others;
+  for (const struct addrinfo* rp = list; rp; rp = rp->ai_next)
+    {
+      if (rp->ai_family == list->ai_family)
+        preferred.push_back(rp);
+      else
+        others.push_back(rp);
+    }
+
+  std::vector<const struct addrinfo*> res;
+  res.reserve(preferred.size() + others.size());
+  for (std::size_t i = 0; i < std::max(preferred.size(), others.size()); ++i)
+    {
+      if (i < preferred.size())
+        res.push_back(preferred[i]);
+      if (i < others.size())
+        res.push_back(others[i]);
+    }
+  return res;
+}
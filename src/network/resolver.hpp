@@ -3,6 +3,7 @@
 #include "biboumi.h"
 
 #include <functional>
+#include <cstdint>
 #include <vector>
 #include <memory>
 #include <string>
@@ -11,7 +12,7 @@
 #include <sys/socket.h>
 #include <netdb.h>
 #ifdef UDNS_FOUND
-# include <udns.h>
+# include <network/dns_cache.hpp>
 #endif
 
 class AddrinfoDeleter
@@ -32,7 +33,7 @@ public:
   using SuccessCallbackType = std::function<void(const struct addrinfo*)>;
 
   Resolver();
-  ~Resolver() = default;
+  ~Resolver();
   Resolver(const Resolver&) = delete;
   Resolver(Resolver&&) = delete;
   Resolver& operator=(const Resolver&) = delete;
@@ -40,11 +41,7 @@ public:
 
   bool is_resolving() const
   {
-#ifdef UDNS_FOUND
     return this->resolving;
-#else
-    return false;
-#endif
   }
 
   bool is_resolved() const
@@ -61,50 +58,43 @@ public:
     return this->error_msg;
   }
 
-  void clear()
-  {
-#ifdef UDNS_FOUND
-    this->resolved6 = false;
-    this->resolved4 = false;
-    this->resolving = false;
-    this->port.clear();
-#endif
-    this->resolved = false;
-    this->addr.reset();
-    this->error_msg.clear();
-  }
+  void clear();
 
   void resolve(const std::string& hostname, const std::string& port,
                SuccessCallbackType success_cb, ErrorCallbackType error_cb);
 
+#ifdef UDNS_FOUND
+  /**
+   * Called by the DNSCache, with the addresses found for our hostname, or
+   * the error message if there is none.
+   */
+  void on_cache_result(const std::vector<std::string>& addresses, const std::string& error_msg);
+#endif
+
 private:
   void start_resolving(const std::string& hostname, const std::string& port);
-  std::vector<std::string> look_in_etc_hosts(const std::string& hostname);
   /**
    * Call getaddrinfo() on the given hostname or IP, and append the result
    * to our internal addrinfo list. Return getaddrinfo()’s return value.
    */
   int call_getaddrinfo(const char* name, const char* port, int flags);
 
-#ifdef UDNS_FOUND
-  void on_hostname4_resolved(dns_rr_a4 *result);
-  void on_hostname6_resolved(dns_rr_a6 *result);
   /**
-   * Called after one record (4 or 6) has been resolved.
+   * Stop waiting for the result of the current resolution, if any.
    */
-  void after_resolved();
-
-  void start_timer();
-
+  void cancel();
   void on_resolved();
 
-  bool resolved4;
-  bool resolved6;
-
   bool resolving;
 
+  std::string hostname;
   std::string port;
 
+#ifndef UDNS_FOUND
+  /**
+   * The identifier of our request in the GetaddrinfoPool, if resolving.
+   */
+  std::uint64_t request_id;
 #endif
  /**
   * Tells if we finished the resolution process. It doesn't indicate if it
@@ -120,3 +110,17 @@ private:
 };
 
 std::string addr_to_string(const struct addrinfo* rp);
+/**
+ * The numeric form of an IPv4 or IPv6 address, an empty string for the
+ * other families.  An IPv4 address mapped into an IPv6 one is given in its
+ * IPv4 form.
+ */
+std::string addr_to_string(const struct sockaddr* addr);
+
+/**
+ * Return the addresses of the given list, ordered as recommended by RFC
+ * 8305: the first address of the list (which is the preferred one,
+ * according to getaddrinfo()), then alternating between the other
+ * address family and that one, keeping the relative order of each family.
+ */
+std::vector<const struct addrinfo*> interleave_address_families(const struct addrinfo* list);
@@ -0,0 +1,137 @@
+#include <network/signal_handler.hpp>
+#include <network/poller.hpp>
+#include <logger/logger.hpp>
+
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+
+#include <unistd.h>
+#ifdef HAS_SIGNALFD
+# include <sys/signalfd.h>
+#else
+# include <fcntl.h>
+#endif
+
+using namespace std::string_literals;
+
+static sigset_t make_signal_set(const std::vector<int>& signals)
+{
+  sigset_t mask{};
+  sigemptyset(&mask);
+  for (const auto sig: signals)
+    sigaddset(&mask, sig);
+  return mask;
+}
+
+#ifndef HAS_SIGNALFD
+int SignalHandler::write_end = -1;
+
+void SignalHandler::write_signal_number(int sig)
+{
+  const auto saved_errno = errno;
+  const auto number = static_cast<unsigned char>(sig);
+  const auto written = ::write(SignalHandler::write_end, &number, sizeof(number));
+  static_cast<void>(written);
+  errno = saved_errno;
+}
+#endif
+
+SignalHandler::SignalHandler(std::shared_ptr<Poller>& poller, std::vector<int> signals,
+                             CallbackType callback):
+  SocketHandler(poller, -1),
+  signals(std::move(signals)),
+  callback(std::move(callback))
+{
+  const auto mask = make_signal_set(this->signals);
+#ifdef HAS_SIGNALFD
+  SignalHandler::block(this->signals);
+  this->socket = ::signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (this->socket == -1)
+    throw std::runtime_error("Failed to create the signalfd: "s + strerror(errno));
+#else
+  if (SignalHandler::write_end != -1)
+    throw std::runtime_error("Only one SignalHandler can exist at a time");
+  int fds[2];
+  if (::pipe(fds) == -1)
+    throw std::runtime_error("Failed to create the signal pipe: "s + strerror(errno));
+  for (const auto fd: fds)
+    {
+      ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+      ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+  this->socket = fds[0];
+  SignalHandler::write_end = fds[1];
+
+  struct sigaction action{};
+  action.sa_handler = &SignalHandler::write_signal_number;
+  // All signals must be blocked while a signal handler is running
+  sigfillset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  for (const auto sig: this->signals)
+    ::sigaction(sig, &action, nullptr);
+  // Only in this thread: the threads started after a call to block() keep
+  // them blocked, but the handler can run in any thread anyway
+  ::pthread_sigmask(SIG_UNBLOCK, &mask, nullptr);
+#endif
+  this->poller->add_socket_handler(this);
+}
+
+SignalHandler::~SignalHandler()
+{
+  this->destroy();
+}
+
+void SignalHandler::block(const std::vector<int>& signals)
+{
+  const auto mask = make_signal_set(signals);
+  ::pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+}
+
+void SignalHandler::on_recv()
+{
+  // The callback may destroy us, in which case we stop reading
+  while (this->socket != -1)
+    {
+#ifdef HAS_SIGNALFD
+      struct signalfd_siginfo info;
+      const auto size = ::read(this->socket, &info, sizeof(info));
+      if (size != sizeof(info))
+        break;
+      this->callback(static_cast<int>(info.ssi_signo));
+#else
+      unsigned char number;
+      const auto size = ::read(this->socket, &number, sizeof(number));
+      if (size != sizeof(number))
+        break;
+      this->callback(number);
+#endif
+    }
+  if (this->socket != -1 && errno != EAGAIN)
+    log_error("Failed to read the received signals: ", strerror(errno));
+}
+
+bool SignalHandler::is_connected() const
+{
+  return true;
+}
+
+void SignalHandler::destroy()
+{
+  if (this->socket == -1)
+    return;
+  if (this->poller->is_managing_socket(this->socket))
+    this->poller->remove_socket_handler(this->socket);
+  ::close(this->socket);
+  this->socket = -1;
+#ifndef HAS_SIGNALFD
+  ::close(SignalHandler::write_end);
+  SignalHandler::write_end = -1;
+#endif
+
+  for (const auto sig: this->signals)
+    ::signal(sig, SIG_DFL);
+  const auto mask = make_signal_set(this->signals);
+  ::pthread_sigmask(SIG_UNBLOCK, &mask, nullptr);
+}
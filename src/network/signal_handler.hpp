@@ -0,0 +1,71 @@
+#pragma once
+
+#include <biboumi.h>
+
+#include <network/socket_handler.hpp>
+
+#include <functional>
+#include <vector>
+
+/**
+ * Receive some signals like any other event of the poller, instead of
+ * having them interrupt whatever we are doing.
+ *
+ * On linux, the signals are blocked and read from a signalfd. Elsewhere, a
+ * minimal signal handler writes their number into a pipe, and we watch its
+ * other end (only one SignalHandler can exist in that case).
+ *
+ * The signals are blocked only in the thread creating the SignalHandler,
+ * and in the threads it starts afterwards. With a signalfd, a thread
+ * started before would still receive them with their default behaviour,
+ * so they must be blocked (with block()) before starting any thread.
+ */
+class SignalHandler: public SocketHandler
+{
+public:
+  /**
+   * Called with the number of each received signal, from the poller’s
+   * loop.
+   */
+  using CallbackType = std::function<void(const int)>;
+
+  explicit SignalHandler(std::shared_ptr<Poller>& poller, std::vector<int> signals,
+                         CallbackType callback);
+  ~SignalHandler();
+  SignalHandler(const SignalHandler&) = delete;
+  SignalHandler(SignalHandler&&) = delete;
+  SignalHandler& operator=(const SignalHandler&) = delete;
+  SignalHandler& operator=(SignalHandler&&) = delete;
+
+  /**
+   * Read all the received signals and call the callback for each of them.
+   */
+  void on_recv() override final;
+  bool is_connected() const override final;
+
+  /**
+   * Stop watching the signals. They get their default behaviour back:
+   * receiving one of them again usually terminates the process.
+   */
+  void destroy();
+
+  /**
+   * Block the given signals in the calling thread, and in all the threads
+   * it will create.
+   */
+  static void block(const std::vector<int>& signals);
+
+private:
+  const std::vector<int> signals;
+  CallbackType callback;
+#ifndef HAS_SIGNALFD
+  /**
+   * The signal handler, writing the signal number into write_end.
+   */
+  static void write_signal_number(int sig);
+  /**
+   * The end of the pipe written by the signal handler.
+   */
+  static int write_end;
+#endif
+};
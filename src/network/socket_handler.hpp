@@ -2,6 +2,7 @@
 
 #include <biboumi.h>
 #include <memory>
+#include <string>
 
 class Poller;
 
@@ -24,6 +25,11 @@ public:
   virtual void on_send() {}
   virtual void connect() {}
   virtual bool is_connected() const = 0;
+  /**
+   * What this socket is used for, in the logs about the slow callbacks.
+   */
+  virtual std::string describe() const
+  { return "socket " + std::to_string(this->socket); }
 
   socket_t get_socket() const
   { return this->socket; }
@@ -5,15 +5,27 @@
 
 #include <logger/logger.hpp>
 
+#include <algorithm>
+#include <cstdint>
 #include <cstring>
 #include <unistd.h>
 #include <fcntl.h>
 
 using namespace std::string_literals;
 
+constexpr std::chrono::milliseconds TCPClientSocketHandler::connection_attempt_delay;
+
+std::unordered_multimap<std::uint32_t, const TCPClientSocketHandler*> TCPClientSocketHandler::by_port_pair;
+
+static std::uint32_t port_pair_key(const uint16_t local, const uint16_t remote)
+{
+  return static_cast<std::uint32_t>(local) << 16 | remote;
+}
+
 TCPClientSocketHandler::TCPClientSocketHandler(std::shared_ptr<Poller>& poller):
    TCPSocketHandler(poller),
    hostname_resolution_failed(false),
+   events_suffix(std::to_string(reinterpret_cast<std::uintptr_t>(this))),
    connected(false),
    connecting(false)
 {}
@@ -21,14 +33,15 @@ TCPClientSocketHandler::TCPClientSocketHandler(std::shared_ptr<Poller>& poller):
 TCPClientSocketHandler::~TCPClientSocketHandler()
 {
   this->close();
+  TimedEventsManager::instance().cancel("connection_attempts_cleanup" + this->events_suffix);
 }
 
-void TCPClientSocketHandler::init_socket(const struct addrinfo* rp)
+socket_t TCPClientSocketHandler::create_socket(const struct addrinfo* rp) const
 {
-  if (this->socket != -1)
-    ::close(this->socket);
-  if ((this->socket = ::socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol)) == -1)
+  const socket_t socket = ::socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+  if (socket == -1)
     throw std::runtime_error("Could not create socket: "s + std::strerror(errno));
+  utils::ScopeGuard close_on_error([socket]() { ::close(socket); });
   // Bind the socket to a specific address, if specified
   if (!this->bind_addr.empty())
     {
@@ -48,7 +61,7 @@ void TCPClientSocketHandler::init_socket(const struct addrinfo* rp)
           utils::ScopeGuard sg([result](){ freeaddrinfo(result); });
           for (; result; result = result->ai_next)
             {
-              if ((::bind(this->socket,
+              if ((::bind(socket,
                          reinterpret_cast<const struct sockaddr*>(result->ai_addr),
                          result->ai_addrlen)) == 0)
                 break;
@@ -61,15 +74,17 @@ void TCPClientSocketHandler::init_socket(const struct addrinfo* rp)
         }
     }
   int optval = 1;
-  if (::setsockopt(this->socket, SOL_SOCKET, SO_KEEPALIVE, &optval, sizeof(optval)) == -1)
+  if (::setsockopt(socket, SOL_SOCKET, SO_KEEPALIVE, &optval, sizeof(optval)) == -1)
     log_warning("Failed to enable TCP keepalive on socket: ", strerror(errno));
   // Set the socket on non-blocking mode.  This is useful to receive a EAGAIN
   // error when connect() would block, to not block the whole process if a
   // remote is not responsive.
-  const int existing_flags = ::fcntl(this->socket, F_GETFL, 0);
+  const int existing_flags = ::fcntl(socket, F_GETFL, 0);
   if ((existing_flags == -1) ||
-      (::fcntl(this->socket, F_SETFL, existing_flags | O_NONBLOCK) == -1))
+      (::fcntl(socket, F_SETFL, existing_flags | O_NONBLOCK) == -1))
     throw std::runtime_error("Could not initialize socket: "s + std::strerror(errno));
+  close_on_error.disable();
+  return socket;
 }
 
 void TCPClientSocketHandler::connect(const std::string& address, const std::string& port, const bool tls)
@@ -78,139 +93,275 @@ void TCPClientSocketHandler::connect(const std::string& address, const std::stri
   this->port = port;
   this->use_tls = tls;
 
-  struct addrinfo* addr_res;
+  // Our connection attempts are already racing, they will call us back
+  if (this->connecting)
+    return;
+
+  // Get the addrinfo from getaddrinfo (or using udns), only if
+  // this is the first call of this function.
+  if (!this->resolver.is_resolved())
+    {
+      log_info("Trying to connect to ", address, ":", port);
+      // Start the asynchronous process of resolving the hostname. Once
+      // the addresses have been found and `resolved` has been set to true
+      // (but connecting will still be false), TCPClientSocketHandler::connect()
+      // needs to be called, again.
+      this->resolver.resolve(address, port,
+                             [this](const struct addrinfo*)
+                             {
+                               log_debug("Resolution success, calling connect() again");
+                               this->connect();
+                             },
+                             [this](const char*)
+                             {
+                               log_debug("Resolution failed, calling connect() again");
+                               this->connect();
+                             });
+      return;
+    }
+
+  // The DNS resolver resolved the hostname and the available addresses
+  // where saved in the addrinfo linked list. Now, just use
+  // this list to try to connect.
+  const struct addrinfo* addr_res = this->resolver.get_result().get();
+  if (!addr_res)
+    {
+      this->hostname_resolution_failed = true;
+      const auto msg = this->resolver.get_error_message();
+      this->close();
+      this->on_connection_failed(msg);
+      return ;
+    }
+
+  this->connect_to(interleave_address_families(addr_res));
+}
+
+void TCPClientSocketHandler::connect_to(std::vector<const struct addrinfo*> addresses)
+{
+  this->addresses = std::move(addresses);
+  this->next_address = 0;
+  this->last_error.clear();
+  this->connecting = true;
+  this->start_next_attempt();
+}
+
+void TCPClientSocketHandler::start_next_attempt()
+{
+  TimedEventsManager::instance().cancel("connection_attempt" + this->events_suffix);
 
-  if (!this->connecting)
+  while (this->next_address < this->addresses.size())
     {
-      // Get the addrinfo from getaddrinfo (or using udns), only if
-      // this is the first call of this function.
-      if (!this->resolver.is_resolved())
+      const struct addrinfo* rp = this->addresses[this->next_address++];
+      this->display_resolved_ip(rp);
+
+      socket_t socket;
+      try {
+        socket = this->create_socket(rp);
+      }
+      catch (const std::runtime_error& error) {
+        log_error("Failed to init socket: ", error.what());
+        this->last_error = error.what();
+        continue;
+      }
+
+      if (::connect(socket, rp->ai_addr, rp->ai_addrlen) == 0)
         {
-          log_info("Trying to connect to ", address, ":", port);
-          // Start the asynchronous process of resolving the hostname. Once
-          // the addresses have been found and `resolved` has been set to true
-          // (but connecting will still be false), TCPClientSocketHandler::connect()
-          // needs to be called, again.
-          this->resolver.resolve(address, port,
-                                 [this](const struct addrinfo*)
-                                 {
-                                   log_debug("Resolution success, calling connect() again");
-                                   this->connect();
-                                 },
-                                 [this](const char*)
-                                 {
-                                   log_debug("Resolution failed, calling connect() again");
-                                   this->connect();
-                                 });
-          return;
+          this->on_socket_connected(socket, *rp);
+          return ;
         }
-      else
+      else if (errno == EINPROGRESS)
         {
-          // The DNS resolver resolved the hostname and the available addresses
-          // where saved in the addrinfo linked list. Now, just use
-          // this list to try to connect.
-          addr_res = this->resolver.get_result().get();
-          if (!addr_res)
-            {
-              this->hostname_resolution_failed = true;
-              const auto msg = this->resolver.get_error_message();
-              this->close();
-              this->on_connection_failed(msg);
-              return ;
-            }
+          this->attempts.push_back(std::make_unique<ConnectionAttempt>(this->poller, socket, rp,
+                                                                       [this](ConnectionAttempt& attempt, const int error)
+                                                                       {
+                                                                         this->on_attempt_done(attempt, error);
+                                                                       }));
+          // If this attempt does not succeed or fail quickly, race it
+          // with the next address
+          if (this->next_address < this->addresses.size())
+            TimedEventsManager::instance().add_event(
+                TimedEvent(std::chrono::steady_clock::now() + connection_attempt_delay,
+                           std::bind(&TCPClientSocketHandler::start_next_attempt, this),
+                           "connection_attempt" + this->events_suffix));
+          // If the connection has not succeeded or failed in 5s after the
+          // last attempt was started, we consider it to have failed
+          TimedEventsManager::instance().cancel("connection_timeout" + this->events_suffix);
+          TimedEventsManager::instance().add_event(
+              TimedEvent(std::chrono::steady_clock::now() + 5s,
+                         std::bind(&TCPClientSocketHandler::on_connection_timeout, this),
+                         "connection_timeout" + this->events_suffix));
+          return ;
         }
+      this->last_error = std::strerror(errno);
+      log_info("Connection failed:", this->last_error);
+      ::close(socket);
     }
-  else
-    { // This function is called again, use the saved addrinfo structure,
-      // instead of re-doing the whole getaddrinfo process.
-      addr_res = &this->addrinfo;
+
+  if (this->attempts.empty())
+    {
+      log_error("All connection attempts failed.");
+      const auto error = this->last_error;
+      this->close();
+      this->on_connection_failed(error);
     }
+}
 
-  for (struct addrinfo* rp = addr_res; rp; rp = rp->ai_next)
+void TCPClientSocketHandler::on_attempt_done(ConnectionAttempt& attempt, const int error)
+{
+  // Two attempts may complete in the same batch of events: once the first
+  // one won, the others have been aborted and must be ignored
+  if (this->connected)
+    return;
+  const auto it = std::find_if(this->attempts.begin(), this->attempts.end(),
+                               [&attempt](const std::unique_ptr<ConnectionAttempt>& a)
+                               {
+                                 return a.get() == &attempt;
+                               });
+  if (it == this->attempts.end())
+    return;
+  if (error == 0)
     {
-      if (!this->connecting)
-        {
-          try {
-            this->init_socket(rp);
-          }
-          catch (const std::runtime_error& error) {
-            log_error("Failed to init socket: ", error.what());
-            break;
-          }
-        }
+      const auto socket = attempt.release();
+      const auto rp = attempt.get_addrinfo();
+      this->discard_attempt(attempt);
+      this->on_socket_connected(socket, rp);
+      return ;
+    }
+  this->last_error = std::strerror(error);
+  log_info("Connection to ", addr_to_string(&attempt.get_addrinfo()), " failed: ", this->last_error);
+  attempt.abort();
+  this->discard_attempt(attempt);
+  // Do not wait for the delay to try the next address
+  this->start_next_attempt();
+}
 
-      this->display_resolved_ip(rp);
+void TCPClientSocketHandler::on_socket_connected(const socket_t socket, const struct addrinfo& rp)
+{
+  this->abort_attempts();
+  TimedEventsManager::instance().cancel("connection_attempt" + this->events_suffix);
+  TimedEventsManager::instance().cancel("connection_timeout" + this->events_suffix);
 
-      if (::connect(this->socket, rp->ai_addr, rp->ai_addrlen) == 0
-          || errno == EISCONN)
-        {
-          log_info("Connection success.");
+  this->socket = socket;
+  log_info("Connection success.");
 #ifdef BOTAN_FOUND
-          if (this->use_tls)
-            try {
-                this->start_tls(this->address, this->port);
-              } catch (const Botan::Exception& e)
-              {
-                this->on_connection_failed("TLS error: "s + e.what());
-                this->close();
-                return ;
-              }
+  if (this->use_tls)
+    try {
+        this->start_tls(this->address, this->port);
+      } catch (const Botan::Exception& e)
+      {
+        this->on_connection_failed("TLS error: "s + e.what());
+        this->close();
+        return ;
+      }
 #endif
-          TimedEventsManager::instance().cancel("connection_timeout" +
-                                                std::to_string(this->socket));
-          this->poller->add_socket_handler(this);
-          this->connected = true;
-          this->connecting = false;
-          this->connection_date = std::chrono::system_clock::now();
-
-          // Get our local TCP port and store it
-          this->local_port = static_cast<uint16_t>(-1);
-          if (rp->ai_family == AF_INET6)
-            {
-              struct sockaddr_in6 a{};
-              socklen_t l = sizeof(a);
-              if (::getsockname(this->socket, (struct sockaddr*)&a, &l) != -1)
-                this->local_port = ntohs(a.sin6_port);
-            }
-          else if (rp->ai_family == AF_INET)
-            {
-              struct sockaddr_in a{};
-              socklen_t l = sizeof(a);
-              if (::getsockname(this->socket, (struct sockaddr*)&a, &l) != -1)
-                this->local_port = ntohs(a.sin_port);
-            }
+  this->watch_socket();
+  this->connected = true;
+  this->connecting = false;
+  this->connection_date = std::chrono::system_clock::now();
+
+  // Get our local and remote TCP ports and store them
+  this->local_port = static_cast<uint16_t>(-1);
+  this->remote_port = static_cast<uint16_t>(-1);
+  if (rp.ai_family == AF_INET6)
+    {
+      struct sockaddr_in6 a{};
+      socklen_t l = sizeof(a);
+      if (::getsockname(this->socket, (struct sockaddr*)&a, &l) != -1)
+        this->local_port = ntohs(a.sin6_port);
+      this->remote_port = ntohs(reinterpret_cast<const struct sockaddr_in6*>(rp.ai_addr)->sin6_port);
+    }
+  else if (rp.ai_family == AF_INET)
+    {
+      struct sockaddr_in a{};
+      socklen_t l = sizeof(a);
+      if (::getsockname(this->socket, (struct sockaddr*)&a, &l) != -1)
+        this->local_port = ntohs(a.sin_port);
+      this->remote_port = ntohs(reinterpret_cast<const struct sockaddr_in*>(rp.ai_addr)->sin_port);
+    }
+  this->remote_address = addr_to_string(rp.ai_addr);
+  TCPClientSocketHandler::by_port_pair.emplace(port_pair_key(this->local_port, this->remote_port), this);
 
-          log_debug("Local port: ", this->local_port, ", and remote port: ", this->port);
+  log_debug("Local port: ", this->local_port, ", and remote port: ", this->remote_port);
 
-          this->on_connected();
-          return ;
+  this->on_connected();
+}
+
+void TCPClientSocketHandler::use_connected_socket(const socket_t socket)
+{
+  this->abort_attempts();
+  this->socket = socket;
+  this->use_tls = false;
+  this->watch_socket();
+  this->connected = true;
+  this->connecting = false;
+  this->connection_date = std::chrono::system_clock::now();
+  this->on_connected();
+}
+
+void TCPClientSocketHandler::resume_connected_socket(const socket_t socket, const std::string& address,
+                                                     const std::string& port)
+{
+  this->abort_attempts();
+  this->address = address;
+  this->port = port;
+  this->socket = socket;
+  this->use_tls = false;
+  this->watch_socket();
+  this->connected = true;
+  this->connecting = false;
+  this->connection_date = std::chrono::system_clock::now();
+
+  struct sockaddr_storage local{};
+  struct sockaddr_storage remote{};
+  socklen_t local_size = sizeof(local);
+  socklen_t remote_size = sizeof(remote);
+  this->local_port = static_cast<uint16_t>(-1);
+  this->remote_port = static_cast<uint16_t>(-1);
+  if (::getsockname(this->socket, reinterpret_cast<struct sockaddr*>(&local), &local_size) != -1 &&
+      ::getpeername(this->socket, reinterpret_cast<struct sockaddr*>(&remote), &remote_size) != -1)
+    {
+      if (local.ss_family == AF_INET6)
+        {
+          this->local_port = ntohs(reinterpret_cast<const struct sockaddr_in6*>(&local)->sin6_port);
+          this->remote_port = ntohs(reinterpret_cast<const struct sockaddr_in6*>(&remote)->sin6_port);
         }
-      else if (errno == EINPROGRESS || errno == EALREADY)
-        {   // retry this process later, when the socket
-            // is ready to be written on.
-          this->connecting = true;
-          this->poller->add_socket_handler(this);
-          this->poller->watch_send_events(this);
-          // Save the addrinfo structure, to use it on the next call
-          this->ai_addrlen = rp->ai_addrlen;
-          memcpy(&this->ai_addr, rp->ai_addr, this->ai_addrlen);
-          memcpy(&this->addrinfo, rp, sizeof(struct addrinfo));
-          this->addrinfo.ai_addr = reinterpret_cast<struct sockaddr*>(&this->ai_addr);
-          this->addrinfo.ai_next = nullptr;
-          // If the connection has not succeeded or failed in 5s, we consider
-          // it to have failed
-          TimedEventsManager::instance().add_event(
-                                                   TimedEvent(std::chrono::steady_clock::now() + 5s,
-                                                              std::bind(&TCPClientSocketHandler::on_connection_timeout, this),
-                                                              "connection_timeout" + std::to_string(this->socket)));
-          return ;
+      else if (local.ss_family == AF_INET)
+        {
+          this->local_port = ntohs(reinterpret_cast<const struct sockaddr_in*>(&local)->sin_port);
+          this->remote_port = ntohs(reinterpret_cast<const struct sockaddr_in*>(&remote)->sin_port);
         }
-      log_info("Connection failed:", std::strerror(errno));
+      this->remote_address = addr_to_string(reinterpret_cast<const struct sockaddr*>(&remote));
     }
-  log_error("All connection attempts failed.");
-  this->close();
-  this->on_connection_failed(std::strerror(errno));
-  return ;
+  TCPClientSocketHandler::by_port_pair.emplace(port_pair_key(this->local_port, this->remote_port), this);
+}
+
+void TCPClientSocketHandler::abort_attempts()
+{
+  while (!this->attempts.empty())
+    {
+      auto& attempt = *this->attempts.back();
+      attempt.abort();
+      this->discard_attempt(attempt);
+    }
+}
+
+void TCPClientSocketHandler::discard_attempt(ConnectionAttempt& attempt)
+{
+  const auto it = std::find_if(this->attempts.begin(), this->attempts.end(),
+                               [&attempt](const std::unique_ptr<ConnectionAttempt>& a)
+                               {
+                                 return a.get() == &attempt;
+                               });
+  if (it == this->attempts.end())
+    return;
+  this->finished_attempts.push_back(std::move(*it));
+  this->attempts.erase(it);
+
+  const auto cleanup_name = "connection_attempts_cleanup" + this->events_suffix;
+  if (!TimedEventsManager::instance().find_event(cleanup_name))
+    TimedEventsManager::instance().add_event(TimedEvent(std::chrono::steady_clock::now(),
+                                                        [this]() { this->finished_attempts.clear(); },
+                                                        cleanup_name));
 }
 
 void TCPClientSocketHandler::on_connection_timeout()
@@ -226,18 +377,31 @@ void TCPClientSocketHandler::connect()
 
 void TCPClientSocketHandler::close()
 {
-  TimedEventsManager::instance().cancel("connection_timeout" +
-                                        std::to_string(this->socket));
+  TimedEventsManager::instance().cancel("connection_attempt" + this->events_suffix);
+  TimedEventsManager::instance().cancel("connection_timeout" + this->events_suffix);
+  this->abort_attempts();
+
+  if (this->connected)
+    {
+      const auto range = TCPClientSocketHandler::by_port_pair.equal_range(port_pair_key(this->local_port, this->remote_port));
+      const auto it = std::find_if(range.first, range.second, [this](const auto& pair) { return pair.second == this; });
+      if (it != range.second)
+        TCPClientSocketHandler::by_port_pair.erase(it);
+    }
 
   TCPSocketHandler::close();
 
   this->connected = false;
   this->connecting = false;
   this->port.clear();
+  this->addresses.clear();
+  this->next_address = 0;
   this->resolver.clear();
+
+  this->on_closed();
 }
 
-void TCPClientSocketHandler::display_resolved_ip(struct addrinfo* rp) const
+void TCPClientSocketHandler::display_resolved_ip(const struct addrinfo* rp) const
 {
   if (rp->ai_family == AF_INET)
     log_debug("Trying IPv4 address ", addr_to_string(rp));
@@ -260,10 +424,15 @@ std::string TCPClientSocketHandler::get_port() const
   return this->port;
 }
 
-bool TCPClientSocketHandler::match_port_pair(const uint16_t local, const uint16_t remote) const
+const TCPClientSocketHandler* TCPClientSocketHandler::find_by_port_pair(const uint16_t local, const uint16_t remote,
+                                                                        const std::string& remote_address)
 {
-  if (!this->is_connected())
-    return false;
-  const auto remote_port = static_cast<uint16_t>(std::stoi(this->port));
-  return local == this->local_port && remote == remote_port;
+  const auto range = TCPClientSocketHandler::by_port_pair.equal_range(port_pair_key(local, remote));
+  const auto it = std::find_if(range.first, range.second, [&remote_address](const auto& pair)
+  {
+    return pair.second->remote_address == remote_address;
+  });
+  if (it == range.second)
+    return nullptr;
+  return it->second;
 }
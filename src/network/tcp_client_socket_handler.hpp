@@ -1,6 +1,10 @@
 #pragma once
 
 #include <network/tcp_socket_handler.hpp>
+#include <network/connection_attempt.hpp>
+
+#include <unordered_map>
+#include <cstdint>
 
 class TCPClientSocketHandler: public TCPSocketHandler
 {
@@ -11,14 +15,39 @@ class TCPClientSocketHandler: public TCPSocketHandler
    * Connect to the remote server, and call on_connected() if this
    * succeeds. If tls is true, we set use_tls to true and will also call
    * start_tls() when the connection succeeds.
+   *
+   * If the hostname resolves to more than one address, connections are
+   * attempted following RFC 8305 (Happy Eyeballs): the addresses are
+   * sorted to alternate between IPv6 and IPv4, and a new attempt is
+   * started every connection_attempt_delay (or as soon as the previous one
+   * fails) while the previous ones are still in progress. The first one
+   * that succeeds is kept, the others are aborted.
    */
   void connect(const std::string& address, const std::string& port, const bool tls);
   void connect() override final;
   /**
-   * Called by a TimedEvent, when the connection did not succeed or fail
+   * Use the given socket, already connected to something, instead of
+   * connecting to the remote server: used to replay a capture, with one end
+   * of a socketpair. TLS is not used.
+   */
+  void use_connected_socket(const socket_t socket);
+  /**
+   * Use the given socket, connected to the given server by a previous
+   * biboumi process (see src/network/upgrade.hpp), as if we had just
+   * connected it ourself, but without calling on_connected(): the
+   * connection continues where it was.  TLS is not used.
+   */
+  void resume_connected_socket(const socket_t socket, const std::string& address, const std::string& port);
+  /**
+   * Called by a TimedEvent, when no connection attempt succeeded or failed
    * after a given time.
    */
   void on_connection_timeout();
+  /**
+   * The delay after which we start connecting to the next address, if no
+   * connection attempt succeeded yet.
+   */
+  static constexpr std::chrono::milliseconds connection_attempt_delay{250};
   /**
    * Called when the connection is successful.
    */
@@ -29,12 +58,24 @@ class TCPClientSocketHandler: public TCPSocketHandler
   std::string get_port() const;
 
   void close() override final;
+  /**
+   * Called at the end of close(), whatever the reason of the closing.
+   */
+  virtual void on_closed() {}
   std::chrono::system_clock::time_point connection_date;
 
   /**
-   * Whether or not this connection is using the two given TCP ports.
+   * Return the connected socket handler using the two given TCP ports, to
+   * the given remote address (in its numeric form), or nullptr if there is
+   * none.
    */
-  bool match_port_pair(const uint16_t local, const uint16_t remote) const;
+  static const TCPClientSocketHandler* find_by_port_pair(const uint16_t local, const uint16_t remote,
+                                                         const std::string& remote_address);
+  /**
+   * The identity that our identd server answers for this connection.
+   */
+  const std::string& get_ident() const
+  { return this->ident; }
 
  protected:
   bool hostname_resolution_failed;
@@ -43,28 +84,78 @@ class TCPClientSocketHandler: public TCPSocketHandler
    * If empty, it’s equivalent to binding to INADDR_ANY.
    */
   std::string bind_addr;
+  /**
+   * Must be set by the subclass before connecting, if it wants to be
+   * identified by our identd server.
+   */
+  std::string ident;
   /**
    * Display the resolved IP, just for information purpose.
    */
-  void display_resolved_ip(struct addrinfo* rp) const;
+  void display_resolved_ip(const struct addrinfo* rp) const;
+  /**
+   * Race connection attempts to the given addresses, in this order. They
+   * must stay valid until the connection succeeds or fails.
+   */
+  void connect_to(std::vector<const struct addrinfo*> addresses);
  private:
   /**
    * Initialize the socket with the parameters contained in the given
    * addrinfo structure.
    */
-  void init_socket(const struct addrinfo* rp);
+  socket_t create_socket(const struct addrinfo* rp) const;
+  /**
+   * Start connecting to the next address in our list, skipping the ones
+   * that fail immediately. If there is none left and no attempt is in
+   * progress, the connection failed.
+   */
+  void start_next_attempt();
+  /**
+   * Called by a ConnectionAttempt when it succeeded or failed.
+   */
+  void on_attempt_done(ConnectionAttempt& attempt, const int error);
+  /**
+   * Use the given connected socket as our own, and finish the connection
+   * process.
+   */
+  void on_socket_connected(const socket_t socket, const struct addrinfo& rp);
+  /**
+   * Abort all the connection attempts in progress.
+   */
+  void abort_attempts();
+  /**
+   * Move the given attempt out of the attempts list. It is kept alive
+   * until the next call of execute_expired_events(), because the poller
+   * may still be holding a pointer to it in its current events list.
+   */
+  void discard_attempt(ConnectionAttempt& attempt);
   /**
    * DNS resolver
    */
   Resolver resolver;
   /**
-   * Keep the details of the addrinfo returned by the resolver that
-   * triggered a EINPROGRESS error when connect()ing to it, to reuse it
-   * directly when connect() is called again.
+   * The resolved addresses, in the order in which we try them. They point
+   * into the resolver’s result, and are thus valid until it is cleared.
+   */
+  std::vector<const struct addrinfo*> addresses;
+  std::size_t next_address{0};
+  /**
+   * The connections currently in progress.
+   */
+  std::vector<std::unique_ptr<ConnectionAttempt>> attempts;
+  /**
+   * The attempts that have been aborted or have failed, waiting to be
+   * destroyed.
+   */
+  std::vector<std::unique_ptr<ConnectionAttempt>> finished_attempts;
+  /**
+   * The error of the last failed attempt, reported if they all fail.
+   */
+  std::string last_error;
+  /**
+   * Appended to the name of our timed events, to make them unique.
    */
-  struct addrinfo addrinfo{};
-  struct sockaddr_in6 ai_addr{};
-  socklen_t ai_addrlen{};
+  const std::string events_suffix;
 
   /**
    * Hostname we are connected/connecting to
@@ -76,6 +167,18 @@ class TCPClientSocketHandler: public TCPSocketHandler
   std::string port;
 
   uint16_t local_port{};
+  uint16_t remote_port{};
+  /**
+   * The numeric form of the address we are connected to, see
+   * addr_to_string().
+   */
+  std::string remote_address;
+  /**
+   * All the connected sockets, indexed by their (local port, remote port)
+   * pair, see port_pair_key().  The connections to different servers can
+   * use the same pair, their remote address tells them apart.
+   */
+  static std::unordered_multimap<std::uint32_t, const TCPClientSocketHandler*> by_port_pair;
 
   bool connected;
   bool connecting;
@@ -17,7 +17,10 @@ template <typename RemoteSocketType>
 class TcpSocketServer: public SocketHandler
 {
  public:
-  TcpSocketServer(std::shared_ptr<Poller>& poller, const uint16_t port):
+  /**
+   * Listen on all the addresses, or only on the given one (IPv4 or IPv6).
+   */
+  TcpSocketServer(std::shared_ptr<Poller>& poller, const uint16_t port, const std::string& address={}):
       SocketHandler(poller, -1)
   {
     if ((this->socket = ::socket(AF_INET6, SOCK_STREAM, 0)) == -1)
@@ -31,6 +34,17 @@ class TcpSocketServer: public SocketHandler
     addr.sin6_family = AF_INET6;
     addr.sin6_port = htons(port);
     addr.sin6_addr = IN6ADDR_ANY_INIT;
+    if (!address.empty())
+      {
+        // Our socket is dual-stack: an IPv4 address is used through its
+        // IPv4-mapped IPv6 address
+        const auto v6_address = address.find(':') == std::string::npos ? "::ffff:" + address : address;
+        if (::inet_pton(AF_INET6, v6_address.data(), &addr.sin6_addr) != 1)
+          {
+            log_warning("Invalid address to listen on: ", address);
+            return;
+          }
+      }
     if ((::bind(this->socket, (const struct sockaddr*)&addr, sizeof(addr))) == -1)
       { // If we can’t listen on this port, we just give up, but this is not fatal.
         log_warning("Failed to bind on port ", std::to_string(port), ": ", std::strerror(errno));
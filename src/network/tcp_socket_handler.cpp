@@ -4,6 +4,9 @@
 #include <network/poller.hpp>
 
 #include <logger/logger.hpp>
+#include <utils/memory_usage.hpp>
+#include <utils/allocations.hpp>
+#include <config/config.hpp>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <stdexcept>
@@ -16,7 +19,6 @@
 # include <botan/hex.h>
 # include <botan/auto_rng.h>
 # include <botan/tls_exceptn.h>
-# include <config/config.hpp>
 # include <utils/dirname.hpp>
 
 namespace
@@ -56,6 +58,7 @@ TCPSocketHandler::TCPSocketHandler(std::shared_ptr<Poller>& poller):
 
 TCPSocketHandler::~TCPSocketHandler()
 {
+  this->forget_out_buf();
   if (this->poller->is_managing_socket(this->get_socket()))
     this->poller->remove_socket_handler(this->get_socket());
   if (this->socket != -1)
@@ -67,6 +70,7 @@ TCPSocketHandler::~TCPSocketHandler()
 
 void TCPSocketHandler::on_recv()
 {
+  ALLOCATIONS_SCOPE(network, "TCPSocketHandler::on_recv");
 #ifdef BOTAN_FOUND
   if (this->use_tls)
     this->tls_recv();
@@ -96,13 +100,52 @@ void TCPSocketHandler::plain_recv()
           // will be handled in parse_in_buffer()
           this->in_buf += std::string(buf, size);
         }
+      if (this->capture_stream)
+        capture::Writer::instance().data(this->capture_stream, static_cast<const char*>(recv_buf), size);
       this->parse_in_buffer(size);
     }
 }
 
+void TCPSocketHandler::handle_received_data(const char* data, const std::size_t size)
+{
+  void* recv_buf = this->get_receive_buffer(size);
+  if (recv_buf)
+    std::memcpy(recv_buf, data, size);
+  else
+    this->in_buf.append(data, size);
+  this->parse_in_buffer(size);
+}
+
+std::size_t TCPSocketHandler::get_buffers_size() const
+{
+  std::size_t res = memory_usage::heap(this->in_buf) + this->out_buf.capacity() * sizeof(std::string);
+  for (const std::string& data: this->out_buf)
+    res += memory_usage::heap(data);
+  return res;
+}
+
+void TCPSocketHandler::shrink_buffers()
+{
+  this->in_buf.shrink_to_fit();
+  if (this->out_buf.empty())
+    this->out_buf.shrink_to_fit();
+}
+
+std::string TCPSocketHandler::get_pending_data() const
+{
+  std::string res;
+  for (const std::string& data: this->out_buf)
+    res += data;
+  return res;
+}
+
 ssize_t TCPSocketHandler::do_recv(void* recv_buf, const size_t buf_size)
 {
   ssize_t size = ::recv(this->socket, recv_buf, buf_size, 0);
+  if (size > 0 && this->traffic)
+    this->traffic->received_bytes.inc(static_cast<std::size_t>(size));
+  if (size > 0 && tracing::is_enabled())
+    this->last_received = tracing::clock::now();
   if (0 == size)
     {
       this->on_connection_close("");
@@ -128,6 +171,7 @@ ssize_t TCPSocketHandler::do_recv(void* recv_buf, const size_t buf_size)
 
 void TCPSocketHandler::on_send()
 {
+  ALLOCATIONS_SCOPE(network, "TCPSocketHandler::on_send");
   struct iovec msg_iov[UIO_FASTIOV] = {};
   struct msghdr msg{};
   msg.msg_iov = msg_iov;
@@ -151,6 +195,21 @@ void TCPSocketHandler::on_send()
   else
     {
       auto size = static_cast<std::size_t>(res);
+      if (this->traffic)
+        {
+          this->traffic->sent_bytes.inc(size);
+          this->traffic->pending_bytes.dec(res);
+        }
+      this->written_bytes += size;
+      while (!this->traces.empty() && this->traces.front().first <= this->written_bytes)
+        {
+          auto& trace = this->traces.front().second;
+          trace->mark(tracing::Stage::sent);
+          // The message may also be waiting on other sockets
+          if (trace.use_count() == 1)
+            trace->finish();
+          this->traces.pop_front();
+        }
       // remove all the strings that were successfully sent.
       auto it = this->out_buf.begin();
       while (it != this->out_buf.end())
@@ -172,20 +231,88 @@ void TCPSocketHandler::on_send()
       this->out_buf.erase(this->out_buf.begin(), it);
       if (this->out_buf.empty())
         this->poller->stop_watching_send_events(this);
+      if (this->above_high_watermark)
+        this->check_watermarks();
+      if (this->out_buf.empty())
+        this->on_all_sent();
     }
 }
 
 void TCPSocketHandler::close()
 {
-  if (this->is_connected() || this->is_connecting())
-    this->poller->remove_socket_handler(this->get_socket());
+  if (this->capture_stream && this->socket != -1)
+    capture::Writer::instance().close_stream(this->capture_stream);
+  if (this->socket != -1 && this->poller->is_managing_socket(this->socket))
+    this->poller->remove_socket_handler(this->socket);
   if (this->socket != -1)
     {
       ::close(this->socket);
       this->socket = -1;
     }
   this->in_buf.clear();
+  this->forget_out_buf();
+}
+
+void TCPSocketHandler::forget_out_buf()
+{
+  if (this->traffic)
+    for (const auto& data: this->out_buf)
+      this->traffic->pending_bytes.dec(static_cast<std::int64_t>(data.size()));
   this->out_buf.clear();
+  this->written_bytes = this->queued_bytes;
+  this->traces.clear();
+  if (this->above_high_watermark)
+    {
+      this->above_high_watermark = false;
+      if (this->traffic)
+        this->traffic->low_watermark_crossings.inc();
+      this->on_low_watermark();
+    }
+}
+
+void TCPSocketHandler::check_watermarks()
+{
+  const auto pending = this->queued_bytes - this->written_bytes;
+  const auto& config = Config::snapshot();
+  if (!this->above_high_watermark)
+    {
+      if (config.output_high_watermark == 0 || pending < config.output_high_watermark)
+        return;
+      this->above_high_watermark = true;
+      if (this->traffic)
+        this->traffic->high_watermark_crossings.inc();
+      log_warning(pending, " bytes are waiting to be sent to ", this->describe(), ", which does not read them fast enough");
+      this->on_high_watermark();
+    }
+  else if (pending <= config.output_low_watermark)
+    {
+      this->above_high_watermark = false;
+      if (this->traffic)
+        this->traffic->low_watermark_crossings.inc();
+      log_info("Only ", pending, " bytes are waiting to be sent to ", this->describe(), " now");
+      this->on_low_watermark();
+    }
+}
+
+void TCPSocketHandler::pause_receiving()
+{
+  this->receiving_paused = true;
+  if (this->socket != -1 && this->poller->is_managing_socket(this->socket))
+    this->poller->pause_receive_events(this);
+}
+
+void TCPSocketHandler::resume_receiving()
+{
+  this->receiving_paused = false;
+  if (this->socket != -1 && this->poller->is_managing_socket(this->socket))
+    this->poller->resume_receive_events(this);
+}
+
+void TCPSocketHandler::watch_socket()
+{
+  this->poller->add_socket_handler(this);
+  if (this->receiving_paused)
+    this->poller->pause_receive_events(this);
 }
 
 void TCPSocketHandler::send_data(std::string&& data)
@@ -206,11 +333,22 @@ void TCPSocketHandler::send_data(std::string&& data)
 
 void TCPSocketHandler::raw_send(std::string&& data)
 {
+  ALLOCATIONS_SCOPE(network, "TCPSocketHandler::raw_send");
   if (data.empty())
     return ;
+  if (this->traffic)
+    this->traffic->pending_bytes.inc(static_cast<std::int64_t>(data.size()));
+  this->queued_bytes += data.size();
+  if (tracing::current && tracing::current->origin != this)
+    {
+      tracing::current->mark(tracing::Stage::queued);
+      this->traces.emplace_back(this->queued_bytes, tracing::current);
+    }
   this->out_buf.emplace_back(std::move(data));
   if (this->is_connected())
     this->poller->watch_send_events(this);
+  if (!this->above_high_watermark)
+    this->check_watermarks();
 }
 
 void TCPSocketHandler::send_pending_data()
@@ -302,6 +440,8 @@ void TCPSocketHandler::tls_record_received(uint64_t, const Botan::byte *data, si
 {
   this->in_buf += std::string(reinterpret_cast<const char*>(data),
                               size);
+  if (this->capture_stream)
+    capture::Writer::instance().data(this->capture_stream, reinterpret_cast<const char*>(data), size);
   if (!this->in_buf.empty())
     this->parse_in_buffer(size);
 }
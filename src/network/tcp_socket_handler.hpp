@@ -7,6 +7,10 @@
 
 #include <network/credentials_manager.hpp>
 
+#include <utils/metrics.hpp>
+#include <utils/tracing.hpp>
+#include <utils/capture.hpp>
+
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -14,6 +18,7 @@
 
 #include <chrono>
 #include <vector>
+#include <deque>
 #include <memory>
 #include <string>
 #include <list>
@@ -80,6 +85,39 @@ public:
    * “parsing”, and thus to be removed from the input buffer.
    */
   virtual void parse_in_buffer(const size_t size) = 0;
+  /**
+   * Handle the given data as if it had just been read from the socket
+   * (and decrypted). Used to replay a capture.
+   */
+  void handle_received_data(const char* data, const std::size_t size);
+  /**
+   * The memory used by in_buf and out_buf, including their unused
+   * capacity.
+   */
+  std::size_t get_buffers_size() const;
+  /**
+   * Give back the unused capacity of in_buf, which can stay large after
+   * a burst of data was received.
+   */
+  void shrink_buffers();
+  /**
+   * The data waiting in out_buf, not yet written on the socket.
+   */
+  std::string get_pending_data() const;
+  /**
+   * Stop reading from the socket, even if it is reconnected, until
+   * resume_receiving() is called.
+   */
+  void pause_receiving();
+  void resume_receiving();
+  bool is_receiving_paused() const
+  { return this->receiving_paused; }
+  /**
+   * Whether the data waiting in out_buf went above output_high_watermark,
+   * and not yet back below output_low_watermark.
+   */
+  bool is_above_high_watermark() const
+  { return this->above_high_watermark; }
 #ifdef BOTAN_FOUND
   /**
    * Tell whether the credential manager should cancel the connection when the
@@ -111,6 +149,15 @@ private:
    * as we can.
    */
   void raw_send(std::string&& data);
+  /**
+   * Clear out_buf, and stop counting its content as pending.
+   */
+  void forget_out_buf();
+  /**
+   * Call on_high_watermark() or on_low_watermark() if the data waiting in
+   * out_buf just crossed one of them.
+   */
+  void check_watermarks();
 
  protected:
   virtual bool is_connecting() const = 0;
@@ -171,6 +218,18 @@ private:
    * Where data is added, when we want to send something to the client.
    */
   std::vector<std::string> out_buf;
+  /**
+   * The number of bytes ever added to out_buf, and written on the socket.
+   */
+  std::uint64_t queued_bytes{0};
+  std::uint64_t written_bytes{0};
+  /**
+   * The traced messages waiting in out_buf, with the value that
+   * written_bytes will reach once their last byte is written.
+   */
+  std::deque<std::pair<std::uint64_t, std::shared_ptr<tracing::Trace>>> traces;
+  bool receiving_paused{false};
+  bool above_high_watermark{false};
 protected:
   /**
    * Whether we are using TLS on this connection or not.
@@ -187,6 +246,20 @@ protected:
    * Remove the given “size” first bytes from our in_buf.
    */
   void consume_in_buffer(const std::size_t size);
+  /**
+   * Where the bytes read, written and waiting in out_buf are counted, if
+   * the subclass sets it.
+   */
+  metrics::Traffic* traffic{nullptr};
+  /**
+   * When the last data was received, if tracing is enabled.
+   */
+  tracing::clock::time_point last_received{};
+  /**
+   * The stream in which the received data is captured, if the subclass
+   * opened one. 0 means nothing is captured.
+   */
+  std::uint32_t capture_stream{0};
   /**
    * Provide a buffer in which data can be directly received. This can be
    * used to avoid copying data into in_buf before using it. If no buffer
@@ -200,6 +273,23 @@ protected:
    */
   virtual void on_connection_close(const std::string&) {}
   virtual void on_connection_failed(const std::string&) {}
+  /**
+   * Called when the remote end stops reading what we send: the data
+   * waiting in out_buf went above output_high_watermark.  Then, once it
+   * went back below output_low_watermark (or was discarded because the
+   * connection was closed), on_low_watermark() is called.
+   */
+  virtual void on_high_watermark() {}
+  virtual void on_low_watermark() {}
+  /**
+   * Called when everything in out_buf has been written into the socket.
+   */
+  virtual void on_all_sent() {}
+  /**
+   * Add the socket to the poller, and keep its receive events paused if
+   * pause_receiving() was called.
+   */
+  void watch_socket();
 
 #ifdef BOTAN_FOUND
 protected:
@@ -0,0 +1,241 @@
+#include <network/upgrade.hpp>
+#include <config/config.hpp>
+#include <logger/logger.hpp>
+#include <utils/scopeguard.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <climits>
+
+using namespace std::string_literals;
+
+namespace upgrade
+{
+/**
+ * The most sockets sent in one message, below the SCM_MAX_FD of linux.
+ */
+static constexpr std::size_t max_fds_per_message = 200;
+static constexpr std::size_t max_data_per_message = 60000;
+/**
+ * How long each side waits for the other one.
+ */
+static constexpr int timeout_seconds = 10;
+/**
+ * The file descriptor of the socket, in the new process.
+ */
+static constexpr int child_fd = 3;
+
+static bool requested = false;
+static std::string own_binary;
+
+void request()
+{
+  requested = true;
+}
+
+bool take_request()
+{
+  const bool res = requested;
+  requested = false;
+  return res;
+}
+
+void remember_own_binary()
+{
+  char buf[PATH_MAX];
+  const auto size = ::readlink("/proc/self/exe", buf, sizeof(buf) - 1);
+  if (size > 0)
+    own_binary.assign(buf, static_cast<std::size_t>(size));
+}
+
+std::string get_binary()
+{
+  return Config::get("upgrade_binary", own_binary);
+}
+
+static void set_timeouts(const int fd)
+{
+  struct timeval tv{};
+  tv.tv_sec = timeout_seconds;
+  ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+static void send_message(const int fd, const char type, const char* data, const std::size_t size,
+                         const int* fds, const std::size_t fds_number)
+{
+  struct iovec iov[2];
+  iov[0].iov_base = const_cast<char*>(&type);
+  iov[0].iov_len = 1;
+  iov[1].iov_base = const_cast<char*>(data);
+  iov[1].iov_len = size;
+  struct msghdr msg{};
+  msg.msg_iov = iov;
+  msg.msg_iovlen = size > 0 ? 2 : 1;
+  std::vector<char> control;
+  if (fds_number > 0)
+    {
+      control.resize(CMSG_SPACE(sizeof(int) * fds_number));
+      msg.msg_control = control.data();
+      msg.msg_controllen = control.size();
+      struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds_number);
+      std::memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fds_number);
+    }
+  if (::sendmsg(fd, &msg, MSG_NOSIGNAL) == -1)
+    throw std::runtime_error("Failed to send the state to the new process: "s + std::strerror(errno));
+}
+
+/**
+ * Returns the type of the message, and appends its content and sockets to
+ * the given ones.  Returns 0 at the end of the stream.
+ */
+static char receive_message(const int fd, std::string& data, std::vector<int>& fds)
+{
+  std::vector<char> buf(max_data_per_message + 1);
+  std::vector<char> control(CMSG_SPACE(sizeof(int) * max_fds_per_message));
+  struct iovec iov{buf.data(), buf.size()};
+  struct msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.data();
+  msg.msg_controllen = control.size();
+  const auto size = ::recvmsg(fd, &msg, 0);
+  if (size == -1)
+    throw std::runtime_error("Failed to receive the state: "s + std::strerror(errno));
+  for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+      {
+        const auto number = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const auto first = fds.size();
+        fds.resize(first + number);
+        std::memcpy(&fds[first], CMSG_DATA(cmsg), sizeof(int) * number);
+      }
+  if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))
+    throw std::runtime_error("Truncated message received");
+  if (size == 0)
+    return 0;
+  data.append(buf.data() + 1, static_cast<std::size_t>(size - 1));
+  return buf[0];
+}
+
+/**
+ * The highest file descriptor currently open, to close them all in the
+ * new process.
+ */
+static int highest_fd()
+{
+  int res = -1;
+  if (DIR* dir = ::opendir("/proc/self/fd"))
+    {
+      while (const struct dirent* entry = ::readdir(dir))
+        res = std::max(res, std::atoi(entry->d_name));
+      ::closedir(dir);
+      return res;
+    }
+  return static_cast<int>(::sysconf(_SC_OPEN_MAX));
+}
+
+pid_t hand_over(const std::string& binary, const std::string& conf_filename,
+                const std::string& state, const std::vector<int>& sockets)
+{
+  int fds[2];
+  if (::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) == -1)
+    throw std::runtime_error("socketpair failed: "s + std::strerror(errno));
+  const int fd = fds[0];
+  utils::ScopeGuard close_fd([fd]() { ::close(fd); });
+  set_timeouts(fd);
+
+  // Everything used after fork() must be prepared before: the other
+  // threads may hold some lock (of malloc for example) forever in the child
+  const std::string fd_arg = std::to_string(child_fd);
+  const char* const argv[] = {binary.data(), "--upgrade-from", fd_arg.data(), conf_filename.data(), nullptr};
+  const int last_fd = highest_fd();
+
+  const pid_t pid = ::fork();
+  if (pid == -1)
+    {
+      ::close(fds[1]);
+      throw std::runtime_error("fork failed: "s + std::strerror(errno));
+    }
+  if (pid == 0)
+    {
+      // dup2() clears the FD_CLOEXEC flag, but does nothing if the socket
+      // already is child_fd
+      if (fds[1] == child_fd)
+        {
+          if (::fcntl(child_fd, F_SETFD, 0) == -1)
+            ::_exit(1);
+        }
+      else if (::dup2(fds[1], child_fd) == -1)
+        ::_exit(1);
+      for (int i = child_fd + 1; i <= last_fd; i++)
+        ::close(i);
+      ::execv(argv[0], const_cast<char* const*>(argv));
+      ::_exit(1);
+    }
+  ::close(fds[1]);
+  utils::ScopeGuard kill_child([pid]()
+  {
+    ::kill(pid, SIGKILL);
+    ::waitpid(pid, nullptr, 0);
+  });
+
+  for (std::size_t i = 0; i < sockets.size(); i += max_fds_per_message)
+    send_message(fd, 'F', nullptr, 0, sockets.data() + i, std::min(max_fds_per_message, sockets.size() - i));
+  for (std::size_t i = 0; i < state.size(); i += max_data_per_message)
+    send_message(fd, 'D', state.data() + i, std::min(max_data_per_message, state.size() - i), nullptr, 0);
+  send_message(fd, 'E', nullptr, 0, nullptr, 0);
+
+  std::string ack;
+  std::vector<int> unused;
+  if (receive_message(fd, ack, unused) != 'A')
+    throw std::runtime_error("The new process failed to resume the state");
+  kill_child.disable();
+  // Our end is closed when we exit, the new process waits for that
+  close_fd.disable();
+  return pid;
+}
+
+void receive(const int fd, std::string& state, std::vector<int>& sockets)
+{
+  set_timeouts(fd);
+  while (true)
+    {
+      const auto type = receive_message(fd, state, sockets);
+      if (type == 'E')
+        return;
+      if (type != 'D' && type != 'F')
+        throw std::runtime_error("The previous process stopped giving its state");
+    }
+}
+
+void acknowledge(const int fd)
+{
+  send_message(fd, 'A', nullptr, 0, nullptr, 0);
+  std::string data;
+  std::vector<int> unused;
+  try
+    {
+      while (receive_message(fd, data, unused) != 0);
+    }
+  catch (const std::runtime_error& e)
+    {
+      log_warning("The previous process did not exit: ", e.what());
+    }
+  ::close(fd);
+}
+}
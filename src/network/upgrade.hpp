@@ -0,0 +1,63 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+/**
+ * Replace the running process by a new one (usually a newer binary),
+ * without disconnecting the users from their IRC servers.
+ *
+ * The running process starts the new one with “--upgrade-from <fd>”, and
+ * gives it, on that Unix socket, the state it serialized and the sockets
+ * of the IRC connections (with SCM_RIGHTS).  Once the new process resumed
+ * everything, it tells the previous one, which then exits without closing
+ * these connections.  The new process waits for that before connecting to
+ * the XMPP server, and listening on the identd and metrics ports.
+ *
+ * Every message on the socket starts with one byte: 'D' for a chunk of the
+ * state, 'F' for some sockets, 'E' after the last of them, and 'A' (sent
+ * back by the new process) when it resumed everything.
+ */
+namespace upgrade
+{
+/**
+ * Ask the main loop to start an upgrade, as soon as it can.
+ */
+void request();
+/**
+ * Whether an upgrade was requested, since the previous call.
+ */
+bool take_request();
+/**
+ * Remember the path of the running binary: a package upgrade may replace
+ * the file, /proc/self/exe would then point to the deleted one.
+ */
+void remember_own_binary();
+/**
+ * The binary that an upgrade starts: the upgrade_binary option, or the
+ * running one.
+ */
+std::string get_binary();
+
+/**
+ * Start the given binary, and give it the state and the sockets.  Returns
+ * the pid of the new process, once it resumed everything.  Throws a
+ * std::runtime_error if that fails, or takes too long: the new process is
+ * then killed, and the caller still owns everything.
+ */
+pid_t hand_over(const std::string& binary, const std::string& conf_filename,
+                const std::string& state, const std::vector<int>& sockets);
+
+/**
+ * In the new process: read the state and the sockets given by
+ * hand_over().  Throws a std::runtime_error if that fails.
+ */
+void receive(const int fd, std::string& state, std::vector<int>& sockets);
+/**
+ * Tell the previous process that everything was resumed, and wait for it
+ * to exit (or for a few seconds), then close the socket.
+ */
+void acknowledge(const int fd);
+}
@@ -0,0 +1,157 @@
+#include <utils/allocations.hpp>
+
+#ifdef PROFILE_ALLOCATIONS
+
+#include <algorithm>
+#include <sstream>
+#include <cstdlib>
+#include <vector>
+#include <chrono>
+#include <array>
+#include <tuple>
+#include <new>
+
+namespace allocations
+{
+
+static constexpr std::size_t subsystems_number = static_cast<std::size_t>(Subsystem::size);
+
+static const std::array<const char*, subsystems_number> subsystem_names{{
+  "other", "xmpp", "irc", "bridge", "database", "network",
+}};
+
+/**
+ * Everything used by operator new is constant-initialized, it can be
+ * called before main() and from any thread.
+ */
+static std::array<std::atomic<std::uint64_t>, subsystems_number> subsystem_counts{};
+static std::array<std::atomic<std::uint64_t>, subsystems_number> subsystem_bytes{};
+static std::atomic<Site*> sites{nullptr};
+static thread_local Site* current_site{nullptr};
+
+static void record(const std::size_t size)
+{
+  Site* site = current_site;
+  const auto subsystem = static_cast<std::size_t>(site ? site->subsystem : Subsystem::other);
+  subsystem_counts[subsystem].fetch_add(1, std::memory_order_relaxed);
+  subsystem_bytes[subsystem].fetch_add(size, std::memory_order_relaxed);
+  if (site)
+    {
+      site->count.fetch_add(1, std::memory_order_relaxed);
+      site->bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+}
+
+Site::Site(const Subsystem subsystem, const char* name):
+  subsystem(subsystem),
+  name(name)
+{
+  this->next = sites.load(std::memory_order_relaxed);
+  while (!sites.compare_exchange_weak(this->next, this));
+}
+
+Scope::Scope(Site& site):
+  previous(current_site)
+{
+  current_site = &site;
+}
+
+Scope::~Scope()
+{
+  current_site = this->previous;
+}
+
+std::uint64_t total_count()
+{
+  std::uint64_t res = 0;
+  for (const auto& count: subsystem_counts)
+    res += count.load(std::memory_order_relaxed);
+  return res;
+}
+
+std::uint64_t total_bytes()
+{
+  std::uint64_t res = 0;
+  for (const auto& bytes: subsystem_bytes)
+    res += bytes.load(std::memory_order_relaxed);
+  return res;
+}
+
+/**
+ * When the previous report was made, or when the process started.
+ */
+static auto previous_time = std::chrono::steady_clock::now();
+static std::array<std::uint64_t, subsystems_number> previous_counts{};
+
+std::string report()
+{
+  const auto now = std::chrono::steady_clock::now();
+  const auto elapsed = std::chrono::duration<double>(now - previous_time).count();
+  std::ostringstream ss;
+  ss << "Allocations since the start (and per second during the last "
+     << static_cast<std::uint64_t>(elapsed) << "s):";
+  for (std::size_t i = 0; i < subsystems_number; i++)
+    {
+      const auto count = subsystem_counts[i].load(std::memory_order_relaxed);
+      ss << "\n" << subsystem_names[i] << ": " << count << " allocations, "
+         << subsystem_bytes[i].load(std::memory_order_relaxed) << " bytes";
+      if (elapsed > 0)
+        ss << " (" << static_cast<std::uint64_t>(static_cast<double>(count - previous_counts[i]) / elapsed) << "/s)";
+      previous_counts[i] = count;
+    }
+  previous_time = now;
+
+  std::vector<std::tuple<std::uint64_t, std::uint64_t, const Site*>> by_count;
+  for (const Site* site = sites.load(); site; site = site->next)
+    by_count.emplace_back(site->count.load(std::memory_order_relaxed),
+                          site->bytes.load(std::memory_order_relaxed), site);
+  std::sort(by_count.begin(), by_count.end(), [](const auto& a, const auto& b)
+  {
+    return std::get<0>(a) > std::get<0>(b);
+  });
+  ss << "\nTop call sites:";
+  for (std::size_t i = 0; i < by_count.size() && i < 10; i++)
+    {
+      const Site* site = std::get<2>(by_count[i]);
+      ss << "\n" << site->name << " (" << subsystem_names[static_cast<std::size_t>(site->subsystem)] << "): "
+         << std::get<0>(by_count[i]) << " allocations, " << std::get<1>(by_count[i]) << " bytes";
+    }
+  return ss.str();
+}
+
+}
+
+void* operator new(std::size_t size)
+{
+  allocations::record(size);
+  if (void* res = std::malloc(size == 0 ? 1 : size))
+    return res;
+  throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+  return ::operator new(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept
+{
+  std::free(ptr);
+}
+
+#endif
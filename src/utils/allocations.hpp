@@ -0,0 +1,106 @@
+#pragma once
+
+#include <biboumi.h>
+
+/**
+ * Count the memory allocations done by each part of biboumi, when built
+ * with PROFILE_ALLOCATIONS.
+ *
+ * The code that is worth measuring is marked with ALLOCATIONS_SCOPE():
+ * every allocation done (by the thread) until the end of the enclosing
+ * block is counted for that call site, and for its subsystem.  Scopes can
+ * be nested, the innermost one is used.  The allocations done outside of
+ * any scope are counted for the “other” subsystem.
+ *
+ * Without PROFILE_ALLOCATIONS, ALLOCATIONS_SCOPE() expands to nothing,
+ * and operator new is left untouched.
+ */
+
+#ifdef PROFILE_ALLOCATIONS
+
+#include <cstdint>
+#include <atomic>
+#include <string>
+
+namespace allocations
+{
+
+enum class Subsystem
+{
+  other,
+  xmpp,
+  irc,
+  bridge,
+  database,
+  network,
+  size
+};
+
+/**
+ * One place in the code marked with ALLOCATIONS_SCOPE(), and what was
+ * allocated while it was executed.  They are static, and never destroyed.
+ */
+class Site
+{
+public:
+  Site(const Subsystem subsystem, const char* name);
+  ~Site() = default;
+  Site(const Site&) = delete;
+  Site(Site&&) = delete;
+  Site& operator=(const Site&) = delete;
+  Site& operator=(Site&&) = delete;
+
+  const Subsystem subsystem;
+  const char* const name;
+  std::atomic<std::uint64_t> count{0};
+  std::atomic<std::uint64_t> bytes{0};
+  /**
+   * All the sites are linked together, to be listed by report().
+   */
+  Site* next{nullptr};
+};
+
+/**
+ * Makes the allocations of the current thread count for the given site,
+ * until it is destroyed.
+ */
+class Scope
+{
+public:
+  explicit Scope(Site& site);
+  ~Scope();
+  Scope(const Scope&) = delete;
+  Scope(Scope&&) = delete;
+  Scope& operator=(const Scope&) = delete;
+  Scope& operator=(Scope&&) = delete;
+
+private:
+  Site* const previous;
+};
+
+/**
+ * The number of allocations, and their size, since the start.
+ */
+std::uint64_t total_count();
+std::uint64_t total_bytes();
+
+/**
+ * A human-readable summary: the allocations of each subsystem, with their
+ * rate since the previous report, and the call sites that allocate the
+ * most.
+ */
+std::string report();
+
+}
+
+#define ALLOCATIONS_SCOPE_CONCAT2(a, b) a ## b
+#define ALLOCATIONS_SCOPE_CONCAT(a, b) ALLOCATIONS_SCOPE_CONCAT2(a, b)
+#define ALLOCATIONS_SCOPE(subsystem, name)                                                              \
+  static allocations::Site ALLOCATIONS_SCOPE_CONCAT(allocations_site_, __LINE__){allocations::Subsystem::subsystem, name}; \
+  allocations::Scope ALLOCATIONS_SCOPE_CONCAT(allocations_scope_, __LINE__){ALLOCATIONS_SCOPE_CONCAT(allocations_site_, __LINE__)}
+
+#else
+
+#define ALLOCATIONS_SCOPE(subsystem, name)
+
+#endif
@@ -1,16 +1,41 @@
 #include <utils/base64.hpp>
 
+#include "biboumi.h"
+
+#include <cstdint>
+
 #ifdef BOTAN_FOUND
 #include <botan/base64.h>
+#endif
 
 namespace base64
 {
 
+#ifdef BOTAN_FOUND
 std::string encode(const std::string &input)
 {
   return Botan::base64_encode(reinterpret_cast<const uint8_t*>(input.data()), input.size());
 }
-
+#else
+std::string encode(const std::string &input)
+{
+  static const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string res;
+  res.reserve((input.size() + 2) / 3 * 4);
+  for (std::size_t i = 0; i < input.size(); i += 3)
+    {
+      std::uint32_t group = static_cast<std::uint32_t>(static_cast<unsigned char>(input[i])) << 16;
+      if (i + 1 < input.size())
+        group |= static_cast<std::uint32_t>(static_cast<unsigned char>(input[i + 1])) << 8;
+      if (i + 2 < input.size())
+        group |= static_cast<unsigned char>(input[i + 2]);
+      res += alphabet[(group >> 18) & 0x3f];
+      res += alphabet[(group >> 12) & 0x3f];
+      res += i + 1 < input.size() ? alphabet[(group >> 6) & 0x3f] : '=';
+      res += i + 2 < input.size() ? alphabet[group & 0x3f] : '=';
+    }
+  return res;
 }
-
 #endif
+
+}
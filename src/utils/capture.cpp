@@ -0,0 +1,185 @@
+#include <utils/capture.hpp>
+
+#include <logger/logger.hpp>
+
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+namespace capture
+{
+static const std::string magic{"BBMCAP01"};
+
+static constexpr std::size_t header_size = 1 + 4 + 8 + 4;
+
+template <typename Int>
+static void put(char*& out, Int value)
+{
+  for (std::size_t i = 0; i < sizeof(Int); i++)
+    *out++ = static_cast<char>((value >> (8 * i)) & 0xff);
+}
+
+template <typename Int>
+static Int get(const char*& in)
+{
+  Int value = 0;
+  for (std::size_t i = 0; i < sizeof(Int); i++)
+    value = static_cast<Int>(value | (static_cast<Int>(static_cast<unsigned char>(*in++)) << (8 * i)));
+  return value;
+}
+
+std::string make_open_payload(const StreamInfo& info)
+{
+  std::string res(1, static_cast<char>(info.kind));
+  res += info.jid;
+  res += '\0';
+  res += info.hostname;
+  return res;
+}
+
+StreamInfo parse_open_payload(const std::string& payload)
+{
+  const auto separator = payload.find('\0', 1);
+  if (payload.empty() || separator == std::string::npos ||
+      static_cast<std::uint8_t>(payload[0]) > static_cast<std::uint8_t>(StreamKind::irc))
+    throw std::runtime_error("Invalid open record in the capture");
+  return {static_cast<StreamKind>(payload[0]), payload.substr(1, separator - 1), payload.substr(separator + 1)};
+}
+
+constexpr std::size_t Writer::buffer_size;
+
+Writer& Writer::instance()
+{
+  static Writer inst;
+  return inst;
+}
+
+Writer::~Writer()
+{
+  this->stop();
+}
+
+bool Writer::start(const std::string& filename)
+{
+  this->stop();
+  const int fd = ::open(filename.data(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd == -1)
+    {
+      log_error("Failed to open the capture file ", filename, ": ", std::strerror(errno));
+      return false;
+    }
+  // The mode given to open() is not applied to an existing file
+  if (::fchmod(fd, 0600) == -1)
+    {
+      log_error("Failed to restrict the permissions of the capture file ", filename, ": ", std::strerror(errno));
+      ::close(fd);
+      return false;
+    }
+  log_warning("Capturing everything received from the XMPP and IRC servers into ", filename);
+  this->fd = fd;
+  this->buffer.reserve(buffer_size);
+  this->buffer.assign(magic);
+  this->start_time = clock::now();
+  return true;
+}
+
+void Writer::stop()
+{
+  if (this->fd == -1)
+    return;
+  this->flush();
+  if (this->fd != -1)
+    ::close(this->fd);
+  this->fd = -1;
+}
+
+std::uint32_t Writer::open_stream(const StreamInfo& info)
+{
+  if (this->fd == -1)
+    return 0;
+  const auto payload = make_open_payload(info);
+  this->write(RecordType::open, ++this->last_stream, payload.data(), payload.size());
+  return this->last_stream;
+}
+
+void Writer::data(const std::uint32_t stream, const char* data, const std::size_t size)
+{
+  if (this->fd != -1)
+    this->write(RecordType::data, stream, data, size);
+}
+
+void Writer::close_stream(const std::uint32_t stream)
+{
+  if (this->fd != -1)
+    this->write(RecordType::close, stream, nullptr, 0);
+}
+
+void Writer::write(const RecordType type, const std::uint32_t stream, const char* data, const std::size_t size)
+{
+  char header[header_size];
+  char* out = header;
+  put(out, static_cast<std::uint8_t>(type));
+  put(out, stream);
+  put(out, static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - this->start_time).count()));
+  put(out, static_cast<std::uint32_t>(size));
+  this->buffer.append(header, header_size);
+  if (size > 0)
+    this->buffer.append(data, size);
+  if (this->buffer.size() >= buffer_size)
+    this->flush();
+}
+
+void Writer::flush()
+{
+  std::size_t written = 0;
+  while (written < this->buffer.size())
+    {
+      const auto res = ::write(this->fd, this->buffer.data() + written, this->buffer.size() - written);
+      if (res == -1 && errno == EINTR)
+        continue;
+      if (res == -1)
+        {
+          log_error("Failed to write into the capture file, stopping the capture: ", std::strerror(errno));
+          ::close(this->fd);
+          this->fd = -1;
+          break;
+        }
+      written += static_cast<std::size_t>(res);
+    }
+  this->buffer.clear();
+}
+
+Reader::Reader(std::istream& input):
+  input(input)
+{
+  std::string header(magic.size(), '\0');
+  if (!this->input.read(&header[0], static_cast<std::streamsize>(header.size())) || header != magic)
+    throw std::runtime_error("Not a biboumi capture");
+}
+
+bool Reader::next(Record& record)
+{
+  char header[header_size];
+  this->input.read(header, header_size);
+  if (this->input.gcount() == 0)
+    return false;
+  if (this->input.gcount() != header_size)
+    throw std::runtime_error("Truncated record in the capture");
+  const char* in = header;
+  const auto type = get<std::uint8_t>(in);
+  if (type > static_cast<std::uint8_t>(RecordType::close))
+    throw std::runtime_error("Invalid record type in the capture");
+  record.type = static_cast<RecordType>(type);
+  record.stream = get<std::uint32_t>(in);
+  record.time = std::chrono::nanoseconds(get<std::uint64_t>(in));
+  record.payload.resize(get<std::uint32_t>(in));
+  if (!record.payload.empty() &&
+      !this->input.read(&record.payload[0], static_cast<std::streamsize>(record.payload.size())))
+    throw std::runtime_error("Truncated record in the capture");
+  return true;
+}
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <istream>
+#include <string>
+
+/**
+ * Record the raw data received on the XMPP component socket and on every
+ * IRC socket into a file, to replay it later (see tests/replay/).
+ *
+ * The file starts with the 8 bytes “BBMCAP01”, followed by records made
+ * of a header, all integers being little-endian:
+ *
+ *   type (1 byte), stream (4 bytes), time (8 bytes), size (4 bytes)
+ *
+ * and size bytes of payload.  The time is the number of nanoseconds since
+ * the capture started.  The stream identifies the socket, a record of type
+ * open introduces it before its first data: its payload is its kind (1
+ * byte), the JID of the user, a nul byte, and the hostname of the IRC
+ * server (or the hostname served by the component).  The data records
+ * contain what was read on the socket (after the TLS decryption), and a
+ * close record tells that the connection was closed.
+ */
+namespace capture
+{
+using clock = std::chrono::steady_clock;
+
+enum class RecordType: std::uint8_t
+{
+  open,
+  data,
+  close,
+};
+
+enum class StreamKind: std::uint8_t
+{
+  xmpp,
+  irc,
+};
+
+struct StreamInfo
+{
+  StreamKind kind;
+  std::string jid;
+  std::string hostname;
+};
+
+struct Record
+{
+  RecordType type;
+  std::uint32_t stream;
+  std::chrono::nanoseconds time;
+  std::string payload;
+};
+
+std::string make_open_payload(const StreamInfo& info);
+/**
+ * Throws a std::runtime_error if the payload is not a valid one.
+ */
+StreamInfo parse_open_payload(const std::string& payload);
+
+/**
+ * Writes the capture, if it has been started.  Everything is done in the
+ * main thread: the records are buffered, and written into the file when
+ * the buffer is full and when the capture stops.
+ */
+class Writer
+{
+public:
+  static Writer& instance();
+  ~Writer();
+  Writer(const Writer&) = delete;
+  Writer(Writer&&) = delete;
+  Writer& operator=(const Writer&) = delete;
+  Writer& operator=(Writer&&) = delete;
+
+  /**
+   * Create (or truncate) the file and start writing into it.  Only its
+   * owner can read it, even if it already existed: it contains the
+   * conversations and some passwords.  Returns false, and logs the error,
+   * if the file can not be opened or its permissions can not be set.
+   */
+  bool start(const std::string& filename);
+  /**
+   * Flush and close the file.
+   */
+  void stop();
+  bool is_active() const
+  { return this->fd != -1; }
+  /**
+   * Returns the identifier of the new stream, or 0 if nothing is being
+   * captured.
+   */
+  std::uint32_t open_stream(const StreamInfo& info);
+  void data(const std::uint32_t stream, const char* data, const std::size_t size);
+  void close_stream(const std::uint32_t stream);
+
+private:
+  Writer() = default;
+  void write(const RecordType type, const std::uint32_t stream, const char* data, const std::size_t size);
+  /**
+   * Write the buffer into the file.  On error, the capture is stopped.
+   */
+  void flush();
+
+  static constexpr std::size_t buffer_size = 64 * 1024;
+
+  int fd{-1};
+  std::string buffer;
+  clock::time_point start_time;
+  std::uint32_t last_stream{0};
+};
+
+/**
+ * Reads the records of a capture, one by one.
+ */
+class Reader
+{
+public:
+  /**
+   * Throws a std::runtime_error if the stream does not contain a capture.
+   */
+  explicit Reader(std::istream& input);
+  ~Reader() = default;
+  Reader(const Reader&) = delete;
+  Reader(Reader&&) = delete;
+  Reader& operator=(const Reader&) = delete;
+  Reader& operator=(Reader&&) = delete;
+
+  /**
+   * Returns false at the end of the capture.  Throws a std::runtime_error
+   * if the last record is truncated.
+   */
+  bool next(Record& record);
+
+private:
+  std::istream& input;
+};
+}
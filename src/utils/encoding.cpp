@@ -9,6 +9,8 @@
 #include <iconv.h>
 #include <cerrno>
 
+#include <unordered_map>
+#include <memory>
 #include <map>
 #include <bitset>
 
@@ -19,6 +21,81 @@
 static const char* invalid_char = "\xef\xbf\xbd";
 static const size_t invalid_char_len = 3;
 
+namespace
+{
+  /**
+   * An iconv descriptor converting one charset into UTF-8, opened the first
+   * time that charset is used, and kept until the thread exits.
+   */
+  class Utf8Converter
+  {
+  public:
+    explicit Utf8Converter(const std::string& charset):
+      cd(iconv_open("UTF-8", charset.data()))
+    {
+      if (this->cd == (iconv_t)-1)
+        throw std::runtime_error("Cannot convert into UTF-8");
+      this->ascii_compatible = this->check_ascii_compatible();
+    }
+    ~Utf8Converter()
+    {
+      iconv_close(this->cd);
+    }
+    Utf8Converter(const Utf8Converter&) = delete;
+    Utf8Converter(Utf8Converter&&) = delete;
+    Utf8Converter& operator=(const Utf8Converter&) = delete;
+    Utf8Converter& operator=(Utf8Converter&&) = delete;
+
+    /**
+     * Returns the descriptor, in its initial state.
+     */
+    iconv_t get()
+    {
+      iconv(this->cd, nullptr, nullptr, nullptr, nullptr);
+      return this->cd;
+    }
+    /**
+     * Whether ASCII characters are left untouched by the conversion. This
+     * is not the case for charsets like UTF-16 or ISO-2022-JP.
+     */
+    bool is_ascii_compatible() const
+    { return this->ascii_compatible; }
+
+  private:
+    bool check_ascii_compatible()
+    {
+      char ascii[127];
+      for (std::size_t i = 0; i < sizeof(ascii); ++i)
+        ascii[i] = static_cast<char>(i + 1);
+      char converted[sizeof(ascii) * 4];
+
+#ifdef ICONV_SECOND_ARGUMENT_IS_CONST
+      const char* inbuf_ptr = ascii;
+#else
+      char* inbuf_ptr = ascii;
+#endif
+      size_t inbytesleft = sizeof(ascii);
+      char* outbuf_ptr = converted;
+      size_t outbytesleft = sizeof(converted);
+      const auto res = iconv(this->get(), &inbuf_ptr, &inbytesleft, &outbuf_ptr, &outbytesleft);
+      return res != (size_t)-1 && outbuf_ptr - converted == sizeof(ascii) &&
+        ::memcmp(ascii, converted, sizeof(ascii)) == 0;
+    }
+
+    const iconv_t cd;
+    bool ascii_compatible;
+  };
+
+  Utf8Converter& get_utf8_converter(const char* charset)
+  {
+    thread_local std::unordered_map<std::string, std::unique_ptr<Utf8Converter>> converters;
+    auto it = converters.find(charset);
+    if (it == converters.end())
+      it = converters.emplace(charset, std::make_unique<Utf8Converter>(charset)).first;
+    return *it->second;
+  }
+}
+
 namespace utils
 {
   /**
@@ -73,6 +150,41 @@ namespace utils
     return true;
   }
 
+  bool is_valid_xml_codepoint(const unsigned char* str, const std::size_t size)
+  {
+    std::bitset<20> codepoint;
+
+    // 4 bytes:  11110xxx 10xxxxxx 10xxxxxx 10xxxxxx
+    if (size == 4)
+      {
+        codepoint  = ((str[0] & 0b00000111u) << 18u);
+        codepoint |= ((str[1] & 0b00111111u) << 12u);
+        codepoint |= ((str[2] & 0b00111111u) << 6u );
+        codepoint |= ((str[3] & 0b00111111u) << 0u );
+        return codepoint.to_ulong() <= 0x10FFFF;
+      }
+    // 3 bytes:  1110xxx 10xxxxxx 10xxxxxx
+    else if (size == 3)
+      {
+        codepoint  = ((str[0] & 0b00001111u) << 12u);
+        codepoint |= ((str[1] & 0b00111111u) << 6u);
+        codepoint |= ((str[2] & 0b00111111u) << 0u );
+        return codepoint.to_ulong() <= 0xD7FF ||
+          (codepoint.to_ulong() >= 0xE000 && codepoint.to_ulong() <= 0xFFFD);
+      }
+    // 2 bytes:  110xxxxx 10xxxxxx
+    else if (size == 2)
+      // All 2 bytes char are valid, don't even bother calculating the
+      // codepoint
+      return true;
+    // 1 byte:  0xxxxxxx
+    codepoint = ((str[0] & 0b01111111));
+    return codepoint.to_ulong() == 0x09 ||
+      codepoint.to_ulong() == 0x0A ||
+      codepoint.to_ulong() == 0x0D ||
+      codepoint.to_ulong() >= 0x20;
+  }
+
   std::string remove_invalid_xml_chars(const std::string& original)
   {
     // The given string MUST be a valid utf-8 string
@@ -82,63 +194,18 @@ namespace utils
     char* r = res.data();
 
     const unsigned char* str = reinterpret_cast<const unsigned char*>(original.c_str());
-    std::bitset<20> codepoint;
 
     while (*str)
       {
-        // 4 bytes:  11110xxx 10xxxxxx 10xxxxxx 10xxxxxx
-        if ((str[0] & 0b11111000) == 0b11110000)
-          {
-            codepoint  = ((str[0] & 0b00000111u) << 18u);
-            codepoint |= ((str[1] & 0b00111111u) << 12u);
-            codepoint |= ((str[2] & 0b00111111u) << 6u );
-            codepoint |= ((str[3] & 0b00111111u) << 0u );
-            if (codepoint.to_ulong() <= 0x10FFFF)
-              {
-                ::memcpy(r, str, 4);
-                r += 4;
-              }
-            str += 4;
-          }
-        // 3 bytes:  1110xxx 10xxxxxx 10xxxxxx
-        else if ((str[0] & 0b11110000) == 0b11100000)
-          {
-            codepoint  = ((str[0] & 0b00001111u) << 12u);
-            codepoint |= ((str[1] & 0b00111111u) << 6u);
-            codepoint |= ((str[2] & 0b00111111u) << 0u );
-            if (codepoint.to_ulong() <= 0xD7FF ||
-                (codepoint.to_ulong() >= 0xE000 && codepoint.to_ulong() <= 0xFFFD))
-              {
-                ::memcpy(r, str, 3);
-                r += 3;
-              }
-            str += 3;
-          }
-        // 2 bytes:  110xxxxx 10xxxxxx
-        else if (((str[0]) & 0b11100000) == 0b11000000)
-          {
-            // All 2 bytes char are valid, don't even bother calculating
-            // the codepoint
-            ::memcpy(r, str, 2);
-            r += 2;
-            str += 2;
-          }
-        // 1 byte:  0xxxxxxx
-        else if ((str[0] & 0b10000000) == 0)
+        const auto size = get_next_codepoint_size(str[0]);
+        if (size == 1 && (str[0] & 0b10000000) != 0)
+          throw std::runtime_error("Invalid UTF-8 passed to remove_invalid_xml_chars");
+        if (is_valid_xml_codepoint(str, size))
           {
-            codepoint = ((str[0] & 0b01111111));
-            if (codepoint.to_ulong() == 0x09 ||
-                codepoint.to_ulong() == 0x0A ||
-                codepoint.to_ulong() == 0x0D ||
-                codepoint.to_ulong() >= 0x20)
-              {
-                ::memcpy(r, str, 1);
-                r += 1;
-              }
-            str += 1;
+            ::memcpy(r, str, size);
+            r += size;
           }
-        else
-          throw std::runtime_error("Invalid UTF-8 passed to remove_invalid_xml_chars");
+        str += size;
       }
     return {res.data(), static_cast<size_t>(r - res.data())};
   }
@@ -147,12 +214,18 @@ namespace utils
   {
     std::string res;
 
-    const iconv_t cd = iconv_open("UTF-8", charset);
-    if (cd == (iconv_t)-1)
-      throw std::runtime_error("Cannot convert into UTF-8");
-
-    // Make sure cd is always closed when we leave this function
-    const auto sg = utils::make_scope_guard([&cd](){ iconv_close(cd); });
+    auto& converter = get_utf8_converter(charset);
+    if (converter.is_ascii_compatible())
+      {
+        // Nothing to convert if the string only contains ASCII characters.
+        // Like the conversion, this stops at the first null byte.
+        const char* p = str.c_str();
+        while (*p && (*p & 0x80) == 0)
+          ++p;
+        if (!*p)
+          return {str.c_str(), static_cast<std::size_t>(p - str.c_str())};
+      }
+    const iconv_t cd = converter.get();
 
     size_t inbytesleft = str.size();
 
@@ -24,6 +24,11 @@ namespace utils
    * in XML.
    */
   std::string remove_invalid_xml_chars(const std::string& original);
+  /**
+   * Returns true if the utf-8 codepoint starting at str, of the given size
+   * (see get_next_codepoint_size), is a character allowed in XML.
+   */
+  bool is_valid_xml_codepoint(const unsigned char* str, const std::size_t size);
   /**
    * Convert the given string (encoded is "encoding") into valid utf-8.
    * If some decoding fails, insert an utf-8 placeholder character instead.
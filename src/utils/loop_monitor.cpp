@@ -0,0 +1,67 @@
+#include <utils/loop_monitor.hpp>
+#include <utils/metrics.hpp>
+
+#include <config/config.hpp>
+#include <logger/logger.hpp>
+
+#include <algorithm>
+#include <array>
+
+static constexpr std::size_t kinds_number = static_cast<std::size_t>(LoopMonitor::Kind::size);
+
+static const std::array<const char*, kinds_number> kind_names{{
+  "recv", "send", "connect", "posted task", "timed event",
+}};
+
+static const std::vector<double> bounds{0.0001, 0.001, 0.01, 0.1, 0.5, 1, 5, 30};
+
+static std::array<metrics::Histogram*, kinds_number> make_callback_histograms()
+{
+  std::array<metrics::Histogram*, kinds_number> res{};
+  static const std::array<const char*, kinds_number> labels{{
+    "recv", "send", "connect", "posted_task", "timed_event",
+  }};
+  for (std::size_t i = 0; i < kinds_number; i++)
+    res[i] = &metrics::Registry::instance().histogram("biboumi_loop_callback_duration_seconds",
+                                                       "Time spent in each callback of the main loop",
+                                                       bounds, {{"kind", labels[i]}});
+  return res;
+}
+
+static const auto callback_histograms = make_callback_histograms();
+static metrics::Histogram& lag_histogram = metrics::Registry::instance().histogram("biboumi_loop_lag_seconds",
+                                                                                  "Delay between the expiration of the timed events and their execution",
+                                                                                  bounds);
+
+LoopMonitor& LoopMonitor::instance()
+{
+  static LoopMonitor inst;
+  return inst;
+}
+
+bool LoopMonitor::observe(const Kind kind, const clock::duration duration)
+{
+  callback_histograms[static_cast<std::size_t>(kind)]->observe(duration);
+  this->worst = std::max(this->worst, duration);
+  const auto threshold = Config::snapshot().loop_slow_threshold;
+  return threshold.count() > 0 && duration >= threshold;
+}
+
+void LoopMonitor::report(const Kind kind, const clock::duration duration, const std::string& description) const
+{
+  log_warning("Slow ", kind_names[static_cast<std::size_t>(kind)], " callback (",
+              std::chrono::duration_cast<std::chrono::milliseconds>(duration).count(), "ms) for ", description);
+}
+
+void LoopMonitor::observe_lag(const clock::duration lag)
+{
+  lag_histogram.observe(lag);
+  this->worst = std::max(this->worst, lag);
+}
+
+bool LoopMonitor::should_notify_watchdog(const clock::duration limit)
+{
+  const bool responsive = this->worst < limit;
+  this->worst = clock::duration::zero();
+  return responsive;
+}
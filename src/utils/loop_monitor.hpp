@@ -0,0 +1,77 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+
+/**
+ * Measure how long each callback of the main loop (the socket events
+ * dispatched by the Poller, the tasks posted to it, and the timed events)
+ * takes, and how late the timed events are executed.
+ *
+ * Everything runs in a single thread, so one slow callback (joining a
+ * channel with thousands of users, a slow database query…) delays all the
+ * others: the callbacks that take longer than loop_slow_threshold
+ * milliseconds are logged with what they were handling, and the
+ * durations are exported as histograms with the other metrics.
+ */
+class LoopMonitor
+{
+public:
+  using clock = std::chrono::steady_clock;
+
+  enum class Kind
+  {
+    recv,
+    send,
+    connect,
+    posted_task,
+    timed_event,
+    size
+  };
+
+  static LoopMonitor& instance();
+  ~LoopMonitor() = default;
+  LoopMonitor(const LoopMonitor&) = delete;
+  LoopMonitor(LoopMonitor&&) = delete;
+  LoopMonitor& operator=(const LoopMonitor&) = delete;
+  LoopMonitor& operator=(LoopMonitor&&) = delete;
+
+  /**
+   * Execute the callback and measure its duration. describe() returns
+   * what the callback was working for, for example the JID and IRC server
+   * of an IrcClient, and is only called if it was slow.
+   */
+  template <typename Callback, typename Describe>
+  void run(const Kind kind, Callback&& callback, Describe&& describe)
+  {
+    const auto start = clock::now();
+    callback();
+    const auto duration = clock::now() - start;
+    if (this->observe(kind, duration))
+      this->report(kind, duration, describe());
+  }
+  /**
+   * How late a timed event is executed, after the time it expired.
+   */
+  void observe_lag(const clock::duration lag);
+  /**
+   * Whether no callback took, and no timed event was delayed by, more
+   * than the given duration since the previous call, which means that the
+   * systemd watchdog can be notified.  Once the loop recovered from a
+   * stall, the next call returns true again.
+   */
+  bool should_notify_watchdog(const clock::duration limit);
+
+private:
+  LoopMonitor() = default;
+  /**
+   * Returns true if the duration is above the slow threshold.
+   */
+  bool observe(const Kind kind, const clock::duration duration);
+  void report(const Kind kind, const clock::duration duration, const std::string& description) const;
+  /**
+   * The longest callback or lag since the previous call to
+   * should_notify_watchdog().
+   */
+  clock::duration worst{0};
+};
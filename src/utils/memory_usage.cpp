@@ -0,0 +1,12 @@
+#include <utils/memory_usage.hpp>
+
+namespace memory_usage
+{
+std::size_t heap(const std::string& str)
+{
+  const auto object = reinterpret_cast<const char*>(&str);
+  if (str.data() >= object && str.data() < object + sizeof(str))
+    return 0;
+  return str.capacity() + 1;
+}
+}
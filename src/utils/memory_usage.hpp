@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+/**
+ * An approximation of the memory used by the data of one Bridge, to find
+ * out which users consume the most.  Only the containers that can grow
+ * with what the IRC servers send are counted, with the size of their
+ * elements and a guess of their allocations overhead, not what the
+ * allocator really uses.
+ */
+struct MemoryUsage
+{
+  /**
+   * The IrcClients themselves, with their MOTD, and the resources of the
+   * user on each server.
+   */
+  std::size_t irc_clients{0};
+  /**
+   * The IrcChannels, with their topic, and the resources in each of them.
+   */
+  std::size_t channels{0};
+  std::size_t occupants{0};
+  /**
+   * The messages waiting for a token to be sent to the IRC servers.
+   */
+  std::size_t message_queue{0};
+  /**
+   * What was received and not parsed yet, and what is waiting to be
+   * written on the sockets.
+   */
+  std::size_t buffers{0};
+  std::size_t channel_list_cache{0};
+  std::size_t waiting_callbacks{0};
+
+  std::size_t total() const
+  {
+    return this->irc_clients + this->channels + this->occupants + this->message_queue +
+        this->buffers + this->channel_list_cache + this->waiting_callbacks;
+  }
+};
+
+namespace memory_usage
+{
+/**
+ * What a node of a std::map, std::set or std::unordered_map adds to the
+ * size of its element: the pointers and the allocation header.
+ */
+constexpr std::size_t node_overhead = 4 * sizeof(void*);
+
+/**
+ * The size of the buffer allocated by the string, 0 if its content fits
+ * in the object itself.  The object is counted with the struct or the
+ * container that holds it.
+ */
+std::size_t heap(const std::string& str);
+}
@@ -0,0 +1,220 @@
+#include <utils/metrics.hpp>
+
+#include <algorithm>
+#include <sstream>
+#include <set>
+
+namespace metrics
+{
+
+Histogram::Histogram(std::vector<double> bounds):
+  bounds(std::move(bounds)),
+  buckets(std::make_unique<std::atomic<std::uint64_t>[]>(this->bounds.size() + 1))
+{
+  for (std::size_t i = 0; i <= this->bounds.size(); ++i)
+    this->buckets[i].store(0, std::memory_order_relaxed);
+}
+
+void Histogram::observe(const std::chrono::steady_clock::duration duration)
+{
+  const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+  const double seconds = static_cast<double>(ns) / 1e9;
+  std::size_t index = 0;
+  while (index < this->bounds.size() && seconds > this->bounds[index])
+    index++;
+  this->buckets[index].fetch_add(1, std::memory_order_relaxed);
+  this->count.fetch_add(1, std::memory_order_relaxed);
+  this->sum_ns.fetch_add(static_cast<std::uint64_t>(std::max<decltype(ns)>(ns, 0)), std::memory_order_relaxed);
+}
+
+double Histogram::get_sum() const
+{
+  return static_cast<double>(this->sum_ns.load(std::memory_order_relaxed)) / 1e9;
+}
+
+double Metric::get_value() const
+{
+  if (this->counter)
+    return static_cast<double>(this->counter->get());
+  if (this->gauge)
+    return static_cast<double>(this->gauge->get());
+  if (this->histogram)
+    return static_cast<double>(this->histogram->get_count());
+  if (this->callback)
+    return this->callback();
+  return 0;
+}
+
+Registry& Registry::instance()
+{
+  static Registry registry;
+  return registry;
+}
+
+Counter& Registry::counter(const std::string& name, const std::string& help, Labels labels)
+{
+  this->counters.emplace_back();
+  auto& counter = this->counters.back();
+  this->metrics.push_back({name, help, Type::counter, std::move(labels)});
+  this->metrics.back().counter = &counter;
+  return counter;
+}
+
+Gauge& Registry::gauge(const std::string& name, const std::string& help, Labels labels)
+{
+  this->gauges.emplace_back();
+  auto& gauge = this->gauges.back();
+  this->metrics.push_back({name, help, Type::gauge, std::move(labels)});
+  this->metrics.back().gauge = &gauge;
+  return gauge;
+}
+
+void Registry::gauge(const std::string& name, const std::string& help, std::function<double()> callback, Labels labels)
+{
+  this->metrics.push_back({name, help, Type::gauge, std::move(labels)});
+  this->metrics.back().callback = std::move(callback);
+}
+
+Histogram& Registry::histogram(const std::string& name, const std::string& help, std::vector<double> bounds, Labels labels)
+{
+  this->histograms.emplace_back(std::move(bounds));
+  auto& histogram = this->histograms.back();
+  this->metrics.push_back({name, help, Type::histogram, std::move(labels)});
+  this->metrics.back().histogram = &histogram;
+  return histogram;
+}
+
+namespace
+{
+const char* type_name(const Type type)
+{
+  switch (type)
+    {
+    case Type::counter:
+      return "counter";
+    case Type::gauge:
+      return "gauge";
+    case Type::histogram:
+      return "histogram";
+    }
+  return "untyped";
+}
+
+void write_escaped(std::ostream& os, const std::string& str, const bool escape_quotes)
+{
+  for (const char c: str)
+    {
+      if (c == '\\')
+        os << "\\\\";
+      else if (c == '\n')
+        os << "\\n";
+      else if (c == '"' && escape_quotes)
+        os << "\\\"";
+      else
+        os << c;
+    }
+}
+
+/**
+ * Write {a="b",c="d"}, with an additional label at the end, if any.
+ */
+void write_labels(std::ostream& os, const Labels& labels, const std::string& extra_name={}, const std::string& extra_value={})
+{
+  if (labels.empty() && extra_name.empty())
+    return;
+  os << '{';
+  bool first = true;
+  for (const auto& label: labels)
+    {
+      os << (first ? "" : ",") << label.first << "=\"";
+      write_escaped(os, label.second, true);
+      os << '"';
+      first = false;
+    }
+  if (!extra_name.empty())
+    os << (first ? "" : ",") << extra_name << "=\"" << extra_value << '"';
+  os << '}';
+}
+
+void write_histogram(std::ostream& os, const Metric& metric)
+{
+  const auto& histogram = *metric.histogram;
+  const auto& bounds = histogram.get_bounds();
+  std::uint64_t cumulative = 0;
+  for (std::size_t i = 0; i <= bounds.size(); ++i)
+    {
+      cumulative += histogram.get_bucket(i);
+      os << metric.name << "_bucket";
+      if (i < bounds.size())
+        {
+          std::ostringstream bound;
+          bound << bounds[i];
+          write_labels(os, metric.labels, "le", bound.str());
+        }
+      else
+        write_labels(os, metric.labels, "le", "+Inf");
+      os << ' ' << cumulative << '\n';
+    }
+  os << metric.name << "_sum";
+  write_labels(os, metric.labels);
+  os << ' ' << histogram.get_sum() << '\n';
+  os << metric.name << "_count";
+  write_labels(os, metric.labels);
+  // Not get_count(), which may have been incremented since we read the
+  // buckets
+  os << ' ' << cumulative << '\n';
+}
+}
+
+void Registry::write_prometheus(std::ostream& os) const
+{
+  const auto precision = os.precision(9);
+  // All the lines of one metric family must be written together, even if
+  // they were not created one after the other
+  std::set<std::string> written;
+  for (auto family = this->metrics.begin(); family != this->metrics.end(); ++family)
+    {
+      if (!written.insert(family->name).second)
+        continue;
+      os << "# HELP " << family->name << ' ';
+      write_escaped(os, family->help, false);
+      os << "\n# TYPE " << family->name << ' ' << type_name(family->type) << '\n';
+      for (auto it = family; it != this->metrics.end(); ++it)
+        {
+          if (it->name != family->name)
+            continue;
+          if (it->type == Type::histogram)
+            write_histogram(os, *it);
+          else
+            {
+              os << it->name;
+              write_labels(os, it->labels);
+              if (it->counter)
+                os << ' ' << it->counter->get() << '\n';
+              else if (it->gauge)
+                os << ' ' << it->gauge->get() << '\n';
+              else
+                os << ' ' << it->get_value() << '\n';
+            }
+        }
+    }
+  os.precision(precision);
+}
+
+Traffic::Traffic(const std::string& prefix, const std::string& description):
+  received_bytes(Registry::instance().counter(prefix + "_received_bytes_total",
+                                              "Bytes received from " + description)),
+  sent_bytes(Registry::instance().counter(prefix + "_sent_bytes_total",
+                                          "Bytes sent to " + description)),
+  pending_bytes(Registry::instance().gauge(prefix + "_pending_bytes",
+                                           "Bytes waiting to be sent to " + description)),
+  high_watermark_crossings(Registry::instance().counter(prefix + "_high_watermark_crossings_total",
+                                                        "Times the bytes waiting to be sent to " + description +
+                                                        " went above output_high_watermark")),
+  low_watermark_crossings(Registry::instance().counter(prefix + "_low_watermark_crossings_total",
+                                                       "Times the bytes waiting to be sent to " + description +
+                                                       " went back below output_low_watermark"))
+{
+}
+
+}
@@ -0,0 +1,210 @@
+#pragma once
+
+/**
+ * Counters, gauges and histograms describing what biboumi is doing, for
+ * monitoring.  They are updated from the hot paths (each stanza, each IRC
+ * line, each database query…), so updating one is only a relaxed atomic
+ * operation: no lock, no allocation, no lookup.  Each one is created once,
+ * usually as a static reference in the file that updates it, and lives
+ * until the end of the process.
+ *
+ * The registry can then write all of them, in the Prometheus text format
+ * (served by the MetricsServer), or walk through them (for the
+ * StatsdClient).
+ */
+
+#include <functional>
+#include <ostream>
+#include <cstdint>
+#include <utility>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <deque>
+
+namespace metrics
+{
+
+using Labels = std::vector<std::pair<std::string, std::string>>;
+
+/**
+ * A value that only goes up.
+ */
+class Counter
+{
+public:
+  Counter() = default;
+  Counter(const Counter&) = delete;
+  Counter(Counter&&) = delete;
+  Counter& operator=(const Counter&) = delete;
+  Counter& operator=(Counter&&) = delete;
+
+  void inc(const std::uint64_t n=1)
+  { this->value.fetch_add(n, std::memory_order_relaxed); }
+  std::uint64_t get() const
+  { return this->value.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<std::uint64_t> value{0};
+};
+
+/**
+ * A value that goes up and down, like a number of live objects.
+ */
+class Gauge
+{
+public:
+  Gauge() = default;
+  Gauge(const Gauge&) = delete;
+  Gauge(Gauge&&) = delete;
+  Gauge& operator=(const Gauge&) = delete;
+  Gauge& operator=(Gauge&&) = delete;
+
+  void inc(const std::int64_t n=1)
+  { this->value.fetch_add(n, std::memory_order_relaxed); }
+  void dec(const std::int64_t n=1)
+  { this->value.fetch_sub(n, std::memory_order_relaxed); }
+  void set(const std::int64_t n)
+  { this->value.store(n, std::memory_order_relaxed); }
+  std::int64_t get() const
+  { return this->value.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<std::int64_t> value{0};
+};
+
+/**
+ * Count the observed durations in a fixed set of buckets, and keep their
+ * sum.
+ */
+class Histogram
+{
+public:
+  /**
+   * The upper bounds of the buckets, in seconds, in increasing order. An
+   * additional bucket counts everything above the last one.
+   */
+  explicit Histogram(std::vector<double> bounds);
+  Histogram(const Histogram&) = delete;
+  Histogram(Histogram&&) = delete;
+  Histogram& operator=(const Histogram&) = delete;
+  Histogram& operator=(Histogram&&) = delete;
+
+  void observe(const std::chrono::steady_clock::duration duration);
+
+  const std::vector<double>& get_bounds() const
+  { return this->bounds; }
+  /**
+   * The number of observations that fell in the given bucket (not
+   * cumulative). The index bounds.size() is the last, unbounded, bucket.
+   */
+  std::uint64_t get_bucket(const std::size_t index) const
+  { return this->buckets[index].load(std::memory_order_relaxed); }
+  std::uint64_t get_count() const
+  { return this->count.load(std::memory_order_relaxed); }
+  /**
+   * The sum of all the observed durations, in seconds.
+   */
+  double get_sum() const;
+
+private:
+  const std::vector<double> bounds;
+  std::unique_ptr<std::atomic<std::uint64_t>[]> buckets;
+  std::atomic<std::uint64_t> count{0};
+  std::atomic<std::uint64_t> sum_ns{0};
+};
+
+enum class Type
+{
+  counter,
+  gauge,
+  histogram,
+};
+
+/**
+ * The description of one metric, and a pointer to its value. Exactly one
+ * of the value pointers (or the callback) is set, depending on the type.
+ */
+struct Metric
+{
+  std::string name;
+  std::string help;
+  Type type;
+  Labels labels;
+  const Counter* counter{nullptr};
+  const Gauge* gauge{nullptr};
+  const Histogram* histogram{nullptr};
+  /**
+   * For a gauge that is computed only when it is exported.
+   */
+  std::function<double()> callback{};
+
+  double get_value() const;
+};
+
+class Registry
+{
+public:
+  static Registry& instance();
+  Registry(const Registry&) = delete;
+  Registry(Registry&&) = delete;
+  Registry& operator=(const Registry&) = delete;
+  Registry& operator=(Registry&&) = delete;
+
+  /**
+   * Create a new metric. Metrics with the same name (and type and help),
+   * but different labels, are exported together.
+   */
+  Counter& counter(const std::string& name, const std::string& help, Labels labels={});
+  Gauge& gauge(const std::string& name, const std::string& help, Labels labels={});
+  void gauge(const std::string& name, const std::string& help, std::function<double()> callback, Labels labels={});
+  Histogram& histogram(const std::string& name, const std::string& help, std::vector<double> bounds, Labels labels={});
+
+  const std::deque<Metric>& get_metrics() const
+  { return this->metrics; }
+  /**
+   * Write all the metrics in the Prometheus text exposition format.
+   */
+  void write_prometheus(std::ostream& os) const;
+
+private:
+  Registry() = default;
+  /**
+   * The containers never move their elements, so the references returned
+   * above stay valid.
+   */
+  std::deque<Metric> metrics;
+  std::deque<Counter> counters;
+  std::deque<Gauge> gauges;
+  std::deque<Histogram> histograms;
+};
+
+/**
+ * The bytes read from and written to the sockets of one kind of
+ * connection, and the bytes waiting to be written.
+ */
+struct Traffic
+{
+  /**
+   * The prefix is something like "biboumi_irc".
+   */
+  Traffic(const std::string& prefix, const std::string& description);
+  Traffic(const Traffic&) = delete;
+  Traffic(Traffic&&) = delete;
+  Traffic& operator=(const Traffic&) = delete;
+  Traffic& operator=(Traffic&&) = delete;
+
+  Counter& received_bytes;
+  Counter& sent_bytes;
+  Gauge& pending_bytes;
+  /**
+   * How many times the bytes waiting on one socket went above the
+   * output_high_watermark, and then back below output_low_watermark.
+   */
+  Counter& high_watermark_crossings;
+  Counter& low_watermark_crossings;
+};
+
+}
@@ -0,0 +1,39 @@
+#include <utils/serializer.hpp>
+
+#include <stdexcept>
+
+void Serializer::put(const std::uint64_t value)
+{
+  for (std::size_t i = 0; i < sizeof(value); i++)
+    this->buffer += static_cast<char>((value >> (8 * i)) & 0xff);
+}
+
+void Serializer::put(const std::string& value)
+{
+  this->put(static_cast<std::uint64_t>(value.size()));
+  this->buffer += value;
+}
+
+Deserializer::Deserializer(const std::string& data):
+  data(data)
+{}
+
+std::uint64_t Deserializer::get_int()
+{
+  if (this->data.size() - this->position < sizeof(std::uint64_t))
+    throw std::runtime_error("Truncated state");
+  std::uint64_t value = 0;
+  for (std::size_t i = 0; i < sizeof(value); i++)
+    value |= static_cast<std::uint64_t>(static_cast<unsigned char>(this->data[this->position++])) << (8 * i);
+  return value;
+}
+
+std::string Deserializer::get_string()
+{
+  const auto size = this->get_int();
+  if (this->data.size() - this->position < size)
+    throw std::runtime_error("Truncated state");
+  std::string value = this->data.substr(this->position, static_cast<std::size_t>(size));
+  this->position += static_cast<std::size_t>(size);
+  return value;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Write some state into a string, to give it to another process (see
+ * src/network/upgrade.hpp), and read it back.  The integers are 8 bytes,
+ * little-endian, and each string is preceded by its size.  Nothing else is
+ * recorded: the reader must ask for the same things, in the same order, as
+ * the writer gave them.
+ */
+class Serializer
+{
+public:
+  Serializer() = default;
+  ~Serializer() = default;
+  Serializer(const Serializer&) = delete;
+  Serializer(Serializer&&) = delete;
+  Serializer& operator=(const Serializer&) = delete;
+  Serializer& operator=(Serializer&&) = delete;
+
+  void put(const std::uint64_t value);
+  void put(const std::string& value);
+  void put(const char* value) = delete;
+  void put(const bool value) = delete;
+
+  const std::string& data() const
+  { return this->buffer; }
+
+private:
+  std::string buffer;
+};
+
+class Deserializer
+{
+public:
+  explicit Deserializer(const std::string& data);
+  ~Deserializer() = default;
+  Deserializer(const Deserializer&) = delete;
+  Deserializer(Deserializer&&) = delete;
+  Deserializer& operator=(const Deserializer&) = delete;
+  Deserializer& operator=(Deserializer&&) = delete;
+
+  /**
+   * Both throw a std::runtime_error if the data is truncated.
+   */
+  std::uint64_t get_int();
+  std::string get_string();
+  bool at_end() const
+  { return this->position == this->data.size(); }
+
+private:
+  const std::string& data;
+  std::size_t position{0};
+};
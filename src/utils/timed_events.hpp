@@ -112,7 +112,9 @@ public:
    * Execute all the expired events (if their expiration time is exactly
    * now, or before now). The event is then removed from the list. If the
    * event does repeat, its expiration time is updated and it is reinserted
-   * in the list at the correct position.
+   * in the list at the correct position. A repeating event that is late by
+   * more than its delay is executed only once, and its next expiration
+   * time is the first one still in the future.
    * Returns the number of executed events.
    */
   std::size_t execute_expired_events();
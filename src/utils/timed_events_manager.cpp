@@ -1,7 +1,16 @@
 #include <utils/timed_events.hpp>
+#include <utils/metrics.hpp>
+#include <utils/loop_monitor.hpp>
 
 #include <algorithm>
 
+static const auto register_size_gauge = []()
+{
+  metrics::Registry::instance().gauge("biboumi_timed_events", "Timed events waiting to be executed",
+                                      []() { return static_cast<double>(TimedEventsManager::instance().size()); });
+  return true;
+}();
+
 TimedEventsManager& TimedEventsManager::instance()
 {
   static TimedEventsManager inst;
@@ -32,23 +41,27 @@ std::size_t TimedEventsManager::execute_expired_events()
 {
   std::size_t count = 0;
   const auto now = std::chrono::steady_clock::now();
-  for (auto it = this->events.begin(); it != this->events.end();)
+  // The callbacks may add or cancel events, so we can not keep an iterator
+  // on the list: the next event to execute is always the first one
+  while (!this->events.empty() && !this->events.front().is_after(now))
     {
-      if (!it->is_after(now))
+      TimedEvent copy(std::move(this->events.front()));
+      this->events.erase(this->events.begin());
+      ++count;
+      auto& monitor = LoopMonitor::instance();
+      monitor.observe_lag(now - copy.time_point);
+      monitor.run(LoopMonitor::Kind::timed_event, [&copy]() { copy.execute(); },
+                  [&copy]() { return "timed event “" + copy.get_name() + "”"; });
+      if (copy.repeat)
         {
-          TimedEvent copy(std::move(*it));
-          it = this->events.erase(it);
-          ++count;
-          copy.execute();
-          if (copy.repeat)
-            {
-              copy.time_point += copy.repeat_delay;
-              this->add_event(std::move(copy));
-            }
-          continue;
+          // The occurrences missed while the loop was blocked are skipped:
+          // running them all in a row would just repeat the same work
+          const auto after = std::chrono::steady_clock::now();
+          do
+            copy.time_point += copy.repeat_delay;
+          while (copy.repeat_delay.count() > 0 && !copy.is_after(after));
+          this->add_event(std::move(copy));
         }
-      else
-        break;
     }
   return count;
 }
@@ -0,0 +1,119 @@
+#include <utils/tracing.hpp>
+#include <utils/metrics.hpp>
+
+#include <config/config.hpp>
+#include <logger/logger.hpp>
+
+#include <iomanip>
+#include <sstream>
+
+namespace tracing
+{
+std::shared_ptr<Trace> current;
+
+static constexpr std::size_t stages_number = static_cast<std::size_t>(Stage::size);
+
+static const std::array<const char*, stages_number> stage_names{{
+  "received", "parsed", "bridged", "archived", "built", "queued", "sent",
+}};
+
+static const std::vector<double> bounds{0.00001, 0.0001, 0.001, 0.01, 0.1, 0.5, 1, 5};
+
+static std::array<metrics::Histogram*, stages_number> make_stage_histograms()
+{
+  std::array<metrics::Histogram*, stages_number> res{};
+  // Nothing is spent before being received
+  for (std::size_t i = 1; i < stages_number; i++)
+    res[i] = &metrics::Registry::instance().histogram("biboumi_trace_stage_duration_seconds",
+                                                       "Time spent by the traced messages before reaching each stage, since the previous one",
+                                                       bounds, {{"stage", stage_names[i]}});
+  return res;
+}
+
+static const auto stage_histograms = make_stage_histograms();
+static metrics::Histogram& total_histogram = metrics::Registry::instance().histogram("biboumi_trace_duration_seconds",
+                                                                                    "Time spent by the traced messages from their reception to their sending",
+                                                                                    bounds);
+
+/**
+ * The number of messages received since the last one that was traced.
+ */
+static int not_sampled = 0;
+
+static std::string to_milliseconds(const clock::duration duration)
+{
+  std::ostringstream os;
+  os << std::fixed << std::setprecision(3)
+     << std::chrono::duration<double, std::milli>(duration).count() << "ms";
+  return os.str();
+}
+
+Trace::Trace(const clock::time_point received, const void* origin):
+  origin(origin)
+{
+  this->mark(Stage::received, received);
+}
+
+void Trace::mark(const Stage stage, const clock::time_point time)
+{
+  this->stamps[static_cast<std::size_t>(stage)] = time;
+}
+
+clock::duration Trace::total() const
+{
+  return this->stamps.back() - this->stamps.front();
+}
+
+void Trace::finish() const
+{
+  auto previous = this->stamps.front();
+  for (std::size_t i = 1; i < stages_number; i++)
+    if (this->stamps[i] != clock::time_point{})
+      {
+        stage_histograms[i]->observe(this->stamps[i] - previous);
+        previous = this->stamps[i];
+      }
+  total_histogram.observe(this->total());
+
+  const auto threshold = Config::snapshot().trace_slow_threshold;
+  if (threshold.count() > 0 && this->total() >= threshold)
+    log_warning("Slow message (", to_milliseconds(this->total()), "): ", this->description,
+                ": ", this->breakdown());
+}
+
+std::string Trace::breakdown() const
+{
+  std::string res;
+  auto previous = this->stamps.front();
+  for (std::size_t i = 1; i < stages_number; i++)
+    if (this->stamps[i] != clock::time_point{})
+      {
+        if (!res.empty())
+          res += ", ";
+        res += std::string(stage_names[i]) + " +" + to_milliseconds(this->stamps[i] - previous);
+        previous = this->stamps[i];
+      }
+  return res;
+}
+
+bool is_enabled()
+{
+  return Config::snapshot().trace_sampling > 0;
+}
+
+bool sample(const clock::time_point received, const void* origin)
+{
+  current.reset();
+  const auto sampling = Config::snapshot().trace_sampling;
+  if (sampling <= 0 || ++not_sampled < sampling)
+    return false;
+  not_sampled = 0;
+  current = std::make_shared<Trace>(received, origin);
+  return true;
+}
+
+void end()
+{
+  current.reset();
+}
+}
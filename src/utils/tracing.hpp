@@ -0,0 +1,110 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <memory>
+#include <string>
+
+/**
+ * Sampled tracing of the messages going through biboumi, from the
+ * moment they are read on one socket until they are written on another
+ * one.
+ *
+ * One message out of trace_sampling (a configuration option) is traced:
+ * each stage it reaches is stamped, the time spent between two stages is
+ * added to a histogram exported with the other metrics, and the whole
+ * breakdown is logged if the message took more than trace_slow_threshold
+ * milliseconds.
+ *
+ * Everything happens in the main thread: the trace of the message being
+ * handled is simply kept in a global, and the code of each stage calls
+ * tracing::mark(), which does nothing if that message is not traced.
+ */
+namespace tracing
+{
+using clock = std::chrono::steady_clock;
+
+enum class Stage: std::size_t
+{
+  received,                     // Read from the socket
+  parsed,                       // Parsed into an IrcMessage
+  bridged,                      // Given to the Bridge, to forward it
+  archived,                     // Stored in the database
+  built,                        // Stanza built
+  queued,                       // Serialized and added to an output buffer
+  sent,                         // Written on the socket by sendmsg
+  size
+};
+
+class Trace
+{
+public:
+  Trace(const clock::time_point received, const void* origin);
+  ~Trace() = default;
+  Trace(const Trace&) = delete;
+  Trace(Trace&&) = delete;
+  Trace& operator=(const Trace&) = delete;
+  Trace& operator=(Trace&&) = delete;
+
+  /**
+   * Stamp the given stage. A message can reach the same stage more than
+   * once (for example one stanza is built for each resource of the user),
+   * in that case the last time is kept.
+   */
+  void mark(const Stage stage, const clock::time_point time=clock::now());
+  /**
+   * Called once the last byte of the message has been written: observe
+   * the histograms and, if it was slow, log the breakdown.
+   */
+  void finish() const;
+  /**
+   * The time spent before reaching each stage, since the previous
+   * stage that was reached, for example “parsed +0.012ms, bridged
+   * +0.004ms, archived +1.2ms”.
+   */
+  std::string breakdown() const;
+  clock::duration total() const;
+  /**
+   * The socket on which the message was received. The data written back
+   * on that same socket (a PONG for example) is not part of the trace.
+   */
+  const void* const origin;
+  /**
+   * Something to tell what message this is, in the logs.
+   */
+  std::string description;
+
+private:
+  /**
+   * A default-constructed time_point means the stage was not reached.
+   */
+  std::array<clock::time_point, static_cast<std::size_t>(Stage::size)> stamps{};
+};
+
+/**
+ * The trace of the message being handled, if it is traced.
+ */
+extern std::shared_ptr<Trace> current;
+
+/**
+ * Whether the traces are sampled at all (trace_sampling is not 0).
+ */
+bool is_enabled();
+/**
+ * Called for each received message. Once every trace_sampling calls, a
+ * new trace is started and becomes the current one, and true is
+ * returned. The previous current trace, if any, is ended.
+ */
+bool sample(const clock::time_point received, const void* origin);
+/**
+ * Stop tracing the message being handled.  The trace stays alive as
+ * long as some of the data it produced is waiting in an output buffer.
+ */
+void end();
+
+inline void mark(const Stage stage)
+{
+  if (current)
+    current->mark(stage);
+}
+}
@@ -2,6 +2,7 @@
 #include <xmpp/adhoc_command.hpp>
 #include <xmpp/xmpp_component.hpp>
 #include <utils/reload.hpp>
+#include <network/upgrade.hpp>
 
 using namespace std::string_literals;
 
@@ -79,3 +80,13 @@ void Reload(XmppComponent&, AdhocSession&, XmlNode& command_node)
   note["type"] = "info";
   note.set_inner("Configuration reloaded.");
 }
+
+void Upgrade(XmppComponent&, AdhocSession&, XmlNode& command_node)
+{
+  // Done by the main loop, once this response is sent
+  upgrade::request();
+  command_node.delete_all_children();
+  XmlSubNode note(command_node, "note");
+  note["type"] = "info";
+  note.set_inner("Upgrading to " + upgrade::get_binary() + ", see the logs for the result.");
+}
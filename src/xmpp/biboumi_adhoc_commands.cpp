@@ -5,8 +5,11 @@
 #include <config/config.hpp>
 #include <utils/string.hpp>
 #include <utils/split.hpp>
+#include <utils/allocations.hpp>
+#include <logger/logger.hpp>
 #include <xmpp/jid.hpp>
 #include <algorithm>
+#include <map>
 #include <sstream>
 #include <iomanip>
 
@@ -114,6 +117,115 @@ void DisconnectUserStep2(XmppComponent& xmpp_component, AdhocSession& session, X
   session.terminate();
 }
 
+void MemoryUsageStep1(XmppComponent&, AdhocSession&, XmlNode& command_node)
+{
+  XmlSubNode x(command_node, "jabber:x:data", "x");
+  x["type"] = "form";
+  XmlSubNode title(x, "title");
+  title.set_inner("Memory used by each user");
+  XmlSubNode instructions(x, "instructions");
+  instructions.set_inner("Choose how many users to list, and optionally a soft limit: "
+                         "the cached data of the users above it is freed");
+
+  XmlSubNode max_field(x, "field");
+  max_field["var"] = "max";
+  max_field["type"] = "text-single";
+  max_field["label"] = "Number of users to list";
+  XmlSubNode max_value(max_field, "value");
+  max_value.set_inner("10");
+
+  XmlSubNode limit_field(x, "field");
+  limit_field["var"] = "soft-limit";
+  limit_field["type"] = "text-single";
+  limit_field["label"] = "Soft limit per user, in KiB";
+}
+
+static std::string to_kib(const std::size_t bytes)
+{
+  return std::to_string((bytes + 1023) / 1024) + " KiB";
+}
+
+void MemoryUsageStep2(XmppComponent& xmpp_component, AdhocSession& session, XmlNode& command_node)
+{
+  auto& biboumi_component = dynamic_cast<BiboumiComponent&>(xmpp_component);
+
+  const XmlNode* x = command_node.get_child("x", "jabber:x:data");
+  if (!x)
+    {
+      XmlSubNode error(command_node, ADHOC_NS, "error");
+      error["type"] = "modify";
+      XmlSubNode condition(error, STANZA_NS, "bad-request");
+      session.terminate();
+      return;
+    }
+  long max = 10;
+  long soft_limit = 0;
+  for (const XmlNode* field: x->get_children("field", "jabber:x:data"))
+    {
+      const XmlNode* value = field->get_child("value", "jabber:x:data");
+      if (!value)
+        continue;
+      if (field->get_tag("var") == "max")
+        max = std::atol(value->get_inner().data());
+      else if (field->get_tag("var") == "soft-limit")
+        soft_limit = std::atol(value->get_inner().data());
+    }
+
+  std::vector<std::pair<Bridge*, MemoryUsage>> usages;
+  std::size_t shed = 0;
+  for (Bridge* bridge: biboumi_component.get_bridges())
+    {
+      auto usage = bridge->get_memory_usage();
+      if (soft_limit > 0 && usage.total() > static_cast<std::size_t>(soft_limit) * 1024)
+        {
+          log_info("Freeing the cached data of ", bridge->get_jid(), ", using ", to_kib(usage.total()));
+          bridge->shed_cached_data();
+          usage = bridge->get_memory_usage();
+          shed++;
+        }
+      usages.emplace_back(bridge, usage);
+    }
+  std::sort(usages.begin(), usages.end(), [](const auto& a, const auto& b)
+  {
+    return a.second.total() > b.second.total();
+  });
+
+  std::size_t total = 0;
+  for (const auto& usage: usages)
+    total += usage.second.total();
+  std::ostringstream ss;
+  ss << usages.size() << " user" << (usages.size() == 1 ? "" : "s") << " using approximately " << to_kib(total) << ".";
+  if (soft_limit > 0)
+    ss << "\nThe cached data of " << shed << " user" << (shed == 1 ? "" : "s") << " above " << soft_limit << " KiB was freed.";
+  for (std::size_t i = 0; i < usages.size() && static_cast<long>(i) < max; i++)
+    {
+      const auto& usage = usages[i].second;
+      ss << "\n" << usages[i].first->get_jid() << ": " << to_kib(usage.total())
+         << " (IRC clients " << to_kib(usage.irc_clients)
+         << ", channels " << to_kib(usage.channels)
+         << ", occupants " << to_kib(usage.occupants)
+         << ", message queue " << to_kib(usage.message_queue)
+         << ", buffers " << to_kib(usage.buffers)
+         << ", channel list cache " << to_kib(usage.channel_list_cache)
+         << ", waiting callbacks " << to_kib(usage.waiting_callbacks) << ")";
+    }
+
+  command_node.delete_all_children();
+  XmlSubNode note(command_node, "note");
+  note["type"] = "info";
+  note.set_inner(ss.str());
+}
+
+#ifdef PROFILE_ALLOCATIONS
+void AllocationsReport(XmppComponent&, AdhocSession&, XmlNode& command_node)
+{
+  command_node.delete_all_children();
+  XmlSubNode note(command_node, "note");
+  note["type"] = "info";
+  note.set_inner(allocations::report());
+}
+#endif
+
 #ifdef USE_DATABASE
 
 void ConfigureGlobalStep1(XmppComponent&, AdhocSession& session, XmlNode& command_node)
@@ -231,7 +343,7 @@ void ConfigureIrcServerStep1(XmppComponent&, AdhocSession& session, XmlNode& com
   const Jid owner(session.get_owner_jid());
   const Jid target(session.get_target_jid());
   std::string server_domain;
-  if ((server_domain = Config::get("fixed_irc_server", "")).empty())
+  if ((server_domain = Config::snapshot().fixed_irc_server).empty())
     server_domain = target.local;
   auto options = Database::get_irc_server_options(owner.local + "@" + owner.domain,
                                                   server_domain);
@@ -245,7 +357,7 @@ void ConfigureIrcServerStep1(XmppComponent&, AdhocSession& session, XmlNode& com
   XmlSubNode instructions(x, "instructions");
   instructions.set_inner("Edit the form, to configure the settings of the IRC server " + server_domain);
 
-  if (Config::get("fixed_irc_server", "").empty())
+  if (Config::snapshot().fixed_irc_server.empty())
   {
     XmlSubNode field(x, "field");
     field["var"] = "address";
@@ -365,7 +477,7 @@ void ConfigureIrcServerStep1(XmppComponent&, AdhocSession& session, XmlNode& com
       }
   }
 
-  if (Config::get("realname_customization", "true") == "true")
+  if (Config::snapshot().realname_customization)
     {
       {
         XmlSubNode username(x, "field");
@@ -447,7 +559,7 @@ void ConfigureIrcServerStep2(XmppComponent& xmpp_component, AdhocSession& sessio
       const Jid owner(session.get_owner_jid());
       const Jid target(session.get_target_jid());
       std::string server_domain;
-      if ((server_domain = Config::get("fixed_irc_server", "")).empty())
+      if ((server_domain = Config::snapshot().fixed_irc_server).empty())
         server_domain = target.local;
       auto options = Database::get_irc_server_options(owner.local + "@" + owner.domain,
                                                       server_domain);
@@ -459,7 +571,7 @@ void ConfigureIrcServerStep2(XmppComponent& xmpp_component, AdhocSession& sessio
           const XmlNode* value = field->get_child("value", "jabber:x:data");
           const std::vector<const XmlNode*> values = field->get_children("value", "jabber:x:data");
 
-          if (field->get_tag("var") == "address" && value && Config::get("fixed_irc_server", "").empty())
+          if (field->get_tag("var") == "address" && value && Config::snapshot().fixed_irc_server.empty())
             options.col<Database::Address>() = value->get_inner();
 
           if (field->get_tag("var") == "ports")
@@ -909,7 +1021,7 @@ void GetIrcConnectionInfoStep1(XmppComponent& component, AdhocSession& session,
     }
 
   std::string hostname;
-  if ((hostname = Config::get("fixed_irc_server", "")).empty())
+  if ((hostname = Config::snapshot().fixed_irc_server).empty())
     hostname = target.local;
 
   IrcClient* irc = bridge->find_irc_client(hostname);
@@ -936,15 +1048,19 @@ void GetIrcConnectionInfoStep1(XmppComponent& component, AdhocSession& session,
 #endif
   ss << " (" << std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now() - irc->connection_date).count() << " seconds ago).";
 
-  for (const auto& it: bridge->resources_in_chan)
+  const auto server_it = bridge->resources_in_chan.find(irc->get_hostname());
+  if (server_it != bridge->resources_in_chan.end())
     {
-      const auto& channel_key = it.first;
-      const auto& irc_hostname = std::get<1>(channel_key);
-      const auto& resources = it.second;
-
-      if (irc_hostname == irc->get_hostname() && !resources.empty())
+      // Sort the channels, the map is not ordered
+      std::map<std::string, const ResourceSet*> channels;
+      for (const auto& it: server_it->second)
+        channels.emplace(it.first, &it.second);
+      for (const auto& it: channels)
         {
-          const auto& channel_name = std::get<0>(channel_key);
+          const auto& channel_name = it.first;
+          const auto& resources = *it.second;
+          if (resources.empty())
+            continue;
           ss << "\n" << channel_name << " from " << resources.size() << " resource" << (resources.size() > 1 ? "s": "") << ": ";
           for (const auto& resource: resources)
             ss << resource << " ";
@@ -6,11 +6,20 @@
 #include <xmpp/xmpp_stanza.hpp>
 #include <xmpp/jid.hpp>
 
+#include <biboumi.h>
+
 class XmppComponent;
 
 void DisconnectUserStep1(XmppComponent&, AdhocSession& session, XmlNode& command_node);
 void DisconnectUserStep2(XmppComponent&, AdhocSession& session, XmlNode& command_node);
 
+void MemoryUsageStep1(XmppComponent&, AdhocSession& session, XmlNode& command_node);
+void MemoryUsageStep2(XmppComponent&, AdhocSession& session, XmlNode& command_node);
+
+#ifdef PROFILE_ALLOCATIONS
+void AllocationsReport(XmppComponent&, AdhocSession& session, XmlNode& command_node);
+#endif
+
 void ConfigureGlobalStep1(XmppComponent&, AdhocSession& session, XmlNode& command_node);
 void ConfigureGlobalStep2(XmppComponent&, AdhocSession& session, XmlNode& command_node);
 
@@ -10,11 +10,14 @@
 #include <utils/encoding.hpp>
 #include <config/config.hpp>
 #include <utils/time.hpp>
+#include <utils/serializer.hpp>
 #include <xmpp/jid.hpp>
+#include <xmpp/caps.hpp>
 
 #include <stdexcept>
 #include <iostream>
 
+#include <algorithm>
 #include <cstdlib>
 
 #include <biboumi.h>
@@ -42,6 +45,83 @@ static std::set<std::string> kickable_errors{
     "malformed-error"
     };
 
+/**
+ * The features of the disco#info of one kind of entity, serialized once:
+ * only the identity (and the room info form) differ from one entity to
+ * the other.
+ */
+struct DiscoFeatures
+{
+  DiscoFeatures(std::initializer_list<const char*> list):
+    features(list.begin(), list.end())
+  {
+    for (const auto& feature: this->features)
+      {
+        XmlNode node("feature");
+        node["var"] = feature;
+        this->xml += node.to_string();
+      }
+  }
+  const std::vector<std::string> features;
+  std::string xml;
+};
+
+/**
+ * The gateway itself and the IRC servers have the same features.
+ */
+static const DiscoFeatures& server_features()
+{
+  static const DiscoFeatures features{DISCO_INFO_NS, MUC_NS, ADHOC_NS, PING_NS, MAM_NS, VERSION_NS, STABLE_MUC_ID_NS, CAPS_NS};
+  return features;
+}
+
+static const DiscoFeatures& channel_features()
+{
+  static const DiscoFeatures features{DISCO_INFO_NS, MUC_NS, ADHOC_NS, PING_NS, MAM_NS, VERSION_NS, STABLE_MUC_ID_NS,
+                                      SELF_PING_FLAG, "muc_nonanonymous", STABLE_ID_NS};
+  return features;
+}
+
+static std::string gateway_name()
+{
+  return "Biboumi XMPP-IRC gateway";
+}
+
+static std::string irc_server_name(const std::string& hostname)
+{
+  return "IRC server " + hostname + " over Biboumi";
+}
+
+static std::string identity_xml(const std::string& name)
+{
+  XmlNode identity("identity");
+  identity["category"] = "conference";
+  identity["type"] = "irc";
+  identity["name"] = name;
+  return identity.to_string();
+}
+
+/**
+ * The RSM (XEP-0059) request of a disco#items query, if any.
+ */
+static ResultSetInfo parse_result_set_info(const XmlNode* query)
+{
+  ResultSetInfo rs_info;
+  const XmlNode* set_node = query->get_child("set", RSM_NS);
+  if (set_node)
+    {
+      const XmlNode* after = set_node->get_child("after", RSM_NS);
+      if (after)
+        rs_info.after = after->get_inner();
+      const XmlNode* before = set_node->get_child("before", RSM_NS);
+      if (before)
+        rs_info.before = before->get_inner();
+      const XmlNode* max = set_node->get_child("max", RSM_NS);
+      if (max)
+        rs_info.max = std::atoi(max->get_inner().data());
+    }
+  return rs_info;
+}
 
 BiboumiComponent::BiboumiComponent(std::shared_ptr<Poller>& poller, const std::string& hostname, const std::string& secret):
   XmppComponent(poller, hostname, secret),
@@ -59,10 +139,15 @@ BiboumiComponent::BiboumiComponent(std::shared_ptr<Poller>& poller, const std::s
   this->adhoc_commands_handler.add_command("hello", {{&HelloStep1, &HelloStep2}, "Receive a custom greeting", false});
   this->adhoc_commands_handler.add_command("disconnect-user", {{&DisconnectUserStep1, &DisconnectUserStep2}, "Disconnect selected users from the gateway", true});
   this->adhoc_commands_handler.add_command("disconnect-from-irc-server", {{&DisconnectUserFromServerStep1, &DisconnectUserFromServerStep2, &DisconnectUserFromServerStep3}, "Disconnect from the selected IRC servers", false});
+  this->adhoc_commands_handler.add_command("memory-usage", {{&MemoryUsageStep1, &MemoryUsageStep2}, "List the users using the most memory", true});
+#ifdef PROFILE_ALLOCATIONS
+  this->adhoc_commands_handler.add_command("allocations", {{&AllocationsReport}, "Report the memory allocations of each subsystem", true});
+#endif
   this->adhoc_commands_handler.add_command("reload", {{&Reload}, "Reload biboumi’s configuration", true});
+  this->adhoc_commands_handler.add_command("upgrade", {{&Upgrade}, "Replace biboumi by a new process, without disconnecting from the IRC servers", true});
 
   AdhocCommand get_irc_connection_info{{&GetIrcConnectionInfoStep1}, "Returns various information about your connection to this IRC server.", false};
-  if (!Config::get("fixed_irc_server", "").empty())
+  if (!Config::snapshot().fixed_irc_server.empty())
     this->adhoc_commands_handler.add_command("get-irc-connection-info", get_irc_connection_info);
   else
     this->irc_server_adhoc_commands_handler.add_command("get-irc-connection-info", get_irc_connection_info);
@@ -71,7 +156,7 @@ BiboumiComponent::BiboumiComponent(std::shared_ptr<Poller>& poller, const std::s
   AdhocCommand configure_server_command({&ConfigureIrcServerStep1, &ConfigureIrcServerStep2}, "Configure a few settings for that IRC server", false);
   AdhocCommand configure_global_command({&ConfigureGlobalStep1, &ConfigureGlobalStep2}, "Configure a few settings", false);
 
-  if (!Config::get("fixed_irc_server", "").empty())
+  if (!Config::snapshot().fixed_irc_server.empty())
     {
       this->adhoc_commands_handler.add_command("server-configure", configure_server_command);
       this->adhoc_commands_handler.add_command("global-configure", configure_global_command);
@@ -100,19 +185,65 @@ void BiboumiComponent::shutdown()
 #endif
 }
 
+constexpr const char* BiboumiComponent::state_magic;
+constexpr std::uint64_t BiboumiComponent::state_version;
+
+void BiboumiComponent::save_state(Serializer& out, std::vector<socket_t>& sockets) const
+{
+  out.put(std::string(BiboumiComponent::state_magic));
+  out.put(BiboumiComponent::state_version);
+  out.put(this->bridges.size());
+  for (const auto& pair: this->bridges)
+    {
+      out.put(pair.first);
+      pair.second->save_state(out, sockets);
+    }
+}
+
+void BiboumiComponent::restore_state(Deserializer& in, const std::vector<socket_t>& sockets)
+{
+  // Checked before anything is restored: the previous process then keeps
+  // its connections
+  if (in.get_string() != BiboumiComponent::state_magic)
+    throw std::runtime_error("The previous process did not send a biboumi state");
+  const auto version = in.get_int();
+  if (version != BiboumiComponent::state_version)
+    throw std::runtime_error("The state of the previous process has the format version " + std::to_string(version) +
+                             ", this one only reads version " + std::to_string(BiboumiComponent::state_version));
+  for (auto i = in.get_int(); i > 0; i--)
+    this->get_user_bridge(in.get_string())->restore_state(in, sockets);
+  for (const auto& bridge: this->bridges)
+    for (const auto& pair: bridge.second->get_irc_clients())
+      pair.second->pause_receiving();
+  this->resume_irc_clients_after_handshake = true;
+}
+
+void BiboumiComponent::quit_not_handed_over()
+{
+  for (auto& pair: this->bridges)
+    pair.second->quit_not_handed_over("Gateway upgrade");
+}
+
 void BiboumiComponent::clean()
 {
-  auto it = std::begin(this->bridges);
-  while (it != std::end(this->bridges))
+  std::vector<std::string> bare_jids;
+  std::swap(bare_jids, this->bridges_to_clean);
+  for (const auto& bare_jid: bare_jids)
   {
+    auto it = this->bridges.find(bare_jid);
+    if (it == this->bridges.end())
+      continue;
     it->second->clean();
     if (it->second->active_clients() == 0)
-      it = this->bridges.erase(it);
-    else
-      ++it;
+      this->bridges.erase(it);
   }
 }
 
+void BiboumiComponent::mark_for_cleanup(const std::string& bare_jid)
+{
+  this->bridges_to_clean.push_back(bare_jid);
+}
+
 void BiboumiComponent::handle_presence(const Stanza& stanza)
 {
   std::string from_str = stanza.get_tag("from");
@@ -301,7 +432,7 @@ void BiboumiComponent::handle_message(const Stanza& stanza)
     {
       if (body && !body->get_inner().empty())
         {
-          if (bridge->is_resource_in_chan(iid.to_tuple(), from.resource))
+          if (bridge->is_resource_in_chan(iid.get_local(), iid.get_server(), from.resource))
             {
               // Extract some XML nodes that we must include in the
               // reflection (if any), because XMPP says so
@@ -355,7 +486,7 @@ void BiboumiComponent::handle_message(const Stanza& stanza)
     {
       if (body && !body->get_inner().empty())
         {
-          const auto fixed_irc_server = Config::get("fixed_irc_server", "");
+          const auto& fixed_irc_server = Config::snapshot().fixed_irc_server;
           // a message for nick!server
           if (iid.type == Iid::Type::User && !iid.get_local().empty())
             {
@@ -534,20 +665,22 @@ void BiboumiComponent::handle_iq(const Stanza& stanza)
         { // Disco info
           Iid iid(to.local, {'#', '&'});
           const std::string node = query->get_tag("node");
-          if (to_str == this->served_hostname)
+          // Whatever the resource
+          if (to.local.empty() && to.domain == this->served_hostname)
             {
-              if (node.empty())
+              // The node is the one of our caps, if the client checks them
+              if (node.empty() || this->is_caps_node(node, gateway_name()))
                 {
                   // On the gateway itself
-                  this->send_self_disco_info(id, from);
+                  this->send_self_disco_info(id, from, node);
                   stanza_error.disable();
                 }
             }
           else if (iid.type == Iid::Type::Server)
             {
-                if (node.empty())
+                if (node.empty() || this->is_caps_node(node, irc_server_name(to.local)))
                 {
-                    this->send_irc_server_disco_info(id, from, to_str);
+                    this->send_irc_server_disco_info(id, from, to_str, node);
                     stanza_error.disable();
                 }
             }
@@ -624,25 +757,25 @@ void BiboumiComponent::handle_iq(const Stanza& stanza)
             }
           else if (node.empty() && iid.type == Iid::Type::Server)
             { // Disco on an IRC server: get the list of channels
-              ResultSetInfo rs_info;
-              const XmlNode* set_node = query->get_child("set", RSM_NS);
-              if (set_node)
-                {
-                  const XmlNode* after = set_node->get_child("after", RSM_NS);
-                  if (after)
-                    rs_info.after = after->get_inner();
-                  const XmlNode* before = set_node->get_child("before", RSM_NS);
-                  if (before)
-                    rs_info.before = before->get_inner();
-                  const XmlNode* max = set_node->get_child("max", RSM_NS);
-                  if (max)
-                    rs_info.max = std::atoi(max->get_inner().data());
-                }
+              ResultSetInfo rs_info = parse_result_set_info(query);
               if (rs_info.max == -1)
                 rs_info.max = 100;
               bridge->send_irc_channel_list_request(iid, id, from, std::move(rs_info));
               stanza_error.disable();
             }
+          else if (node.empty() && iid.type == Iid::Type::Channel && to.resource.empty())
+            { // Disco on a channel: get the list of all its occupants,
+              // including the ones not announced with a presence
+              const IrcClient* irc_client = bridge->find_irc_client(iid.get_server());
+              const IrcChannel* irc_channel{};
+              if (irc_client)
+                irc_channel = irc_client->find_channel(iid.get_local());
+              // An empty <before/> is not kept in the ResultSetInfo
+              const XmlNode* set_node = query->get_child("set", RSM_NS);
+              const bool backward = set_node && set_node->get_child("before", RSM_NS);
+              this->send_irc_channel_occupants(id, from, to_str, irc_channel, parse_result_set_info(query), backward);
+              stanza_error.disable();
+            }
         }
       else if ((query = stanza.get_child("ping", PING_NS)))
         {
@@ -765,7 +898,8 @@ bool BiboumiComponent::handle_mam_request(const Stanza& stanza)
           }
         const XmlNode* set = query->get_child("set", RSM_NS);
         int limit = -1;
-        Id::real_type reference_record_id{Id::unset_value};
+        auto reference_record = Database::muc_log_lines.row();
+        const Database::MucLogLine* reference{};
         Database::Paging paging_order{Database::Paging::first};
         if (set)
           {
@@ -775,9 +909,9 @@ bool BiboumiComponent::handle_mam_request(const Stanza& stanza)
             const XmlNode* after = set->get_child("after", RSM_NS);
             if (after)
               {
-                auto after_record = Database::get_muc_log(from.bare(), iid.get_local(), iid.get_server(),
-                                                          after->get_inner(), start, end);
-                reference_record_id = after_record.col<Id>();
+                reference_record = Database::get_muc_log(from.bare(), iid.get_local(), iid.get_server(),
+                                                         after->get_inner(), start, end);
+                reference = &reference_record;
               }
             const XmlNode* before = set->get_child("before", RSM_NS);
             if (before)
@@ -785,8 +919,8 @@ bool BiboumiComponent::handle_mam_request(const Stanza& stanza)
                 paging_order = Database::Paging::last;
                 if (!before->get_inner().empty())
                   {
-                    auto before_record = Database::get_muc_log(from.bare(), iid.get_local(), iid.get_server(), before->get_inner(), start, end);
-                    reference_record_id = before_record.col<Id>();
+                    reference_record = Database::get_muc_log(from.bare(), iid.get_local(), iid.get_server(), before->get_inner(), start, end);
+                    reference = &reference_record;
                   }
               }
           }
@@ -797,7 +931,7 @@ bool BiboumiComponent::handle_mam_request(const Stanza& stanza)
         auto result = Database::get_muc_logs(from.bare(), iid.get_local(), iid.get_server(),
                                             static_cast<std::size_t>(limit),
                                             start, end,
-                                            reference_record_id, paging_order);
+                                            reference, paging_order);
         bool complete = std::get<bool>(result);
         auto& lines = std::get<1>(result);
 
@@ -918,6 +1052,8 @@ Bridge* BiboumiComponent::get_user_bridge(const std::string& user_jid)
     }
   catch (const std::out_of_range& exception)
     {
+      // If no IrcClient is created for it, it must be removed
+      this->mark_for_cleanup(bare_jid);
       return this->bridges.emplace(bare_jid, std::make_unique<Bridge>(bare_jid, *this, this->poller)).first->second.get();
     }
 }
@@ -935,6 +1071,22 @@ Bridge* BiboumiComponent::find_user_bridge(const std::string& full_jid)
     }
 }
 
+void BiboumiComponent::on_high_watermark()
+{
+  log_warning("Pausing the reading from the IRC servers until the XMPP server catches up");
+  for (const auto& bridge: this->bridges)
+    for (const auto& pair: bridge.second->get_irc_clients())
+      pair.second->pause_receiving();
+}
+
+void BiboumiComponent::on_low_watermark()
+{
+  log_info("Resuming the reading from the IRC servers");
+  for (const auto& bridge: this->bridges)
+    for (const auto& pair: bridge.second->get_irc_clients())
+      pair.second->resume_receiving();
+}
+
 std::vector<Bridge*> BiboumiComponent::get_bridges() const
 {
   std::vector<Bridge*> res;
@@ -943,7 +1095,7 @@ std::vector<Bridge*> BiboumiComponent::get_bridges() const
   return res;
 }
 
-void BiboumiComponent::send_self_disco_info(const std::string& id, const std::string& jid_to)
+void BiboumiComponent::send_self_disco_info(const std::string& id, const std::string& jid_to, const std::string& node)
 {
   Stanza iq("iq");
   {
@@ -953,20 +1105,15 @@ void BiboumiComponent::send_self_disco_info(const std::string& id, const std::st
     iq["from"] = this->served_hostname;
     XmlSubNode query(iq, "query");
     query["xmlns"] = DISCO_INFO_NS;
-    XmlSubNode identity(query, "identity");
-    identity["category"] = "conference";
-    identity["type"] = "irc";
-    identity["name"] = "Biboumi XMPP-IRC gateway";
-    for (const char *ns: {DISCO_INFO_NS, MUC_NS, ADHOC_NS, PING_NS, MAM_NS, VERSION_NS, STABLE_MUC_ID_NS})
-      {
-        XmlSubNode feature(query, "feature");
-        feature["var"] = ns;
-      }
+    if (!node.empty())
+      query["node"] = node;
+    query.set_inner_xml(identity_xml(gateway_name()) + server_features().xml);
   }
   this->send_stanza(iq);
 }
 
-void BiboumiComponent::send_irc_server_disco_info(const std::string& id, const std::string& jid_to, const std::string& jid_from)
+void BiboumiComponent::send_irc_server_disco_info(const std::string& id, const std::string& jid_to, const std::string& jid_from,
+                                                  const std::string& node)
 {
   Jid from(jid_from);
   Stanza iq("iq");
@@ -977,15 +1124,9 @@ void BiboumiComponent::send_irc_server_disco_info(const std::string& id, const s
     iq["from"] = jid_from;
     XmlSubNode query(iq, "query");
     query["xmlns"] = DISCO_INFO_NS;
-    XmlSubNode identity(query, "identity");
-    identity["category"] = "conference";
-    identity["type"] = "irc";
-    identity["name"] = "IRC server " + from.local + " over Biboumi";
-    for (const char *ns: {DISCO_INFO_NS, MUC_NS, ADHOC_NS, PING_NS, MAM_NS, VERSION_NS, STABLE_MUC_ID_NS})
-      {
-        XmlSubNode feature(query, "feature");
-        feature["var"] = ns;
-      }
+    if (!node.empty())
+      query["node"] = node;
+    query.set_inner_xml(identity_xml(irc_server_name(from.local)) + server_features().xml);
   }
   this->send_stanza(iq);
 }
@@ -1013,6 +1154,24 @@ void BiboumiComponent::send_irc_channel_disco_info(const std::string& id, const
 {
   Jid from(jid_from);
   Iid iid(from.local, {});
+  XmlNode x("x");
+  x["xmlns"] = DATAFORM_NS;
+  x["type"] = "result";
+  {
+    XmlSubNode field(x, "field");
+    field["var"] = "FORM_TYPE";
+    field["type"] = "hidden";
+    XmlSubNode value(field, "value");
+    value.set_inner("http://jabber.org/protocol/muc#roominfo");
+  }
+  if (irc_channel && irc_channel->joined)
+    {
+      XmlSubNode field(x, "field");
+      field["var"] = "muc#roominfo_occupants";
+      field["label"] = "Number of occupants";
+      XmlSubNode value(field, "value");
+      value.set_inner(std::to_string(irc_channel->get_users().size()));
+    }
   Stanza iq("iq");
   {
     iq["type"] = "result";
@@ -1021,35 +1180,8 @@ void BiboumiComponent::send_irc_channel_disco_info(const std::string& id, const
     iq["from"] = jid_from;
     XmlSubNode query(iq, "query");
     query["xmlns"] = DISCO_INFO_NS;
-    XmlSubNode identity(query, "identity");
-    identity["category"] = "conference";
-    identity["type"] = "irc";
-    identity["name"] = ""s + iid.get_local() + " on " + iid.get_server();
-    for (const char *ns: {DISCO_INFO_NS, MUC_NS, ADHOC_NS, PING_NS, MAM_NS, VERSION_NS, STABLE_MUC_ID_NS, SELF_PING_FLAG, "muc_nonanonymous", STABLE_ID_NS})
-      {
-        XmlSubNode feature(query, "feature");
-        feature["var"] = ns;
-      }
-
-    XmlSubNode x(query, "x");
-    x["xmlns"] = DATAFORM_NS;
-    x["type"] = "result";
-    {
-      XmlSubNode field(x, "field");
-      field["var"] = "FORM_TYPE";
-      field["type"] = "hidden";
-      XmlSubNode value(field, "value");
-      value.set_inner("http://jabber.org/protocol/muc#roominfo");
-    }
-
-    if (irc_channel && irc_channel->joined)
-      {
-        XmlSubNode field(x, "field");
-        field["var"] = "muc#roominfo_occupants";
-        field["label"] = "Number of occupants";
-        XmlSubNode value(field, "value");
-        value.set_inner(std::to_string(irc_channel->get_users().size()));
-      }
+    query.set_inner_xml(identity_xml(""s + iid.get_local() + " on " + iid.get_server()) +
+                        channel_features().xml + x.to_string());
   }
   this->send_stanza(iq);
 }
@@ -1138,6 +1270,74 @@ void BiboumiComponent::send_iq_room_list_result(const std::string& id, const std
   this->send_stanza(iq);
 }
 
+void BiboumiComponent::send_irc_channel_occupants(const std::string& id, const std::string& jid_to,
+                                                  const std::string& jid_from, const IrcChannel* irc_channel,
+                                                  const ResultSetInfo& rs_info, const bool backward)
+{
+  Stanza iq("iq");
+  {
+    iq["type"] = "result";
+    iq["id"] = id;
+    iq["to"] = jid_to;
+    iq["from"] = jid_from;
+    XmlSubNode query(iq, "query");
+    query["xmlns"] = DISCO_ITEMS_NS;
+    if (irc_channel && irc_channel->joined)
+      {
+        // Paged with the nicks, in the order in which the occupants were
+        // added to the channel
+        const auto& users = irc_channel->get_users();
+        auto begin = users.begin();
+        if (!rs_info.after.empty())
+          {
+            begin = std::find_if(users.begin(), users.end(), [&rs_info](const auto& user)
+                                 { return user->nick == rs_info.after; });
+            if (begin != users.end())
+              ++begin;
+          }
+        auto end = users.end();
+        if (!rs_info.before.empty())
+          {
+            end = std::find_if(begin, users.end(), [&rs_info](const auto& user)
+                               { return user->nick == rs_info.before; });
+            if (end == users.end())
+              end = begin;
+          }
+        // With <before/>, the page is the last one before that nick (or the
+        // last one of all)
+        if (rs_info.max >= 0 && static_cast<std::size_t>(std::distance(begin, end)) > static_cast<std::size_t>(rs_info.max))
+          {
+            if (backward)
+              begin = end - rs_info.max;
+            else
+              end = begin + rs_info.max;
+          }
+        for (auto it = begin; it != end; ++it)
+          {
+            XmlSubNode item(query, "item");
+            item["jid"] = jid_from + "/" + (*it)->nick;
+            item["name"] = (*it)->nick;
+          }
+        if (rs_info.max >= 0 || !rs_info.after.empty() || backward)
+          {
+            XmlSubNode set_node(query, "set");
+            set_node["xmlns"] = RSM_NS;
+            if (begin != end)
+              {
+                XmlSubNode first_node(set_node, "first");
+                first_node["index"] = std::to_string(std::distance(users.begin(), begin));
+                first_node.set_inner((*begin)->nick);
+                XmlSubNode last_node(set_node, "last");
+                last_node.set_inner((*std::prev(end))->nick);
+              }
+            XmlSubNode count_node(set_node, "count");
+            count_node.set_inner(std::to_string(users.size()));
+          }
+      }
+  }
+  this->send_stanza(iq);
+}
+
 void BiboumiComponent::send_invitation(const std::string& room_target,
                                        const std::string& jid_to,
                                        const std::string& author_nick)
@@ -1194,9 +1394,34 @@ void BiboumiComponent::send_presence_to_contact(const std::string& from, const s
     presence["type"] = type;
   if (!id.empty())
     presence["id"] = id;
+  if (type.empty())
+    {
+      XmlSubNode c(presence, "c");
+      c["xmlns"] = CAPS_NS;
+      c["hash"] = "sha-1";
+      c["node"] = caps::node;
+      const Jid entity(from);
+      c["ver"] = this->get_caps_ver(entity.local.empty() ? gateway_name() : irc_server_name(entity.local));
+    }
   this->send_stanza(presence);
 }
 
+const std::string& BiboumiComponent::get_caps_ver(const std::string& name)
+{
+  auto it = this->caps_vers.find(name);
+  if (it == this->caps_vers.end())
+    it = this->caps_vers.emplace(name, caps::compute_ver("conference", "irc", name, server_features().features)).first;
+  return it->second;
+}
+
+bool BiboumiComponent::is_caps_node(const std::string& node, const std::string& name) const
+{
+  // Any JID can be queried, only the vers of the presences we sent are kept
+  const auto it = this->caps_vers.find(name);
+  const auto ver = it == this->caps_vers.end() ? caps::compute_ver("conference", "irc", name, server_features().features) : it->second;
+  return node == caps::node + "#"s + ver;
+}
+
 void BiboumiComponent::on_irc_client_connected(const std::string& irc_hostname, const std::string& jid)
 {
 #ifdef USE_DATABASE
@@ -1225,6 +1450,14 @@ void BiboumiComponent::after_handshake()
 {
   XmppComponent::after_handshake();
 
+  if (this->resume_irc_clients_after_handshake && !this->is_above_high_watermark())
+    {
+      for (const auto& bridge: this->bridges)
+        for (const auto& pair: bridge.second->get_irc_clients())
+          pair.second->resume_receiving();
+      this->resume_irc_clients_after_handshake = false;
+    }
+
 #ifdef USE_DATABASE
   const auto contacts = Database::get_contact_list(this->get_served_hostname());
 
@@ -9,6 +9,7 @@
 #include <memory>
 #include <string>
 #include <map>
+#include <cstdint>
 
 namespace db
 {
@@ -56,18 +57,50 @@ public:
    */
   void shutdown();
   /**
-   * Run a check on all bridges, to remove all disconnected (socket is
-   * closed, or no channel is joined) IrcClients. Some kind of garbage collector.
+   * The state starts with these: a process only takes over the state of
+   * another one written in the same format.  Increment the version
+   * whenever one of the save_state() methods writes something else.
+   */
+  static constexpr const char* state_magic = "biboumi upgrade state";
+  static constexpr std::uint64_t state_version = 2;
+  /**
+   * Write the state of the connections that can be given to a new biboumi
+   * process, on an upgrade, and add their sockets to the list (see
+   * Bridge::save_state()).
+   */
+  void save_state(Serializer& out, std::vector<socket_t>& sockets) const;
+  /**
+   * Recreate the bridges and their IrcClients written by save_state().
+   * The IrcClients do not read anything from their servers until we are
+   * authenticated with the XMPP server.
+   */
+  void restore_state(Deserializer& in, const std::vector<socket_t>& sockets);
+  /**
+   * Once the new process took the other connections, QUIT the ones that
+   * could not be given to it.
+   */
+  void quit_not_handed_over();
+  /**
+   * Run a check on the bridges marked with mark_for_cleanup(), to remove
+   * their disconnected (socket is closed, or no channel is joined)
+   * IrcClients, and the bridges that have no IrcClient left. Some kind of
+   * garbage collector.
    */
   void clean();
+  /**
+   * Remember that the bridge of this bare JID needs to be checked by the
+   * next clean().
+   */
+  void mark_for_cleanup(const std::string& bare_jid);
   /**
    * Send a result IQ with the gateway disco informations.
    */
-  void send_self_disco_info(const std::string& id, const std::string& jid_to);
+  void send_self_disco_info(const std::string& id, const std::string& jid_to, const std::string& node="");
   /**
    * Send a result IQ with the disco informations regarding IRC server JIDs.
    */
-  void send_irc_server_disco_info(const std::string& id, const std::string& jid_to, const std::string& jid_from);
+  void send_irc_server_disco_info(const std::string& id, const std::string& jid_to, const std::string& jid_from,
+                                  const std::string& node="");
   /**
    * Sends the allowed namespaces in MUC message, according to
    * http://xmpp.org/extensions/xep-0045.html#impl-service-traffic
@@ -87,12 +120,22 @@ public:
   void send_iq_room_list_result(const std::string& id, const std::string& to_jid, const std::string& from,
                                 const ChannelList& channel_list, std::vector<ListElement>::const_iterator begin,
                                 std::vector<ListElement>::const_iterator end, const ResultSetInfo& rs_info);
+  /**
+   * Send the list of all the occupants of the channel (an empty one if it
+   * is not joined), as the disco#items of the room.  backward is true if
+   * the request contained a <before/> element, even an empty one.
+   */
+  void send_irc_channel_occupants(const std::string& id, const std::string& jid_to, const std::string& jid_from,
+                                  const IrcChannel* irc_channel, const ResultSetInfo& rs_info, const bool backward);
   void send_invitation(const std::string& room_target, const std::string& jid_to, const std::string& author_nick);
 private:
   void send_invitation_from_fulljid(const std::string& room_target, const std::string& jid_to, const std::string& from);
 public:
   void accept_subscription(const std::string& from, const std::string& to);
   void ask_subscription(const std::string& from, const std::string& to);
+  /**
+   * The available presences contain our XEP-0115 caps
+   */
   void send_presence_to_contact(const std::string& from, const std::string& to, const std::string& type, const std::string& id="");
   void on_irc_client_connected(const std::string& irc_hostname, const std::string& jid);
   void on_irc_client_disconnected(const std::string& irc_hostname, const std::string& jid);
@@ -119,6 +162,13 @@ public:
   Bridge* get_user_bridge(const std::string& user_jid);
 
 private:
+  /**
+   * When the XMPP server does not read our stanzas fast enough, stop
+   * reading from all the IRC servers (which is what generates most of
+   * them), until it catches up.
+   */
+  void on_high_watermark() override final;
+  void on_low_watermark() override final;
   /**
    * A map of id -> callback.  When we want to wait for an iq result, we add
    * the callback to this map, with the iq id as the key. When an iq result
@@ -132,6 +182,29 @@ private:
    * jid
    */
   std::unordered_map<std::string, std::unique_ptr<Bridge>> bridges;
+  /**
+   * The bare JIDs of the bridges that were created, or had an IrcClient
+   * created or closed, since the last clean().
+   */
+  std::vector<std::string> bridges_to_clean;
+  /**
+   * Set when the IrcClients were restored from a previous process, and
+   * wait for the handshake to start reading.
+   */
+  bool resume_irc_clients_after_handshake{false};
+  /**
+   * The XEP-0115 verification string of the gateway and of each IRC
+   * server, indexed by the name of their identity: it is the only
+   * difference between their disco#info.  They are computed when first
+   * needed, and only kept for the entities we send presences from.
+   */
+  const std::string& get_caps_ver(const std::string& name);
+  /**
+   * Whether the disco#info node is the one of the caps of the entity with
+   * that identity name.
+   */
+  bool is_caps_node(const std::string& node, const std::string& name) const;
+  std::unordered_map<std::string, std::string> caps_vers;
 
   AdhocCommandsHandler irc_server_adhoc_commands_handler;
   AdhocCommandsHandler irc_channel_adhoc_commands_handler;
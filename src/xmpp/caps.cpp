@@ -0,0 +1,26 @@
+#include <xmpp/caps.hpp>
+
+#include <utils/base64.hpp>
+#include <utils/sha1.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace caps
+{
+std::string compute_ver(const std::string& category, const std::string& type, const std::string& name,
+                        std::vector<std::string> features)
+{
+  std::string input = category + "/" + type + "//" + name + "<";
+  std::sort(features.begin(), features.end());
+  for (const auto& feature: features)
+    input += feature + "<";
+  // sha1() gives the hexadecimal form of the digest, the raw bytes are
+  // encoded in base64
+  const auto hex = sha1(input);
+  std::string digest;
+  for (std::size_t i = 0; i + 1 < hex.size(); i += 2)
+    digest += static_cast<char>(std::strtol(hex.substr(i, 2).data(), nullptr, 16));
+  return base64::encode(digest);
+}
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/**
+ * Entity Capabilities (XEP-0115): a hash of the disco#info of an entity,
+ * advertised in its presences, so that the clients only query the
+ * disco#info of a combination of identity and features once, and cache it.
+ */
+namespace caps
+{
+/**
+ * The node of the <c/> elements that we send
+ */
+constexpr const char* node = "https://lab.louiz.org/louiz/biboumi";
+
+/**
+ * The verification string of a disco#info result with only this identity
+ * (without xml:lang) and these features, and no extended information
+ * form.  See https://xmpp.org/extensions/xep-0115.html#ver-gen
+ */
+std::string compute_ver(const std::string& category, const std::string& type, const std::string& name,
+                        std::vector<std::string> features);
+}
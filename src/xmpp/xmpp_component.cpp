@@ -2,6 +2,11 @@
 #include <utils/scopeguard.hpp>
 #include <utils/tolower.hpp>
 #include <logger/logger.hpp>
+#include <utils/metrics.hpp>
+#include <utils/tracing.hpp>
+#include <utils/capture.hpp>
+#include <utils/allocations.hpp>
+#include <utils/loop_monitor.hpp>
 #include <utils/uuid.hpp>
 
 #include <xmpp/xmpp_component.hpp>
@@ -38,6 +43,45 @@ static std::set<std::string> kickable_errors{
     "malformed-error"
     };
 
+namespace
+{
+/**
+ * One counter for each kind of stanza, in one direction.
+ */
+class StanzaCounters
+{
+public:
+  StanzaCounters(const std::string& name, const std::string& help):
+    message(metrics::Registry::instance().counter(name, help, {{"kind", "message"}})),
+    presence(metrics::Registry::instance().counter(name, help, {{"kind", "presence"}})),
+    iq(metrics::Registry::instance().counter(name, help, {{"kind", "iq"}})),
+    other(metrics::Registry::instance().counter(name, help, {{"kind", "other"}}))
+  {}
+
+  void inc(const std::string& kind)
+  {
+    if (kind == "message")
+      this->message.inc();
+    else if (kind == "presence")
+      this->presence.inc();
+    else if (kind == "iq")
+      this->iq.inc();
+    else
+      this->other.inc();
+  }
+
+private:
+  metrics::Counter& message;
+  metrics::Counter& presence;
+  metrics::Counter& iq;
+  metrics::Counter& other;
+};
+}
+
+static metrics::Traffic xmpp_traffic("biboumi_xmpp", "the XMPP server");
+static StanzaCounters received_stanzas("biboumi_xmpp_received_stanzas_total", "Stanzas received from the XMPP server");
+static StanzaCounters sent_stanzas("biboumi_xmpp_sent_stanzas_total", "Stanzas sent to the XMPP server");
+
 XmppComponent::XmppComponent(std::shared_ptr<Poller>& poller, std::string hostname, std::string secret):
   TCPClientSocketHandler(poller),
   ever_auth(false),
@@ -49,6 +93,8 @@ XmppComponent::XmppComponent(std::shared_ptr<Poller>& poller, std::string hostna
   stanza_handlers{},
   adhoc_commands_handler(*this)
 {
+  this->traffic = &xmpp_traffic;
+  this->capture_stream = capture::Writer::instance().open_stream({capture::StreamKind::xmpp, {}, this->served_hostname});
   this->parser.add_stream_open_callback(std::bind(&XmppComponent::on_remote_stream_open, this,
                                                   std::placeholders::_1));
   this->parser.add_stanza_callback(std::bind(&XmppComponent::on_stanza, this,
@@ -73,11 +119,19 @@ bool XmppComponent::is_document_open() const
 
 void XmppComponent::send_stanza(const Stanza& stanza)
 {
+  ALLOCATIONS_SCOPE(xmpp, "XmppComponent::send_stanza");
+  tracing::mark(tracing::Stage::built);
+  sent_stanzas.inc(stanza.get_name());
   std::string str = stanza.to_string();
   log_debug("XMPP SENDING: ", str);
   this->send_data(std::move(str));
 }
 
+std::string XmppComponent::describe() const
+{
+  return "the XMPP component " + this->served_hostname;
+}
+
 void XmppComponent::on_connection_failed(const std::string& reason)
 {
   this->first_connection_try = false;
@@ -111,6 +165,7 @@ void XmppComponent::on_connection_close(const std::string& error)
 
 void XmppComponent::parse_in_buffer(const size_t size)
 {
+  ALLOCATIONS_SCOPE(xmpp, "XmppComponent::parse_in_buffer");
   // in_buf.size, or size, cannot be bigger than our read-size (4096) so it’s safe
   // to cast.
 
@@ -160,6 +215,7 @@ void XmppComponent::reset()
 void XmppComponent::on_stanza(const Stanza& stanza)
 {
   log_debug("XMPP RECEIVING: ", stanza.to_string());
+  received_stanzas.inc(stanza.get_name());
   std::function<void(const Stanza&)> handler;
   try
     {
@@ -237,13 +293,25 @@ void XmppComponent::handle_handshake(const Stanza&)
 #ifdef SYSTEMD_FOUND
   sd_notify(0, "READY=1");
   // Install an event that sends a keepalive to systemd.  If biboumi crashes
-  // or hangs for too long, systemd will restart it.
+  // or hangs for too long, systemd will restart it.  The keepalive is
+  // also withheld when the main loop, even if it is still running, got
+  // stuck for half of the watchdog timeout since the previous one: if
+  // that keeps happening, systemd restarts biboumi.  It is sent again as
+  // soon as the loop recovers.
   uint64_t usec;
   if (sd_watchdog_enabled(0, &usec) > 0)
     {
+      const std::chrono::microseconds timeout(usec);
+      TimedEventsManager::instance().cancel("systemd watchdog");
       TimedEventsManager::instance().add_event(TimedEvent(
-             std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::microseconds(usec / 2)),
-             []() { sd_notify(0, "WATCHDOG=1"); }));
+             std::chrono::duration_cast<std::chrono::milliseconds>(timeout / 4),
+             [timeout]()
+             {
+               if (LoopMonitor::instance().should_notify_watchdog(timeout / 2))
+                 sd_notify(0, "WATCHDOG=1");
+               else
+                 log_warning("The main loop was blocked for too long, not notifying the systemd watchdog");
+             }, "systemd watchdog"));
     }
 #endif
   this->after_handshake();
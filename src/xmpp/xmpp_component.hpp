@@ -39,6 +39,7 @@
 #define STABLE_ID_NS     "urn:xmpp:sid:0"
 #define STABLE_MUC_ID_NS "http://jabber.org/protocol/muc#stable_id"
 #define SELF_PING_FLAG   MUC_NS"#self-ping-optimization"
+#define CAPS_NS          "http://jabber.org/protocol/caps"
 
 /**
  * An XMPP component, communicating with an XMPP server using the protocole
@@ -61,6 +62,7 @@ public:
   void on_connected() override final;
   void on_connection_close(const std::string& error) override final;
   void parse_in_buffer(const size_t size) override final;
+  std::string describe() const override final;
 
   /**
    * Returns a unique id, to be used in the 'id' element of our iq stanzas.
@@ -102,11 +102,23 @@ void XmlNode::add_to_tail(const std::string& data)
 void XmlNode::set_inner(const std::string& data)
 {
   this->inner = data;
+  this->inner_is_xml = false;
 }
 
 void XmlNode::add_to_inner(const std::string& data)
 {
-  this->inner += data;
+  // Appended to some serialized XML, the text must be escaped now, since
+  // to_string() will not do it
+  if (this->inner_is_xml)
+    this->inner += sanitize(data);
+  else
+    this->inner += data;
+}
+
+void XmlNode::set_inner_xml(std::string xml)
+{
+  this->inner = std::move(xml);
+  this->inner_is_xml = true;
 }
 
 std::string XmlNode::get_inner() const
@@ -195,7 +207,10 @@ std::string XmlNode::to_string() const
     res << "/>";
   else
     {
-      res << ">" + sanitize(this->inner);
+      if (this->inner_is_xml)
+        res << ">" << this->inner;
+      else
+        res << ">" + sanitize(this->inner);
       for (const auto& child: this->children)
         res << child->to_string();
       res << "</" << this->get_name() << ">";
@@ -37,6 +37,7 @@ public:
     attributes(node.attributes),
     children{},
     inner(node.inner),
+    inner_is_xml(node.inner_is_xml),
     tail(node.tail)
   {
     for (const auto& child: node.children)
@@ -70,6 +71,12 @@ public:
    * described in add_to_tail comment.
    */
   void add_to_inner(const std::string& data);
+  /**
+   * Set some already-serialized XML as the content of this node. It is
+   * written as is by to_string(), instead of being escaped like the inner
+   * text. The node must not have any child.
+   */
+  void set_inner_xml(std::string xml);
   /**
    * Get the content of inner
    */
@@ -133,6 +140,10 @@ private:
   std::map<std::string, std::string> attributes;
   std::vector<std::unique_ptr<XmlNode>> children;
   std::string inner;
+  /**
+   * Whether the inner was set with set_inner_xml().
+   */
+  bool inner_is_xml{false};
   std::string tail;
 };
 
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <functional>
+#include <chrono>
+#include <string>
+#include <vector>
+
+/**
+ * A minimal microbenchmark harness for the hot paths of biboumi.
+ *
+ * Each benchmark is a function registered with the BENCHMARK() macro. It
+ * receives a State, does its setup, then calls State::measure() with the
+ * operation to time: only that call is measured, and the operation is run
+ * state.iterations times in a row. The runner (in main.cpp) chooses the
+ * number of iterations, repeats the measure a few times and writes the
+ * results as JSON, to be compared with a stored baseline.
+ */
+namespace bench
+{
+class State
+{
+public:
+  explicit State(const std::size_t iterations):
+    iterations(iterations),
+    elapsed(0)
+  {}
+
+  template <typename Operation>
+  void measure(Operation&& operation)
+  {
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < this->iterations; ++i)
+      operation();
+    this->elapsed += std::chrono::steady_clock::now() - start;
+  }
+
+  const std::size_t iterations;
+  std::chrono::steady_clock::duration elapsed;
+};
+
+using Function = void(*)(State&);
+
+struct Benchmark
+{
+  std::string name;
+  Function function;
+};
+
+std::vector<Benchmark>& registry();
+
+struct Registrar
+{
+  Registrar(const char* name, Function function)
+  {
+    registry().push_back({name, function});
+  }
+};
+
+/**
+ * Make the compiler believe that the value is used, so that the
+ * computation producing it is not optimized out.
+ */
+template <typename T>
+inline void keep(const T& value)
+{
+  asm volatile("" : : "g"(&value) : "memory");
+}
+}
+
+#define BENCH_CONCAT_IMPL(a, b) a##b
+#define BENCH_CONCAT(a, b) BENCH_CONCAT_IMPL(a, b)
+
+#define BENCHMARK(name) \
+  static void BENCH_CONCAT(bench_function_, __LINE__)(bench::State&); \
+  static const bench::Registrar BENCH_CONCAT(bench_registrar_, __LINE__){name, &BENCH_CONCAT(bench_function_, __LINE__)}; \
+  static void BENCH_CONCAT(bench_function_, __LINE__)(bench::State& state)
@@ -0,0 +1,47 @@
+#!/usr/bin/env python3
+
+"""
+Compare the results of two runs of the bench executable, and exit with an
+error if one benchmark got slower than the given threshold.
+
+Usage: compare.py baseline.json result.json [threshold_percent]
+"""
+
+import json
+import sys
+
+
+def load(filename):
+    with open(filename) as f:
+        return {bench["name"]: bench["ns_per_iteration"]["median"] for bench in json.load(f)["benchmarks"]}
+
+
+def main():
+    if len(sys.argv) not in (3, 4):
+        print(__doc__.strip(), file=sys.stderr)
+        return 2
+    baseline = load(sys.argv[1])
+    result = load(sys.argv[2])
+    threshold = float(sys.argv[3]) if len(sys.argv) == 4 else 10.0
+
+    regressions = 0
+    print("%-50s %15s %15s %9s" % ("benchmark", "baseline (ns)", "result (ns)", "change"))
+    for name in sorted(set(baseline) | set(result)):
+        if name not in baseline or name not in result:
+            print("%-50s %15s %15s" % (name,
+                                       "%.2f" % baseline[name] if name in baseline else "-",
+                                       "%.2f" % result[name] if name in result else "-"))
+            continue
+        change = (result[name] - baseline[name]) / baseline[name] * 100
+        mark = ""
+        if change > threshold:
+            mark = "  <- slower"
+            regressions += 1
+        elif change < -threshold:
+            mark = "  <- faster"
+        print("%-50s %15.2f %15.2f %+8.1f%%%s" % (name, baseline[name], result[name], change, mark))
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,100 @@
+#include "bench.hpp"
+
+#include <irc/irc_message.hpp>
+#include <irc/irc_channel.hpp>
+#include <irc/irc_user.hpp>
+#include <irc/iid.hpp>
+
+#include <utils/split.hpp>
+
+static const std::map<char, char> prefix_to_mode{{'~', 'q'}, {'&', 'a'}, {'@', 'o'}, {'%', 'h'}, {'+', 'v'}};
+
+/**
+ * The 353 messages that a server sends when joining a channel with that
+ * many users, with 300 nicks per message like most servers do.
+ */
+static std::vector<std::string> make_names_lines(const std::size_t nb_users)
+{
+  std::vector<std::string> lines;
+  std::string line;
+  for (std::size_t i = 0; i < nb_users; ++i)
+    {
+      if (i % 300 == 0)
+        {
+          if (!line.empty())
+            lines.push_back(line);
+          line = ":irc.example.org 353 me = #bigchannel :";
+        }
+      else
+        line += ' ';
+      if (i % 50 == 0)
+        line += '@';
+      else if (i % 10 == 0)
+        line += '+';
+      line += "user_" + std::to_string(i);
+    }
+  lines.push_back(line);
+  return lines;
+}
+
+BENCHMARK("irc_message/parse_privmsg")
+{
+  const std::string line = ":nick!~user@some.host.example.org PRIVMSG #biboumi :Hello everyone, this is a message of a usual length";
+  state.measure([&]()
+  {
+    const IrcMessage message(line);
+    bench::keep(message);
+  });
+}
+
+BENCHMARK("irc_message/parse_many_arguments")
+{
+  const std::string line = ":irc.example.org 005 me CHANTYPES=# EXCEPTS INVEX CHANMODES=eIbq,k,flj,CFLMPQScgimnprstuz "
+      "CHANLIMIT=#:120 PREFIX=(ov)@+ MAXLIST=bqeI:100 MODES=4 NETWORK=example :are supported by this server";
+  state.measure([&]()
+  {
+    const IrcMessage message(line);
+    bench::keep(message);
+  });
+}
+
+BENCHMARK("irc_channel/names_ingestion_10k")
+{
+  // Same work as IrcClient::on_names_received(), without the bridge
+  const auto lines = make_names_lines(10000);
+  state.measure([&]()
+  {
+    IrcChannel channel;
+    for (const auto& line: lines)
+      {
+        const IrcMessage message(line);
+        for (const auto& nick: utils::split(message.arguments[3], ' '))
+          {
+            IrcUser tmp_user{nick, prefix_to_mode};
+            if (!channel.find_user(tmp_user.nick))
+              channel.add_user(nick, prefix_to_mode);
+          }
+      }
+    bench::keep(channel.get_users().size());
+  });
+}
+
+BENCHMARK("iid/parse_channel")
+{
+  const std::string str = "#biboumi%irc.example.org";
+  state.measure([&]()
+  {
+    const Iid iid(str, {'#', '&'});
+    bench::keep(iid);
+  });
+}
+
+BENCHMARK("iid/parse_user")
+{
+  const std::string str = "some_nick%irc.example.org";
+  state.measure([&]()
+  {
+    const Iid iid(str, {'#', '&'});
+    bench::keep(iid);
+  });
+}
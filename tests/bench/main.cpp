@@ -0,0 +1,143 @@
+#include "bench.hpp"
+
+#include <config/config.hpp>
+#include <biboumi.h>
+
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std::string_literals;
+
+std::vector<bench::Benchmark>& bench::registry()
+{
+  static std::vector<bench::Benchmark> benchmarks;
+  return benchmarks;
+}
+
+static void usage(const char* name)
+{
+  std::cerr << "Usage: " << name << " [--filter <substring>] [--min-time <ms>] [--repetitions <n>] [--list]\n"
+            << "Runs the benchmarks and writes their results, as JSON, on the standard output." << std::endl;
+}
+
+static std::string json_escape(const std::string& str)
+{
+  std::string res;
+  for (const char c: str)
+    {
+      if (c == '"' || c == '\\')
+        res += '\\';
+      res += c;
+    }
+  return res;
+}
+
+/**
+ * Run the benchmark once with the given number of iterations, and return
+ * the elapsed time in nanoseconds.
+ */
+static double run_once(const bench::Benchmark& benchmark, const std::size_t iterations)
+{
+  bench::State state(iterations);
+  benchmark.function(state);
+  return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(state.elapsed).count());
+}
+
+/**
+ * Find a number of iterations for which one run lasts at least
+ * min_time_ns.
+ */
+static std::size_t calibrate(const bench::Benchmark& benchmark, const double min_time_ns)
+{
+  std::size_t iterations = 1;
+  while (true)
+    {
+      const auto elapsed = run_once(benchmark, iterations);
+      if (elapsed >= min_time_ns)
+        return iterations;
+      // Aim a bit above the minimum time, but never grow by more than 10x
+      // at once, because the first runs are the least precise
+      const auto factor = elapsed > 0 ? std::min(10.0, 1.2 * min_time_ns / elapsed): 10.0;
+      iterations = std::max(iterations + 1, static_cast<std::size_t>(static_cast<double>(iterations) * factor));
+    }
+}
+
+int main(int argc, char** argv)
+{
+  // Logs are written on stdout, mixing them with the JSON would make it
+  // unusable
+  Config::set("log_level", "10");
+
+  std::string filter;
+  double min_time_ms = 200;
+  std::size_t repetitions = 5;
+  bool list = false;
+  for (int i = 1; i < argc; ++i)
+    {
+      const std::string arg = argv[i];
+      if (arg == "--list")
+        list = true;
+      else if (i + 1 < argc && arg == "--filter")
+        filter = argv[++i];
+      else if (i + 1 < argc && arg == "--min-time")
+        min_time_ms = std::atof(argv[++i]);
+      else if (i + 1 < argc && arg == "--repetitions")
+        repetitions = std::max(1, std::atoi(argv[++i]));
+      else
+        {
+          usage(argv[0]);
+          return 1;
+        }
+    }
+
+  auto benchmarks = bench::registry();
+  std::sort(benchmarks.begin(), benchmarks.end(),
+            [](const auto& a, const auto& b) { return a.name < b.name; });
+  benchmarks.erase(std::remove_if(benchmarks.begin(), benchmarks.end(),
+                                  [&filter](const auto& benchmark)
+                                  { return benchmark.name.find(filter) == std::string::npos; }),
+                   benchmarks.end());
+
+  if (list)
+    {
+      for (const auto& benchmark: benchmarks)
+        std::cout << benchmark.name << '\n';
+      return 0;
+    }
+
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << "{\n"
+            << "  \"context\": {\n"
+            << "    \"version\": \"" << SOFTWARE_VERSION << "\",\n"
+            << "    \"min_time_ms\": " << min_time_ms << ",\n"
+            << "    \"repetitions\": " << repetitions << "\n"
+            << "  },\n"
+            << "  \"benchmarks\": [";
+
+  bool first = true;
+  for (const auto& benchmark: benchmarks)
+    {
+      std::cerr << "Running " << benchmark.name << "…" << std::endl;
+      const auto iterations = calibrate(benchmark, min_time_ms * 1e6);
+      std::vector<double> samples;
+      for (std::size_t i = 0; i < repetitions; ++i)
+        samples.push_back(run_once(benchmark, iterations) / static_cast<double>(iterations));
+      std::sort(samples.begin(), samples.end());
+      const auto median = samples.size() % 2 ? samples[samples.size() / 2]:
+                          (samples[samples.size() / 2 - 1] + samples[samples.size() / 2]) / 2;
+
+      std::cout << (first ? "\n": ",\n")
+                << "    {\"name\": \"" << json_escape(benchmark.name) << "\", "
+                << "\"iterations\": " << iterations << ", "
+                << "\"ns_per_iteration\": {"
+                << "\"min\": " << samples.front() << ", "
+                << "\"median\": " << median << ", "
+                << "\"max\": " << samples.back() << "}}";
+      first = false;
+    }
+  std::cout << "\n  ]\n}" << std::endl;
+  return 0;
+}
@@ -0,0 +1,89 @@
+#include "bench.hpp"
+
+#include <bridge/colors.hpp>
+#include <xmpp/xmpp_stanza.hpp>
+#include <utils/encoding.hpp>
+#include <utils/timed_events.hpp>
+
+using namespace std::chrono_literals;
+
+BENCHMARK("colors/irc_format_to_xhtmlim_plain")
+{
+  const std::string text = "A message without any formatting, which is what we receive most of the time";
+  state.measure([&]()
+  {
+    const auto res = irc_format_to_xhtmlim(text);
+    bench::keep(res);
+  });
+}
+
+BENCHMARK("colors/irc_format_to_xhtmlim_formatted")
+{
+  const std::string text = "\x02" "bold\x02 then \x03" "4,12red on blue\x03 and \x1F" "underlined \x1Ditalic\x0F <reset> & co";
+  state.measure([&]()
+  {
+    const auto res = irc_format_to_xhtmlim(text);
+    bench::keep(res);
+  });
+}
+
+BENCHMARK("encoding/convert_to_utf8_ascii")
+{
+  const std::string text = "A message in pure ASCII, like most of the IRC messages we receive";
+  state.measure([&]()
+  {
+    const auto res = utils::convert_to_utf8(text, "ISO-8859-1");
+    bench::keep(res);
+  });
+}
+
+BENCHMARK("encoding/convert_to_utf8_latin1")
+{
+  const std::string text = "Un message en fran\xe7" "ais, encod\xe9 en latin-1, avec des accents \xe0 convertir";
+  state.measure([&]()
+  {
+    const auto res = utils::convert_to_utf8(text, "ISO-8859-1");
+    bench::keep(res);
+  });
+}
+
+BENCHMARK("timed_events/add_and_cancel")
+{
+  // A server with many connected users has many pending events (pings,
+  // throttling, reconnections…)
+  auto& manager = TimedEventsManager::instance();
+  const auto now = std::chrono::steady_clock::now();
+  for (int i = 0; i < 1000; ++i)
+    manager.add_event(TimedEvent(now + std::chrono::seconds(i), []() {}, "background" + std::to_string(i)));
+  std::size_t i = 0;
+  state.measure([&]()
+  {
+    const auto name = "event" + std::to_string(i % 16);
+    manager.add_event(TimedEvent(now + std::chrono::milliseconds(500 * (i % 2000)), []() {}, name));
+    if (++i % 16 == 0)
+      for (int j = 0; j < 16; ++j)
+        manager.cancel("event" + std::to_string(j));
+  });
+  for (int j = 0; j < 16; ++j)
+    manager.cancel("event" + std::to_string(j));
+  for (int j = 0; j < 1000; ++j)
+    manager.cancel("background" + std::to_string(j));
+}
+
+BENCHMARK("timed_events/execute_expired")
+{
+  auto& manager = TimedEventsManager::instance();
+  const auto now = std::chrono::steady_clock::now();
+  for (int i = 0; i < 1000; ++i)
+    manager.add_event(TimedEvent(now + std::chrono::seconds(3600 + i), []() {}, "background" + std::to_string(i)));
+  std::size_t executed = 0;
+  state.measure([&]()
+  {
+    for (int j = 0; j < 10; ++j)
+      manager.add_event(TimedEvent(now - 1s, [&executed]() { ++executed; }));
+    manager.execute_expired_events();
+  });
+  bench::keep(executed);
+  for (int j = 0; j < 1000; ++j)
+    manager.cancel("background" + std::to_string(j));
+}
@@ -0,0 +1,179 @@
+#include "bench.hpp"
+
+#include <xmpp/xmpp_parser.hpp>
+#include <xmpp/xmpp_stanza.hpp>
+#include <xmpp/jid.hpp>
+
+/**
+ * What a component typically receives from its XMPP server: a few users
+ * joining some channels, talking in them, and their clients asking for
+ * some disco#info.
+ */
+static const std::string stream_header = "<stream:stream xmlns='jabber:component:accept' "
+    "xmlns:stream='http://etherx.jabber.org/streams' from='biboumi.example.org' id='1234'>";
+static const std::string recorded_stanzas[] = {
+  "<presence from='alice@example.org/laptop' to='#biboumi%irc.example.org@biboumi.example.org/alice' id='p1'>"
+    "<x xmlns='http://jabber.org/protocol/muc'><history maxstanzas='20'/></x>"
+    "<c xmlns='http://jabber.org/protocol/caps' hash='sha-1' node='http://poez.io' ver='PIZw6fWnXXW/gSdQ5/Q+1BBxQ28='/>"
+  "</presence>",
+  "<message from='alice@example.org/laptop' to='#biboumi%irc.example.org@biboumi.example.org' type='groupchat' id='m1'>"
+    "<body>Hello everyone, did anyone try the latest release with a big channel?</body>"
+    "<active xmlns='http://jabber.org/protocol/chatstates'/>"
+    "<origin-id xmlns='urn:xmpp:sid:0' id='3c1e4bf0-f4e6-4e6f-9f7c-2d1c1e1ad1f5'/>"
+  "</message>",
+  "<iq from='bob@example.org/phone' to='biboumi.example.org' type='get' id='disco1'>"
+    "<query xmlns='http://jabber.org/protocol/disco#info'/>"
+  "</iq>",
+  "<message from='bob@example.org/phone' to='#biboumi%irc.example.org@biboumi.example.org' type='groupchat' id='m2'>"
+    "<body>Yes, it&apos;s working fine &lt;3, even with &quot;special&quot; chars &amp; UTF-8: éàç ✓</body>"
+    "<html xmlns='http://jabber.org/protocol/xhtml-im'><body xmlns='http://www.w3.org/1999/xhtml'>"
+      "Yes, it&apos;s working <span style='font-weight:bold'>fine</span> &lt;3"
+    "</body></html>"
+  "</message>",
+  "<message from='alice@example.org/laptop' to='nick%irc.example.org@biboumi.example.org' type='chat' id='m3'>"
+    "<body>This one is a private message</body>"
+    "<request xmlns='urn:xmpp:receipts'/>"
+  "</message>",
+  "<iq from='alice@example.org/laptop' to='#biboumi%irc.example.org@biboumi.example.org' type='set' id='mam1'>"
+    "<query xmlns='urn:xmpp:mam:2' queryid='q1'><set xmlns='http://jabber.org/protocol/rsm'><max>20</max><before/></set></query>"
+  "</iq>",
+  "<presence from='bob@example.org/phone' to='#biboumi%irc.example.org@biboumi.example.org/bob' type='unavailable' id='p2'>"
+    "<status>Gone to sleep</status>"
+  "</presence>",
+};
+
+static std::string make_recorded_stream(const std::size_t stanzas)
+{
+  std::string stream = stream_header;
+  const auto nb_recorded = sizeof(recorded_stanzas) / sizeof(recorded_stanzas[0]);
+  for (std::size_t i = 0; i < stanzas; ++i)
+    stream += recorded_stanzas[i % nb_recorded];
+  return stream;
+}
+
+static XmlNode make_message_stanza()
+{
+  Stanza message("message");
+  message["from"] = "#biboumi%irc.example.org@biboumi.example.org/someone";
+  message["to"] = "alice@example.org/laptop";
+  message["type"] = "groupchat";
+  message["id"] = "b1c2d3e4-f5a6-4b7c-8d9e-0f1a2b3c4d5e";
+  XmlSubNode body(message, "body");
+  body.set_inner("Some <escaped> & \"quoted\" text, and a long enough line to look like a real message: éàç");
+  XmlSubNode html(message, "html");
+  html["xmlns"] = "http://jabber.org/protocol/xhtml-im";
+  XmlSubNode html_body(html, "body");
+  html_body["xmlns"] = "http://www.w3.org/1999/xhtml";
+  XmlSubNode span(html_body, "span");
+  span["style"] = "font-weight:bold;color:red";
+  span.set_inner("Some bold red text");
+  XmlSubNode stanza_id(message, "stanza-id");
+  stanza_id["xmlns"] = "urn:xmpp:sid:0";
+  stanza_id["by"] = "#biboumi%irc.example.org@biboumi.example.org";
+  stanza_id["id"] = "5d6e7f80-91a2-4b3c-8d4e-5f60718293a4";
+  return message;
+}
+
+BENCHMARK("xmpp_parser/feed_recorded_stream")
+{
+  const auto stream = make_recorded_stream(1000);
+  XmppParser parser;
+  std::size_t received = 0;
+  parser.add_stanza_callback([&received](const Stanza&) { ++received; });
+  state.measure([&]()
+  {
+    parser.reset();
+    parser.feed(stream.data(), static_cast<int>(stream.size()), false);
+  });
+  bench::keep(received);
+}
+
+BENCHMARK("xmpp_parser/feed_recorded_stream_in_chunks")
+{
+  // Like what we read from the socket: a few KiB at a time, cutting
+  // stanzas anywhere
+  const auto stream = make_recorded_stream(1000);
+  XmppParser parser;
+  std::size_t received = 0;
+  parser.add_stanza_callback([&received](const Stanza&) { ++received; });
+  state.measure([&]()
+  {
+    parser.reset();
+    for (std::size_t pos = 0; pos < stream.size(); pos += 4096)
+      {
+        const auto len = std::min<std::size_t>(4096, stream.size() - pos);
+        parser.feed(stream.data() + pos, static_cast<int>(len), false);
+      }
+  });
+  bench::keep(received);
+}
+
+BENCHMARK("xml_node/to_string")
+{
+  const auto message = make_message_stanza();
+  state.measure([&]()
+  {
+    const auto str = message.to_string();
+    bench::keep(str);
+  });
+}
+
+BENCHMARK("xml_node/copy")
+{
+  const auto message = make_message_stanza();
+  state.measure([&]()
+  {
+    const XmlNode copy(message);
+    bench::keep(copy);
+  });
+}
+
+BENCHMARK("xml_escape/plain_text")
+{
+  const std::string text = "Just a normal message without anything to escape, like most of them are";
+  state.measure([&]()
+  {
+    const auto escaped = xml_escape(text);
+    bench::keep(escaped);
+  });
+}
+
+BENCHMARK("xml_escape/special_chars")
+{
+  const std::string text = "if (a < b && c > d) { print(\"it's <fine>\"); }";
+  state.measure([&]()
+  {
+    const auto escaped = xml_escape(text);
+    bench::keep(escaped);
+  });
+}
+
+BENCHMARK("sanitize/utf8")
+{
+  const std::string text = "Un message en français, avec des accents : éàèùç, et un peu d’unicode ✓ ☺";
+  state.measure([&]()
+  {
+    const auto sanitized = sanitize(text);
+    bench::keep(sanitized);
+  });
+}
+
+BENCHMARK("sanitize/latin1")
+{
+  const std::string text = "Un message en fran\xe7" "ais, encod\xe9 en latin-1 par un vieux client IRC";
+  state.measure([&]()
+  {
+    const auto sanitized = sanitize(text);
+    bench::keep(sanitized);
+  });
+}
+
+BENCHMARK("jid/parse")
+{
+  const std::string str = "#biboumi%irc.example.org@biboumi.example.org/some resource";
+  state.measure([&]()
+  {
+    const Jid jid(str);
+    bench::keep(jid);
+  });
+}
@@ -51,4 +51,8 @@ TEST_CASE("IRC colors parsing")
   std::tie(cleaned_up, xhtml) = irc_format_to_xhtmlim("test\ncoucou");
   CHECK(cleaned_up == "test\ncoucou");
   CHECK(xhtml->to_string() == "<body xmlns='http://www.w3.org/1999/xhtml'>test<br/>coucou</body>");
+
+  std::tie(cleaned_up, xhtml) = irc_format_to_xhtmlim("\x02<b>&\x01\x02'é'");
+  CHECK(cleaned_up == "<b>&\x01'é'");
+  CHECK(xhtml->to_string() == "<body xmlns='http://www.w3.org/1999/xhtml'><span style='font-weight:bold;'>&lt;b&gt;&amp;</span>&apos;é&apos;</body>");
 }
@@ -57,3 +57,22 @@ TEST_CASE("Config get_int")
   res = Config::get_int("number", -1);
   CHECK(res == 0);
 }
+
+TEST_CASE("Config snapshot")
+{
+  Config::clear();
+  CHECK(Config::snapshot().fixed_irc_server.empty());
+  CHECK(Config::snapshot().realname_customization);
+  CHECK_FALSE(Config::snapshot().realname_from_jid);
+
+  Config::set("fixed_irc_server", "irc.example.com");
+  Config::set("realname_customization", "false");
+  Config::set("realname_from_jid", "true");
+  CHECK(Config::snapshot().fixed_irc_server == "irc.example.com");
+  CHECK_FALSE(Config::snapshot().realname_customization);
+  CHECK(Config::snapshot().realname_from_jid);
+
+  Config::clear();
+  CHECK(Config::snapshot().fixed_irc_server.empty());
+  CHECK(Config::snapshot().realname_customization);
+}
@@ -42,6 +42,18 @@ TEST_CASE("UTF-8 conversion")
           CHECK(from_ascii == "couc�ou");
         }
     }
+
+  SECTION("ASCII strings are returned as is, when the charset allows it")
+    {
+      CHECK(utils::convert_to_utf8("coucou", "ISO-8859-1") == "coucou");
+      CHECK(utils::convert_to_utf8(std::string("cou\0cou", 7), "ISO-8859-1") == "cou");
+      // The converter is reused, and reset between each conversion
+      CHECK(utils::convert_to_utf8("couc\xa5ou", "ISO-8859-1") == "couc¥ou");
+      CHECK(utils::convert_to_utf8("couc\xa5ou", "ISO-8859-1") == "couc¥ou");
+      // "+AKU-" is how UTF-7 encodes ¥
+      CHECK(utils::convert_to_utf8("couc+AKU-ou", "UTF-7") == "couc¥ou");
+      CHECK_THROWS(utils::convert_to_utf8("coucou", "not a charset"));
+    }
 }
 
 TEST_CASE("Remove invalid XML chars")
@@ -0,0 +1,19 @@
+from scenarios import *
+
+from scenarios.simple_channel_join import expect_self_join_presence
+
+scenario = (
+    send_stanza("<presence from='{jid_admin}/{resource_one}' to='#foo%{irc_server_one}/{nick_one}' ><x xmlns='http://jabber.org/protocol/muc'/></presence>"),
+    sequences.connection("irc.localhost", '{jid_admin}/{resource_one}'),
+    expect_self_join_presence(jid = '{jid_admin}/{resource_one}', chan = "#foo", nick = "{nick_one}"),
+
+    send_stanza("<iq type='set' id='command1' from='{jid_admin}/{resource_one}' to='{biboumi_host}'><command xmlns='http://jabber.org/protocol/commands' node='memory-usage' action='execute' /></iq>"),
+    expect_stanza("/iq[@type='result']/commands:command[@node='memory-usage'][@sessionid][@status='executing']",
+                  "/iq/commands:command/dataform:x[@type='form']/dataform:field[@var='max']/dataform:value[text()='10']",
+                  "/iq/commands:command/dataform:x[@type='form']/dataform:field[@var='soft-limit']",
+                  "/iq/commands:command/commands:actions/commands:complete",
+                  after = save_value("sessionid", extract_attribute("/iq/commands:command[@node='memory-usage']", "sessionid"))
+                 ),
+    send_stanza("<iq type='set' id='command2' from='{jid_admin}/{resource_one}' to='{biboumi_host}'><command xmlns='http://jabber.org/protocol/commands' node='memory-usage' sessionid='{sessionid}' action='complete'><x xmlns='jabber:x:data' type='submit'><field var='max'><value>5</value></field><field var='soft-limit'><value>1</value></field></x></command></iq>"),
+    expect_stanza("/iq[@type='result']/commands:command[@node='memory-usage'][@status='completed']/commands:note[@type='info'][starts-with(text(), '1 user using approximately ')][contains(text(), 'The cached data of 1 user above 1 KiB was freed.')][contains(text(), '{jid_admin}: ')]"),
+)
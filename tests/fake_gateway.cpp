@@ -0,0 +1,163 @@
+#include "fake_gateway.hpp"
+
+#include <config/config.hpp>
+#include <logger/logger.hpp>
+#ifdef USE_DATABASE
+# include <database/database.hpp>
+#endif
+
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std::string_literals;
+
+FakeGateway::FakeGateway():
+  poller(std::make_shared<Poller>()),
+#ifdef UDNS_FOUND
+  dns_handler(poller)
+#else
+  getaddrinfo_pool(poller, 0)
+#endif
+{
+  Logger::instance().reset();
+  Config::clear();
+  Config::set("hostname", "biboumi.test", false);
+#ifdef USE_DATABASE
+  Database::open(":memory:");
+  Database::invalidate_encoding_in_cache();
+#endif
+  this->component = std::make_shared<BiboumiComponent>(this->poller, "biboumi.test", "secret");
+  const auto fds = FakeGateway::make_socketpair();
+  this->xmpp_fd = fds.second;
+  this->component->use_connected_socket(fds.first);
+  this->xmpp_receive("<stream:stream xmlns='jabber:component:accept' xmlns:stream='http://etherx.jabber.org/streams' "
+                     "id='test' from='biboumi.test'><handshake/>");
+  this->xmpp_sent();
+}
+
+FakeGateway::~FakeGateway()
+{
+  this->component.reset();
+  for (const auto& pair: this->irc_fds)
+    ::close(pair.second);
+  ::close(this->xmpp_fd);
+#ifdef UDNS_FOUND
+  this->dns_handler.destroy();
+#else
+  this->getaddrinfo_pool.destroy();
+#endif
+#ifdef USE_DATABASE
+  Database::close();
+#endif
+  Config::clear();
+}
+
+std::pair<int, int> FakeGateway::make_socketpair()
+{
+  int fds[2];
+  if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) == -1)
+    throw std::runtime_error("socketpair failed: "s + std::strerror(errno));
+  return {fds[0], fds[1]};
+}
+
+std::string FakeGateway::read_all(const int fd)
+{
+  std::string res;
+  char buf[65536];
+  ssize_t size;
+  while ((size = ::read(fd, buf, sizeof(buf))) > 0)
+    res.append(buf, static_cast<std::size_t>(size));
+  return res;
+}
+
+void FakeGateway::xmpp_receive(const std::string& data)
+{
+  this->component->handle_received_data(data.data(), data.size());
+}
+
+std::string FakeGateway::xmpp_sent()
+{
+  std::string res;
+  while (this->component->is_connected() && !this->component->get_pending_data().empty())
+    {
+      this->component->on_send();
+      res += FakeGateway::read_all(this->xmpp_fd);
+    }
+  return res;
+}
+
+void FakeGateway::irc_receive(IrcClient* irc, const std::string& lines)
+{
+  irc->handle_received_data(lines.data(), lines.size());
+}
+
+std::string FakeGateway::irc_sent(IrcClient* irc)
+{
+  const auto it = this->irc_fds.find(irc);
+  if (it == this->irc_fds.end())
+    return {};
+  std::string res;
+  while (irc->is_connected() && !irc->get_pending_data().empty())
+    {
+      irc->on_send();
+      res += FakeGateway::read_all(it->second);
+    }
+  return res;
+}
+
+void FakeGateway::adopt(IrcClient* irc, const int peer_fd)
+{
+  this->irc_fds[irc] = peer_fd;
+}
+
+int FakeGateway::release(const IrcClient* irc)
+{
+  const auto it = this->irc_fds.find(irc);
+  if (it == this->irc_fds.end())
+    return -1;
+  const int fd = it->second;
+  this->irc_fds.erase(it);
+  return fd;
+}
+
+void FakeGateway::connect_irc(IrcClient* irc, const std::string& capabilities)
+{
+  const auto fds = FakeGateway::make_socketpair();
+  this->irc_fds[irc] = fds.second;
+  irc->use_connected_socket(fds.first);
+  this->irc_sent(irc);
+  const auto nick = irc->get_own_nick();
+  this->irc_receive(irc, ":irc.test CAP * LS :" + capabilities + "\r\n");
+  if (!capabilities.empty())
+    this->irc_receive(irc, ":irc.test CAP * ACK :" + capabilities + "\r\n");
+  this->irc_receive(irc, ":irc.test 001 " + nick + " :Welcome\r\n"
+                    ":irc.test 005 " + nick + " CHANTYPES=# PREFIX=(ov)@+ :are supported\r\n");
+  this->irc_sent(irc);
+}
+
+IrcClient* FakeGateway::join(const std::string& jid, const std::string& chan, const std::string& nick,
+                             const std::string& capabilities, const std::string& occupants)
+{
+  const auto server = chan.substr(chan.find('%') + 1);
+  const auto chan_name = chan.substr(0, chan.find('%'));
+  this->xmpp_receive("<presence from='" + jid + "' to='" + chan + "@biboumi.test/" + nick + "'>"
+                     "<x xmlns='http://jabber.org/protocol/muc'/></presence>");
+  Bridge* bridge = this->component->find_user_bridge(jid);
+  if (!bridge)
+    throw std::runtime_error("No bridge was created for " + jid);
+  IrcClient* irc = bridge->find_irc_client(server);
+  if (!irc)
+    throw std::runtime_error("No IrcClient was created for " + server);
+  if (!irc->is_connected())
+    this->connect_irc(irc, capabilities);
+  this->irc_sent(irc);
+  const auto own_nick = irc->get_own_nick();
+  this->irc_receive(irc, ":" + own_nick + "!user@host JOIN :" + chan_name + "\r\n"
+                    ":irc.test 353 " + own_nick + " = " + chan_name + " :" + own_nick + (occupants.empty() ? "" : " " + occupants) + "\r\n"
+                    ":irc.test 366 " + own_nick + " " + chan_name + " :End of /NAMES list.\r\n");
+  return irc;
+}
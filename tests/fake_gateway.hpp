@@ -0,0 +1,95 @@
+#pragma once
+
+#include <biboumi.h>
+
+#include <network/poller.hpp>
+#include <xmpp/biboumi_component.hpp>
+#include <bridge/bridge.hpp>
+#include <irc/irc_client.hpp>
+#ifdef UDNS_FOUND
+# include <network/dns_handler.hpp>
+#else
+# include <network/getaddrinfo_pool.hpp>
+#endif
+
+#include <memory>
+#include <string>
+#include <map>
+
+/**
+ * A whole gateway, whose component and IrcClients are connected to one end
+ * of a socketpair instead of their servers, like in the replay tool: the
+ * tests give them what the servers would send, and read what they wrote.
+ * Nothing is ever resolved.
+ *
+ * The configuration is cleared, and the database (if any) is a new one in
+ * memory: the tests can change them after the construction.
+ */
+class FakeGateway
+{
+public:
+  FakeGateway();
+  ~FakeGateway();
+  FakeGateway(const FakeGateway&) = delete;
+  FakeGateway(FakeGateway&&) = delete;
+  FakeGateway& operator=(const FakeGateway&) = delete;
+  FakeGateway& operator=(FakeGateway&&) = delete;
+
+  /**
+   * Give that data to the component, as if the XMPP server sent it.
+   */
+  void xmpp_receive(const std::string& data);
+  /**
+   * Everything the component sent since the previous call.
+   */
+  std::string xmpp_sent();
+  /**
+   * Join the given channel (“#chan%irc.test”) from that full JID, with
+   * that nick. If the IrcClient is not connected yet, it is connected to
+   * a fake socket, and the server accepts the given capabilities and
+   * welcomes it. The channel is then joined, with the given other
+   * occupants (in a 353 reply) and the IrcClient is returned.
+   */
+  IrcClient* join(const std::string& jid, const std::string& chan, const std::string& nick,
+                  const std::string& capabilities="", const std::string& occupants="");
+  /**
+   * Give these lines to the IrcClient, as if its server sent them.
+   */
+  void irc_receive(IrcClient* irc, const std::string& lines);
+  /**
+   * Everything the IrcClient sent since the previous call.
+   */
+  std::string irc_sent(IrcClient* irc);
+  /**
+   * Give an already connected socket (received from a previous process,
+   * for example) to the peer of this IrcClient.
+   */
+  void adopt(IrcClient* irc, const int peer_fd);
+  /**
+   * Stop using the peer of this IrcClient's socket, and return it: the
+   * caller closes it.
+   */
+  int release(const IrcClient* irc);
+  /**
+   * Create a socketpair, and return both ends.
+   */
+  static std::pair<int, int> make_socketpair();
+
+  std::shared_ptr<Poller> poller;
+  std::shared_ptr<BiboumiComponent> component;
+
+private:
+  static std::string read_all(const int fd);
+  void connect_irc(IrcClient* irc, const std::string& capabilities);
+
+#ifdef UDNS_FOUND
+  DNSHandler dns_handler;
+#else
+  GetaddrinfoPool getaddrinfo_pool;
+#endif
+  int xmpp_fd{-1};
+  /**
+   * Our end of the socket of each IrcClient.
+   */
+  std::map<const IrcClient*, int> irc_fds;
+};
@@ -1,6 +1,22 @@
 #include "catch.hpp"
+#include "fake_gateway.hpp"
 
 #include <irc/irc_message.hpp>
+#include <bridge/bridge.hpp>
+#include <utils/time.hpp>
+#include <utils/timed_events.hpp>
+#include <config/config.hpp>
+#include <utils/serializer.hpp>
+#ifdef USE_DATABASE
+# include <database/database.hpp>
+#endif
+
+#include <ctime>
+
+#include <unistd.h>
+
+using namespace std::chrono_literals;
+using namespace std::string_literals;
 
 TEST_CASE("Basic IRC message parsing")
 {
@@ -41,3 +57,409 @@ TEST_CASE("Message with empty :")
   CHECK(m.arguments[1] == "deux");
   CHECK(m.arguments[2] == "");
 }
+
+TEST_CASE("Message with tags")
+{
+  IrcMessage m("@time=2019-02-03T12:34:56.789Z;batch=abc;account;+draft/x=a\\sb\\:c\\\\ :prefix PRIVMSG #chan :hello");
+  CHECK(m.tags.size() == 4);
+  CHECK(m.tags["time"] == "2019-02-03T12:34:56.789Z");
+  CHECK(m.tags["batch"] == "abc");
+  CHECK(m.tags["account"] == "");
+  CHECK(m.tags["+draft/x"] == "a b;c\\");
+  CHECK(m.prefix == "prefix");
+  CHECK(m.command == "PRIVMSG");
+  CHECK(m.arguments.size() == 2);
+  CHECK(m.arguments[1] == "hello");
+}
+
+TEST_CASE("Missed messages filtering")
+{
+  using Message = Bridge::HistoryMessage;
+  const std::time_t since = 1000;
+  const std::vector<Message> received{
+    Message{999, "alice", "too old"},
+    Message{1000, "alice", "archived"},
+    Message{1000, "alice", "archived"},
+    Message{1000, "bob", "missed"},
+    Message{1005, "carol", "live"},
+    Message{1006, "carol", "missed too"},
+  };
+  // The second “archived” message was sent during the same second, but
+  // after we left
+  const std::vector<Message> archived{
+    Message{1000, "alice", "archived"},
+    Message{1005, "carol", "live"},
+  };
+  CHECK(Bridge::filter_missed_messages(since, received, archived) ==
+        std::vector<Message>{Message{1000, "alice", "archived"}, Message{1000, "bob", "missed"},
+                             Message{1006, "carol", "missed too"}});
+  CHECK(Bridge::filter_missed_messages(since, {}, archived).empty());
+  CHECK(Bridge::filter_missed_messages(2000, received, {}).empty());
+}
+
+TEST_CASE("Netsplit and netjoin batches")
+{
+  FakeGateway gateway;
+  IrcClient* irc = gateway.join("user@test/res", "#chan%irc.test", "nick", "batch", "alice bob");
+  gateway.xmpp_sent();
+  const auto event_name = "Netsplit" "irc.test" + gateway.component->find_user_bridge("user@test/res")->get_jid();
+
+  gateway.irc_receive(irc, ":irc.test BATCH +split netsplit irc1.test irc2.test\r\n"
+                      "@batch=split :alice!a@host QUIT :irc1.test irc2.test\r\n"
+                      "@batch=split :bob!b@host QUIT :irc1.test irc2.test\r\n"
+                      ":irc.test BATCH -split\r\n");
+  // Both are kept in the channel, for one minute
+  CHECK(gateway.xmpp_sent().empty());
+  CHECK(irc->get_channel("#chan")->find_user("alice"));
+  CHECK(irc->get_channel("#chan")->find_user("bob"));
+  const TimedEvent* event = TimedEventsManager::instance().find_event(event_name);
+  REQUIRE(event);
+  CHECK(event->get_timeout() > 59s);
+  CHECK(event->get_timeout() <= 60s);
+
+  // The netjoin brings alice back, without any presence
+  gateway.irc_receive(irc, ":irc.test BATCH +join netjoin irc1.test irc2.test\r\n"
+                      "@batch=join :alice!a@host JOIN #chan\r\n"
+                      ":irc.test BATCH -join\r\n");
+  CHECK(gateway.xmpp_sent().empty());
+
+  // When the minute is over, only bob leaves
+  event->execute();
+  TimedEventsManager::instance().cancel(event_name);
+  const auto sent = gateway.xmpp_sent();
+  CHECK(sent.find("#chan%irc.test@biboumi.test/bob") != std::string::npos);
+  CHECK(sent.find("unavailable") != std::string::npos);
+  CHECK(sent.find("alice") == std::string::npos);
+  CHECK(irc->get_channel("#chan")->find_user("alice"));
+  CHECK_FALSE(irc->get_channel("#chan")->find_user("bob"));
+
+  // A new netsplit, without any netjoin: everyone leaves at the end
+  gateway.irc_receive(irc, ":irc.test BATCH +split2 netsplit irc1.test irc2.test\r\n"
+                      "@batch=split2 :alice!a@host QUIT :irc1.test irc2.test\r\n"
+                      ":irc.test BATCH -split2\r\n");
+  CHECK(gateway.xmpp_sent().empty());
+  event = TimedEventsManager::instance().find_event(event_name);
+  REQUIRE(event);
+  event->execute();
+  TimedEventsManager::instance().cancel(event_name);
+  CHECK(gateway.xmpp_sent().find("#chan%irc.test@biboumi.test/alice") != std::string::npos);
+  CHECK_FALSE(irc->get_channel("#chan")->find_user("alice"));
+}
+
+TEST_CASE("Messages of a batch are handled when it ends")
+{
+  FakeGateway gateway;
+  IrcClient* irc = gateway.join("user@test/res", "#chan%irc.test", "nick", "batch", "alice");
+  gateway.xmpp_sent();
+
+  gateway.irc_receive(irc, ":irc.test BATCH +outer example.com/unknown\r\n"
+                      "@batch=outer :alice!a@host PRIVMSG #chan :first\r\n"
+                      "@batch=outer :irc.test BATCH +inner other.example.com/type\r\n"
+                      "@batch=inner :alice!a@host PRIVMSG #chan :second\r\n");
+  CHECK(gateway.xmpp_sent().empty());
+  // A nested batch is handled with the outermost one, in its place
+  gateway.irc_receive(irc, ":irc.test BATCH -inner\r\n"
+                      "@batch=outer :alice!a@host PRIVMSG #chan :third\r\n");
+  CHECK(gateway.xmpp_sent().empty());
+  gateway.irc_receive(irc, ":irc.test BATCH -outer\r\n");
+  auto sent = gateway.xmpp_sent();
+  const auto first = sent.find("<body>first</body>");
+  const auto second = sent.find("<body>second</body>");
+  const auto third = sent.find("<body>third</body>");
+  CHECK(first != std::string::npos);
+  CHECK(second != std::string::npos);
+  CHECK(third != std::string::npos);
+  CHECK(first < second);
+  CHECK(second < third);
+
+  // A message tagged with a batch that was never started is handled right away
+  gateway.irc_receive(irc, "@batch=unknown :alice!a@host PRIVMSG #chan :fourth\r\n");
+  CHECK(gateway.xmpp_sent().find("<body>fourth</body>") != std::string::npos);
+
+  // So are the messages of a batch started when too many are open
+  for (int i = 0; i < 32; i++)
+    gateway.irc_receive(irc, ":irc.test BATCH +b" + std::to_string(i) + " example.com/unknown\r\n");
+  gateway.irc_receive(irc, ":irc.test BATCH +extra example.com/unknown\r\n"
+                      "@batch=extra :alice!a@host PRIVMSG #chan :fifth\r\n");
+  CHECK(gateway.xmpp_sent().find("<body>fifth</body>") != std::string::npos);
+  gateway.irc_receive(irc, "@batch=b0 :alice!a@host PRIVMSG #chan :sixth\r\n");
+  CHECK(gateway.xmpp_sent().empty());
+  gateway.irc_receive(irc, ":irc.test BATCH -b0\r\n");
+  CHECK(gateway.xmpp_sent().find("<body>sixth</body>") != std::string::npos);
+}
+
+TEST_CASE("Lazy occupant presences")
+{
+  FakeGateway gateway;
+  Config::set("lazy_presence_threshold", "4", false);
+  const std::string room = "#chan%irc.test@biboumi.test/";
+
+  // Below the threshold, every occupant is announced
+  IrcClient* irc = gateway.join("user@test/res", "#small%irc.test", "nick", "", "alice");
+  CHECK(gateway.xmpp_sent().find("#small%irc.test@biboumi.test/alice") != std::string::npos);
+  // Including the ones that a NAMES sent later reveals
+  gateway.irc_receive(irc, ":irc.test 353 nick = #small :nick alice eve\r\n");
+  CHECK(gateway.xmpp_sent().find("#small%irc.test@biboumi.test/eve") != std::string::npos);
+
+  // From the threshold, only our own presence is sent
+  gateway.join("user@test/res", "#chan%irc.test", "nick", "", "alice bob carol");
+  auto sent = gateway.xmpp_sent();
+  CHECK(sent.find(room + "nick") != std::string::npos);
+  CHECK(sent.find(room + "alice") == std::string::npos);
+  CHECK(sent.find(room + "bob") == std::string::npos);
+  gateway.irc_receive(irc, ":irc.test 353 nick = #chan :nick alice bob carol dave\r\n");
+  CHECK(gateway.xmpp_sent().find(room + "dave") == std::string::npos);
+  CHECK(irc->get_channel("#chan")->find_user("dave"));
+
+  // The author of a message is announced, and the occupant it is addressed to
+  gateway.irc_receive(irc, ":alice!a@host PRIVMSG #chan :bob: hi\r\n");
+  sent = gateway.xmpp_sent();
+  CHECK(sent.find(room + "alice") != std::string::npos);
+  CHECK(sent.find(room + "bob") != std::string::npos);
+  CHECK(sent.find("<body>bob: hi</body>") != std::string::npos);
+  CHECK(sent.find(room + "carol") == std::string::npos);
+  gateway.irc_receive(irc, ":alice!a@host PRIVMSG #chan :carol is not addressed\r\n");
+  CHECK(gateway.xmpp_sent().find(room + "carol") == std::string::npos);
+
+  // The departures of the occupants that were not announced are not forwarded
+  gateway.irc_receive(irc, ":carol!c@host PART #chan\r\n");
+  CHECK(gateway.xmpp_sent().empty());
+  gateway.irc_receive(irc, ":bob!b@host PART #chan\r\n");
+  CHECK(gateway.xmpp_sent().find(room + "bob") != std::string::npos);
+
+  // Kicked, then joined again below the threshold: everyone is announced
+  gateway.irc_receive(irc, ":alice!a@host KICK #chan nick :bye\r\n");
+  gateway.xmpp_sent();
+  Config::set("lazy_presence_threshold", "100", false);
+  gateway.join("user@test/res", "#chan%irc.test", "nick", "", "alice dave");
+  CHECK_FALSE(irc->get_channel("#chan")->lazy_presences);
+  CHECK(gateway.xmpp_sent().find(room + "dave") != std::string::npos);
+  gateway.irc_receive(irc, ":dave!d@host QUIT :bye\r\n");
+  CHECK(gateway.xmpp_sent().find(room + "dave") != std::string::npos);
+}
+
+TEST_CASE("Paging the occupants of a room")
+{
+  FakeGateway gateway;
+  gateway.join("user@test/res", "#chan%irc.test", "nick", "", "alice bob carol dave");
+  gateway.xmpp_sent();
+  // The nicks of the page, in the order in which they were returned
+  const auto page = [&gateway](const std::string& set) {
+    gateway.xmpp_receive("<iq type='get' id='items' from='user@test/res' to='#chan%irc.test@biboumi.test'>"
+                         "<query xmlns='http://jabber.org/protocol/disco#items'>"
+                         "<set xmlns='http://jabber.org/protocol/rsm'>" + set + "</set></query></iq>");
+    const auto sent = gateway.xmpp_sent();
+    std::vector<std::string> nicks;
+    const std::string prefix = "name='";
+    for (auto pos = sent.find(prefix); pos != std::string::npos; pos = sent.find(prefix, pos))
+      {
+        pos += prefix.size();
+        nicks.push_back(sent.substr(pos, sent.find('\'', pos) - pos));
+      }
+    return nicks;
+  };
+  using Nicks = std::vector<std::string>;
+  CHECK(page("") == (Nicks{"nick", "alice", "bob", "carol", "dave"}));
+  CHECK(page("<max>2</max>") == (Nicks{"nick", "alice"}));
+  CHECK(page("<max>2</max><after>alice</after>") == (Nicks{"bob", "carol"}));
+  CHECK(page("<max>2</max><after>carol</after>") == (Nicks{"dave"}));
+  CHECK(page("<max>2</max><before/>") == (Nicks{"carol", "dave"}));
+  CHECK(page("<max>2</max><before>carol</before>") == (Nicks{"alice", "bob"}));
+  CHECK(page("<max>2</max><before>alice</before>") == (Nicks{"nick"}));
+  CHECK(page("<before>bob</before>") == (Nicks{"nick", "alice"}));
+  CHECK(page("<max>2</max><before>unknown</before>").empty());
+}
+
+TEST_CASE("Refuse the upgrade state of another format")
+{
+  FakeGateway gateway;
+  std::vector<socket_t> sockets;
+  {
+    Serializer out;
+    out.put(std::uint64_t{0});
+    Deserializer in(out.data());
+    CHECK_THROWS_AS(gateway.component->restore_state(in, sockets), std::runtime_error);
+  }
+  {
+    Serializer out;
+    out.put(std::string(BiboumiComponent::state_magic));
+    out.put(BiboumiComponent::state_version + 1);
+    out.put(std::uint64_t{1});
+    out.put("user@test"s);
+    Deserializer in(out.data());
+    CHECK_THROWS_AS(gateway.component->restore_state(in, sockets), std::runtime_error);
+  }
+  CHECK(gateway.component->get_bridges().empty());
+}
+
+#ifdef USE_DATABASE
+static std::string irc_time(const std::time_t date)
+{
+  const auto stamp = utils::to_string(date);
+  return stamp.substr(0, stamp.size() - 1) + ".000Z";
+}
+
+TEST_CASE("Fill the archive gap with CHATHISTORY")
+{
+  FakeGateway gateway;
+  const std::time_t since = std::time(nullptr) - 3600;
+  Database::store_muc_message("user@test", "#chan", "irc.test", std::chrono::system_clock::from_time_t(since),
+                              "hello", "alice");
+
+  IrcClient* irc = gateway.join("user@test/res", "#chan%irc.test", "nick", "batch server-time draft/chathistory");
+  CHECK(gateway.irc_sent(irc).find("CHATHISTORY AFTER #chan timestamp=" + irc_time(since) + " 100\r\n") != std::string::npos);
+  gateway.xmpp_sent();
+
+  // Archived live, before the batch arrives: its date must not be used to
+  // filter the messages of the batch
+  gateway.irc_receive(irc, "@time=" + irc_time(since + 20) + " :bob!b@host PRIVMSG #chan :live\r\n");
+  gateway.irc_receive(irc, ":irc.test BATCH +history chathistory #chan\r\n"
+                      "@batch=history;time=" + irc_time(since) + " :alice!a@host PRIVMSG #chan :hello\r\n"
+                      "@batch=history;time=" + irc_time(since + 10) + " :carol!c@host PRIVMSG #chan :missed\r\n"
+                      "@batch=history;time=" + irc_time(since + 20) + " :bob!b@host PRIVMSG #chan :live\r\n"
+                      ":irc.test BATCH -history\r\n");
+  const auto lines = std::get<1>(Database::get_muc_logs("user@test", "#chan", "irc.test", 100));
+  REQUIRE(lines.size() == 3);
+  // In the order of their dates, not the order in which they were archived
+  CHECK(lines[0].col<Database::Body>() == "hello");
+  CHECK(lines[1].col<Database::Body>() == "missed");
+  CHECK(lines[1].col<Database::Nick>() == "carol");
+  CHECK(lines[1].col<Database::Date>() == since + 10);
+  CHECK(lines[2].col<Database::Body>() == "live");
+  const auto last = std::get<1>(Database::get_muc_logs("user@test", "#chan", "irc.test", 1, {}, {}, nullptr,
+                                                       Database::Paging::last));
+  REQUIRE(last.size() == 1);
+  CHECK(last[0].col<Database::Body>() == "live");
+  const auto sent = gateway.xmpp_sent();
+  CHECK(sent.find("<body>missed</body>") != std::string::npos);
+  CHECK(sent.find("<body>hello</body>") == std::string::npos);
+
+  // A batch that we did not request is not archived
+  gateway.irc_receive(irc, ":irc.test BATCH +other chathistory #chan\r\n"
+                      "@batch=other;time=" + irc_time(since + 30) + " :dave!d@host PRIVMSG #chan :unrequested\r\n"
+                      ":irc.test BATCH -other\r\n");
+  CHECK(std::get<1>(Database::get_muc_logs("user@test", "#chan", "irc.test", 100)).size() == 3);
+}
+
+TEST_CASE("A full CHATHISTORY batch is followed by another request")
+{
+  FakeGateway gateway;
+  const std::time_t since = std::time(nullptr) - 3600;
+  Database::store_muc_message("user@test", "#chan", "irc.test", std::chrono::system_clock::from_time_t(since),
+                              "hello", "alice");
+
+  IrcClient* irc = gateway.join("user@test/res", "#other%irc.test", "nick", "batch server-time draft/chathistory");
+  gateway.irc_receive(irc, ":irc.test 005 nick CHATHISTORY=2 :are supported by this server\r\n");
+  gateway.join("user@test/res", "#chan%irc.test", "nick");
+  CHECK(gateway.irc_sent(irc).find("CHATHISTORY AFTER #chan timestamp=" + irc_time(since) + " 2\r\n") != std::string::npos);
+
+  gateway.irc_receive(irc, ":irc.test BATCH +first chathistory #chan\r\n"
+                      "@batch=first;time=" + irc_time(since + 10) + " :carol!c@host PRIVMSG #chan :one\r\n"
+                      "@batch=first;time=" + irc_time(since + 20) + " :carol!c@host PRIVMSG #chan :two\r\n"
+                      ":irc.test BATCH -first\r\n");
+  CHECK(gateway.irc_sent(irc).find("CHATHISTORY AFTER #chan timestamp=" + irc_time(since + 20) + " 2\r\n") != std::string::npos);
+
+  // The rest of the gap: one message only, the gap is filled
+  gateway.irc_receive(irc, ":irc.test BATCH +second chathistory #chan\r\n"
+                      "@batch=second;time=" + irc_time(since + 30) + " :carol!c@host PRIVMSG #chan :three\r\n"
+                      ":irc.test BATCH -second\r\n");
+  CHECK(gateway.irc_sent(irc).find("CHATHISTORY") == std::string::npos);
+  const auto lines = std::get<1>(Database::get_muc_logs("user@test", "#chan", "irc.test", 100));
+  REQUIRE(lines.size() == 4);
+  CHECK(lines[1].col<Database::Body>() == "one");
+  CHECK(lines[2].col<Database::Body>() == "two");
+  CHECK(lines[3].col<Database::Body>() == "three");
+}
+
+TEST_CASE("Messages are archived with their server-time date")
+{
+  FakeGateway gateway;
+  IrcClient* irc = gateway.join("user@test/res", "#chan%irc.test", "nick", "server-time", "alice");
+  const std::time_t past = std::time(nullptr) - 3600;
+  gateway.irc_receive(irc, "@time=" + irc_time(past) + " :alice!a@host PRIVMSG #chan :past\r\n");
+  // A server clock ahead of ours: the message is dated when it was received
+  const std::time_t before = std::time(nullptr);
+  gateway.irc_receive(irc, "@time=" + irc_time(before + 86400) + " :alice!a@host PRIVMSG #chan :future\r\n");
+  const std::time_t after = std::time(nullptr);
+  const auto lines = std::get<1>(Database::get_muc_logs("user@test", "#chan", "irc.test", 100));
+  REQUIRE(lines.size() == 2);
+  CHECK(lines[0].col<Database::Body>() == "past");
+  CHECK(lines[0].col<Database::Date>() == past);
+  CHECK(lines[1].col<Database::Body>() == "future");
+  CHECK(lines[1].col<Database::Date>() >= before);
+  CHECK(lines[1].col<Database::Date>() <= after);
+}
+
+TEST_CASE("Upgrade state round trip")
+{
+  const std::time_t since = std::time(nullptr) - 3600;
+  Serializer state;
+  std::vector<socket_t> sockets;
+  int peer_fd;
+  {
+    FakeGateway gateway;
+    Database::store_muc_message("user@test", "#chan", "irc.test", std::chrono::system_clock::from_time_t(since),
+                                "hello", "alice");
+    IrcClient* irc = gateway.join("user@test/res", "#chan%irc.test", "nick", "batch server-time draft/chathistory",
+                                  "alice bob");
+    gateway.irc_receive(irc, ":irc.test 005 nick CHATHISTORY=50 :are supported\r\n");
+    gateway.irc_receive(irc, ":irc.test BATCH +open example.com/unknown\r\n"
+                        "@batch=open :alice!a@host PRIVMSG #chan :deferred\r\n"
+                        "@batch=open :irc.test BATCH +nested example.com/unknown\r\n"
+                        "@batch=nested :alice!a@host PRIVMSG #chan :nested\r\n"
+                        ":irc.test BATCH -nested\r\n"
+                        ":irc.test BATCH +split netsplit irc1.test irc2.test\r\n"
+                        "@batch=split :bob!b@host QUIT :irc1.test irc2.test\r\n"
+                        ":irc.test BATCH -split\r\n");
+    gateway.irc_sent(irc);
+    gateway.xmpp_sent();
+    gateway.component->save_state(state, sockets);
+    REQUIRE(sockets.size() == 1);
+    // Like the ones received by the new process
+    sockets[0] = ::dup(sockets[0]);
+    peer_fd = gateway.release(irc);
+  }
+
+  FakeGateway gateway;
+  Database::store_muc_message("user@test", "#chan", "irc.test", std::chrono::system_clock::from_time_t(since),
+                              "hello", "alice");
+  Database::store_muc_message("user@test", "#other", "irc.test", std::chrono::system_clock::from_time_t(since),
+                              "hello", "alice");
+  Deserializer in(state.data());
+  gateway.component->restore_state(in, sockets);
+  CHECK(in.at_end());
+  Bridge* bridge = gateway.component->find_user_bridge("user@test/res");
+  REQUIRE(bridge);
+  IrcClient* irc = bridge->find_irc_client("irc.test");
+  REQUIRE(irc);
+  gateway.adopt(irc, peer_fd);
+  CHECK(irc->is_welcomed());
+  CHECK(irc->get_channel("#chan")->joined);
+  CHECK(irc->get_channel("#chan")->find_user("alice"));
+
+  // The batch that was open goes on
+  gateway.irc_receive(irc, ":irc.test BATCH -open\r\n");
+  auto sent = gateway.xmpp_sent();
+  CHECK(sent.find("<body>deferred</body>") != std::string::npos);
+  CHECK(sent.find("<body>nested</body>") > sent.find("<body>deferred</body>"));
+
+  // So does the netsplit: bob comes back without a presence
+  const auto event_name = "Netsplit" "irc.test" + bridge->get_jid();
+  CHECK(TimedEventsManager::instance().find_event(event_name));
+  gateway.irc_receive(irc, ":irc.test BATCH +join netjoin irc1.test irc2.test\r\n"
+                      "@batch=join :bob!b@host JOIN #chan\r\n"
+                      ":irc.test BATCH -join\r\n");
+  CHECK(gateway.xmpp_sent().empty());
+  TimedEventsManager::instance().cancel(event_name);
+
+  // The CHATHISTORY request sent before the upgrade is answered after it
+  gateway.irc_receive(irc, ":irc.test BATCH +history chathistory #chan\r\n"
+                      "@batch=history;time=" + irc_time(since + 10) + " :carol!c@host PRIVMSG #chan :missed\r\n"
+                      ":irc.test BATCH -history\r\n");
+  CHECK(gateway.xmpp_sent().find("<body>missed</body>") != std::string::npos);
+
+  // And the next ones still use the limit of the server
+  gateway.join("user@test/res", "#other%irc.test", "nick");
+  CHECK(gateway.irc_sent(irc).find("CHATHISTORY AFTER #other timestamp=" + irc_time(since) + " 50\r\n") != std::string::npos);
+}
+#endif
@@ -0,0 +1,279 @@
+#include "fake_irc_server.hpp"
+#include "loadgen.hpp"
+
+#include <irc/irc_message.hpp>
+#include <utils/split.hpp>
+
+#include <iostream>
+
+#include <arpa/inet.h>
+
+/**
+ * Returns the local address of the socket, as a string, without the
+ * prefix of the IPv4-mapped IPv6 addresses.
+ */
+static std::string get_local_address(const socket_t socket)
+{
+  struct sockaddr_in6 addr{};
+  socklen_t len = sizeof(addr);
+  if (::getsockname(socket, reinterpret_cast<struct sockaddr*>(&addr), &len) == -1)
+    return {};
+  char buf[INET6_ADDRSTRLEN];
+  if (!::inet_ntop(AF_INET6, &addr.sin6_addr, buf, sizeof(buf)))
+    return {};
+  const std::string res = buf;
+  if (res.compare(0, 7, "::ffff:") == 0)
+    return res.substr(7);
+  return res;
+}
+
+FakeIrcConnection::FakeIrcConnection(std::shared_ptr<Poller>& poller, const socket_t socket, TcpSocketServer<FakeIrcConnection>& server):
+  TCPSocketHandler(poller),
+  server(dynamic_cast<FakeIrcServer&>(server)),
+  network(nullptr)
+{
+  this->socket = socket;
+  this->server.generator.stats.irc_connections++;
+  const auto address = get_local_address(socket);
+  this->network = this->server.get_network(address);
+  if (!this->network)
+    std::cerr << "Connection to an unexpected address: " << address << std::endl;
+}
+
+void FakeIrcConnection::parse_in_buffer(const std::size_t size)
+{
+  this->server.generator.stats.irc_in.bytes += size;
+  while (true)
+    {
+      const auto pos = this->in_buf.find("\r\n");
+      if (pos == std::string::npos)
+        break;
+      IrcMessage message(this->in_buf.substr(0, pos));
+      this->consume_in_buffer(pos + 2);
+      this->server.generator.stats.irc_in.count++;
+      this->on_message(message);
+      if (this->socket == -1)
+        break;
+    }
+}
+
+void FakeIrcConnection::close()
+{
+  if (this->network)
+    for (auto& channel: this->network->channels)
+      {
+        auto& members = channel.second;
+        const auto it = std::find(members.begin(), members.end(), this);
+        if (it == members.end())
+          continue;
+        members.erase(it);
+        this->server.send_to_channel(*this->network, channel.first, ":" + this->get_prefix() + " QUIT :Connection closed");
+      }
+  this->network = nullptr;
+  TCPSocketHandler::close();
+  this->server.mark_for_cleanup();
+}
+
+void FakeIrcConnection::send_line(std::string&& line)
+{
+  this->server.generator.stats.irc_out.count++;
+  line += "\r\n";
+  this->server.generator.stats.irc_out.bytes += line.size();
+  this->send_data(std::move(line));
+}
+
+void FakeIrcConnection::welcome_if_registered()
+{
+  if (this->welcomed || !this->user_received || this->negotiating_capabilities || this->nick.empty())
+    return;
+  const auto& server_name = this->network->server_name;
+  this->welcomed = true;
+  this->send_line(":" + server_name + " 001 " + this->nick + " :Welcome to the load test network " + this->nick);
+  this->send_line(":" + server_name + " 005 " + this->nick + " CHANTYPES=# PREFIX=(ov)@+ NETWORK=load :are supported by this server");
+  this->send_line(":" + server_name + " 376 " + this->nick + " :End of /MOTD command.");
+}
+
+void FakeIrcConnection::on_message(const IrcMessage& message)
+{
+  if (!this->network)
+    {
+      this->close();
+      return;
+    }
+  const auto& server_name = this->network->server_name;
+  const auto& command = message.command;
+  const auto& args = message.arguments;
+  if (command == "CAP" && !args.empty() && args[0] == "LS")
+    {
+      // Like a real server, the registration is held until CAP END
+      this->negotiating_capabilities = true;
+      this->send_line(":" + server_name + " CAP * LS :multi-prefix");
+    }
+  else if (command == "CAP" && !args.empty() && args[0] == "REQ" && args.size() > 1)
+    this->send_line(":" + server_name + " CAP * ACK :" + args[1]);
+  else if (command == "CAP" && !args.empty() && args[0] == "END")
+    {
+      this->negotiating_capabilities = false;
+      this->welcome_if_registered();
+    }
+  else if (command == "NICK" && !args.empty())
+    this->nick = args[0];
+  else if (command == "USER")
+    {
+      this->user_received = true;
+      this->welcome_if_registered();
+    }
+  else if (command == "PING" && !args.empty())
+    this->send_line(":" + server_name + " PONG " + server_name + " :" + args[0]);
+  else if (command == "JOIN" && !args.empty())
+    {
+      for (const auto& channel: utils::split(args[0], ',', false))
+        this->on_join(channel);
+    }
+  else if (command == "PART" && !args.empty())
+    {
+      for (const auto& channel: utils::split(args[0], ',', false))
+        this->on_part(channel, args.size() > 1 ? args[1] : "");
+    }
+  else if (command == "PRIVMSG" && args.size() > 1)
+    {
+      this->server.generator.on_irc_message(args[1]);
+      if (this->network->channels.count(args[0]))
+        this->server.send_to_channel(*this->network, args[0],
+                                     ":" + this->get_prefix() + " PRIVMSG " + args[0] + " :" + args[1], this);
+    }
+  else if (command == "QUIT")
+    {
+      // biboumi closes the connection once it receives the ERROR
+      for (auto& channel: this->network->channels)
+        {
+          auto& members = channel.second;
+          const auto it = std::find(members.begin(), members.end(), this);
+          if (it == members.end())
+            continue;
+          members.erase(it);
+          this->server.send_to_channel(*this->network, channel.first,
+                                       ":" + this->get_prefix() + " QUIT :" + (args.empty() ? "" : args[0]));
+        }
+      this->send_line("ERROR :Closing Link: " + this->nick);
+    }
+}
+
+void FakeIrcConnection::on_join(const std::string& channel)
+{
+  auto& members = this->network->channels[channel];
+  if (std::find(members.begin(), members.end(), this) != members.end())
+    return;
+  members.push_back(this);
+  this->server.send_to_channel(*this->network, channel, ":" + this->get_prefix() + " JOIN :" + channel);
+
+  std::vector<std::string> names;
+  for (const auto& member: members)
+    names.push_back(member->get_nick());
+  for (const auto& external_user: this->network->external_users)
+    names.push_back("+" + external_user);
+  const auto prefix = ":" + this->network->server_name + " 353 " + this->nick + " = " + channel + " :";
+  for (std::size_t i = 0; i < names.size(); i += 50)
+    {
+      std::string line = prefix;
+      for (std::size_t j = i; j < std::min(names.size(), i + 50); ++j)
+        line += (j == i ? "" : " ") + names[j];
+      this->send_line(std::move(line));
+    }
+  this->send_line(":" + this->network->server_name + " 366 " + this->nick + " " + channel + " :End of /NAMES list.");
+}
+
+void FakeIrcConnection::on_part(const std::string& channel, const std::string& reason)
+{
+  auto it = this->network->channels.find(channel);
+  if (it == this->network->channels.end())
+    return;
+  auto& members = it->second;
+  const auto member = std::find(members.begin(), members.end(), this);
+  if (member == members.end())
+    return;
+  this->server.send_to_channel(*this->network, channel, ":" + this->get_prefix() + " PART " + channel + " :" + reason);
+  members.erase(member);
+}
+
+FakeIrcServer::FakeIrcServer(std::shared_ptr<Poller>& poller, const uint16_t port, LoadGenerator& generator):
+    TcpSocketServer<FakeIrcConnection>(poller, port),
+    generator(generator),
+    networks(generator.options.servers)
+{
+  for (std::size_t i = 0; i < this->networks.size(); ++i)
+    {
+      auto& network = this->networks[i];
+      network.server_name = "irc" + std::to_string(i + 1) + ".load";
+      for (std::size_t j = 0; j < generator.options.external_users; ++j)
+        network.external_users.push_back("ext" + std::to_string(j));
+    }
+}
+
+FakeIrcNetwork* FakeIrcServer::get_network(const std::string& address)
+{
+  if (address == "::1")
+    return &this->networks[0];
+  for (std::size_t i = 0; i < this->networks.size(); ++i)
+    if (address == "127.0.0." + std::to_string(i + 1))
+      return &this->networks[i];
+  return nullptr;
+}
+
+void FakeIrcServer::send_to_channel(FakeIrcNetwork& network, const std::string& channel, const std::string& line,
+                                    const FakeIrcConnection* except)
+{
+  auto it = network.channels.find(channel);
+  if (it == network.channels.end())
+    return;
+  for (auto* connection: it->second)
+    if (connection != except)
+      connection->send_line(std::string{line});
+}
+
+void FakeIrcServer::send_to_network(FakeIrcNetwork& network, const std::string& line)
+{
+  std::set<FakeIrcConnection*> connections;
+  for (const auto& channel: network.channels)
+    connections.insert(channel.second.begin(), channel.second.end());
+  for (auto* connection: connections)
+    connection->send_line(std::string{line});
+}
+
+void FakeIrcServer::send_external_message(const std::size_t network_index, const std::string& channel,
+                                          const std::string& nick, const std::string& text)
+{
+  this->send_to_channel(this->networks[network_index], channel,
+                        ":" + nick + "!" + nick + "@irc.load PRIVMSG " + channel + " :" + text);
+}
+
+std::vector<std::string> FakeIrcServer::split(const std::size_t network_index, const double fraction)
+{
+  auto& network = this->networks[network_index];
+  const auto count = std::min(network.external_users.size(),
+                              static_cast<std::size_t>(fraction * static_cast<double>(network.external_users.size())));
+  std::vector<std::string> nicks(network.external_users.end() - static_cast<std::ptrdiff_t>(count),
+                                 network.external_users.end());
+  network.external_users.resize(network.external_users.size() - count);
+  for (const auto& nick: nicks)
+    {
+      network.split_users.push_back(nick);
+      this->send_to_network(network, ":" + nick + "!" + nick + "@irc.load QUIT :hub.load " + network.server_name);
+    }
+  return nicks;
+}
+
+void FakeIrcServer::rejoin(const std::size_t network_index, const std::vector<std::string>& nicks)
+{
+  auto& network = this->networks[network_index];
+  for (const auto& nick: nicks)
+    {
+      const auto it = std::find(network.split_users.begin(), network.split_users.end(), nick);
+      if (it == network.split_users.end())
+        continue;
+      network.split_users.erase(it);
+      network.external_users.push_back(nick);
+      for (const auto& channel: network.channels)
+        this->send_to_channel(network, channel.first, ":" + nick + "!" + nick + "@irc.load JOIN :" + channel.first);
+    }
+}
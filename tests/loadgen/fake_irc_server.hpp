@@ -0,0 +1,152 @@
+#pragma once
+
+#include <network/tcp_server_socket.hpp>
+#include <network/tcp_socket_handler.hpp>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+
+#include <unistd.h>
+
+class LoadGenerator;
+class FakeIrcServer;
+class FakeIrcConnection;
+class IrcMessage;
+
+/**
+ * One of the simulated IRC servers. They all share the same listening
+ * socket, and are told apart by the local address of each connection:
+ * the one reached through 127.0.0.2 is the second one, etc.
+ */
+struct FakeIrcNetwork
+{
+  std::string server_name;
+  /**
+   * The connections (one per XMPP user) that joined each channel.
+   */
+  std::map<std::string, std::vector<FakeIrcConnection*>> channels;
+  /**
+   * The users that exist only on the IRC side, and are in all the
+   * channels. The ones that quit during a netsplit are moved to
+   * split_users until they join again.
+   */
+  std::vector<std::string> external_users;
+  std::vector<std::string> split_users;
+};
+
+/**
+ * One connection from biboumi, for one XMPP user.
+ */
+class FakeIrcConnection: public TCPSocketHandler
+{
+public:
+  FakeIrcConnection(std::shared_ptr<Poller>& poller, const socket_t socket, TcpSocketServer<FakeIrcConnection>& server);
+  ~FakeIrcConnection() = default;
+
+  void parse_in_buffer(const std::size_t size) override final;
+  void close() override final;
+  void send_line(std::string&& line);
+
+  const std::string& get_nick() const
+  { return this->nick; }
+  std::string get_prefix() const
+  { return this->nick + "!" + this->nick + "@xmpp.load"; }
+
+  bool is_connected() const override final
+  {
+    return true;
+  }
+  bool is_connecting() const override final
+  {
+    return false;
+  }
+
+private:
+  void on_message(const IrcMessage& message);
+  /**
+   * Send the welcome, once USER was received and the capabilities
+   * negotiation, if any, ended.
+   */
+  void welcome_if_registered();
+  void on_join(const std::string& channel);
+  void on_part(const std::string& channel, const std::string& reason);
+
+  FakeIrcServer& server;
+  FakeIrcNetwork* network;
+  std::string nick;
+  bool welcomed{false};
+  bool user_received{false};
+  bool negotiating_capabilities{false};
+};
+
+class FakeIrcServer: public TcpSocketServer<FakeIrcConnection>
+{
+public:
+  FakeIrcServer(std::shared_ptr<Poller>& poller, const uint16_t port, LoadGenerator& generator);
+
+  /**
+   * Returns the network reached through the given local address, or
+   * nullptr if it’s not one of ours.
+   */
+  FakeIrcNetwork* get_network(const std::string& address);
+  FakeIrcNetwork& get_network(const std::size_t index)
+  { return this->networks[index]; }
+
+  /**
+   * Send the line to all the connections in that channel, except the
+   * given one.
+   */
+  void send_to_channel(FakeIrcNetwork& network, const std::string& channel, const std::string& line,
+                       const FakeIrcConnection* except=nullptr);
+  /**
+   * Send the line to all the connections that share at least one channel
+   * with the external users, i.e. all the connections that joined
+   * something, once.
+   */
+  void send_to_network(FakeIrcNetwork& network, const std::string& line);
+  void send_external_message(const std::size_t network_index, const std::string& channel,
+                             const std::string& nick, const std::string& text);
+  /**
+   * Make that fraction of the external users of the network quit, and
+   * returns their nicks.
+   */
+  std::vector<std::string> split(const std::size_t network_index, const double fraction);
+  void rejoin(const std::size_t network_index, const std::vector<std::string>& nicks);
+
+  bool is_listening() const
+  {
+    return this->poller->is_managing_socket(this->socket);
+  }
+  void shutdown()
+  {
+    if (this->poller->is_managing_socket(this->socket))
+      this->poller->remove_socket_handler(this->socket);
+    ::close(this->socket);
+    this->sockets.clear();
+  }
+  void mark_for_cleanup()
+  {
+    this->needs_cleaning = true;
+  }
+  void clean()
+  {
+    if (!this->needs_cleaning)
+      return;
+    this->needs_cleaning = false;
+    this->sockets.erase(std::remove_if(this->sockets.begin(), this->sockets.end(),
+                                       [](const std::unique_ptr<FakeIrcConnection>& socket)
+                                       {
+                                         return socket->get_socket() == -1;
+                                       }),
+                        this->sockets.end());
+  }
+
+  LoadGenerator& generator;
+
+private:
+  std::vector<FakeIrcNetwork> networks;
+  bool needs_cleaning{false};
+};
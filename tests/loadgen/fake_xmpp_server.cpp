@@ -0,0 +1,79 @@
+#include "fake_xmpp_server.hpp"
+#include "loadgen.hpp"
+
+#include <xmpp/auth.hpp>
+
+#include <iostream>
+
+static const std::string stream_id{"loadgen"};
+
+FakeXmppConnection::FakeXmppConnection(std::shared_ptr<Poller>& poller, const socket_t socket, TcpSocketServer<FakeXmppConnection>& server):
+  TCPSocketHandler(poller),
+  server(dynamic_cast<FakeXmppServer&>(server))
+{
+  this->socket = socket;
+  this->parser.add_stream_open_callback([this](const XmlNode& node) { this->on_stream_open(node); });
+  this->parser.add_stanza_callback([this](const Stanza& stanza) { this->on_stanza(stanza); });
+}
+
+void FakeXmppConnection::parse_in_buffer(const std::size_t size)
+{
+  this->server.generator.stats.xmpp_in.bytes += size;
+  // Same as XmppComponent: the data is either in the buffer of the
+  // parser, or in in_buf if it could not provide one
+  if (!this->in_buf.empty())
+    {
+      this->parser.feed(this->in_buf.data(), static_cast<int>(this->in_buf.size()), false);
+      this->in_buf.clear();
+    }
+  else
+    this->parser.parse(static_cast<int>(size), false);
+}
+
+void* FakeXmppConnection::get_receive_buffer(const std::size_t size) const
+{
+  return this->parser.get_buffer(size);
+}
+
+void FakeXmppConnection::close()
+{
+  TCPSocketHandler::close();
+  this->server.generator.on_xmpp_disconnected(this);
+  this->server.mark_for_cleanup();
+}
+
+void FakeXmppConnection::send_stanza(std::string&& stanza)
+{
+  this->server.generator.stats.xmpp_out.count++;
+  this->server.generator.stats.xmpp_out.bytes += stanza.size();
+  this->send_data(std::move(stanza));
+}
+
+void FakeXmppConnection::on_stream_open(const XmlNode& node)
+{
+  if (node.get_tag("to") != this->server.generator.options.hostname)
+    std::cerr << "Unexpected hostname from biboumi: " << node.get_tag("to") << std::endl;
+  this->send_data("<?xml version='1.0'?><stream:stream xmlns:stream='http://etherx.jabber.org/streams' "
+                  "xmlns='jabber:component:accept' from='" + this->server.generator.options.hostname +
+                  "' id='" + stream_id + "'>");
+}
+
+void FakeXmppConnection::on_stanza(const Stanza& stanza)
+{
+  if (this->authenticated)
+    {
+      this->server.generator.stats.xmpp_in.count++;
+      this->server.generator.on_xmpp_stanza(stanza);
+      return;
+    }
+  if (stanza.get_name() != "handshake" ||
+      stanza.get_inner() != get_handshake_digest(stream_id, this->server.generator.options.password))
+    {
+      std::cerr << "Invalid handshake from biboumi, check its password" << std::endl;
+      this->send_data("<stream:error><not-authorized xmlns='urn:ietf:params:xml:ns:xmpp-streams'/></stream:error></stream:stream>");
+      return;
+    }
+  this->authenticated = true;
+  this->send_data("<handshake/>");
+  this->server.generator.on_xmpp_authenticated(this);
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <network/tcp_server_socket.hpp>
+#include <network/tcp_socket_handler.hpp>
+#include <xmpp/xmpp_parser.hpp>
+
+#include <algorithm>
+#include <unistd.h>
+
+class LoadGenerator;
+class FakeXmppServer;
+
+/**
+ * The connection of biboumi to our fake XMPP server: check its handshake,
+ * then give all the received stanzas to the LoadGenerator.
+ */
+class FakeXmppConnection: public TCPSocketHandler
+{
+public:
+  FakeXmppConnection(std::shared_ptr<Poller>& poller, const socket_t socket, TcpSocketServer<FakeXmppConnection>& server);
+  ~FakeXmppConnection() = default;
+
+  void parse_in_buffer(const std::size_t size) override final;
+  void* get_receive_buffer(const std::size_t size) const override final;
+  void close() override final;
+  void send_stanza(std::string&& stanza);
+
+  bool is_connected() const override final
+  {
+    return true;
+  }
+  bool is_connecting() const override final
+  {
+    return false;
+  }
+
+private:
+  void on_stream_open(const XmlNode& node);
+  void on_stanza(const Stanza& stanza);
+
+  FakeXmppServer& server;
+  XmppParser parser;
+  bool authenticated{false};
+};
+
+class FakeXmppServer: public TcpSocketServer<FakeXmppConnection>
+{
+public:
+  FakeXmppServer(std::shared_ptr<Poller>& poller, const uint16_t port, LoadGenerator& generator):
+      TcpSocketServer<FakeXmppConnection>(poller, port),
+      generator(generator)
+  {}
+
+  bool is_listening() const
+  {
+    return this->poller->is_managing_socket(this->socket);
+  }
+  void shutdown()
+  {
+    if (this->poller->is_managing_socket(this->socket))
+      this->poller->remove_socket_handler(this->socket);
+    ::close(this->socket);
+    this->sockets.clear();
+  }
+  void mark_for_cleanup()
+  {
+    this->needs_cleaning = true;
+  }
+  void clean()
+  {
+    if (!this->needs_cleaning)
+      return;
+    this->needs_cleaning = false;
+    this->sockets.erase(std::remove_if(this->sockets.begin(), this->sockets.end(),
+                                       [](const std::unique_ptr<FakeXmppConnection>& socket)
+                                       {
+                                         return socket->get_socket() == -1;
+                                       }),
+                        this->sockets.end());
+  }
+
+  LoadGenerator& generator;
+
+private:
+  bool needs_cleaning{false};
+};
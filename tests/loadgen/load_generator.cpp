@@ -0,0 +1,397 @@
+#include "loadgen.hpp"
+#include "fake_xmpp_server.hpp"
+#include "fake_irc_server.hpp"
+
+#include <utils/timed_events.hpp>
+#include <xmpp/jid.hpp>
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+
+using namespace std::chrono_literals;
+
+constexpr uint16_t LoadOptions::irc_port;
+
+static const std::string user_domain{"load.example"};
+static const std::string muc_user_ns{"http://jabber.org/protocol/muc#user"};
+static const std::string component_ns{"jabber:component:accept"};
+
+/**
+ * Parse the number at the end of the given prefix in str, like the 12 in
+ * "user12" or "#chan12%127.0.0.1". Returns false if it’s not there.
+ */
+static bool parse_index(const std::string& str, const std::string& prefix, std::size_t& index)
+{
+  if (str.compare(0, prefix.size(), prefix) != 0)
+    return false;
+  char* end;
+  const auto res = std::strtoul(str.data() + prefix.size(), &end, 10);
+  if (end == str.data() + prefix.size())
+    return false;
+  index = res;
+  return true;
+}
+
+LoadGenerator::LoadGenerator(const LoadOptions& options):
+  options(options),
+  join_states(options.users * options.channels * options.resources, JoinState::left),
+  random(options.seed),
+  last_tick(std::chrono::steady_clock::now())
+{
+  TimedEventsManager::instance().add_event(TimedEvent(10ms, [this]() { this->tick(); }, "loadgen tick"));
+}
+
+LoadGenerator::~LoadGenerator()
+{
+  TimedEventsManager::instance().cancel("loadgen tick");
+  TimedEventsManager::instance().cancel("loadgen rejoin");
+}
+
+void LoadGenerator::on_xmpp_authenticated(FakeXmppConnection* connection)
+{
+  this->xmpp_connection = connection;
+  if (this->phase != Phase::waiting_biboumi)
+    return;
+  std::cerr << "biboumi connected, joining " << this->join_states.size() << " times…" << std::endl;
+  this->phase = Phase::joining;
+  this->phase_start = std::chrono::steady_clock::now();
+  for (std::size_t user = 0; user < this->options.users; ++user)
+    for (std::size_t channel = 0; channel < this->options.channels; ++channel)
+      for (std::size_t resource = 0; resource < this->options.resources; ++resource)
+        this->send_join(user, channel, resource);
+}
+
+void LoadGenerator::on_xmpp_disconnected(FakeXmppConnection* connection)
+{
+  if (this->xmpp_connection != connection)
+    return;
+  this->xmpp_connection = nullptr;
+  if (this->phase != Phase::finished)
+    {
+      std::cerr << "biboumi disconnected, stopping" << std::endl;
+      this->phase = Phase::finished;
+      this->failed = true;
+    }
+}
+
+void LoadGenerator::on_xmpp_stanza(const Stanza& stanza)
+{
+  this->last_received = std::chrono::steady_clock::now();
+  const Jid to(stanza.get_tag("to"));
+  std::size_t user{0};
+  std::size_t resource{0};
+  if (to.domain != user_domain || !parse_index(to.local, "user", user) || user >= this->options.users ||
+      !parse_index(to.resource, "res", resource) || resource >= this->options.resources)
+    return;
+
+  if (stanza.get_name() == "message")
+    {
+      const auto* body = stanza.get_child("body", component_ns);
+      if (!body)
+        return;
+      std::chrono::steady_clock::duration latency;
+      if (LoadGenerator::get_latency(body->get_inner(), 'i', latency))
+        this->stats.irc_to_xmpp.add(latency);
+      else if (LoadGenerator::get_latency(body->get_inner(), 'x', latency))
+        this->stats.relayed_messages_received++;
+      return;
+    }
+  if (stanza.get_name() != "presence")
+    return;
+
+  const Jid from(stanza.get_tag("from"));
+  std::size_t channel{0};
+  if (!parse_index(from.local, "#chan", channel) || channel >= this->options.channels)
+    return;
+  const auto type = stanza.get_tag("type");
+  if (type == "error")
+    {
+      this->stats.presence_errors++;
+      this->join_state(user, channel, resource) = JoinState::left;
+      return;
+    }
+  // Only our own presence, which completes a join
+  const auto* x = stanza.get_child("x", muc_user_ns);
+  if (!x)
+    return;
+  bool self_presence = false;
+  for (const auto* status: x->get_children("status", muc_user_ns))
+    if (status->get_tag("code") == "110")
+      self_presence = true;
+  if (!self_presence)
+    return;
+  auto& state = this->join_state(user, channel, resource);
+  if (type.empty() && state == JoinState::joining)
+    {
+      state = JoinState::joined;
+      this->joined++;
+    }
+}
+
+void LoadGenerator::on_irc_message(const std::string& text)
+{
+  this->last_received = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::duration latency;
+  if (LoadGenerator::get_latency(text, 'x', latency))
+    this->stats.xmpp_to_irc.add(latency);
+}
+
+std::string LoadGenerator::make_message_text(const char direction) const
+{
+  const auto now = std::chrono::steady_clock::now().time_since_epoch();
+  std::string text = "lg ";
+  text += direction;
+  text += ' ' + std::to_string(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count()) + ' ';
+  if (text.size() < this->options.message_size)
+    text.append(this->options.message_size - text.size(), 'a');
+  return text;
+}
+
+bool LoadGenerator::get_latency(const std::string& text, const char direction,
+                                std::chrono::steady_clock::duration& latency)
+{
+  if (text.size() < 5 || text.compare(0, 3, "lg ") != 0 || text[3] != direction)
+    return false;
+  const auto sent = std::chrono::nanoseconds(std::strtoll(text.data() + 5, nullptr, 10));
+  latency = std::chrono::steady_clock::now().time_since_epoch() - sent;
+  return true;
+}
+
+void LoadGenerator::tick()
+{
+  const auto now = std::chrono::steady_clock::now();
+  const auto elapsed = std::chrono::duration<double>(now - this->last_tick).count();
+  this->last_tick = now;
+
+  if (this->phase == Phase::joining)
+    {
+      const auto join_timeout = std::chrono::duration<double>(this->options.join_timeout);
+      if (this->joined == this->join_states.size())
+        this->start_running();
+      else if (now - this->phase_start > join_timeout)
+        {
+          std::cerr << "Only " << this->joined << " joins out of " << this->join_states.size()
+                    << " were done after " << this->options.join_timeout << "s, starting anyway" << std::endl;
+          this->failed = true;
+          this->start_running();
+        }
+    }
+  else if (this->phase == Phase::running)
+    {
+      if (now - this->phase_start >= std::chrono::duration<double>(this->options.duration))
+        {
+          this->run_duration = now - this->phase_start;
+          std::cerr << "Done, waiting for the last messages…" << std::endl;
+          this->phase = Phase::draining;
+          this->phase_start = now;
+          return;
+        }
+      this->irc_budget += this->options.irc_rate * elapsed;
+      for (; this->irc_budget >= 1; this->irc_budget--)
+        this->send_irc_message();
+      this->xmpp_budget += this->options.xmpp_rate * elapsed;
+      for (; this->xmpp_budget >= 1; this->xmpp_budget--)
+        this->send_xmpp_message();
+      this->churn_budget += this->options.churn_rate * elapsed;
+      for (; this->churn_budget >= 1; this->churn_budget--)
+        this->churn();
+      if (this->options.netsplit_interval > 0 && now >= this->next_netsplit)
+        {
+          this->netsplit();
+          this->next_netsplit = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+              std::chrono::duration<double>(this->options.netsplit_interval));
+        }
+    }
+  else if (this->phase == Phase::draining)
+    {
+      // biboumi may be far behind when it is overloaded, or stalled by
+      // its database: wait until it has been quiet for a while, but not
+      // forever
+      if (now - this->last_received >= 5s || now - this->phase_start >= 60s)
+        this->phase = Phase::finished;
+    }
+}
+
+void LoadGenerator::start_running()
+{
+  const auto now = std::chrono::steady_clock::now();
+  this->join_duration = now - this->phase_start;
+  this->joins_done = this->joined;
+  std::cerr << "Sending messages for " << this->options.duration << "s…" << std::endl;
+  this->phase = Phase::running;
+  this->phase_start = now;
+  this->next_netsplit = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double>(this->options.netsplit_interval));
+}
+
+void LoadGenerator::send_irc_message()
+{
+  if (!this->irc_server || this->options.channels == 0)
+    return;
+  const auto channel = std::uniform_int_distribution<std::size_t>(0, this->options.channels - 1)(this->random);
+  const auto server = this->server_of_channel(channel);
+  const auto& external_users = this->irc_server->get_network(server).external_users;
+  if (external_users.empty())
+    return;
+  const auto& nick = external_users[std::uniform_int_distribution<std::size_t>(0, external_users.size() - 1)(this->random)];
+  this->irc_server->send_external_message(server, "#chan" + std::to_string(channel), nick,
+                                          this->make_message_text('i'));
+  this->stats.irc_messages_sent++;
+}
+
+void LoadGenerator::send_xmpp_message()
+{
+  if (this->joined == 0)
+    return;
+  // Pick a random joined resource, this can only loop for long if almost
+  // all of them have left
+  std::uniform_int_distribution<std::size_t> distribution(0, this->join_states.size() - 1);
+  std::size_t index;
+  do
+    index = distribution(this->random);
+  while (this->join_states[index] != JoinState::joined);
+  const auto resource = index % this->options.resources;
+  const auto channel = (index / this->options.resources) % this->options.channels;
+  const auto user = index / this->options.resources / this->options.channels;
+  this->send_stanza("<message from='" + this->user_jid(user, resource) + "' to='" + this->muc_jid(channel) +
+                    "' type='groupchat'><body>" + this->make_message_text('x') + "</body></message>");
+  this->stats.xmpp_messages_sent++;
+}
+
+void LoadGenerator::churn()
+{
+  if (this->joined == 0)
+    return;
+  std::uniform_int_distribution<std::size_t> distribution(0, this->join_states.size() - 1);
+  std::size_t index;
+  do
+    index = distribution(this->random);
+  while (this->join_states[index] != JoinState::joined);
+  const auto resource = index % this->options.resources;
+  const auto channel = (index / this->options.resources) % this->options.channels;
+  const auto user = index / this->options.resources / this->options.channels;
+  this->send_leave(user, channel, resource);
+  this->stats.leaves++;
+  TimedEventsManager::instance().add_event(TimedEvent(std::chrono::steady_clock::now() + 1s, [this, user, channel, resource]()
+  {
+    if (this->join_state(user, channel, resource) == JoinState::left)
+      this->send_join(user, channel, resource);
+  }, "loadgen rejoin"));
+}
+
+void LoadGenerator::netsplit()
+{
+  if (!this->irc_server)
+    return;
+  this->stats.netsplits++;
+  for (std::size_t server = 0; server < this->options.servers; ++server)
+    {
+      auto nicks = this->irc_server->split(server, this->options.netsplit_fraction);
+      TimedEventsManager::instance().add_event(TimedEvent(std::chrono::steady_clock::now() + 5s, [this, server, nicks]()
+      {
+        if (this->irc_server)
+          this->irc_server->rejoin(server, nicks);
+      }, "loadgen rejoin"));
+    }
+}
+
+void LoadGenerator::send_join(const std::size_t user, const std::size_t channel, const std::size_t resource)
+{
+  this->join_state(user, channel, resource) = JoinState::joining;
+  this->send_stanza("<presence from='" + this->user_jid(user, resource) + "' to='" + this->muc_jid(channel) +
+                    "/user" + std::to_string(user) + "'><x xmlns='http://jabber.org/protocol/muc'/></presence>");
+}
+
+void LoadGenerator::send_leave(const std::size_t user, const std::size_t channel, const std::size_t resource)
+{
+  // Considered as left right away, so that no message is sent from it
+  // until it joins again
+  if (this->join_state(user, channel, resource) == JoinState::joined)
+    this->joined--;
+  this->join_state(user, channel, resource) = JoinState::left;
+  this->send_stanza("<presence type='unavailable' from='" + this->user_jid(user, resource) + "' to='" +
+                    this->muc_jid(channel) + "/user" + std::to_string(user) + "'/>");
+}
+
+void LoadGenerator::send_stanza(std::string&& stanza)
+{
+  if (this->xmpp_connection)
+    this->xmpp_connection->send_stanza(std::move(stanza));
+}
+
+std::string LoadGenerator::user_jid(const std::size_t user, const std::size_t resource) const
+{
+  return "user" + std::to_string(user) + "@" + user_domain + "/res" + std::to_string(resource);
+}
+
+std::string LoadGenerator::muc_jid(const std::size_t channel) const
+{
+  return "#chan" + std::to_string(channel) + "%127.0.0." + std::to_string(this->server_of_channel(channel) + 1) +
+         "@" + this->options.hostname;
+}
+
+static void write_latencies(std::ostream& os, LatencyRecorder& latencies)
+{
+  os << "{\"p50\": " << latencies.percentile(0.5)
+     << ", \"p99\": " << latencies.percentile(0.99)
+     << ", \"p999\": " << latencies.percentile(0.999)
+     << ", \"max\": " << latencies.percentile(1) << "}";
+}
+
+static void write_traffic(std::ostream& os, const TrafficCounter& counter)
+{
+  os << "{\"count\": " << counter.count << ", \"bytes\": " << counter.bytes << "}";
+}
+
+void LoadGenerator::write_report(std::ostream& os)
+{
+  const auto seconds = [](const std::chrono::steady_clock::duration& duration)
+  {
+    return std::chrono::duration<double>(duration).count();
+  };
+  const auto run_seconds = std::max(seconds(this->run_duration), 0.001);
+  os << std::fixed << std::setprecision(3);
+  os << "{\n"
+     << "  \"options\": {\"servers\": " << this->options.servers
+     << ", \"users\": " << this->options.users
+     << ", \"channels\": " << this->options.channels
+     << ", \"resources\": " << this->options.resources
+     << ", \"external_users\": " << this->options.external_users
+     << ", \"irc_rate\": " << this->options.irc_rate
+     << ", \"xmpp_rate\": " << this->options.xmpp_rate
+     << ", \"churn_rate\": " << this->options.churn_rate
+     << ", \"netsplit_interval\": " << this->options.netsplit_interval
+     << ", \"message_size\": " << this->options.message_size
+     << ", \"duration\": " << this->options.duration << "},\n"
+     << "  \"joins\": {\"expected\": " << this->join_states.size()
+     << ", \"done\": " << this->joins_done
+     << ", \"seconds\": " << seconds(this->join_duration)
+     << ", \"errors\": " << this->stats.presence_errors << "},\n"
+     << "  \"run_seconds\": " << run_seconds << ",\n"
+     << "  \"irc_to_xmpp\": {\"sent\": " << this->stats.irc_messages_sent
+     << ", \"received\": " << this->stats.irc_to_xmpp.size()
+     << ", \"received_per_second\": " << static_cast<double>(this->stats.irc_to_xmpp.size()) / run_seconds
+     << ", \"latency_ms\": ";
+  write_latencies(os, this->stats.irc_to_xmpp);
+  os << "},\n"
+     << "  \"xmpp_to_irc\": {\"sent\": " << this->stats.xmpp_messages_sent
+     << ", \"received\": " << this->stats.xmpp_to_irc.size()
+     << ", \"received_per_second\": " << static_cast<double>(this->stats.xmpp_to_irc.size()) / run_seconds
+     << ", \"relayed_to_xmpp\": " << this->stats.relayed_messages_received
+     << ", \"latency_ms\": ";
+  write_latencies(os, this->stats.xmpp_to_irc);
+  os << "},\n"
+     << "  \"churn\": {\"leaves\": " << this->stats.leaves << ", \"netsplits\": " << this->stats.netsplits << "},\n"
+     << "  \"xmpp\": {\"in\": ";
+  write_traffic(os, this->stats.xmpp_in);
+  os << ", \"out\": ";
+  write_traffic(os, this->stats.xmpp_out);
+  os << "},\n"
+     << "  \"irc\": {\"connections\": " << this->stats.irc_connections << ", \"in\": ";
+  write_traffic(os, this->stats.irc_in);
+  os << ", \"out\": ";
+  write_traffic(os, this->stats.irc_out);
+  os << "}\n"
+     << "}" << std::endl;
+}
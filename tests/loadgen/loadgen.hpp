@@ -0,0 +1,244 @@
+#pragma once
+
+#include <xmpp/xmpp_stanza.hpp>
+
+#include <algorithm>
+#include <ostream>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <chrono>
+#include <string>
+#include <vector>
+
+class Poller;
+class FakeXmppConnection;
+class FakeIrcServer;
+
+/**
+ * Everything that can be configured from the command line.
+ */
+struct LoadOptions
+{
+  std::string hostname{"biboumi.load"};
+  std::string password{"loadgen"};
+  uint16_t xmpp_port{8811};
+  /**
+   * The port of the fake IRC servers. It is not configurable, because it
+   * must be the first one biboumi tries for a server it knows nothing
+   * about.
+   */
+  static constexpr uint16_t irc_port{6667};
+  /**
+   * Each fake IRC server is reached through a different loopback address:
+   * 127.0.0.1, 127.0.0.2, etc.
+   */
+  std::size_t servers{1};
+  std::size_t users{10};
+  /**
+   * The total number of channels, spread over all the servers. Each user
+   * joins all of them.
+   */
+  std::size_t channels{5};
+  std::size_t resources{1};
+  /**
+   * Users only on the IRC side, present in all the channels of their
+   * server, and sending the IRC→XMPP messages.
+   */
+  std::size_t external_users{20};
+  /**
+   * Messages per second, over all the channels.
+   */
+  double irc_rate{50};
+  double xmpp_rate{10};
+  /**
+   * Leaves (followed by a rejoin one second later) of one resource, per
+   * second.
+   */
+  double churn_rate{0};
+  /**
+   * Seconds between two netsplits, 0 to disable them. During a netsplit,
+   * that fraction of the external users quit, and join again 5 seconds
+   * later.
+   */
+  double netsplit_interval{0};
+  double netsplit_fraction{0.5};
+  std::size_t message_size{80};
+  double duration{30};
+  double join_timeout{60};
+  unsigned int seed{42};
+};
+
+/**
+ * Keep all the measured latencies, to compute their percentiles at the
+ * end.
+ */
+class LatencyRecorder
+{
+public:
+  void add(const std::chrono::steady_clock::duration latency)
+  {
+    this->samples.push_back(std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+    this->sorted = false;
+  }
+  std::size_t size() const
+  { return this->samples.size(); }
+  /**
+   * Returns the latency, in milliseconds, below which the given fraction
+   * of the samples are.
+   */
+  double percentile(const double fraction)
+  {
+    if (this->samples.empty())
+      return 0;
+    if (!this->sorted)
+      std::sort(this->samples.begin(), this->samples.end());
+    this->sorted = true;
+    const auto index = std::min(this->samples.size() - 1,
+                                static_cast<std::size_t>(fraction * static_cast<double>(this->samples.size())));
+    return static_cast<double>(this->samples[index]) / 1000;
+  }
+
+private:
+  std::vector<std::int64_t> samples;
+  bool sorted{true};
+};
+
+struct TrafficCounter
+{
+  std::uint64_t count{0};
+  std::uint64_t bytes{0};
+};
+
+struct LoadStats
+{
+  TrafficCounter xmpp_in;
+  TrafficCounter xmpp_out;
+  TrafficCounter irc_in;
+  TrafficCounter irc_out;
+  std::uint64_t irc_messages_sent{0};
+  std::uint64_t xmpp_messages_sent{0};
+  /**
+   * The messages sent by an XMPP user, and received by the other ones
+   * through the IRC server.
+   */
+  std::uint64_t relayed_messages_received{0};
+  std::uint64_t presence_errors{0};
+  std::uint64_t leaves{0};
+  std::uint64_t netsplits{0};
+  std::uint64_t irc_connections{0};
+  LatencyRecorder irc_to_xmpp;
+  LatencyRecorder xmpp_to_irc;
+};
+
+/**
+ * Drive the whole scenario: join all the channels with all the users and
+ * resources, then generate the traffic on both sides for the configured
+ * duration, and measure what comes out of biboumi.
+ */
+class LoadGenerator
+{
+public:
+  explicit LoadGenerator(const LoadOptions& options);
+  ~LoadGenerator();
+  LoadGenerator(const LoadGenerator&) = delete;
+  LoadGenerator(LoadGenerator&&) = delete;
+  LoadGenerator& operator=(const LoadGenerator&) = delete;
+  LoadGenerator& operator=(LoadGenerator&&) = delete;
+
+  void set_irc_server(FakeIrcServer* irc_server)
+  { this->irc_server = irc_server; }
+  bool is_finished() const
+  { return this->phase == Phase::finished; }
+  /**
+   * Whether the test stopped before the end, because biboumi disconnected.
+   */
+  bool has_failed() const
+  { return this->failed; }
+
+  void on_xmpp_authenticated(FakeXmppConnection* connection);
+  void on_xmpp_disconnected(FakeXmppConnection* connection);
+  void on_xmpp_stanza(const Stanza& stanza);
+  /**
+   * Called by the fake IRC server for each message received from biboumi.
+   */
+  void on_irc_message(const std::string& text);
+
+  /**
+   * Returns the text of a message, with the current time embedded into
+   * it, to measure its latency when we receive it on the other side.
+   */
+  std::string make_message_text(const char direction) const;
+  /**
+   * If the text was generated by make_message_text(), returns the time
+   * elapsed since then.
+   */
+  static bool get_latency(const std::string& text, const char direction,
+                          std::chrono::steady_clock::duration& latency);
+
+  void write_report(std::ostream& os);
+
+  const LoadOptions options;
+  LoadStats stats;
+
+private:
+  enum class Phase
+  {
+    waiting_biboumi,
+    joining,
+    running,
+    draining,
+    finished,
+  };
+  enum class JoinState
+  {
+    left,
+    joining,
+    joined,
+  };
+
+  /**
+   * Called every 10ms: move to the next phase, and send the messages,
+   * leaves and netsplits that are due since the previous call.
+   */
+  void tick();
+  void start_running();
+  void send_irc_message();
+  void send_xmpp_message();
+  void churn();
+  void netsplit();
+
+  void send_join(const std::size_t user, const std::size_t channel, const std::size_t resource);
+  void send_leave(const std::size_t user, const std::size_t channel, const std::size_t resource);
+  void send_stanza(std::string&& stanza);
+
+  std::string user_jid(const std::size_t user, const std::size_t resource) const;
+  std::string muc_jid(const std::size_t channel) const;
+  std::size_t server_of_channel(const std::size_t channel) const
+  { return channel % this->options.servers; }
+  JoinState& join_state(const std::size_t user, const std::size_t channel, const std::size_t resource)
+  { return this->join_states[(user * this->options.channels + channel) * this->options.resources + resource]; }
+
+  FakeXmppConnection* xmpp_connection{nullptr};
+  FakeIrcServer* irc_server{nullptr};
+  Phase phase{Phase::waiting_biboumi};
+  bool failed{false};
+  std::vector<JoinState> join_states;
+  std::size_t joined{0};
+  /**
+   * The value of joined when the traffic started, the churn changes it
+   * afterwards.
+   */
+  std::size_t joins_done{0};
+  std::mt19937 random;
+
+  std::chrono::steady_clock::time_point phase_start;
+  std::chrono::steady_clock::time_point last_tick;
+  std::chrono::steady_clock::time_point last_received;
+  std::chrono::steady_clock::duration join_duration{};
+  std::chrono::steady_clock::duration run_duration{};
+  double irc_budget{0};
+  double xmpp_budget{0};
+  double churn_budget{0};
+  std::chrono::steady_clock::time_point next_netsplit;
+};
@@ -0,0 +1,173 @@
+#include "loadgen.hpp"
+#include "fake_xmpp_server.hpp"
+#include "fake_irc_server.hpp"
+
+#include <utils/timed_events.hpp>
+#include <network/poller.hpp>
+#include <config/config.hpp>
+
+#include <functional>
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <csignal>
+#include <cstring>
+#include <map>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std::string_literals;
+
+static void usage(const char* name)
+{
+  std::cerr << "Usage: " << name << " [options]\n"
+            << "Play a fake XMPP server and some fake IRC servers, generate some load through\n"
+            << "biboumi, and write the measured throughput and latencies as JSON.\n\n"
+            << "  --biboumi <path>             start this biboumi executable, with a generated\n"
+            << "                               configuration, instead of waiting for one to connect\n"
+            << "  --hostname <name>            hostname of the component (biboumi.load)\n"
+            << "  --password <password>        password of the component (loadgen)\n"
+            << "  --xmpp-port <port>           port of the fake XMPP server (8811)\n"
+            << "  --servers <n>                IRC servers, on port 6667 of 127.0.0.1, 127.0.0.2… (1)\n"
+            << "  --users <n>                  XMPP users (10)\n"
+            << "  --channels <n>               channels, each joined by all the users (5)\n"
+            << "  --resources <n>              resources of each user (1)\n"
+            << "  --external-users <n>         IRC users in all the channels of each server (20)\n"
+            << "  --irc-rate <n>               IRC messages per second, in total (50)\n"
+            << "  --xmpp-rate <n>              XMPP messages per second, in total (10)\n"
+            << "  --churn-rate <n>             leaves and rejoins per second (0)\n"
+            << "  --netsplit-interval <s>      seconds between two netsplits, 0 for none (0)\n"
+            << "  --netsplit-fraction <f>      fraction of the IRC users that split (0.5)\n"
+            << "  --message-size <n>           size of each message body (80)\n"
+            << "  --duration <s>               duration of the load, after all the joins (30)\n"
+            << "  --join-timeout <s>           maximum time to wait for all the joins, after which\n"
+            << "                               the load still runs, but the test fails (60)\n"
+            << "  --seed <n>                   seed of the random choices (42)" << std::endl;
+}
+
+/**
+ * Write a configuration file for biboumi, and start it. Its output goes to
+ * our error output, to keep our standard output for the report.
+ */
+static pid_t start_biboumi(const std::string& path, const LoadOptions& options)
+{
+  const std::string conf_filename{"loadgen_biboumi.cfg"};
+  const std::string db_filename{"loadgen_biboumi.sqlite"};
+  ::unlink(db_filename.data());
+  {
+    std::ofstream conf(conf_filename);
+    conf << "hostname=" << options.hostname << "\n"
+         << "password=" << options.password << "\n"
+         << "xmpp_server_ip=127.0.0.1\n"
+         << "port=" << options.xmpp_port << "\n"
+         << "db_name=" << db_filename << "\n"
+         << "identd_port=0\n"
+         << "log_level=2\n";
+  }
+  const auto pid = ::fork();
+  if (pid == -1)
+    throw std::runtime_error("fork() failed: "s + std::strerror(errno));
+  if (pid == 0)
+    {
+      ::dup2(STDERR_FILENO, STDOUT_FILENO);
+      // Our listening sockets must not stay open in biboumi
+      for (int fd = STDERR_FILENO + 1; fd < ::sysconf(_SC_OPEN_MAX); ++fd)
+        ::close(fd);
+      ::execl(path.data(), path.data(), conf_filename.data(), nullptr);
+      std::cerr << "Failed to execute " << path << ": " << std::strerror(errno) << std::endl;
+      ::_exit(1);
+    }
+  return pid;
+}
+
+int main(int argc, char** argv)
+{
+  // Our logs would go to the standard output, with the report
+  Config::set("log_level", "10");
+  ::signal(SIGPIPE, SIG_IGN);
+
+  LoadOptions options;
+  std::string biboumi;
+  const std::map<std::string, std::function<void(const char*)>> setters{
+    {"--biboumi", [&](const char* value) { biboumi = value; }},
+    {"--hostname", [&](const char* value) { options.hostname = value; }},
+    {"--password", [&](const char* value) { options.password = value; }},
+    {"--xmpp-port", [&](const char* value) { options.xmpp_port = static_cast<uint16_t>(std::atoi(value)); }},
+    {"--servers", [&](const char* value) { options.servers = std::strtoul(value, nullptr, 10); }},
+    {"--users", [&](const char* value) { options.users = std::strtoul(value, nullptr, 10); }},
+    {"--channels", [&](const char* value) { options.channels = std::strtoul(value, nullptr, 10); }},
+    {"--resources", [&](const char* value) { options.resources = std::strtoul(value, nullptr, 10); }},
+    {"--external-users", [&](const char* value) { options.external_users = std::strtoul(value, nullptr, 10); }},
+    {"--irc-rate", [&](const char* value) { options.irc_rate = std::atof(value); }},
+    {"--xmpp-rate", [&](const char* value) { options.xmpp_rate = std::atof(value); }},
+    {"--churn-rate", [&](const char* value) { options.churn_rate = std::atof(value); }},
+    {"--netsplit-interval", [&](const char* value) { options.netsplit_interval = std::atof(value); }},
+    {"--netsplit-fraction", [&](const char* value) { options.netsplit_fraction = std::atof(value); }},
+    {"--message-size", [&](const char* value) { options.message_size = std::strtoul(value, nullptr, 10); }},
+    {"--duration", [&](const char* value) { options.duration = std::atof(value); }},
+    {"--join-timeout", [&](const char* value) { options.join_timeout = std::atof(value); }},
+    {"--seed", [&](const char* value) { options.seed = static_cast<unsigned int>(std::strtoul(value, nullptr, 10)); }},
+  };
+  for (int i = 1; i < argc; ++i)
+    {
+      const auto it = setters.find(argv[i]);
+      if (it == setters.end() || i + 1 == argc)
+        {
+          usage(argv[0]);
+          return 1;
+        }
+      it->second(argv[++i]);
+    }
+  if (options.servers == 0 || options.servers > 254 || options.resources == 0)
+    {
+      std::cerr << "There must be between 1 and 254 servers, and at least one resource" << std::endl;
+      return 1;
+    }
+
+  auto p = std::make_shared<Poller>();
+  LoadGenerator generator(options);
+  FakeXmppServer xmpp_server(p, options.xmpp_port, generator);
+  FakeIrcServer irc_server(p, LoadOptions::irc_port, generator);
+  generator.set_irc_server(&irc_server);
+  if (!xmpp_server.is_listening() || !irc_server.is_listening())
+    {
+      std::cerr << "Could not listen on port " << options.xmpp_port << " or " << LoadOptions::irc_port << std::endl;
+      return 1;
+    }
+
+  pid_t biboumi_pid = -1;
+  if (!biboumi.empty())
+    biboumi_pid = start_biboumi(biboumi, options);
+  else
+    std::cerr << "Waiting for biboumi to connect on port " << options.xmpp_port
+              << ", with hostname=" << options.hostname << " and password=" << options.password << "…" << std::endl;
+
+  int status = 0;
+  while (!generator.is_finished())
+    {
+      p->poll(TimedEventsManager::instance().get_timeout());
+      TimedEventsManager::instance().execute_expired_events();
+      xmpp_server.clean();
+      irc_server.clean();
+      if (biboumi_pid != -1 && ::waitpid(biboumi_pid, &status, WNOHANG) == biboumi_pid)
+        {
+          std::cerr << "biboumi exited before the end of the test" << std::endl;
+          biboumi_pid = -1;
+          break;
+        }
+    }
+
+  generator.set_irc_server(nullptr);
+  xmpp_server.shutdown();
+  irc_server.shutdown();
+  if (biboumi_pid != -1)
+    {
+      ::kill(biboumi_pid, SIGTERM);
+      ::waitpid(biboumi_pid, &status, 0);
+    }
+
+  generator.write_report(std::cout);
+  return generator.is_finished() && !generator.has_failed() ? 0 : 1;
+}
@@ -0,0 +1,255 @@
+#include "catch.hpp"
+
+#include <utils/metrics.hpp>
+#include <utils/tracing.hpp>
+#include <utils/loop_monitor.hpp>
+#include <utils/timed_events.hpp>
+#include <metrics/statsd_client.hpp>
+#include <metrics/metrics_server.hpp>
+#include <network/poller.hpp>
+#include <logger/logger.hpp>
+#include <config/config.hpp>
+
+#include <algorithm>
+#include <sstream>
+#include <thread>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+using namespace std::chrono_literals;
+
+static std::string prometheus_output()
+{
+  std::ostringstream os;
+  metrics::Registry::instance().write_prometheus(os);
+  return os.str();
+}
+
+TEST_CASE("Metrics in the Prometheus format")
+{
+  auto& registry = metrics::Registry::instance();
+
+  auto& sent = registry.counter("test_sent_total", "Things sent", {{"kind", "a"}});
+  auto& level = registry.gauge("test_level", "A level");
+  registry.gauge("test_computed", "Computed at \\ export", []() { return 2.5; });
+  auto& other_sent = registry.counter("test_sent_total", "Things sent", {{"kind", "b\"c"}});
+  auto& duration = registry.histogram("test_duration_seconds", "Some durations", {0.001, 0.1});
+
+  sent.inc();
+  sent.inc(2);
+  other_sent.inc();
+  level.inc(5);
+  level.dec(2);
+  duration.observe(500us);
+  duration.observe(50ms);
+  duration.observe(2s);
+
+  CHECK(sent.get() == 3);
+  CHECK(level.get() == 3);
+  CHECK(duration.get_count() == 3);
+  CHECK(duration.get_bucket(0) == 1);
+  CHECK(duration.get_bucket(1) == 1);
+  CHECK(duration.get_bucket(2) == 1);
+
+  const auto output = prometheus_output();
+  // The two counters of the same family are written together, after a
+  // single header
+  CHECK(output.find("# HELP test_sent_total Things sent\n"
+                    "# TYPE test_sent_total counter\n"
+                    "test_sent_total{kind=\"a\"} 3\n"
+                    "test_sent_total{kind=\"b\\\"c\"} 1\n") != std::string::npos);
+  CHECK(output.find("# TYPE test_level gauge\ntest_level 3\n") != std::string::npos);
+  CHECK(output.find("# HELP test_computed Computed at \\\\ export\n"
+                    "# TYPE test_computed gauge\n"
+                    "test_computed 2.5\n") != std::string::npos);
+  CHECK(output.find("# TYPE test_duration_seconds histogram\n"
+                    "test_duration_seconds_bucket{le=\"0.001\"} 1\n"
+                    "test_duration_seconds_bucket{le=\"0.1\"} 2\n"
+                    "test_duration_seconds_bucket{le=\"+Inf\"} 3\n"
+                    "test_duration_seconds_sum 2.0505\n"
+                    "test_duration_seconds_count 3\n") != std::string::npos);
+  // The metrics of biboumi itself are there too
+  CHECK(output.find("# TYPE biboumi_xmpp_received_stanzas_total counter\n") != std::string::npos);
+  CHECK(output.find("# TYPE biboumi_irc_channel_users gauge\n") != std::string::npos);
+
+  SECTION("statsd lines")
+    {
+      // Not connected to anything (and logging an error), but the lines
+      // can still be generated
+      Logger::instance().reset();
+      StatsdClient statsd("", "", 10s);
+      auto lines = statsd.make_lines();
+      CHECK(std::find(lines.begin(), lines.end(), "test_sent_total.a:3|c") != lines.end());
+      CHECK(std::find(lines.begin(), lines.end(), "test_level:3|g") != lines.end());
+      CHECK(std::find(lines.begin(), lines.end(), "test_duration_seconds.count:3|c") != lines.end());
+
+      // Counters are sent as increases, gauges as values
+      sent.inc();
+      lines = statsd.make_lines();
+      CHECK(std::find(lines.begin(), lines.end(), "test_sent_total.a:1|c") != lines.end());
+      CHECK(std::find(lines.begin(), lines.end(), "test_sent_total.b\"c:0|c") != lines.end());
+      CHECK(std::find(lines.begin(), lines.end(), "test_level:3|g") != lines.end());
+      CHECK(std::find(lines.begin(), lines.end(), "test_duration_seconds.count:0|c") != lines.end());
+    }
+}
+
+TEST_CASE("Sampled tracing")
+{
+  Logger::instance().reset();
+  Config::set("trace_sampling", "2", false);
+  Config::set("trace_slow_threshold", "0", false);
+
+  const int origin = 0;
+  const auto received = tracing::clock::now();
+  CHECK_FALSE(tracing::sample(received, &origin));
+  CHECK_FALSE(tracing::current);
+  CHECK(tracing::sample(received, &origin));
+  REQUIRE(tracing::current);
+
+  // Only the stages that were reached are part of the breakdown
+  tracing::mark(tracing::Stage::parsed);
+  tracing::current->mark(tracing::Stage::built, received + 3ms);
+  tracing::current->mark(tracing::Stage::queued, received + 4ms);
+  tracing::current->mark(tracing::Stage::sent, received + 10ms);
+  CHECK(tracing::current->breakdown().find("parsed +") == 0);
+  CHECK(tracing::current->breakdown().find(", built +") != std::string::npos);
+  CHECK(tracing::current->breakdown().find(", queued +1.000ms, sent +6.000ms") != std::string::npos);
+  CHECK(tracing::current->breakdown().find("archived") == std::string::npos);
+  CHECK(tracing::current->total() == 10ms);
+
+  tracing::current->finish();
+  CHECK(prometheus_output().find("biboumi_trace_stage_duration_seconds_count{stage=\"sent\"} 1\n") != std::string::npos);
+  tracing::end();
+  CHECK_FALSE(tracing::current);
+
+  Config::set("trace_sampling", "0", false);
+  CHECK_FALSE(tracing::is_enabled());
+  CHECK_FALSE(tracing::sample(received, &origin));
+  CHECK_FALSE(tracing::sample(received, &origin));
+}
+
+TEST_CASE("Loop monitor")
+{
+  Logger::instance().reset();
+  Config::set("loop_slow_threshold", "5", false);
+  auto& monitor = LoopMonitor::instance();
+  monitor.should_notify_watchdog(1h);
+
+  bool described = false;
+  auto describe = [&described]() { described = true; return std::string("test"); };
+  monitor.run(LoopMonitor::Kind::posted_task, []() {}, describe);
+  CHECK_FALSE(described);
+  CHECK(monitor.should_notify_watchdog(5ms));
+
+  // Only the slow callbacks are described
+  monitor.run(LoopMonitor::Kind::posted_task, []() { std::this_thread::sleep_for(10ms); }, describe);
+  CHECK(described);
+  CHECK_FALSE(monitor.should_notify_watchdog(5ms));
+  // Only until the next check
+  CHECK(monitor.should_notify_watchdog(5ms));
+
+  monitor.observe_lag(20ms);
+  CHECK_FALSE(monitor.should_notify_watchdog(5ms));
+  monitor.should_notify_watchdog(1h);
+  CHECK(prometheus_output().find("biboumi_loop_callback_duration_seconds_count{kind=\"posted_task\"} ") != std::string::npos);
+  CHECK(prometheus_output().find("# TYPE biboumi_loop_lag_seconds histogram\n") != std::string::npos);
+  Config::clear();
+}
+
+TEST_CASE("Watchdog withheld after a stall of the timed events")
+{
+  Logger::instance().reset();
+  auto& monitor = LoopMonitor::instance();
+  auto& manager = TimedEventsManager::instance();
+  monitor.should_notify_watchdog(1h);
+
+  std::vector<bool> notified;
+  manager.add_event(TimedEvent(10ms, [&notified, &monitor]()
+                               {
+                                 notified.push_back(monitor.should_notify_watchdog(50ms));
+                               }, "watchdog test"));
+  std::this_thread::sleep_for(15ms);
+  manager.execute_expired_events();
+  CHECK(notified == std::vector<bool>{true});
+
+  // A stall of the loop, longer than the limit: the overdue repeating event
+  // runs once, without notifying, and its missed runs are skipped
+  notified.clear();
+  manager.add_event(TimedEvent(std::chrono::steady_clock::now(), []() { std::this_thread::sleep_for(100ms); }, "stall"));
+  std::this_thread::sleep_for(15ms);
+  manager.execute_expired_events();
+  manager.execute_expired_events();
+  CHECK(notified == std::vector<bool>{false});
+
+  // The loop recovered: the next runs notify again
+  for (int i = 0; i < 2; i++)
+    {
+      std::this_thread::sleep_for(15ms);
+      manager.execute_expired_events();
+    }
+  CHECK(notified == (std::vector<bool>{false, true, true}));
+
+  manager.cancel("watchdog test");
+  monitor.should_notify_watchdog(1h);
+}
+
+/**
+ * Send that request to the server, and return what it answers until it
+ * stops (or closes the connection, then closed is set).
+ */
+static std::string http_request(std::shared_ptr<Poller>& poller, MetricsServer& server, const int client,
+                                const std::string& request, bool& closed)
+{
+  CHECK(::write(client, request.data(), request.size()) == static_cast<ssize_t>(request.size()));
+  std::string res;
+  closed = false;
+  for (int i = 0; i < 5; i++)
+    {
+      poller->poll(50ms);
+      server.clean();
+      char buf[4096];
+      ssize_t size;
+      while ((size = ::recv(client, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+        res.append(buf, static_cast<std::size_t>(size));
+      if (size == 0)
+        {
+          closed = true;
+          break;
+        }
+    }
+  return res;
+}
+
+TEST_CASE("Metrics connection closed after a request that is not understood")
+{
+  Logger::instance().reset();
+  auto poller = std::make_shared<Poller>();
+  MetricsServer server(poller, 0, "127.0.0.1");
+  struct sockaddr_in6 addr{};
+  socklen_t len = sizeof(addr);
+  REQUIRE(::getsockname(server.get_socket(), reinterpret_cast<struct sockaddr*>(&addr), &len) == 0);
+
+  for (const std::string request: {"POST /metrics HTTP/1.1\r\nContent-Length: 2\r\n\r\n{}",
+                                   "nonsense\r\n\r\n"})
+    {
+      const int client = ::socket(AF_INET, SOCK_STREAM, 0);
+      struct sockaddr_in server_addr{};
+      server_addr.sin_family = AF_INET;
+      server_addr.sin_port = addr.sin6_port;
+      server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      REQUIRE(::connect(client, reinterpret_cast<struct sockaddr*>(&server_addr), sizeof(server_addr)) == 0);
+      bool closed;
+      // A valid request keeps the connection open
+      auto response = http_request(poller, server, client, "GET /metrics HTTP/1.1\r\n\r\n", closed);
+      CHECK(response.substr(0, 15) == "HTTP/1.1 200 OK");
+      CHECK_FALSE(closed);
+      response = http_request(poller, server, client, request, closed);
+      CHECK((response.substr(0, 12) == "HTTP/1.1 405" || response.substr(0, 12) == "HTTP/1.1 400"));
+      CHECK(closed);
+      ::close(client);
+    }
+  server.shutdown();
+}
@@ -1,6 +1,27 @@
 #include "catch.hpp"
 #include <network/tls_policy.hpp>
+#include <network/dns_cache.hpp>
+#include <network/getaddrinfo_pool.hpp>
+#include <network/poller.hpp>
+#include <network/signal_handler.hpp>
+#include <network/tcp_client_socket_handler.hpp>
+#include <utils/timed_events.hpp>
+#include <config/config.hpp>
+#include <logger/logger.hpp>
+#include <algorithm>
 #include <sstream>
+#include <stdexcept>
+#include <cstring>
+#include <thread>
+#include <csignal>
+#include <cerrno>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+using namespace std::string_literals;
 
 #ifdef BOTAN_FOUND
 TEST_CASE("tls_policy")
@@ -43,3 +64,408 @@ TEST_CASE("tls_policy")
     }
 }
 #endif
+
+TEST_CASE("hosts_file")
+{
+  HostsFile hosts("");
+  CHECK(hosts.find("localhost").empty());
+
+  std::istringstream iss("# comment\n"
+                         "127.0.0.1 localhost\n"
+                         "\n"
+                         "::1 localhost ip6-localhost # ip6-loopback\n"
+                         "10.0.0.1\tirc.example.com irc\n"
+                         "10.0.0.2 irc.example.com\n");
+  hosts.load(iss);
+  CHECK(hosts.find("localhost") == std::vector<std::string>{"127.0.0.1", "::1"});
+  CHECK(hosts.find("ip6-localhost") == std::vector<std::string>{"::1"});
+  CHECK(hosts.find("ip6-loopback").empty());
+  CHECK(hosts.find("irc") == std::vector<std::string>{"10.0.0.1"});
+  CHECK(hosts.find("irc.example.com") == std::vector<std::string>{"10.0.0.1", "10.0.0.2"});
+  CHECK(hosts.find("example.com").empty());
+}
+
+TEST_CASE("dns_cache")
+{
+  std::vector<std::string> queries;
+  DNSCache cache([&queries](const std::string& hostname) { queries.push_back(hostname); }, "");
+
+  std::vector<std::vector<std::string>> results;
+  auto callback = [&results](const std::vector<std::string>& addresses, const std::string&)
+  {
+    results.push_back(addresses);
+  };
+
+  int a, b;
+  cache.resolve("irc.example.com", &a, callback);
+  cache.resolve("irc.example.com", &b, callback);
+  CHECK(queries == std::vector<std::string>{"irc.example.com"});
+  CHECK(cache.is_resolving("irc.example.com"));
+
+  // IPv6 comes first, whatever the order of the answers
+  cache.on_query_result("irc.example.com", AF_INET, {"10.0.0.1"}, 300s, "");
+  CHECK(results.empty());
+  cache.on_query_result("irc.example.com", AF_INET6, {"::1", "::2"}, 120s, "");
+  REQUIRE(results.size() == 2);
+  CHECK(results[0] == std::vector<std::string>{"::1", "::2", "10.0.0.1"});
+  CHECK(results[1] == results[0]);
+
+  // Answered from the cache
+  cache.resolve("irc.example.com", &a, callback);
+  CHECK(queries.size() == 1);
+  CHECK(results.size() == 3);
+
+  // A cancelled callback is never called
+  cache.resolve("other.example.com", &a, callback);
+  cache.cancel("other.example.com", &a);
+  cache.on_query_result("other.example.com", AF_INET6, {}, 0s, "Domain name not found");
+  cache.on_query_result("other.example.com", AF_INET, {}, 0s, "Domain name not found");
+  CHECK(results.size() == 3);
+  CHECK(cache.size() == 2);
+
+  // The failure is kept for negative_ttl, the answer for its smallest TTL
+  cache.purge_expired(std::chrono::steady_clock::now() + 20s);
+  CHECK(cache.size() == 2);
+  cache.purge_expired(std::chrono::steady_clock::now() + 31s);
+  CHECK(cache.size() == 1);
+  cache.purge_expired(std::chrono::steady_clock::now() + 1h);
+  CHECK(cache.size() == 0);
+
+  // An entry with a query in flight is never purged
+  cache.resolve("irc.example.com", &a, callback);
+  CHECK(queries.size() == 3);
+  cache.purge_expired(std::chrono::steady_clock::now() + 1h);
+  CHECK(cache.is_resolving("irc.example.com"));
+  cache.on_query_result("irc.example.com", AF_INET6, {}, 0s, "Domain name not found");
+  cache.on_query_result("irc.example.com", AF_INET, {"10.0.0.1"}, 60s, "");
+  CHECK(results.back() == std::vector<std::string>{"10.0.0.1"});
+}
+
+#ifndef UDNS_FOUND
+TEST_CASE("dns_cache_query_outlives_the_caller_hostname")
+{
+  // Like udns, the query keeps a reference to the hostname until it
+  // answers, long after the caller’s string is gone
+  std::vector<const std::string*> queried;
+  DNSCache cache([&queried](const std::string& hostname) { queried.push_back(&hostname); }, "");
+
+  std::vector<std::string> result;
+  int owner;
+  {
+    const std::string hostname = "a-long-hostname-outside-of-the-sso-buffer.example.com";
+    cache.resolve(hostname, &owner, [&result](const std::vector<std::string>& addresses, const std::string&)
+                  {
+                    result = addresses;
+                  });
+    REQUIRE(queried.size() == 1);
+    CHECK(queried[0] != &hostname);
+  }
+  // Some other entries, which may move the map’s content around
+  for (int i = 0; i < 100; i++)
+    cache.resolve("host" + std::to_string(i) + ".example.com", &owner, [](const std::vector<std::string>&, const std::string&) {});
+  CHECK(*queried[0] == "a-long-hostname-outside-of-the-sso-buffer.example.com");
+  cache.on_query_result(*queried[0], AF_INET6, {"::1"}, 60s, "");
+  cache.on_query_result(*queried[0], AF_INET, {}, 0s, "");
+  CHECK(result == std::vector<std::string>{"::1"});
+}
+
+TEST_CASE("getaddrinfo_pool")
+{
+  auto poller = std::make_shared<Poller>();
+  GetaddrinfoPool pool(poller, 2);
+  CHECK(GetaddrinfoPool::get() == &pool);
+
+  int done = 0;
+  int cancelled = 0;
+  Resolver resolver;
+  resolver.resolve("localhost", "6667",
+                   [&done](const struct addrinfo* addr) { CHECK(addr != nullptr); done++; },
+                   [&done](const char*) { done++; });
+  CHECK(resolver.is_resolving());
+  const auto id = pool.submit("localhost", "6667", [&cancelled](int, GetaddrinfoPool::ResultType) { cancelled++; });
+  pool.cancel(id);
+
+  while (done == 0)
+    poller->poll(100ms);
+  CHECK(resolver.is_resolved());
+  CHECK_FALSE(resolver.is_resolving());
+  CHECK(cancelled == 0);
+
+  pool.destroy();
+  CHECK(GetaddrinfoPool::get() == nullptr);
+}
+#endif
+
+TEST_CASE("poller_post")
+{
+  auto poller = std::make_shared<Poller>();
+  std::vector<int> done;
+
+  poller->post([&done, &poller]()
+               {
+                 done.push_back(1);
+                 poller->post([&done]() { done.push_back(3); });
+               });
+  std::thread thread([&done, &poller]() { poller->post([&done]() { done.push_back(2); }); });
+  thread.join();
+  CHECK(done.empty());
+
+  poller->poll(1s);
+  CHECK(done == std::vector<int>{1, 2});
+  // Posted by a task: executed by the next call, which does not wait
+  poller->poll(1h);
+  CHECK(done == std::vector<int>{1, 2, 3});
+  CHECK(poller->size() == 0);
+}
+
+namespace
+{
+class WatermarkClient: public TCPClientSocketHandler
+{
+public:
+  explicit WatermarkClient(std::shared_ptr<Poller>& poller):
+    TCPClientSocketHandler(poller) {}
+  void on_connected() override {}
+  void parse_in_buffer(const size_t) override
+  {
+    this->received = true;
+    this->in_buf.clear();
+  }
+  void on_high_watermark() override
+  { this->crossings.push_back("high"); }
+  void on_low_watermark() override
+  { this->crossings.push_back("low"); }
+
+  std::vector<std::string> crossings;
+  bool received{false};
+};
+}
+
+TEST_CASE("output_watermarks")
+{
+  Logger::instance().reset();
+  Config::set("output_high_watermark", "4");
+  Config::set("output_low_watermark", "1");
+  auto poller = std::make_shared<Poller>();
+  int fds[2];
+  REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) == 0);
+  WatermarkClient client(poller);
+  client.use_connected_socket(fds[0]);
+
+  client.send_data(std::string(3000, 'a'));
+  CHECK(client.crossings.empty());
+  client.send_data(std::string(2000, 'a'));
+  CHECK(client.crossings == std::vector<std::string>{"high"});
+  CHECK(client.is_above_high_watermark());
+
+  // The data is written, but what was received stays in the socket
+  client.pause_receiving();
+  CHECK(::write(fds[1], "x", 1) == 1);
+  poller->poll(100ms);
+  CHECK(client.crossings == std::vector<std::string>{"high", "low"});
+  CHECK_FALSE(client.is_above_high_watermark());
+  poller->poll(100ms);
+  CHECK_FALSE(client.received);
+
+  client.resume_receiving();
+  poller->poll(100ms);
+  CHECK(client.received);
+
+  client.close();
+  ::close(fds[1]);
+  Config::clear();
+}
+
+namespace
+{
+class RaceClient: public TCPClientSocketHandler
+{
+public:
+  explicit RaceClient(std::shared_ptr<Poller>& poller):
+    TCPClientSocketHandler(poller) {}
+  void on_connected() override
+  { this->connections++; }
+  void on_connection_failed(const std::string& reason) override
+  { this->failures.push_back(reason); }
+  void parse_in_buffer(const size_t) override
+  { this->in_buf.clear(); }
+  void race(std::vector<const struct addrinfo*> addresses)
+  { this->connect_to(std::move(addresses)); }
+
+  int connections{0};
+  std::vector<std::string> failures;
+};
+}
+
+TEST_CASE("connection_attempts_done_in_the_same_batch")
+{
+  Logger::instance().reset();
+  auto poller = std::make_shared<Poller>();
+
+  const int server = ::socket(AF_INET, SOCK_STREAM, 0);
+  REQUIRE(server != -1);
+  struct sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  REQUIRE(::bind(server, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0);
+  REQUIRE(::listen(server, 8) == 0);
+  socklen_t len = sizeof(addr);
+  REQUIRE(::getsockname(server, reinterpret_cast<struct sockaddr*>(&addr), &len) == 0);
+
+  struct addrinfo first{}, second{};
+  first.ai_family = second.ai_family = AF_INET;
+  first.ai_socktype = second.ai_socktype = SOCK_STREAM;
+  first.ai_addr = second.ai_addr = reinterpret_cast<struct sockaddr*>(&addr);
+  first.ai_addrlen = second.ai_addrlen = sizeof(addr);
+
+  RaceClient client(poller);
+  client.race({&first, &second});
+  // Start the second attempt without giving the first one a chance to
+  // complete: both sockets are then writable in the same batch of events
+  std::this_thread::sleep_for(TCPClientSocketHandler::connection_attempt_delay + 50ms);
+  TimedEventsManager::instance().execute_expired_events();
+  for (int i = 0; i < 5 && client.connections == 0; ++i)
+    poller->poll(100ms);
+  TimedEventsManager::instance().execute_expired_events();
+  poller->poll(100ms);
+
+  CHECK(client.connections == 1);
+  CHECK(client.failures.empty());
+  CHECK(client.is_connected());
+
+  client.close();
+  ::close(server);
+}
+
+namespace
+{
+class IdentifiedClient: public TCPClientSocketHandler
+{
+public:
+  IdentifiedClient(std::shared_ptr<Poller>& poller, const std::string& ident):
+    TCPClientSocketHandler(poller)
+  { this->ident = ident; }
+  void on_connected() override {}
+  void parse_in_buffer(const size_t) override
+  { this->in_buf.clear(); }
+};
+
+/**
+ * A listening socket on that loopback address, on the given port (any if
+ * it is 0).
+ */
+int listen_on(const char* address, const std::uint16_t port)
+{
+  const int server = ::socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  ::inet_pton(AF_INET, address, &addr.sin_addr);
+  if (server == -1 || ::bind(server, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      ::listen(server, 1) != 0)
+    throw std::runtime_error("Failed to listen on "s + address);
+  return server;
+}
+
+std::uint16_t port_of(const int socket)
+{
+  struct sockaddr_in addr{};
+  socklen_t len = sizeof(addr);
+  ::getsockname(socket, reinterpret_cast<struct sockaddr*>(&addr), &len);
+  return ntohs(addr.sin_port);
+}
+
+/**
+ * A socket connected to that server from the given local port (any if it
+ * is 0), that other sockets can also use.
+ */
+int connect_to(const int server, const std::uint16_t local_port)
+{
+  const int socket = ::socket(AF_INET, SOCK_STREAM, 0);
+  const int enable = 1;
+  ::setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+  struct sockaddr_in local{};
+  local.sin_family = AF_INET;
+  local.sin_port = htons(local_port);
+  local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  struct sockaddr_in remote{};
+  socklen_t len = sizeof(remote);
+  if (::bind(socket, reinterpret_cast<struct sockaddr*>(&local), sizeof(local)) != 0 ||
+      ::getsockname(server, reinterpret_cast<struct sockaddr*>(&remote), &len) != 0 ||
+      ::connect(socket, reinterpret_cast<struct sockaddr*>(&remote), sizeof(remote)) != 0)
+    throw std::runtime_error("Failed to connect: "s + std::strerror(errno));
+  return socket;
+}
+}
+
+TEST_CASE("find_by_port_pair")
+{
+  Logger::instance().reset();
+  auto poller = std::make_shared<Poller>();
+
+  // Two servers using the same port, on different addresses
+  const int first_server = listen_on("127.0.0.2", 0);
+  const auto remote_port = port_of(first_server);
+  const int second_server = listen_on("127.0.0.3", remote_port);
+
+  IdentifiedClient first(poller, "first");
+  first.resume_connected_socket(connect_to(first_server, 0), "127.0.0.2", std::to_string(remote_port));
+  const auto local_port = port_of(first.get_socket());
+  CHECK(TCPClientSocketHandler::find_by_port_pair(local_port, remote_port, "127.0.0.2") == &first);
+  CHECK(TCPClientSocketHandler::find_by_port_pair(local_port, remote_port + 1, "127.0.0.2") == nullptr);
+  CHECK(TCPClientSocketHandler::find_by_port_pair(local_port + 1, remote_port, "127.0.0.2") == nullptr);
+  CHECK(TCPClientSocketHandler::find_by_port_pair(local_port, remote_port, "127.0.0.3") == nullptr);
+
+  // The same ports, to the other server: each one is found with its address
+  IdentifiedClient second(poller, "second");
+  second.resume_connected_socket(connect_to(second_server, local_port), "127.0.0.3", std::to_string(remote_port));
+  REQUIRE(port_of(second.get_socket()) == local_port);
+  CHECK(TCPClientSocketHandler::find_by_port_pair(local_port, remote_port, "127.0.0.2")->get_ident() == "first");
+  CHECK(TCPClientSocketHandler::find_by_port_pair(local_port, remote_port, "127.0.0.3")->get_ident() == "second");
+  CHECK(TCPClientSocketHandler::find_by_port_pair(local_port, remote_port, "127.0.0.4") == nullptr);
+
+  first.close();
+  CHECK(TCPClientSocketHandler::find_by_port_pair(local_port, remote_port, "127.0.0.2") == nullptr);
+  CHECK(TCPClientSocketHandler::find_by_port_pair(local_port, remote_port, "127.0.0.3") == &second);
+  second.close();
+  CHECK(TCPClientSocketHandler::find_by_port_pair(local_port, remote_port, "127.0.0.3") == nullptr);
+  ::close(first_server);
+  ::close(second_server);
+}
+
+TEST_CASE("signal_handler")
+{
+  auto poller = std::make_shared<Poller>();
+  std::vector<int> received;
+  SignalHandler handler(poller, {SIGUSR1, SIGUSR2}, [&received](const int sig) { received.push_back(sig); });
+  CHECK(poller->size() == 1);
+
+  ::raise(SIGUSR2);
+  ::raise(SIGUSR1);
+  while (received.size() < 2)
+    poller->poll(100ms);
+  std::sort(received.begin(), received.end());
+  CHECK(received == std::vector<int>{SIGUSR1, SIGUSR2});
+
+  handler.destroy();
+  CHECK(poller->size() == 0);
+}
+
+TEST_CASE("interleave_address_families")
+{
+  struct addrinfo v6_1{}, v6_2{}, v6_3{}, v4_1{}, v4_2{};
+  v6_1.ai_family = v6_2.ai_family = v6_3.ai_family = AF_INET6;
+  v4_1.ai_family = v4_2.ai_family = AF_INET;
+
+  CHECK(interleave_address_families(nullptr).empty());
+
+  v6_1.ai_next = &v6_2;
+  v6_2.ai_next = &v6_3;
+  v6_3.ai_next = &v4_1;
+  v4_1.ai_next = &v4_2;
+  CHECK(interleave_address_families(&v6_1) == std::vector<const struct addrinfo*>{&v6_1, &v4_1, &v6_2, &v4_2, &v6_3});
+
+  v4_2.ai_next = &v6_1;
+  v6_3.ai_next = nullptr;
+  CHECK(interleave_address_families(&v4_1) == std::vector<const struct addrinfo*>{&v4_1, &v6_1, &v4_2, &v6_2, &v6_3});
+}
@@ -0,0 +1,298 @@
+#include <xmpp/biboumi_component.hpp>
+#include <irc/irc_client.hpp>
+#include <bridge/bridge.hpp>
+#include <network/poller.hpp>
+#include <config/config.hpp>
+#include <logger/logger.hpp>
+#include <utils/capture.hpp>
+#include <utils/reload.hpp>
+#include <utils/allocations.hpp>
+
+#ifdef UDNS_FOUND
+# include <network/dns_handler.hpp>
+#else
+# include <network/getaddrinfo_pool.hpp>
+#endif
+
+#include <unordered_map>
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <chrono>
+#include <thread>
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <time.h>
+
+using namespace std::string_literals;
+
+/**
+ * Every allocation made by the process is counted by the replacement of
+ * operator new in src/utils/allocations.cpp, built into this program even
+ * when biboumi is built without PROFILE_ALLOCATIONS.
+ */
+static std::uint64_t allocations_count()
+{
+  return allocations::total_count();
+}
+
+static std::uint64_t allocated_bytes()
+{
+  return allocations::total_bytes();
+}
+
+static std::chrono::nanoseconds cpu_time()
+{
+  struct timespec ts{};
+  ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+/**
+ * What was spent to handle the data received on one kind of stream.
+ */
+struct Stage
+{
+  std::uint64_t records{0};
+  std::uint64_t bytes{0};
+  std::chrono::nanoseconds cpu{0};
+  std::uint64_t allocations{0};
+  std::uint64_t allocated_bytes{0};
+
+  template <typename Callback>
+  void measure(const std::size_t size, Callback&& callback)
+  {
+    const auto cpu_start = cpu_time();
+    const auto allocations_start = allocations_count();
+    const auto bytes_start = ::allocated_bytes();
+    callback();
+    this->cpu += cpu_time() - cpu_start;
+    this->allocations += allocations_count() - allocations_start;
+    this->allocated_bytes += ::allocated_bytes() - bytes_start;
+    this->records++;
+    this->bytes += size;
+  }
+
+  void write_json(std::ostream& os) const
+  {
+    os << "{\"records\": " << this->records
+       << ", \"bytes\": " << this->bytes
+       << ", \"cpu_seconds\": " << std::chrono::duration<double>(this->cpu).count()
+       << ", \"allocations\": " << this->allocations
+       << ", \"allocated_bytes\": " << this->allocated_bytes << "}";
+  }
+};
+
+/**
+ * The replayed component and IrcClients are never connected to anything:
+ * each one is given one end of a socketpair, as if it was connected to
+ * its server, and everything it writes on it is read and thrown away.
+ */
+class FakeSockets
+{
+public:
+  FakeSockets() = default;
+  ~FakeSockets()
+  {
+    for (const auto fd: this->sinks)
+      ::close(fd);
+  }
+  FakeSockets(const FakeSockets&) = delete;
+  FakeSockets(FakeSockets&&) = delete;
+  FakeSockets& operator=(const FakeSockets&) = delete;
+  FakeSockets& operator=(FakeSockets&&) = delete;
+
+  void connect(TCPClientSocketHandler& handler)
+  {
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) == -1)
+      throw std::runtime_error("socketpair failed: "s + std::strerror(errno));
+    this->sinks.push_back(fds[1]);
+    handler.use_connected_socket(fds[0]);
+  }
+
+  void drain()
+  {
+    char buf[65536];
+    for (const auto fd: this->sinks)
+      while (::read(fd, buf, sizeof(buf)) > 0);
+  }
+
+private:
+  std::vector<int> sinks;
+};
+
+static void usage(const char* name)
+{
+  std::cerr << "Usage: " << name << " [options] <capture file>\n"
+            << "Feed the data recorded with the capture_file option to biboumi's XMPP\n"
+            << "component and IrcClients, and write the time and allocations spent to\n"
+            << "handle it as JSON.\n\n"
+            << "  --speed max|recorded         replay as fast as possible (the default), or\n"
+            << "                               with the recorded delays\n"
+            << "  --db <name>                  database to use (:memory:)\n"
+            << "  --verbose                    write biboumi's debug logs on the error output" << std::endl;
+}
+
+int main(int ac, char** av)
+{
+  std::string capture_filename;
+  std::string db_name{":memory:"};
+  bool recorded_speed = false;
+  bool verbose = false;
+  for (int i = 1; i < ac; i++)
+    {
+      const std::string arg = av[i];
+      if (arg == "--speed" && i + 1 < ac)
+        recorded_speed = std::string(av[++i]) == "recorded";
+      else if (arg == "--db" && i + 1 < ac)
+        db_name = av[++i];
+      else if (arg == "--verbose")
+        verbose = true;
+      else if (arg[0] != '-' && capture_filename.empty())
+        capture_filename = arg;
+      else
+        {
+          usage(av[0]);
+          return 1;
+        }
+    }
+  if (capture_filename.empty())
+    {
+      usage(av[0]);
+      return 1;
+    }
+
+  Config::set("db_name", db_name);
+  Config::set("log_file", "/dev/stderr");
+  Config::set("log_level", verbose ? "0" : "3");
+#ifdef USE_DATABASE
+  open_database();
+#endif
+
+  std::ifstream file(capture_filename, std::ios::binary);
+  if (!file)
+    {
+      std::cerr << "Failed to open " << capture_filename << ": " << std::strerror(errno) << std::endl;
+      return 1;
+    }
+
+  auto poller = std::make_shared<Poller>();
+  // The hostnames are never resolved, and no connection is made: the
+  // IrcClients are given a fake socket when their capture starts
+#ifdef UDNS_FOUND
+  DNSHandler dns_handler(poller);
+#else
+  GetaddrinfoPool getaddrinfo_pool(poller, 0);
+#endif
+  FakeSockets fake_sockets;
+  std::shared_ptr<BiboumiComponent> component;
+  std::unordered_map<std::uint32_t, capture::StreamInfo> streams;
+  Stage xmpp_stage;
+  Stage irc_stage;
+  std::uint64_t unmatched_records = 0;
+
+  auto find_irc_client = [&component](const capture::StreamInfo& info) -> IrcClient*
+  {
+    Bridge* bridge = component->find_user_bridge(info.jid);
+    return bridge ? bridge->find_irc_client(info.hostname) : nullptr;
+  };
+
+  const auto start = std::chrono::steady_clock::now();
+  try
+    {
+      capture::Reader reader(file);
+      capture::Record record;
+      while (reader.next(record))
+        {
+          if (recorded_speed)
+            std::this_thread::sleep_until(start + record.time);
+          if (record.type == capture::RecordType::open)
+            {
+              auto& info = streams[record.stream];
+              info = capture::parse_open_payload(record.payload);
+              if (info.kind == capture::StreamKind::xmpp && !component)
+                {
+                  Config::set("hostname", info.hostname);
+                  component = std::make_shared<BiboumiComponent>(poller, info.hostname, "replay");
+                  fake_sockets.connect(*component);
+                }
+              else if (info.kind == capture::StreamKind::irc && component)
+                {
+                  // The IrcClient was just created, by the data replayed on
+                  // the XMPP stream.  If the replay diverged and it was not,
+                  // the records of that stream are not replayed
+                  IrcClient* irc = find_irc_client(info);
+                  if (irc && !irc->is_connected())
+                    fake_sockets.connect(*irc);
+                }
+            }
+          else
+            {
+              const auto it = streams.find(record.stream);
+              if (it == streams.end() || !component)
+                {
+                  unmatched_records++;
+                  continue;
+                }
+              const auto& info = it->second;
+              if (info.kind == capture::StreamKind::xmpp)
+                {
+                  if (record.type == capture::RecordType::data)
+                    xmpp_stage.measure(record.payload.size(), [&]()
+                    {
+                      component->handle_received_data(record.payload.data(), record.payload.size());
+                    });
+                  else
+                    component->reset();
+                }
+              else
+                {
+                  IrcClient* irc = find_irc_client(info);
+                  if (!irc || !irc->is_connected())
+                    unmatched_records++;
+                  else if (record.type == capture::RecordType::data)
+                    irc_stage.measure(record.payload.size(), [&]()
+                    {
+                      irc->handle_received_data(record.payload.data(), record.payload.size());
+                    });
+                  else
+                    {
+                      irc->on_connection_close("");
+                      irc->close();
+                    }
+                }
+            }
+          // What the main loop does between two events, not measured
+          if (component)
+            {
+              component->on_send();
+              for (const auto& stream: streams)
+                if (stream.second.kind == capture::StreamKind::irc)
+                  if (IrcClient* irc = find_irc_client(stream.second))
+                    if (irc->is_connected())
+                      irc->on_send();
+              fake_sockets.drain();
+              component->clean();
+            }
+        }
+    }
+  catch (const std::exception& e)
+    {
+      std::cerr << "Failed to replay " << capture_filename << ": " << e.what() << std::endl;
+      return 1;
+    }
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+
+  std::cout << "{\n  \"capture\": \"" << capture_filename << "\",\n"
+            << "  \"streams\": " << streams.size() << ",\n"
+            << "  \"unmatched_records\": " << unmatched_records << ",\n"
+            << "  \"wall_seconds\": " << std::chrono::duration<double>(elapsed).count() << ",\n"
+            << "  \"stages\": {\n    \"xmpp\": ";
+  xmpp_stage.write_json(std::cout);
+  std::cout << ",\n    \"irc\": ";
+  irc_stage.write_json(std::cout);
+  std::cout << "\n  }\n}" << std::endl;
+  return 0;
+}
@@ -59,3 +59,29 @@ TEST_CASE("Test timed event cancellation")
   CHECK(TimedEventsManager::instance().cancel("deux") == 2);
   CHECK(TimedEventsManager::instance().get_timeout() == utils::no_timeout);
 }
+
+TEST_CASE("Timed events added or canceled by a callback")
+{
+  auto now = std::chrono::steady_clock::now();
+  int executed = 0;
+  // Enough events to make the container grow while they are executed
+  for (int i = 0; i < 20; ++i)
+    TimedEventsManager::instance().add_event(TimedEvent(now - 1ms, [&executed]()
+    {
+      ++executed;
+      TimedEventsManager::instance().add_event(TimedEvent(std::chrono::steady_clock::now() + 1h, [](){ }, "later"));
+    }));
+  TimedEventsManager::instance().add_event(TimedEvent(now - 1ms, [&executed]()
+  {
+    ++executed;
+    TimedEventsManager::instance().cancel("canceled");
+  }));
+  TimedEventsManager::instance().add_event(TimedEvent(now + 0ms, [&executed]() { ++executed; }, "canceled"));
+  TimedEventsManager::instance().add_event(TimedEvent(now + 1h, [](){ }, "canceled"));
+
+  CHECK(TimedEventsManager::instance().execute_expired_events() == 21);
+  CHECK(executed == 21);
+  CHECK(TimedEventsManager::instance().size() == 20);
+  CHECK(TimedEventsManager::instance().cancel("later") == 20);
+  CHECK(TimedEventsManager::instance().get_timeout() == utils::no_timeout);
+}
@@ -12,6 +12,21 @@
 #include <utils/scopeguard.hpp>
 #include <utils/dirname.hpp>
 #include <utils/is_one_of.hpp>
+#include <utils/capture.hpp>
+#include <utils/memory_usage.hpp>
+#include <utils/allocations.hpp>
+#include <utils/serializer.hpp>
+#include <bridge/resource_set.hpp>
+#include <logger/logger.hpp>
+
+#include <fstream>
+#include <memory>
+#include <array>
+#include <sstream>
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 using namespace std::string_literals;
 
@@ -186,3 +201,139 @@ TEST_CASE("is_in")
   CHECK((is_one_of<bool, bool>) == true);
   CHECK((is_one_of<bool, bool, bool, bool, bool, int>) == true);
 }
+
+TEST_CASE("ResourceSet")
+{
+  ResourceSet resources;
+  CHECK(resources.empty());
+  CHECK(resources.insert("gajim"));
+  CHECK(resources.insert("conversations"));
+  CHECK_FALSE(resources.insert("gajim"));
+  CHECK(resources.insert("dino"));
+  CHECK(resources.size() == 3);
+  CHECK(resources.count("dino") == 1);
+  CHECK(resources.count("poezio") == 0);
+  // Iterated in the same order as a std::set
+  CHECK(std::vector<std::string>(resources.begin(), resources.end()) == std::vector<std::string>{"conversations", "dino", "gajim"});
+
+  CHECK(resources.erase("dino") == 1);
+  CHECK(resources.erase("dino") == 0);
+  CHECK(resources.size() == 2);
+}
+
+TEST_CASE("Capture written and read back")
+{
+  Logger::instance().reset();
+  const std::string filename{"test_capture.bin"};
+  // An existing file, readable by everyone
+  ::close(::open(filename.data(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+  ::chmod(filename.data(), 0644);
+  auto& writer = capture::Writer::instance();
+  CHECK(writer.open_stream({capture::StreamKind::xmpp, {}, "biboumi.example"}) == 0);
+  REQUIRE(writer.start(filename));
+  struct stat st{};
+  REQUIRE(::stat(filename.data(), &st) == 0);
+  CHECK((st.st_mode & 0777) == 0600);
+  const auto xmpp = writer.open_stream({capture::StreamKind::xmpp, {}, "biboumi.example"});
+  const auto irc = writer.open_stream({capture::StreamKind::irc, "user@example.com", "irc.example.org"});
+  CHECK(xmpp != irc);
+  const std::string line{":irc.example.org 001 me :Welcome\r\n"};
+  writer.data(irc, line.data(), line.size());
+  const std::string binary("<a>\0\xff</a>", 10);
+  writer.data(xmpp, binary.data(), binary.size());
+  writer.close_stream(irc);
+  writer.stop();
+  CHECK_FALSE(writer.is_active());
+
+  std::ifstream file(filename, std::ios::binary);
+  capture::Reader reader(file);
+  capture::Record record;
+  REQUIRE(reader.next(record));
+  CHECK(record.type == capture::RecordType::open);
+  CHECK(capture::parse_open_payload(record.payload).hostname == "biboumi.example");
+  REQUIRE(reader.next(record));
+  CHECK(record.stream == irc);
+  const auto info = capture::parse_open_payload(record.payload);
+  CHECK(info.kind == capture::StreamKind::irc);
+  CHECK(info.jid == "user@example.com");
+  CHECK(info.hostname == "irc.example.org");
+  REQUIRE(reader.next(record));
+  CHECK(record.type == capture::RecordType::data);
+  CHECK(record.payload == line);
+  const auto first_time = record.time;
+  REQUIRE(reader.next(record));
+  CHECK(record.stream == xmpp);
+  CHECK(record.payload == binary);
+  CHECK(record.time >= first_time);
+  REQUIRE(reader.next(record));
+  CHECK(record.type == capture::RecordType::close);
+  CHECK(record.payload.empty());
+  CHECK_FALSE(reader.next(record));
+  ::unlink(filename.data());
+
+  std::istringstream not_a_capture("BBMCAP00");
+  CHECK_THROWS(capture::Reader{not_a_capture});
+}
+
+TEST_CASE("Memory usage")
+{
+  std::string empty;
+  CHECK(memory_usage::heap(empty) == 0);
+  std::string long_string(1000, 'a');
+  CHECK(memory_usage::heap(long_string) > 1000);
+  long_string.clear();
+  CHECK(memory_usage::heap(long_string) > 1000);
+  long_string.shrink_to_fit();
+  CHECK(memory_usage::heap(long_string) < 1000);
+
+  MemoryUsage usage;
+  CHECK(usage.total() == 0);
+  usage.channels = 10;
+  usage.buffers = 32;
+  CHECK(usage.total() == 42);
+}
+
+TEST_CASE("State serialized and read back")
+{
+  Serializer out;
+  out.put(static_cast<std::uint64_t>(0));
+  out.put(std::string{"#chan"});
+  out.put(std::string{});
+  out.put(std::string("a\0b", 3));
+  out.put(static_cast<std::uint64_t>(-1));
+
+  Deserializer in(out.data());
+  CHECK(in.get_int() == 0);
+  CHECK(in.get_string() == "#chan");
+  CHECK(in.get_string().empty());
+  CHECK(in.get_string() == std::string("a\0b", 3));
+  CHECK(in.get_int() == static_cast<std::uint64_t>(-1));
+  CHECK(in.at_end());
+  CHECK_THROWS_AS(in.get_int(), std::runtime_error);
+
+  const std::string truncated = out.data().substr(0, 12);
+  Deserializer truncated_in(truncated);
+  CHECK(truncated_in.get_int() == 0);
+  CHECK_THROWS_AS(truncated_in.get_string(), std::runtime_error);
+}
+
+#ifdef PROFILE_ALLOCATIONS
+TEST_CASE("Allocations counted per call site")
+{
+  static allocations::Site site{allocations::Subsystem::irc, "test site"};
+  const auto total = allocations::total_count();
+  {
+    allocations::Scope scope(site);
+    auto allocated = std::make_unique<std::array<char, 100>>();
+    CHECK(site.count == 1);
+    CHECK(site.bytes == 100);
+  }
+  auto allocated = std::make_unique<int>(1);
+  CHECK(site.count == 1);
+  CHECK(allocations::total_count() == total + 2);
+
+  const auto report = allocations::report();
+  CHECK(report.find("\nirc: ") != std::string::npos);
+  CHECK(report.find("\ntest site (irc): 1 allocations, 100 bytes") != std::string::npos);
+}
+#endif
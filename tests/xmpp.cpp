@@ -1,7 +1,14 @@
 #include "catch.hpp"
+#include "fake_gateway.hpp"
 
 #include <xmpp/xmpp_parser.hpp>
 #include <xmpp/auth.hpp>
+#include <xmpp/caps.hpp>
+#include <xmpp/xmpp_component.hpp>
+
+#include <vector>
+
+using namespace std::string_literals;
 
 TEST_CASE("Test basic XML parsing")
 {
@@ -48,6 +55,17 @@ TEST_CASE("XML escape")
   CHECK(xml_escape(unescaped) == "&apos;coucou&apos;&lt;cc&gt;/&amp;&quot;gaga&quot;");
 }
 
+TEST_CASE("Text appended to inner XML")
+{
+  XmlNode node("body");
+  node.set_inner_xml("<b>bold</b>");
+  node.add_to_inner("<script/> & co");
+  CHECK(node.to_string() == "<body><b>bold</b>&lt;script/&gt; &amp; co</body>");
+  node.set_inner("<b>");
+  node.add_to_inner("</b>");
+  CHECK(node.to_string() == "<body>&lt;b&gt;&lt;/b&gt;</body>");
+}
+
 TEST_CASE("handshake_digest")
 {
   const auto res = get_handshake_digest("id1234", "S4CR3T");
@@ -72,3 +90,83 @@ TEST_CASE("substanzas")
   }
   CHECK(a.has_children());
 }
+
+TEST_CASE("Entity capabilities verification string")
+{
+  // The simple example of XEP-0115
+  CHECK(caps::compute_ver("client", "pc", "Exodus 0.9.1",
+                          {"http://jabber.org/protocol/muc", "http://jabber.org/protocol/disco#info",
+                           "http://jabber.org/protocol/disco#items", "http://jabber.org/protocol/caps"}) ==
+        "QgayPKawpkPSDYmwT/WM94uAlu0=");
+}
+
+/**
+ * The stanzas sent by the component
+ */
+static std::vector<Stanza> parse_stanzas(const std::string& data)
+{
+  std::vector<Stanza> stanzas;
+  XmppParser xml;
+  xml.add_stanza_callback([&stanzas](const Stanza& stanza) { stanzas.push_back(stanza); });
+  const std::string doc = "<stream:stream xmlns='jabber:component:accept' xmlns:stream='http://etherx.jabber.org/streams'>" +
+                          data + "</stream:stream>";
+  xml.feed(doc.data(), static_cast<int>(doc.size()), true);
+  return stanzas;
+}
+
+/**
+ * The caps ver of the available presence sent from that JID, then the one
+ * computed from the disco#info that we serve on its caps node.
+ */
+static std::pair<std::string, std::string> served_caps(FakeGateway& gateway, const std::string& jid)
+{
+  gateway.xmpp_receive("<presence type='subscribe' from='user@test/res' to='" + jid + "'/>");
+  std::string ver;
+  for (const auto& stanza: parse_stanzas(gateway.xmpp_sent()))
+    {
+      const XmlNode* c = stanza.get_child("c", CAPS_NS);
+      if (stanza.get_name() == "presence" && stanza.get_tag("type").empty() && c)
+        ver = c->get_tag("ver");
+    }
+  if (ver.empty())
+    return {};
+  gateway.xmpp_receive("<iq type='get' id='caps' from='user@test/res' to='" + jid + "'>"
+                       "<query xmlns='" DISCO_INFO_NS "' node='" + caps::node + "#" + ver + "'/></iq>");
+  const auto stanzas = parse_stanzas(gateway.xmpp_sent());
+  if (stanzas.size() != 1 || stanzas[0].get_tag("type") != "result")
+    return {ver, {}};
+  const XmlNode* query = stanzas[0].get_child("query", DISCO_INFO_NS);
+  const XmlNode* identity = query->get_child("identity", DISCO_INFO_NS);
+  std::vector<std::string> features;
+  for (const XmlNode* feature: query->get_children("feature", DISCO_INFO_NS))
+    features.push_back(feature->get_tag("var"));
+  return {ver, caps::compute_ver(identity->get_tag("category"), identity->get_tag("type"), identity->get_tag("name"), features)};
+}
+
+TEST_CASE("Entity capabilities match the served disco#info")
+{
+  FakeGateway gateway;
+  auto caps = served_caps(gateway, "biboumi.test");
+  CHECK_FALSE(caps.first.empty());
+  CHECK(caps.first == caps.second);
+  const auto gateway_ver = caps.first;
+
+  // With a resource, this is still the gateway
+  caps = served_caps(gateway, "biboumi.test/res");
+  CHECK(caps.first == gateway_ver);
+  CHECK(caps.first == caps.second);
+
+  gateway.join("user@test/res", "#chan%irc.test", "nick");
+  gateway.xmpp_sent();
+  caps = served_caps(gateway, "irc.test@biboumi.test");
+  CHECK_FALSE(caps.first.empty());
+  CHECK(caps.first != gateway_ver);
+  CHECK(caps.first == caps.second);
+
+  // Any other node is not ours
+  gateway.xmpp_receive("<iq type='get' id='caps' from='user@test/res' to='other.test@biboumi.test'>"
+                       "<query xmlns='" DISCO_INFO_NS "' node='"s + caps::node + "#" + caps.first + "'/></iq>");
+  const auto stanzas = parse_stanzas(gateway.xmpp_sent());
+  REQUIRE(stanzas.size() == 1);
+  CHECK(stanzas[0].get_tag("type") == "error");
+}
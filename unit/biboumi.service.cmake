@@ -7,6 +7,7 @@ After=network.target
 Type=${SYSTEMD_SERVICE_TYPE}
 ExecStart=${CMAKE_INSTALL_PREFIX}/bin/biboumi /etc/biboumi/biboumi.cfg
 ExecReload=/bin/kill -s USR1 $MAINPID
+NotifyAccess=all
 WatchdogSec=${WATCHDOG_SEC}
 Restart=always
 User=${SERVICE_USER}